@@ -397,6 +397,7 @@ extern "C" {
 #include <mach/mach.h>
 #elif defined(__unix__)
 #include <semaphore.h>
+#include <cerrno>		// for errno, EINTR in Semaphore::wait
 #endif
 
 namespace moodycamel
@@ -0,0 +1,251 @@
+#ifndef __CLOCKSYNC_H__
+#define __CLOCKSYNC_H__
+
+#include <cmath>
+#include <stdint.h>
+#include <vector>
+
+// Fits a remote clock (po8e ticks, bridge ticks) against the local one
+// (gettime(), CLOCK_MONOTONIC_RAW): remote = ref + slope * (local - xref).
+//
+// An observation is a remote time and the local time we saw it, which is
+// late by however long it sat in drivers, switches and queues. So each bin
+// of local time keeps only its least delayed observation -- the one
+// furthest above the line -- and the line is a least squares fit through
+// the last window of those, which follows the skew as it drifts. A kept
+// point too far off the line (gate times the residual scale) is dropped; a
+// run of them means the remote clock jumped, and the fit starts over.
+//
+// Updates are constant time: running sums over the window, added up afresh
+// each time it wraps so rounding can't build up. Sums are of points
+// relative to the oldest, less the nominal slope, so they stay small.
+class ClockSync
+{
+public:
+	struct Point {
+		double	x;	// local seconds
+		double	y;	// remote ticks
+	};
+
+protected:
+	double	m_nominal;	// ticks per second, until there is span to fit it
+	double	m_bin;		// seconds of local time per kept point
+	double	m_gate;		// residuals beyond this many scales are outliers
+	double	m_minSpan;	// seconds of window before the slope is fitted
+	std::vector<Point> m_win;	// ring of kept points
+	size_t	m_n;		// points in it
+	size_t	m_w;		// next to write
+	Point	m_0;		// the sums are relative to this, detrended
+	double	m_sx, m_sy, m_sxx, m_sxy, m_syy;
+	bool	m_have;		// a candidate for the current bin
+	Point	m_cand;
+	double	m_binStart;
+	int		m_rejectRun;
+	// the fit: a line through (m_xm, m_ym)
+	double	m_slope;
+	double	m_xm;
+	double	m_ym;
+	double	m_cxx;		// spread of x about m_xm; 0 while the slope is nominal
+	double	m_sigma;	// residual standard deviation, ticks
+	double	m_scale;	// smoothed residual magnitude, for the gate
+	double	m_residual;	// of the last kept point, before it was fitted
+
+public:
+	uint64_t	m_accepted;
+	uint64_t	m_rejected;
+	uint64_t	m_restarts;
+
+	ClockSync(double nominal, double bin = 0.1, size_t window = 600,
+	          double gate = 5.0)
+	{
+		m_bin = bin;
+		m_gate = gate;
+		m_minSpan = 20 * bin;
+		m_win.resize(window < 4 ? 4 : window);
+		reset(nominal);
+	}
+	void reset(double nominal)
+	{
+		m_nominal = nominal;
+		m_accepted = m_rejected = m_restarts = 0;
+		restart();
+	}
+	// the remote time of local time x
+	double remote(double x) const
+	{
+		return m_ym + m_slope * (x - m_xm);
+	}
+	// the local time of remote time y
+	double local(double y) const
+	{
+		return (y - m_ym) / m_slope + m_xm;
+	}
+	double slope() const
+	{
+		return m_slope;
+	}
+	// the line as (local, remote) through which it passes
+	double refLocal() const
+	{
+		return m_xm;
+	}
+	double refRemote() const
+	{
+		return m_ym;
+	}
+	// one standard deviation of remote(x), in ticks: the scatter of the
+	// kept points about the line, and how far x is from their middle
+	double error(double x) const
+	{
+		if (m_n < 3)
+			return m_scale;
+		double e = 1.0 / m_n;
+		if (m_cxx > 0.0)
+			e += (x - m_xm) * (x - m_xm) / m_cxx;
+		return m_sigma * sqrt(e);
+	}
+	double residual() const
+	{
+		return m_residual;
+	}
+	double scatter() const
+	{
+		return m_sigma;
+	}
+	size_t points() const
+	{
+		return m_n;
+	}
+
+	// remote time y seen at local time x; x never decreasing
+	void add(double x, double y)
+	{
+		if (!m_have) {
+			m_cand.x = x;
+			m_cand.y = y;
+			m_binStart = x;
+			m_have = true;
+			if (m_n == 0)
+				follow(m_cand);
+			return;
+		}
+		if (x - m_binStart < m_bin) {
+			// least delayed: the highest remote time for its local time
+			if (y - m_slope * x > m_cand.y - m_slope * m_cand.x) {
+				m_cand.x = x;
+				m_cand.y = y;
+				if (m_n == 0)
+					follow(m_cand);
+			}
+			return;
+		}
+		keep(m_cand);
+		m_cand.x = x;
+		m_cand.y = y;
+		m_binStart = x;
+	}
+
+protected:
+	void restart()
+	{
+		m_n = m_w = 0;
+		m_0.x = m_0.y = 0.0;
+		m_sx = m_sy = m_sxx = m_sxy = m_syy = 0.0;
+		m_have = false;
+		m_binStart = 0.0;
+		m_rejectRun = 0;
+		m_slope = m_nominal;
+		m_xm = m_ym = 0.0;
+		m_cxx = 0.0;
+		m_sigma = 0.0;
+		m_scale = 1e-3 * m_nominal;	// 1 ms, until there is better
+		m_residual = 0.0;
+	}
+	// no kept points yet: the line runs through the best so far
+	void follow(const Point &p)
+	{
+		m_xm = p.x;
+		m_ym = p.y;
+	}
+	void keep(const Point &p)
+	{
+		double r = p.y - remote(p.x);
+		if (m_n >= 4 && fabs(r) > m_gate * m_scale) {
+			m_rejected++;
+			if (++m_rejectRun >= 8) {
+				m_restarts++;
+				restart();
+				push(p);
+				fit();
+			}
+			return;
+		}
+		m_rejectRun = 0;
+		m_accepted++;
+		m_residual = r;
+		if (m_n >= 4) {
+			// about the standard deviation, for normal residuals; with a
+			// floor of 20us, below which the gate would only chase jitter
+			double a = 1.25 * fabs(r);
+			double floor = 20e-6 * m_nominal;
+			m_scale = 0.95 * m_scale + 0.05 * (a > floor ? a : floor);
+		}
+		push(p);
+		fit();
+	}
+	void sums(const Point &p, double sign)
+	{
+		double x = p.x - m_0.x;
+		double y = p.y - m_0.y - m_nominal * x;
+		m_sx += sign * x;
+		m_sy += sign * y;
+		m_sxx += sign * x * x;
+		m_sxy += sign * x * y;
+		m_syy += sign * y * y;
+	}
+	void push(const Point &p)
+	{
+		size_t cap = m_win.size();
+		if (m_n == 0)
+			m_0 = p;
+		if (m_n == cap)
+			sums(m_win[m_w], -1.0);
+		else
+			m_n++;
+		m_win[m_w] = p;
+		sums(p, 1.0);
+		m_w = (m_w + 1) % cap;
+		if (m_w == 0 && m_n == cap) {
+			// once a window: rebase on the oldest and add up again
+			m_0 = m_win[0];
+			m_sx = m_sy = m_sxx = m_sxy = m_syy = 0.0;
+			for (size_t i=0; i<cap; i++)
+				sums(m_win[i], 1.0);
+		}
+	}
+	void fit()
+	{
+		double n = (double)m_n;
+		double mx = m_sx / n;
+		double my = m_sy / n;
+		double cxx = m_sxx - n * mx * mx;
+		double cxy = m_sxy - n * mx * my;
+		double cyy = m_syy - n * my * my;
+		const Point &oldest = m_win[m_n < m_win.size() ? 0 : m_w];
+		const Point &newest = m_win[(m_w + m_win.size() - 1) % m_win.size()];
+		double b = 0.0;	// on top of the nominal slope
+		if (m_n >= 3 && newest.x - oldest.x >= m_minSpan && cxx > 0.0) {
+			b = cxy / cxx;
+			m_cxx = cxx;
+		} else {
+			m_cxx = 0.0;
+		}
+		m_slope = m_nominal + b;
+		m_xm = m_0.x + mx;
+		m_ym = m_0.y + my + m_nominal * mx;
+		double sse = cyy - 2.0 * b * cxy + b * b * cxx;
+		m_sigma = m_n > 2 ? sqrt((sse > 0.0 ? sse : 0.0) / (n - 2.0)) : 0.0;
+	}
+};
+
+#endif
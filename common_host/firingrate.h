@@ -1,7 +1,12 @@
 //code to calculate the firing rate at any given time using
 //convolution with a polynomial.
 
+#include <sys/param.h>	// MIN, which used to come with gtk
+#include <math.h>
+#include <vector>
+
 #define FR_LEN 2048 //must be a power of 2.
+#define FR_MAXLAGS 64
 //with lags, need up to a second of firing times.
 class FiringRate
 {
@@ -13,7 +18,6 @@ private:
 	// in comparison, linked list of times / circular buffer of times
 	// would only do computation on say 100 spikes.
 	//circular buffers sounds better.
-	double	m_ts[FR_LEN];
 	unsigned int	m_w; //write to here.
 	unsigned int	m_l; //last valid timestamp; start reading from here.
 	double 	m_duration;
@@ -21,6 +25,19 @@ private:
 	double	m_xfade;
 	double	m_a;
 	double	m_integral;
+	//the lagged bins, kept up incrementally. fade k is the cross-fade
+	//centred on k bin widths of age; young and old are the first spikes
+	//(in m_w counts) younger than its two edges as of the last request,
+	//so [old, young) are in it and [young of k+1, old of k) are all lag k.
+	//sum is the spike times in the fade, as only there does the weight
+	//depend on them. a request only moves the edges over the spikes that
+	//crossed them.
+	struct {
+		unsigned int	young;
+		unsigned int	old;
+		double	sum;
+	}	m_fade[FR_MAXLAGS+1];
+	double	m_ts[FR_LEN];
 public:
 	FiringRate()
 	{
@@ -31,6 +48,7 @@ public:
 		m_xfade = 0.3; //fractional cross-fade between bins (trapezoidal bins).
 		for (int i=0; i<FR_LEN; i++)
 			m_ts[i] = -1e10;
+		reset_bins();
 	}
 	~FiringRate()
 	{
@@ -43,8 +61,9 @@ public:
 	}
 	void set_bin_params(unsigned int lags, double duration)
 	{
-		m_lags = lags;
+		m_lags = MIN(lags, FR_MAXLAGS);
 		m_duration = duration;
+		reset_bins();
 	}
 	int get_lags()
 	{
@@ -85,13 +104,12 @@ public:
 	unsigned short get_count(double starttime, double endtime)
 	{
 		//gets count of spikes in time range (starttime, endtime]
-		m_l=m_w;//this will mark all spikes "read", this affects get_coutn_since
-		unsigned short count=0;
-		for (unsigned int i=0; i<FR_LEN; i++) {
-			if (m_ts[i] > starttime && m_ts[i]<=endtime)
-				count++;
-		}
-		return count;
+		unsigned int w = m_w; //atomic.
+		m_l=w;//this will mark all spikes "read", this affects get_coutn_since
+		unsigned int lo = w > FR_LEN ? w - FR_LEN : 0;
+		//the buffer is in time order: two binary searches, not a scan.
+		unsigned int c = newer(lo, w, endtime) - newer(lo, w, starttime);
+		return MIN(c, 0xffff);
 	}
 	unsigned short get_count_since()
 	{
@@ -106,7 +124,26 @@ public:
 		return ((FR_LEN-local_ml ) + local_mw);
 	}
 	/** lagged bin interface (bmi5 & matlab) **/
+	//each spike adds 1 spread over the lags as a trapezoid: lag l is
+	//[l, l+1) bin widths old, its edges cross-faded linearly over m_xfade
+	//of a bin, everything delayed by half a cross-fade so all bins are
+	//equal. out[0] is the most recent, in 1/128ths of a spike.
+	//get_bins() moves this unit's edges to time, so one thread asks, and
+	//asks forward in time (back works, but walks the edges back over the
+	//spikes). it rounds once per bin; get_bins_scan() rounded each spike's
+	//share, so a bin differs from it by up to 1/128 per spike in the bin's
+	//cross-fades.
 	void get_bins(double time, unsigned short *out)
+	{
+		double n[2*FR_MAXLAGS+1];
+		double age[2*FR_MAXLAGS+1];
+		get_segments(time, n, age);
+		bins_from_segments(n, age, 1, m_lags, bin_width(), cross_fade(), out);
+	}
+	//the old way, kept for requests at any time from any thread: walk back
+	//from the newest spike, rounding each spike's share of a bin. touches
+	//no state.
+	void get_bins_scan(double time, unsigned short *out)
 	{
 		int w = m_w - 1; //atomic.
 		int i = 0;
@@ -136,6 +173,67 @@ public:
 			}
 		}
 	}
+	//the edges moved to time; then the spikes in each of the 2*lags+1
+	//segments of age between them, fade 0, lag 0, fade 1, ... fade lags,
+	//and the sum of their ages in the fades (the lags' are left alone).
+	void get_segments(double time, double *n, double *age)
+	{
+		time -= cross_fade()/2;
+		advance_bins(time);
+		for (int k=0; k<=m_lags; k++) {
+			n[2*k] = (double)(m_fade[k].young - m_fade[k].old);
+			age[2*k] = n[2*k]*time - m_fade[k].sum;
+			if (k < m_lags)
+				n[2*k+1] = (double)(m_fade[k].old - m_fade[k+1].young);
+		}
+	}
+	//the lines the next get_segments() will want, for a pass over many
+	//units to pull in while it works on the one before
+	void prefetch()
+	{
+		const char *p = (const char *)&m_w;
+		const char *e = (const char *)&m_fade[m_lags+1];
+		for (; p < e; p += 64)
+			__builtin_prefetch(p);
+		unsigned int w = m_w;
+		for (int i=1; i<=3*8; i+=8)
+			__builtin_prefetch(&m_ts[(w-i) & (FR_LEN-1)]);
+	}
+	double bin_width()
+	{
+		return m_duration / (double)m_lags;
+	}
+	double cross_fade()
+	{
+		return bin_width() * m_xfade;
+	}
+	//segments 2l are the cross-fades centred on l bin widths, up into lag
+	//l and down out of lag l-1; 2l+1 are all lag l. nunits of them in a
+	//row, 2*lags+1 apiece, into nunits x lags bins (unit major). one
+	//straight pass over contiguous arrays, so it vectorizes.
+	static void bins_from_segments(const double *n, const double *age,
+	                               size_t nunits, int lags, double lw, double xf,
+	                               unsigned short *out)
+	{
+		int ns = 2*lags+1;
+		double r = 1.0 / xf;
+		double k = lw / xf;
+		for (size_t u=0; u<nunits; u++) {
+			const double *un = &n[u*ns];
+			const double *ua = &age[u*ns];
+			unsigned short *uo = &out[u*lags];
+			for (int l=0; l<lags; l++) {
+				//rising into l: 0.5 + (age - l*lw)/xf each
+				double up = un[2*l]*(0.5 - l*k) + ua[2*l]*r;
+				//falling out of l, at the next edge: 1 minus its rise
+				double nx = un[2*l+2];
+				double down = nx*(0.5 + (l+1)*k) - ua[2*l+2]*r;
+				double v = (up + un[2*l+1] + down) * 128.0 + 0.5;
+				v = v < 0.0 ? 0.0 : v;
+				uo[l] = v >= 65535.0 ? 0xffff : (unsigned short)v;
+			}
+		}
+	}
 	void get_bins_test()   //matt was complaining that nobody does unit tests.  so here.
 	{
 		//spikes must be added temporal order!
@@ -155,4 +253,84 @@ public:
 		printf("should be: 1.0 0.5 0.5 1.5 0.5 0.0 0.0 0.0 0.0 0.0\n");
 		free(bins);
 	}
+private:
+	void reset_bins()
+	{
+		unsigned int w = m_w;
+		unsigned int lo = w > FR_LEN ? w - FR_LEN : 0;
+		for (int k=0; k<=FR_MAXLAGS; k++) {
+			m_fade[k].young = m_fade[k].old = lo;
+			m_fade[k].sum = 0.0;
+		}
+	}
+	//first spike in [lo, w) later than t
+	unsigned int newer(unsigned int lo, unsigned int w, double t)
+	{
+		while (lo < w) {
+			unsigned int mid = lo + (w - lo)/2;
+			if (m_ts[mid & (FR_LEN-1)] > t)
+				w = mid;
+			else
+				lo = mid + 1;
+		}
+		return lo;
+	}
+	//move each edge over the spikes that crossed it since the last request
+	//(either way, so requests needn't be in order), into or out of its fade.
+	void advance_bins(double time)
+	{
+		unsigned int w = m_w; //atomic.
+		unsigned int lo = w > FR_LEN ? w - FR_LEN : 0;
+		if (m_fade[m_lags].old < lo)
+			reset_bins(); //the oldest fade lost spikes to the ring
+		double lw = bin_width();
+		double hxf = cross_fade()/2;
+		for (int k=0; k<=m_lags; k++) {
+			double edge = time - (k*lw - hxf);
+			unsigned int c = m_fade[k].young;
+			double sum = m_fade[k].sum;
+			while (c < w && m_ts[c & (FR_LEN-1)] <= edge)
+				sum += m_ts[(c++) & (FR_LEN-1)];
+			while (c > lo && m_ts[(c-1) & (FR_LEN-1)] > edge)
+				sum -= m_ts[(--c) & (FR_LEN-1)];
+			m_fade[k].young = c;
+			edge = time - (k*lw + hxf);
+			c = m_fade[k].old;
+			while (c < w && m_ts[c & (FR_LEN-1)] <= edge)
+				sum -= m_ts[(c++) & (FR_LEN-1)];
+			while (c > lo && m_ts[(c-1) & (FR_LEN-1)] > edge)
+				sum += m_ts[(--c) & (FR_LEN-1)];
+			m_fade[k].old = c;
+			//no rounding drift in empty fades
+			m_fade[k].sum = c == m_fade[k].young ? 0.0 : sum;
+		}
+	}
+};
+
+//every unit's lagged bins in one go, into a contiguous nunits x lags
+//matrix (unit major), as get_bins() would fill it unit by unit. the edges
+//are moved per unit, then all the trapezoids are one pass. the units must
+//share their bin parameters, and, as for get_bins(), one thread asks.
+class FiringRateMatrix
+{
+private:
+	std::vector<double>	m_n;
+	std::vector<double>	m_age;
+public:
+	void get_bins(FiringRate **fr, size_t nunits, double time, unsigned short *out)
+	{
+		if (nunits == 0)
+			return;
+		int lags = fr[0]->get_lags();
+		size_t ns = 2*lags+1;
+		m_n.resize(nunits*ns);
+		m_age.resize(nunits*ns);
+		for (size_t u=0; u<nunits; u++) {
+			if (u+1 < nunits)
+				fr[u+1]->prefetch();
+			fr[u]->get_segments(time, &m_n[u*ns], &m_age[u*ns]);
+		}
+		FiringRate::bins_from_segments(m_n.data(), m_age.data(), nunits, lags,
+		                               fr[0]->bin_width(), fr[0]->cross_fade(), out);
+	}
 };
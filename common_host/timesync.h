@@ -4,121 +4,161 @@
 #include <atomic>
 #include <cmath>
 #include <sstream>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "clocksync.h"
+#include "gettime.h"
 #include "mmaphelp.h"
 
 #define TIMESYNC_MMAP	"/tmp/timesync.mmap"
 
-class GainController
-{
-public:
-	long double m_avg;
-	long double m_absavg;
-	long double m_alpha;
-	long double m_gain;
-	long double m_gainIncr;
-	long double m_gainDecr;
+// ticks -> time as of one update of the estimate:
+// time = (ticks - offset) / slope + timeOffset. times are gettime()'s,
+// seconds since g_startTime; double is plenty for either.
+struct TimeMap {
+	uint64_t	version;	// updates published, ever; 0 before the first
+	double		timeOffset;
+	double		slope;		// ticks per second, e.g. 24414.0625
+	double		offset;		// ticks at timeOffset
+	double		period;		// 1 / slope
+	double		error;		// one standard deviation of time(), seconds
 
-	GainController(double initialGain)
-	{
-		m_alpha = 0.95;
-		m_avg = 0.0;
-		m_absavg = 1.0;
-		m_gain = initialGain;
-		m_gainIncr = initialGain / 1809.47;
-		m_gainDecr = initialGain / 1914.12;
-	}
-	~GainController() {}
-	void update(long double u)
-	{
-		m_avg = m_alpha * m_avg + (1.0-m_alpha)*u;
-		m_absavg = m_alpha * m_absavg + (1.0-m_alpha)*fabs((double)u);
-		if (m_absavg > 0.0) {
-			if (fabs((double)m_avg) / m_absavg > 0.45) m_gain += m_gainIncr;
-			else m_gain -= m_gainDecr;
-			if (m_gain < 0.0) m_gain *= -1.0;
-		}
+	double time(double ticks) const
+	{
+		return (ticks - offset) * period + timeOffset;
 	}
-	void prinfo()
+	double ticks(double time) const
 	{
-		printf("gain controller: ratio %.4Lf, gain %.7Lf avg %.4Lf absavg %.4Lf\n",
-		       fabs((double)m_avg) / m_absavg, m_gain, m_avg, m_absavg);
+		return (time - timeOffset) * slope + offset;
+	}
+	// the times of n consecutive ticks from tk: one affine fill, which
+	// the compiler vectorizes, instead of a divide per sample
+	void fill(int64_t tk, size_t n, double *ts) const
+	{
+		double t0 = time((double)tk);
+		double dt = period;
+		for (size_t i=0; i<n; i++)
+			ts[i] = t0 + (double)i * dt;
 	}
 };
+
+#define TIMESYNC_MAGIC		0x134fbab3
+#define TIMESYNC_VERSION	3
+
+// the current TimeMap behind a seqlock, so it can be read from any thread,
+// or any process mapping TIMESYNC_MMAP, without tearing. one writer.
 struct syncSharedData {
-	unsigned int magic;
-	long double startTime; //subtract from CLOCK_MONOTONIC_RAW.
-	long double timeOffset;
-	long double slope; // e.g. 24414.0625
-	long double offset; // ticks offset.
-	bool valid; //here to preserve alignment.
+	uint32_t				magic;
+	uint32_t				version;	// TIMESYNC_VERSION
+	std::atomic<uint32_t>	seq;		// odd while written
+	uint32_t				pad;
+	double					startTime;	// the writer's g_startTime
+	TimeMap					map;
+
+	void init()
+	{
+		seq.store(0);
+		startTime = 0.0;
+		memset(&map, 0, sizeof(map));
+		version = TIMESYNC_VERSION;
+		std::atomic_thread_fence(std::memory_order_release);
+		magic = TIMESYNC_MAGIC;
+	}
+	void store(const TimeMap &m)
+	{
+		uint32_t q = seq.load(std::memory_order_relaxed) | 1;
+		seq.store(q, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		startTime = (double)g_startTime;
+		map = m;
+		seq.store(q + 1, std::memory_order_release);
+	}
+	// false if nothing was published, or a consistent copy couldn't be had
+	bool load(TimeMap &m, double *start = NULL) const
+	{
+		if (magic != TIMESYNC_MAGIC || version != TIMESYNC_VERSION)
+			return false;
+		for (int i=0; i<64; i++) {
+			uint32_t q = seq.load(std::memory_order_acquire);
+			if (q & 1)
+				continue;
+			m = map;
+			double st = startTime;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (seq.load(std::memory_order_relaxed) != q)
+				continue;
+			if (start)
+				*start = st;
+			return m.version > 0;
+		}
+		return false;
+	}
 };
 class TimeSync
 {
 	//take performance counter time, produce (predict) ticks.
+	//update() runs on one thread; everyone else reads snapshot().
 public:
-	long double 	m_slope;
-	long double 	m_offset;
-	long double 	m_timeOffset;
-	long double 	m_update;
+	ClockSync		m_sync;		// the estimate, the updating thread's own
 	mmapHelp	   *mmh;
-	syncSharedData *m_ssd;
-	int				m_ssdn;
-	std::atomic<int>m_ticks;
+	syncSharedData *m_ssd;		// the mmap, for other processes
+	syncSharedData	m_pub;		// the same, for other threads
+	std::atomic<int64_t>m_ticks;	// the last update's, whole
 	int				m_dropped;
-	int 			m_frame;
-	//updated periodically to prevent precision issues.
-
-	GainController *slopeGC;
-	GainController *offsetGC;
+	uint64_t		m_version;
 
-	TimeSync()
+	TimeSync() : m_sync(24414.0625)
 	{
-		m_slope = 24414.0625;
 		construct();
 	}
-	TimeSync(long double _slope)
+	TimeSync(long double _slope) : m_sync((double)_slope)
 	{
-		m_slope = _slope;
 		construct();
 	}
 	~TimeSync()
 	{
-		delete slopeGC;
-		delete offsetGC;
 		delete mmh;
 	}
 	void construct()
 	{
-		m_offset = 0.0;
-		m_timeOffset = 0.0;
-		m_frame = 0;
-		slopeGC = new GainController(2e-5);
-		offsetGC = new GainController(1e-4);
+		m_ticks = 0;
+		m_dropped = 0;
+		m_version = 0;
+		m_pub.init();
 		// sizeof(*m_ssd) is safer than sizeof(struct syncSharedData)
 		mmh = new mmapHelp(sizeof(*m_ssd), TIMESYNC_MMAP);
 		mmh->prinfo();
 		m_ssd = static_cast<syncSharedData *>(mmh->m_addr);
-		if (m_ssd) {
-			m_ssd[0].magic = m_ssd[1].magic = 0x134fbab3;
-			m_ssd[0].valid = false;
-			m_ssd[1].valid = false;
-		}
-		m_ssdn = 0;
+		if (m_ssd)
+			m_ssd->init();
 	}
+	// on the updating thread, or before it starts
 	void reset()
 	{
-		m_frame = 0.0; //enables quick reset of m_offset.
-		m_slope = 24414.0625;
+		m_sync.reset(24414.0625);
 	}
 	void reset(long double _slope)
 	{
-		m_frame = 0.0;
-		m_slope = _slope;
+		m_sync.reset((double)_slope);
+	}
+	// the map as of the last update(); version 0 (and slope, for time()
+	// to be finite) before the first
+	TimeMap snapshot() const
+	{
+		TimeMap m;
+		if (!m_pub.load(m)) {
+			memset(&m, 0, sizeof(m));
+			m.slope = 24414.0625;
+			m.period = 1.0 / m.slope;
+		}
+		return m;
 	}
 	std::string getInfo()
 	{
 		std::stringstream oss;
-		long double off = m_offset - m_slope * m_timeOffset;
+		TimeMap m = snapshot();
+		double off = m.offset - m.slope * m.timeOffset;
 		double t = (double)gettime();
 		double hours = floor(t / 3600.0);
 		double minutes = floor((t - hours * 3600.0)/60.0);
@@ -128,62 +168,56 @@ public:
 		oss << "time "<< buf << std::endl;
 		oss << "ticks "<< m_ticks <<" dropped "<< m_dropped << std::endl;
 		oss << "sync offset:"<< off << " (ticks)"<< std::endl;
-		oss << " slope:"<< m_slope << " (ticks/s)"<< std::endl;
-		oss << " update:"<< m_update;
+		oss << " slope:"<< m.slope << " (ticks/s)"<< std::endl;
+		snprintf(buf, 256, " error: %.1f (us)", m.error * 1e6);
+		oss << buf;
 		return oss.str();
 	}
+	// on the updating thread
 	void prinfo()
 	{
-		printf("sync offset %Lf slope %.4Lf update %.4Lf\n",
-		       m_offset, m_slope, m_update);
-		printf("offset ");
-		offsetGC->prinfo();
-		printf("slope ");
-		slopeGC->prinfo();
+		printf("sync slope %.4f error %.1f us scatter %.2f ticks "
+		       "over %zu points; %lu kept %lu outliers %lu restarts\n",
+		       m_sync.slope(), 1e6 * m_sync.error(m_sync.refLocal()) /
+		       m_sync.slope(), m_sync.scatter(), m_sync.points(),
+		       (unsigned long)m_sync.m_accepted,
+		       (unsigned long)m_sync.m_rejected,
+		       (unsigned long)m_sync.m_restarts);
 	}
-	void update(long double time, int ticks)
+	// ticks seen at time; outliers and clock jumps are ClockSync's to sort out.
+	// the full count: the worker's blocks carry an i64 tick, which passes
+	// 2^31 after a day at 24 kHz
+	void update(long double time, int64_t ticks)
 	{
-		long double pred = (time-m_timeOffset) * m_slope + m_offset;
-		m_update = ticks - pred;
-		if (m_frame < 100) {
-			m_offset += m_update * 0.9;
-		} else {
-			m_offset += m_update * offsetGC->m_gain;
-			offsetGC->update(m_update);
-		}
-		if (m_frame > 2000) {
-			m_slope += m_update * slopeGC->m_gain;
-			slopeGC->update(m_update);
-		}
-		if (time - m_timeOffset > 10) {
-			m_offset += m_slope * (time - m_timeOffset);
-			m_timeOffset = time;
-		}
-		//also update the mmaped data.
-		if (m_ssd) {
-			m_ssd[m_ssdn].valid = false;
-			m_ssd[m_ssdn].startTime = g_startTime;
-			m_ssd[m_ssdn].timeOffset = m_timeOffset;
-			m_ssd[m_ssdn].slope = m_slope;
-			m_ssd[m_ssdn].offset = m_offset;
-			m_ssd[m_ssdn].magic = 0x134fbab3;
-			m_ssd[m_ssdn].valid = true;
-			m_ssdn ^= 1;
-		}
+		m_sync.add((double)time, (double)ticks);
+		publish((double)time);
 		m_ticks = ticks;
-		m_frame++;
+	}
+	// the estimate, as a new snapshot; here and in the mmap
+	void publish(double now)
+	{
+		TimeMap m;
+		m.version = ++m_version;
+		m.timeOffset = m_sync.refLocal();
+		m.slope = m_sync.slope();
+		m.offset = m_sync.refRemote();
+		m.period = 1.0 / m.slope;
+		m.error = m_sync.error(now) * m.period;
+		m_pub.store(m);
+		if (m_ssd)
+			m_ssd->store(m);
 	}
 	double getTicks(long double time)   //estimated ticks, of course.
 	{
-		return (time - m_timeOffset) * m_slope + m_offset;
+		return snapshot().ticks((double)time);
 	}
-	int getTicks()
+	int64_t getTicks()
 	{
 		return m_ticks;
 	}
 	long double getTime(double ticks)   //estimated time, of course.
 	{
-		return (ticks - m_offset)/m_slope + m_timeOffset;
+		return snapshot().time(ticks);
 	}
 	std::string getTime()
 	{
@@ -206,25 +240,36 @@ public:
 
 	TimeSyncClient()
 	{
-		mmh = new mmapHelp(2*sizeof(syncSharedData), TIMESYNC_MMAP);
-		if (mmh->m_fd > 0) {
+		m_ssd = NULL;
+		// don't fill: that would truncate the writer's map
+		mmh = new mmapHelp(sizeof(syncSharedData), TIMESYNC_MMAP, false);
+		struct stat sb;
+		if (mmh->m_fd > 0 && mmh->m_addr &&
+		    fstat(mmh->m_fd, &sb) == 0 &&
+		    (size_t)sb.st_size >= sizeof(syncSharedData))
 			m_ssd = static_cast<syncSharedData *>(mmh->m_addr);
-			m_ssd[0].magic = m_ssd[1].magic = 0;
-		} else
+		else
 			printf("Error: could not open %s\n",TIMESYNC_MMAP);
 	}
 	~TimeSyncClient()
 	{
 		delete mmh;
 	}
+	// the writer's current map; false if it hasn't published one
+	bool snapshot(TimeMap &m)
+	{
+		double start;
+		if (!m_ssd || !m_ssd->load(m, &start))
+			return false;
+		g_startTime = start; //so the two programs are synced.
+		return true;
+	}
 	void getTicks(long double &time, double &ticks)
 	{
-		int n = 0;
-		if (m_ssd[n].valid == false) n++;
-		if (m_ssd[n].valid && m_ssd[n].magic == 0x134fbab3) {
-			g_startTime = m_ssd[n].startTime; //so the two programs are synced.
+		TimeMap m;
+		if (snapshot(m)) {
 			time = gettime();
-			ticks = (time - m_ssd[n].timeOffset) * m_ssd[n].slope + m_ssd[n].offset;
+			ticks = m.ticks((double)time);
 		} else {
 			time = gettime();
 			ticks = 0; // not synced with TDT.
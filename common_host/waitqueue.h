@@ -0,0 +1,146 @@
+#ifndef __WAITQUEUE_H__
+#define __WAITQUEUE_H__
+
+// a ReaderWriterQueue the consumer can sleep on, so it need not poll.
+
+#include <atomic>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "readerwriterqueue.h"
+
+// A futex word the producer bumps and the consumer sleeps on, optionally
+// after spinning a while. A producer only makes a syscall when someone is
+// asleep. Use one per consumer: take seq(), check for work, and if there
+// is none wait(seen) -- anything signalled after seq() was read wakes it.
+class Wakeup
+{
+protected:
+	std::atomic<unsigned>	m_seq;
+	std::atomic<unsigned>	m_waiters;
+	double					m_spin;	// seconds to spin before parking
+
+	static long futex(std::atomic<unsigned> *w, int op, unsigned val,
+	                  const timespec *ts)
+	{
+		return syscall(SYS_futex, (unsigned *)w, op | FUTEX_PRIVATE_FLAG,
+		               val, ts, NULL, 0);
+	}
+	static double now()
+	{
+		timespec t;
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		return t.tv_sec + t.tv_nsec * 1e-9;
+	}
+
+public:
+	Wakeup(double spin = 0.0) : m_seq(0), m_waiters(0), m_spin(spin) {}
+	void setSpin(double spin)
+	{
+		m_spin = spin;
+	}
+	unsigned seq()
+	{
+		return m_seq.load();
+	}
+	void signal()
+	{
+		m_seq.fetch_add(1);
+		if (m_waiters.load() > 0)
+			futex(&m_seq, FUTEX_WAKE, INT_MAX, NULL);
+	}
+	// until seq() moves on from seen, or timeout seconds (< 0 forever).
+	// false on timeout.
+	bool wait(unsigned seen, double timeout)
+	{
+		if (m_seq.load() != seen)
+			return true;
+		double start = (m_spin > 0.0 || timeout >= 0.0) ? now() : 0.0;
+		if (m_spin > 0.0) {
+			double spin = timeout >= 0.0 && timeout < m_spin ? timeout : m_spin;
+			while (now() - start < spin) {
+				for (int i=0; i<64; i++) {
+					if (m_seq.load(std::memory_order_relaxed) != seen)
+						return true;
+#if defined(__x86_64__) || defined(__i386__)
+					__builtin_ia32_pause();
+#endif
+				}
+			}
+		}
+		while (true) {
+			timespec ts, *tp = NULL;
+			if (timeout >= 0.0) {
+				double left = timeout - (now() - start);
+				if (left <= 0.0)
+					return m_seq.load() != seen;
+				ts.tv_sec = (time_t)left;
+				ts.tv_nsec = (long)((left - ts.tv_sec) * 1e9);
+				tp = &ts;
+			}
+			// counted before seq is looked at again, so a signal() after
+			// this either sees us or changes seq under the futex
+			m_waiters.fetch_add(1);
+			if (m_seq.load() == seen)
+				futex(&m_seq, FUTEX_WAIT, seen, tp);
+			m_waiters.fetch_sub(1);
+			if (m_seq.load() != seen)
+				return true;
+		}
+	}
+};
+
+// single producer, single consumer, as ReaderWriterQueue; the consumer
+// may block in wait_dequeue() until the producer enqueues.
+template<typename T>
+class WaitQueue
+{
+protected:
+	moodycamel::ReaderWriterQueue<T>	m_q;
+	Wakeup								m_wake;
+
+public:
+	explicit WaitQueue(size_t size = 15, double spin = 0.0) :
+		m_q(size), m_wake(spin) {}
+	void setSpin(double spin)
+	{
+		m_wake.setSpin(spin);
+	}
+	// allocates if full, as ReaderWriterQueue::enqueue()
+	bool enqueue(const T &x)
+	{
+		bool ok = m_q.enqueue(x);
+		m_wake.signal();
+		return ok;
+	}
+	bool try_enqueue(const T &x)
+	{
+		if (!m_q.try_enqueue(x))
+			return false;
+		m_wake.signal();
+		return true;
+	}
+	bool try_dequeue(T &x)
+	{
+		return m_q.try_dequeue(x);
+	}
+	// up to timeout seconds (< 0 forever); false if nothing came
+	bool wait_dequeue(T &x, double timeout)
+	{
+		while (true) {
+			unsigned seen = m_wake.seq();
+			if (m_q.try_dequeue(x))
+				return true;
+			if (!m_wake.wait(seen, timeout))
+				return m_q.try_dequeue(x);
+		}
+	}
+	size_t size_approx() const
+	{
+		return m_q.size_approx();
+	}
+};
+
+#endif
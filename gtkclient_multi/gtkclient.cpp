@@ -48,6 +48,7 @@
 #include "spkwriter.h"
 #include "tcpsegmenter.h"
 #include "firingrate.h"
+#include "clocksync.h"
 
 #include "gtkclient.h"
 #include "headstage.h"
@@ -839,7 +840,7 @@ void* sock_thread(void* param){
   
 	int tid = (intptr_t) param;
 	
-	double g_timeOffset = 0.0; //offset between local time and bridge time.
+	ClockSync bridgeSync(BRIDGE_CLOCK); //bridge ticks against local time.
 
 	char destName[256]; destName[0] = 0;
 	char buf[1024+128+4];
@@ -1027,31 +1028,16 @@ packet format in the file, as saved here:
  and we know bridge timestamps of each of those packets, especially the last.
  since there is no clear way of measuring latency, assume that the last packet's
  time is synchronous with the wall clock at rx time -> can build up an offset.
- if the offset is within a few seconds, update by smoothing.
- if it is off by a lot, just replace.
+ ClockSync keeps the least delayed packet of every 0.1s and fits offset
+ and skew through the last minute of those, dropping outliers.
 */
-				if(i == npack-1){ //update the offset.
-					double off = rxtime - ((double)p->ms / BRIDGE_CLOCK);
-					if(abs(off - g_timeOffset) > 1.0) g_timeOffset = off;
-					//not sure what the correct level of smoothing is:
-					//we want to reject noise, but we don't want to lag behind the
-					//changing clock skew by too much (the xtal osc on the bridge is not
-					// precisely trimmed).
-					//actually, now that i think about it, provided clock skew is
-					//consistent the lag should be consistent so this will come out as
-					//another (slight) lag.
-					//perhaps we should also do outlier rejection?
-					//perhaps we sholud implement a PI controller?
-					g_timeOffset *= 0.997;
-					g_timeOffset += 0.003*off;
-					//probably need a GUI element to display offset.
-					//printf("offset time: %f of %f\n", g_timeOffset,
-					//		 ((double)p->ms / BRIDGE_CLOCK));
+				if(i == npack-1){ //update the fit.
+					bridgeSync.add(rxtime, (double)p->ms);
 				}
 				for(int j=0; j<128;j++){
 					g_templMatch[tid][j][0] = g_templMatch[tid][j][1] = false;
 				}
-				double time = ((double)p->ms / BRIDGE_CLOCK) + g_timeOffset;
+				double time = bridgeSync.local((double)p->ms);
 				unsigned int headecho = g_headstage->getHeadecho(tid);
 				decodePacket(p, channels, match, headecho);
 				for(int j=0; j<32; j++){
@@ -2,85 +2,33 @@
 #define __ARTIFACT_H__
 
 #include "matStor.h"
-
-#if defined KHZ_24
-#define ARTBUF	128	// 64 ~ 2.62 msec ; 128 ~ 5.24 msec
-#elif defined KHZ_48
-#define ARTBUF 	256
-#else
-#error Bad sampling rate!
-#endif
-
-#define RECCHAN 	96
-
-#define NARTPTR	8 // number of artifact buffer pointers
+#include "artifact_engine.h"
 
 extern int g_spikesCols;
 extern float g_artifactDispAtten;
 
-class Artifact
+// a stim channel's template, and how to draw it
+class Artifact : public ArtifactTemplate
 {
 
 public:
-	float 	m_wav[RECCHAN *ARTBUF];	// the average artifact buffer
-	float	m_std[RECCHAN *ARTBUF];	// the artifact standard deviation
-	i64		m_windex[NARTPTR];		// write index into the buffer, or -1
-	i64		m_rindex[NARTPTR];		// read index into the buffer, or -1
-	i64		m_nsamples;				// number of examples in the average
-
-	int 	m_stimchan;
-
-	// windex is where we are writing into m_wav (and m_now)
-	// rindex is where we can read from the buffer to subtract artifact
-
-	float	m_now[RECCHAN *ARTBUF];	// the last captured artifact
-	// nb we keep this around not for computing the average,
-	// which can be easily done recursively,
-	// but for saving snippets of the artifact
-
-	Artifact(int _stimchan, MatStor *ms)
+	Artifact(int _stimchan, size_t nchan, MatStor *ms) :
+		ArtifactTemplate(_stimchan, nchan, ms)
 	{
-		m_stimchan = _stimchan;
-		for (int i=0; i<RECCHAN*ARTBUF; i++) {
-			m_wav[i] = 0.f;
-			m_now[i] = 0.f;
-		}
-		for (int i=0; i<NARTPTR; i++) {
-			m_windex[i] = -1;
-			m_rindex[i] = -1;
-		}
-		m_nsamples  = 0;
-
-		if (ms) {
-			for (int i=0; i<RECCHAN; i++)
-				ms->getValue3(m_stimchan, i, "artifact", &(m_wav[i*ARTBUF]), ARTBUF);
-			m_nsamples = (int)ms->getValue(m_stimchan, "artifact_nsamples", m_nsamples);
-		}
-
-	}
-	~Artifact()
-	{
-
-	}
-	void clearArtifacts()
-	{
-		for (int j=0; j<RECCHAN*ARTBUF; j++) {
-			m_wav[j] = 0.f;
-		}
-		m_nsamples = 0;
 	}
 	void draw()
 	{
 
-		int rows = RECCHAN / g_spikesCols;
-		if (RECCHAN % g_spikesCols)
+		int nc = (int)m_nchan;
+		int rows = nc / g_spikesCols;
+		if (nc % g_spikesCols)
 			rows++;
 		float xf = g_spikesCols;
 		float yf = rows;
 		float xz = 2.f/xf;
 		float yz = 2.f/yf;
 
-		for (int k=0; k<RECCHAN; k++) {
+		for (int k=0; k<nc; k++) {
 			float xo = (k%g_spikesCols)/xf;
 			float yo = ((k/g_spikesCols)+1)/yf;
 			float x = xo*2.f-1.f;
@@ -93,7 +41,7 @@ public:
 
 			glBegin(GL_LINE_STRIP);
 			for (int j=0; j<ARTBUF; j++) {
-				float f  = m_wav[k*ARTBUF+j];
+				float f  = m_wav[j*nc+k];
 				float ny = f/g_artifactDispAtten + 0.5f;
 				float nx = (float)(j)/((float)ARTBUF-1.f);
 				glVertex3f(nx*w+x, ny*h+y, 0.f);
@@ -130,14 +78,6 @@ public:
 
 		// xxx chan labels here?
 	}
-	void save(MatStor *ms)
-	{
-		if (ms) {
-			for (int i=0; i<RECCHAN; i++)
-				ms->setValue3(m_stimchan, i, "artifact", &(m_wav[i*ARTBUF]), ARTBUF);
-			ms->setValue(m_stimchan, "artifact_nsamples", m_nsamples);
-		}
-	}
 };
 
 #endif
\ No newline at end of file
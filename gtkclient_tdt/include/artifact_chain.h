@@ -0,0 +1,55 @@
+#ifndef __ARTIFACT_CHAIN_H__
+#define	__ARTIFACT_CHAIN_H__
+
+#include <atomic>
+#include <mutex>
+#include <armadillo>
+#include "util.h"
+
+using namespace std;
+using namespace arma;
+
+#define CHAIN_LAG	16		// nlms publishes (training batches) the fused matrix may trail by
+
+class ArtifactNLMS2;
+class ArtifactFilter;
+
+// The two linear artifact stages, NLMS then the loaded filter, on the
+// worker's float block in place.
+//
+// With both on, x - Pn x then (I - Pa) of that is
+//   x - (Pn + Pa - Pa Pn) x
+// so one GEMM with the fused matrix does the pair. Fusing costs n^3, so
+// it is done in update(), off the worker, and only while proc() is running
+// both stages: when the loaded filter changes, and every CHAIN_LAG/2 nlms
+// batches while it trains. proc() uses the fused matrix while it trails
+// the nlms by no more than CHAIN_LAG batches, and otherwise applies the
+// stages one after the other, which is the same thing in two GEMMs.
+// update() is called by whoever changes a stage (the gui), and polled by
+// the nlms trainer.
+class ArtifactChain
+{
+protected:
+	ArtifactNLMS2	*m_nlms;
+	ArtifactFilter	*m_af;
+
+	mutex	m_umtx;		// one update() at a time
+	mutex	m_mtx;		// m_P
+	fmat	m_P;		// Pn + Pa - Pa Pn
+	u64		m_nv;		// stage versions m_P was built from
+	u64		m_av;
+	bool	m_valid;	// m_P may be used (under both mutexes to write)
+	atomic<bool>	m_both;	// proc() last ran both stages
+
+public:
+	ArtifactChain(ArtifactNLMS2 *nlms, ArtifactFilter *af);
+
+	// rebuild the fused matrix if it is due (see above); now rebuilds it
+	// for any change, as after clearing the nlms weights
+	void update(bool now = false);
+
+	// x is n x ns, column-major; y is the caller's scratch, same size
+	void proc(float *x, float *y, size_t ns, bool nlms, bool filter);
+};
+
+#endif
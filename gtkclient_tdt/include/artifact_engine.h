@@ -0,0 +1,84 @@
+#ifndef __ARTIFACT_ENGINE_H__
+#define __ARTIFACT_ENGINE_H__
+
+#include <vector>
+#include <functional>
+#include "util.h"
+#include "gtkclient.h"	// for the sampling rate
+
+#if defined KHZ_24
+#define ARTBUF	128	// 64 ~ 2.62 msec ; 128 ~ 5.24 msec
+#elif defined KHZ_48
+#define ARTBUF 	256
+#else
+#error Bad sampling rate!
+#endif
+
+#define NARTPTR	8 // events in flight per stim channel
+
+using namespace std;
+
+class MatStor;
+
+// A stim channel's average artifact. Sample-major, like the worker's block:
+// m_wav[j*m_nchan + ch] is channel ch, j samples after onset, so any run of
+// samples across all channels is one contiguous span.
+class ArtifactTemplate
+{
+public:
+	int				m_stimchan;
+	size_t			m_nchan;
+	vector<float>	m_wav;		// ARTBUF x nchan
+	i64				m_nsamples;	// number of examples in the average
+
+	ArtifactTemplate(int stimchan, size_t nchan, MatStor *ms);
+	virtual ~ArtifactTemplate();
+	void clearArtifacts();
+	void save(MatStor *ms);
+};
+
+// one stim event in flight
+struct ArtifactEvent {
+	bool			active;
+	size_t			stim;	// stim channel
+	i64				tick;	// of the onset
+	size_t			pos;	// template samples done before this block
+	size_t			k0;		// this block's span, [k0, k1)
+	size_t			k1;
+	float			alpha;	// weight into the average; 0 if not training
+	vector<float>	now;	// the capture, laid out like the template
+};
+
+// Stim artifact subtraction and blanking, an event at a time.
+//
+// An event is the ARTBUF samples from a stim onset. Each block, process()
+// works out the span of the block each event covers and does the whole span
+// in one pass over contiguous memory: capture, template subtraction and the
+// running-average update. Events carry their position, so they run across
+// block boundaries. After the worker's filters, blank() zeroes the blanking
+// window within the same spans and retires finished events.
+class ArtifactEngine
+{
+public:
+	// a capture is complete
+	typedef function<void(const ArtifactEvent &e)> DoneFn;
+
+protected:
+	vector<ArtifactTemplate *>	m_tmpl;
+	size_t						m_nchan;
+	vector<ArtifactEvent>		m_ev;	// slot z of stim i is i*NARTPTR+z
+
+public:
+	ArtifactEngine(const vector<ArtifactTemplate *> &tmpl, size_t nchan);
+
+	// x is nchan x ns, column-major. stim is nsc x ns, channel-major; an
+	// event starts on every set sample. before filtering.
+	void process(float *x, size_t ns, const u8 *stim, size_t nsc,
+	             const i64 *tk, bool subtract, bool train, i64 maxsamps,
+	             DoneFn done);
+	// zero samples [pre, pre+len) after each onset if enable. after
+	// filtering; call every block, as it also moves the events on.
+	void blank(float *x, bool enable, int pre, int len);
+};
+
+#endif
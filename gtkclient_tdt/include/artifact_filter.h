@@ -2,28 +2,71 @@
 #define	__ARTIFACT_FILTER_H__
 
 #include <string>
+#include <mutex>
 #include <armadillo>
+#include "util.h"
 
 using namespace std;
 using namespace arma;
 
 class MatStor;
 
+enum {
+	AF_DENSE,
+	AF_LOWRANK,		// W = U V'
+	AF_SPARSE,
+};
+
+// relative error below which a weight file's structure counts as exact
+#define AF_EXACT_TOL 1e-6
+// a sparse MAC costs about this many dense ones (indices, no simd)
+#define AF_SPARSE_COST 2.0
+
+// Fixed linear artifact predictor, Xhat = W X, with W loaded from a file.
+//
+// subtract() applies a float copy of W, published on load and clear, in
+// whichever form is cheapest per sample: dense (n^2 MACs), low rank
+// (2 n r) or sparse (nnz). The file is always a dense W; the form is found
+// from it at load time, exact to AF_EXACT_TOL, so a file truncated by
+// artfilt_compress runs in its cheap form with nothing else to configure.
 class ArtifactFilter
 {
 protected:
 	size_t n;		// order of the filter
 	mat W;			// weights (n by n)
 
+	mutex	m_pmtx;		// all of the below
+	int		m_form;
+	fmat	m_P;		// W in float; also what predictor() hands out
+	fmat	m_U;		// n x r
+	fmat	m_Vt;		// r x n
+	sp_fmat	m_S;
+	fmat	m_T;		// V'x, r x ns
+	u64		m_version;	// bumped per publish
+
 public:
 
 	ArtifactFilter(int _n);
 	~ArtifactFilter();
 
 	mat filter(mat X);
+	// x -= Wx in place. x is n x ns, column-major; y is the caller's
+	// scratch, same size.
+	void subtract(float *x, float *y, size_t ns);
+	void predictor(fmat &P);
+	u64 version();
+	string form();		// e.g. "rank 12 (6% of dense)"
 	void loadWeights(const char *fn);
 	void clearWeights();
+
+	// smallest truncations of W within a relative Frobenius error tol.
+	// lowRank: W ~ U V', returns r (n, with U and V empty, if svd fails).
+	// sparsify: drops the smallest weights, returns nnz.
+	static size_t lowRank(const mat &W, double tol, mat &U, mat &V);
+	static size_t sparsify(const mat &W, double tol, mat &S);
+
+protected:
+	void publish();
 };
 
 #endif
-
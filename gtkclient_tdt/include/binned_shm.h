@@ -0,0 +1,121 @@
+#ifndef __BINNED_SHM_H__
+#define __BINNED_SHM_H__
+
+#include <atomic>
+#include <string>
+#include "util.h"
+
+using namespace std;
+
+#define BSHM_NAME	"/gtkclient_binned"	// under /dev/shm
+#define BSHM_MAGIC	0x6e696267			// 'gbin'
+
+enum {
+	BSHM_VERSION = 1,
+	BSHM_FRAMES = 64,	// frames in the ring
+};
+
+// each frame starts with this, then nunits x nlags u16 lagged bins, unit
+// major (unit i's lags at i*nlags), as FiringRate::get_bins() fills them and
+// /tmp/binned always had them. they are rounded once per bin, where the old
+// fifo rounded each spike's share: a bin can differ from what the fifo gave
+// for the same time by up to 1/128 per spike in its cross-fades. (the fifo
+// still gives the old values for a given time.) lag 0 holds what was sorted
+// when the frame went out; spikes still in the sorter land in it later, so
+// asking the fifo for that time afterwards can count a few more. seq is odd
+// while the frame is written.
+struct BinnedFrame {
+	atomic<u32>	seq;
+	u32			pad;
+	u64			frame;		// its number, from 0
+	double		time;		// end of lag 0, the publisher's gettime()
+	double		published;	// gettime() when it went out
+};
+
+struct BinnedShmHeader {
+	u32			magic;
+	u32			version;
+	u32			nunits;		// channels x NSORT, channel major
+	u32			nlags;
+	u32			nframes;
+	u32			stride;		// bytes from one frame to the next
+	double		binRate;	// frames per second
+	double		duration;	// seconds spanned by the lags
+	double		startTime;	// the publisher's g_startTime
+	i32			pid;
+	i32			pad;
+	atomic<u64>	head;		// frames published, ever
+	atomic<u32>	wake;		// futex word, bumped with head
+	atomic<u32>	waiters;	// in wait(); publish() skips the syscall at 0
+};
+
+// Binned firing rates in shared memory, published continuously at a fixed
+// frame rate, in place of the fifo request / "go" handshake of mmap_fun().
+//
+// The publisher fills the next frame of a ring and bumps head. A consumer
+// takes the newest frame with latest(), a seqlock read with no syscall, and
+// can sleep until the next one with wait(), a futex on the shared word
+// (woken only if somebody is actually waiting). Both sides are here: the
+// pipeline creates, decoders (and the fifo shim) attach.
+class BinnedShm
+{
+protected:
+	string				m_name;
+	int					m_fd;
+	u8					*m_addr;
+	size_t				m_len;
+	bool				m_owner;
+	BinnedShmHeader		*m_hdr;
+	u8					*m_frames;
+
+public:
+	BinnedShm();
+	~BinnedShm();
+
+	bool create(const char *name, size_t nunits, size_t nlags,
+	            double binRate, double duration);
+	bool attach(const char *name);
+	void close();
+	bool isOpen()
+	{
+		return m_hdr != NULL;
+	}
+
+	size_t numUnits()
+	{
+		return m_hdr ? m_hdr->nunits : 0;
+	}
+	size_t numLags()
+	{
+		return m_hdr ? m_hdr->nlags : 0;
+	}
+	double binRate()
+	{
+		return m_hdr ? m_hdr->binRate : 0.0;
+	}
+	u64 head()
+	{
+		return m_hdr ? m_hdr->head.load(std::memory_order_acquire) : 0;
+	}
+
+	// publisher: the bins of the next frame, to fill in, then publish()
+	u16 *begin(double time);
+	void publish();
+
+	// the newest frame's bins (nunits x nlags), number and time (either may
+	// be null). false if nothing is published yet, or it kept changing
+	// under us.
+	bool latest(u16 *bins, u64 *frame, double *time);
+	// until head() passes seen (the head you last saw), or timeout_ms
+	// passes (< 0 for no limit). true if it has.
+	bool wait(u64 seen, int timeout_ms);
+
+protected:
+	BinnedFrame *slot(u64 n)
+	{
+		return (BinnedFrame *)(m_frames + (n % m_hdr->nframes) * m_hdr->stride);
+	}
+	static size_t stride(size_t nunits, size_t nlags);
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef __BUTTER_H__
+#define __BUTTER_H__
+
+#include <vector>
+
+using namespace std;
+
+// Butterworth design at runtime, as cascaded second-order sections.
+//
+// Same recipe as matlab's butter(): analog prototype, prewarped bilinear
+// transform, unity gain in the passband (DC for lowpass, nyquist for
+// highpass, the geometric band center for bandpass). Poles and zeros are
+// kept in sections rather than multiplied out, so high orders and low
+// cutoffs stay well conditioned.
+
+enum BUTTER_TYPE {
+	BUTTER_LOW = 0,
+	BUTTER_HIGH,
+	BUTTER_BAND
+};
+
+// order is the order of the whole filter, as in the old coefficient
+// comments: a bandpass of order 4 is butter(2, [lo hi]) and must be even.
+struct ButterSpec {
+	int		type;
+	int		order;
+	double	f1;	// cutoff, or low edge of the band (Hz)
+	double	f2;	// high edge of the band (Hz); bandpass only
+};
+
+struct Biquad {
+	double b[3];
+	double a[3];	// a[0] = 1
+};
+
+// false (and sos left empty) if the spec does not make sense at sr.
+bool butter_sos(const ButterSpec &spec, double sr, vector<Biquad> &sos);
+
+// "lowpass" etc, for the console.
+const char *butter_name(int type);
+
+#endif
@@ -7,6 +7,8 @@
 #include "random.h"
 #include "util.h"
 #include "spikebuffer.h"
+#include "sortchannel.h"
+#include "pcatrack.h"
 
 using namespace arma;
 
@@ -26,74 +28,30 @@ extern int g_whichAlignment;
 extern int g_whichSpikePreEmphasis;
 
 //need some way of encapsulating per-channel information.
-class Channel
+// the sorting half is SortChannel; this adds the vbos and the drawing.
+class Channel : public SortChannel
 {
-private:
-	float 	m_threshold; 	// 1 = + 10mV.
-	float	m_centering; 	// left/right centering. used to look for threshold crossing.
-	float 	m_gain;
-	float 	m_aperture[NSORT]; 		// aka MSE per sample.
 public:
 	Vbo		*m_wfVbo; 				// range 1 mean 0
 	Vbo		*m_usVbo;				// unsorted units
 	VboPca	*m_pcaVbo; 				// 2D points, with color.
-	float	m_pca[2][NWFSAMP]; 	// range 1 mean 0
-	float 	m_pcaScl[2]; 		// sqrt of the eigenvalues.
-	float	m_template[NSORT][NWFSAMP]; // range 1 mean 0.
+	PcaTracker *m_pcaTrack;			// fits m_pcaVbo's waveforms, off this thread
+	PcaBasis m_pcaProj;				// its basis, as addWf() projects with
+	u32		m_pcaShown;				// its version in m_pca and the points
 	float	m_loc[4];
-	int		m_ch; 			//channel number, obvi.
-	running_stat<double>	m_wfstats; // mean of the continuous waveform.
-	i64 	m_isi[NSORT][100]; 	//counts of the isi, in units of ms.
-	i64		m_lastSpike[NSORT]; //zero when a spike occurs. in samples.
-	bool	m_enabled;
-	SpikeBuffer m_spkbuf;
-	// TODO wrap spikebuffer methods into channel so that we can make the
-	// spikebuffer private
-	string 	m_chanName;
-	float 	m_scaleFactor; // from po8e scaling to uV
-
-	Channel(int ch, MatStor *ms)
+
+	Channel(int ch, MatStor *ms) : SortChannel(ch, ms)
 	{
 		m_wfVbo = new Vbo(6, 	NWFVBO, NWFSAMP+2); // sorted units, with color.
 		m_usVbo = new Vbo(3, 	NUSVBO, NWFSAMP+2); // unsorted units, all gray.
 		m_pcaVbo = new VboPca(6, 1024*8, 1, ch, NWFSAMP, ms);	// x, y, t, r, g, b
 		m_wfVbo->m_useSAA = m_usVbo->m_useSAA = m_pcaVbo->m_useSAA = false;
 		m_pcaVbo->m_fade = 0.f;
-		m_ch = ch;
-		//m_var = 0.0;
-		m_wfstats.reset();
-		m_enabled = true;
-
-		for (int j=0; j<NWFSAMP; j++) {
-			// only need first two pc's
-			m_pca[0][j] = 1.f/8.f;
-			m_pca[1][j] = 1.f/8.f;
-		}
-		m_pcaScl[0] = 1.f;
-		m_pcaScl[1] = 1.f;
-
-		for (int k=0; k<NSORT; k++) {
-			for (int j=0; j<NWFSAMP; j++) {
-				m_template[k][j] = 0.5*sinf(j/6.f) / 1e2; // sinusoids scaled to ~100 uV
-			}
-			m_aperture[k] = 0.f;
-		}
-
-		//read from matlab if it's there..
-		if (ms) {
-			ms->getValue3(ch, 0, "pca", &(m_pca[0][0]), NWFSAMP);
-			ms->getValue3(ch, 1, "pca", &(m_pca[1][0]), NWFSAMP);
-			ms->getValue3(ch, 0, "pcaScl", m_pcaScl, 2);
-			for (int j=0; j<NSORT; j++) {
-				ms->getValue3(ch, j, "template", &(m_template[j][0]), NWFSAMP);
-				m_aperture[j] = ms->getValue2(ch, j, "aperture", 0.f); // old default: 0.003f
-			}
-
-			m_threshold = ms->getValue(ch, "threshold", 0.6f);
-			m_centering = ms->getValue(ch, "centering", NWFSAMP/2.f);
-			m_gain = ms->getValue(ch, "gain", 1.f);
-			m_enabled = (bool)ms->getValue(ch, "enabled", 1.f);
-		}
+		m_pcaTrack = new PcaTracker(ch, NWFSAMP, m_pcaVbo->m_wf,
+		                            m_pcaVbo->m_rows, &m_pcaVbo->m_w);
+		m_pcaTrack->seed(&m_pca[0][0], m_pcaScl);
+		memset(&m_pcaProj, 0, sizeof(m_pcaProj));
+		m_pcaShown = m_pcaTrack->version();
 
 		//init m_wfVbo.
 		for (int i=0; i<NWFVBO; i++) {
@@ -136,13 +94,6 @@ public:
 
 		m_loc[0] = m_loc[1] = 0.f;
 		m_loc[2] = m_loc[3] = 1.f;
-
-		for (int u=0; u<NSORT; u++) {
-			m_lastSpike[u] = 0;
-			for (size_t i=0; i < sizeof(m_isi[0])/sizeof(m_isi[0][0]); i++) {
-				m_isi[u][i] = 0;
-			}
-		}
 	}
 	~Channel()
 	{
@@ -150,21 +101,14 @@ public:
 		m_wfVbo = 0;
 		delete m_usVbo;
 		m_usVbo = 0;
+		delete m_pcaTrack;	// the PcaEngine is stopped by now
+		m_pcaTrack = 0;
 		delete m_pcaVbo;
 		m_pcaVbo = 0;
 	}
 	void save(MatStor *ms)
 	{
-		for (int j=0; j<NSORT; j++) {
-			ms->setValue3(m_ch, j, "pca", &(m_pca[j][0]), NWFSAMP);
-			ms->setValue3(m_ch, j, "template", &(m_template[j][0]), NWFSAMP);
-			ms->setValue2(m_ch, j, "aperture", m_aperture[j]);
-		}
-		ms->setValue3(m_ch, 0, "pcaScl", m_pcaScl, 2);
-		ms->setValue(m_ch, "threshold", m_threshold);
-		ms->setValue(m_ch, "centering", m_centering);
-		ms->setValue(m_ch, "gain", m_gain);
-		ms->setValue(m_ch, "enabled", m_enabled);
+		SortChannel::save(ms);
 		m_pcaVbo->save(m_ch, ms);
 	}
 	int addWf(float *wf, int unit, float time, bool updatePCA)
@@ -265,15 +209,10 @@ public:
 			for (int j=0; j<NWFSAMP; j++) {
 				nw[j] = wf[j];
 			}
-			//compute PCA. just inner product.
-			// TODO: this seems to be a data race
+			//project onto the tracker's latest components.
+			m_pcaTrack->latest(m_pcaProj);
 			float *pca = m_pcaVbo->addRow();
-			for (int i=0; i<2; i++) {
-				pca[i] = 0.f;
-				for (int j=0; j<NWFSAMP; j++) {
-					pca[i] += m_pca[i][j] * wf[j];
-				}
-			}
+			pcaProject(m_pcaProj, wf, NWFSAMP, pca);
 			pca[2] = time;
 			for (int i=0; i<3; i++) {
 				pca[3+i] = color[i];
@@ -285,7 +224,12 @@ public:
 	{
 		if (m_wfVbo)  m_wfVbo->copy();
 		if (m_usVbo)  m_usVbo->copy();
-		if (m_pcaVbo) m_pcaVbo->copy(false,false);
+		if (m_pcaVbo) {
+			if (m_pcaTrack->version() != m_pcaShown)
+				showPca();
+			else
+				m_pcaVbo->copy(false,false);
+		}
 	}
 	void setVertexShader(cgVertexShader *vs)
 	{
@@ -334,11 +278,12 @@ public:
 	}
 	void setApertureLocal(int n, float aperture)
 	{
+		if (n < 0 || n >= NSORT)
+			return;
 		// XXX TODO
 		// need to increase the limits to num_sorted, right?
 		// also need to include more colors here
-		if (n >= 0 && n < NSORT)
-			m_aperture[n] = aperture;
+		SortChannel::setApertureLocal(n, aperture);
 		float color[3] = {0.f, 1.f, 1.f};
 		switch (n) {	// 0-indexed
 		case 0:
@@ -364,24 +309,12 @@ public:
 		}
 		m_pcaVbo->updateAperture(m_template[n], aperture, color);
 	}
-	float getThreshold()
-	{
-		return m_threshold;
-	}
 	void setThreshold(float thresh)
 	{
 		if (thresh != m_threshold)
 			resetPca();
 		m_threshold = thresh;
 	}
-	void autoThreshold(double s)
-	{
-		m_threshold = m_wfstats.mean() + m_wfstats.stddev() * s;
-	}
-	int getCentering()
-	{
-		return (int)m_centering;
-	}
 	void setCentering(float c)
 	{
 		if (c != m_centering)
@@ -408,22 +341,6 @@ public:
 		m_usVbo->setLoc(x, y+h/2, w/2.f, h*gain);
 		m_gain = gain;
 	}
-	float getGain()
-	{
-		return m_gain;
-	}
-	void setEnabled(bool enabled)
-	{
-		m_enabled = enabled;
-	}
-	bool getEnabled()
-	{
-		return m_enabled;
-	}
-	void toggleEnabled()
-	{
-		m_enabled = !m_enabled;
-	}
 	void draw(int drawmode, float time, float *cursPos,
 	          bool closest, bool sortMode)
 	{
@@ -732,119 +649,38 @@ public:
 		//should be called if threshold, gain
 		//(or really anything else) is changed / invalidates current display.
 		m_pcaVbo->reset();
+		m_pcaTrack->reset();
 		m_wfVbo->setFade(1.7);//clear it a bit quicker.
 		m_usVbo->setFade(1.7);
-		for (int u=0; u<NSORT; u++) {
-			m_lastSpike[u] = 0;
-			for (size_t i=0; i < sizeof(m_isi[0])/sizeof(m_isi[0][0]); i++) {
-				m_isi[u][i] = 0;
-			}
-		}
+		clearISI();
 	}
+	// the PcaEngine fits at its next pass, and copy() shows it
 	void computePca()
 	{
-		long double t;
-		int nsamp = MIN((int)m_pcaVbo->m_w, m_pcaVbo->m_rows);
-		if (nsamp < NWFSAMP) {
-			printf("Channel::computePca %d (%d) samples, not enough\n",
-			       nsamp, (int)m_pcaVbo->m_w);
+		m_pcaTrack->request();
+	}
+	// a new fit: adopt it, and reproject the stored waveforms with it
+	void showPca()
+	{
+		PcaBasis b;
+		b.version = 0;
+		if (!m_pcaTrack->latest(b))
 			return;
-		}
-
-		mat X(nsamp, NWFSAMP);
-		for (int i=0; i<nsamp; i++) {
-			for (int j=0; j<NWFSAMP; j++) {
-				X(i, j) = m_pcaVbo->m_wf[i*NWFSAMP + j];
-			}
-		}
-
-		printf("PCA [%d x %d]\t", nsamp, NWFSAMP);
-
-		// standardize the data
-		t = gettime();
-		mat C = cov(X);
-		printf("cov: %0.3Lf ms\t", 1e3*(gettime()-t));
-
-		// compute eigenvalues and eigenvectors
-		t = gettime();
-		vec eigval;
-		mat eigvec;
-		eig_sym(eigval, eigvec, C);
-
-		// sort descending
-		vec d = fliplr(eigval);
-		mat V = fliplr(eigvec);
-
-		// normalize the eigenvectors by the sqrt of the eigenvalues
+		m_pcaShown = b.version;
 		for (int k=0; k<2; k++) {
-			m_pcaScl[k] = sqrt(d(k));
-			for (int i=0; i<NWFSAMP; i++) {
-				m_pca[k][i] = V(i,k) / m_pcaScl[k];
-			}
-		}
-
-		// recalculate the pca points for immediate display.
-		t = gettime();
-		for (int i=0; i<nsamp; i++) {
-			for (int k=0; k<2; k++) {
-				float pca = 0;
-				for (int j=0; j<NWFSAMP; j++) {
-					pca += m_pcaVbo->m_wf[i*NWFSAMP + j] * m_pca[k][j];
-				}
-				m_pcaVbo->m_f[i*6 + k] = pca;
-			}
-		}
-		printf("eig: %0.3Lf ms\t", 1e3*(gettime()-t));
-
-		t = gettime();
-		m_pcaVbo->m_r = 0;
-		m_pcaVbo->m_w = nsamp; //force a copy-over of the whole thing.
+			m_pcaScl[k] = b.scl[k];
+			for (int j=0; j<NWFSAMP; j++)
+				m_pca[k][j] = b.pc[k][j];
+		}
+		int w = m_pcaVbo->m_w;
+		int nsamp = MIN(w, m_pcaVbo->m_rows);
+		for (int i=w-nsamp; i<w; i++) {
+			int r = i % m_pcaVbo->m_rows;
+			pcaProject(b, &m_pcaVbo->m_wf[r*NWFSAMP], NWFSAMP,
+			           &m_pcaVbo->m_f[r*6]);
+		}
+		m_pcaVbo->m_r = w - nsamp; //force a copy-over of the whole thing.
 		m_pcaVbo->copy(false,true);
-		printf("cpy: %0.3Lf ms\n", 1e3*(gettime()-t));
-
-#ifdef DEBUG
-		X.save("waveforms.h5", hdf5_binary);
-		C.save("pca_cov.h5", hdf5_binary);
-		V.save("pca_v.h5", hdf5_binary);
-#endif
-	}
-
-	void updateISI(int unit, int sample)
-	{
-		//this used for calculating ISI.
-		unit -= 1; //comes in 0 = unsorted.
-		if (unit >=0 && unit < NSORT) {
-			int dsamp = sample - m_lastSpike[unit];
-			int b = floor(dsamp/SRATE_KHZ - 0.5);
-			int nisi = (int)(sizeof(m_isi[0])/sizeof(m_isi[0][0]));
-			//printf("%d isi %d u %d\n", m_ch, b, unit);
-			if (b > 0 && b < nisi)
-				m_isi[unit][b]++;
-			m_lastSpike[unit] = sample;
-		}
-	}
-	float getAperture(int unit)
-	{
-		if (unit >=0 && unit < NSORT) {
-			return m_aperture[unit];
-		} else return 0.f;
-	}
-	float getApertureUv(int unit)
-	{
-		//returns the aperture in uv. (uv^2 is less intuitive)
-		//input samples are 1 = 10mV.
-		//so waveform misalignment of 0.1 (1mV) -> 0.01; should be represented as
-		//1000uv^2, hence have to multiply by 1e8.
-		//sqrt(m_aperture * 1e8)
-		if (unit >=0 && unit < NSORT) {
-			return sqrt(m_aperture[unit] * 1e8);
-		} else return 0.f;
-	}
-	void setApertureUv(int unit, float aper)
-	{
-		if (unit >=0 && unit < NSORT) {
-			setApertureLocal( unit, aper*aper / 1e8);
-		}
 	}
 };
 
@@ -1,5 +1,4 @@
 /* datawriter.h - inspired by protobuflogger.h, by zheng */
-#include <gtk/gtk.h>
 #include <iostream>
 #include <fstream>
 #include <atomic>
@@ -18,7 +17,6 @@ protected:
 	size_t m_num_written; 			// how many bytes have been written
 	std::string m_fn; 				// the file name
 	ofstream m_os;					// object for writing to file
-	GtkWidget *m_w;					// for drawing to the gui
 
 public:
 	DataWriter();
@@ -50,9 +48,8 @@ public:
 	// returns the name of the file we are writing to
 	virtual string filename();
 
-	virtual void registerWidget(GtkWidget *w);
-
-	virtual void draw();
+	// one line for the gui (or a log); empty when not writing
+	virtual string status();
 
 	virtual const char *name() = 0;
 };
@@ -0,0 +1,102 @@
+#ifndef __DECODE_SHM_H__
+#define __DECODE_SHM_H__
+
+#include <atomic>
+#include <string>
+#include "util.h"
+
+using namespace std;
+
+#define DECSHM_NAME		"/gtkclient_decode"	// under /dev/shm
+#define DECSHM_MAGIC	0x63656467			// 'gdec'
+
+enum {
+	DECSHM_VERSION = 1,
+	DECSHM_FRAMES = 64,	// decoded frames in the ring
+	DEC_MAXOUT = 16,	// kinematic dimensions
+};
+
+// one decoded frame. seq is odd while it is written.
+struct DecodeFrame {
+	atomic<u32>	seq;
+	i32			valid;		// 0 until the decoder has weights
+	u64			frame;		// its number, from 0
+	u64			binFrame;	// the binned rate frame it decoded
+	double		time;		// of the bins, the daemon's gettime()
+	double		ticks;		// the same, in po8e ticks (TimeSync)
+	double		published;	// gettime() when it went out
+	float		y[DEC_MAXOUT];
+};
+
+// what the task says the kinematics really were, for training. written by
+// the task (setTarget()), read by the decoder every frame.
+struct DecodeTarget {
+	atomic<u32>	seq;
+	i32			train;		// 0: decode only
+	double		time;		// the daemon's clock; see timeOffset()
+	float		y[DEC_MAXOUT];
+};
+
+struct DecodeShmHeader {
+	u32			magic;
+	u32			version;
+	u32			nout;
+	u32			type;		// DECODE_WIENER, DECODE_KALMAN
+	double		binRate;	// frames per second
+	double		startTime;	// the daemon's g_startTime
+	i32			pid;
+	i32			pad;
+	atomic<u64>	head;		// frames published, ever
+	atomic<u32>	wake;		// futex word, bumped with head
+	atomic<u32>	waiters;
+	DecodeTarget	target;
+	DecodeFrame	frames[DECSHM_FRAMES];
+};
+
+// Decoded kinematics in shared memory, one frame per binned rate frame, the
+// same way BinnedShm carries the rates: a seqlocked ring read with latest(),
+// and a futex to sleep on with wait(). The other way, the task puts the
+// true kinematics in the target slot while the decoder trains.
+class DecodeShm
+{
+protected:
+	string				m_name;
+	int					m_fd;
+	bool				m_owner;
+	DecodeShmHeader		*m_hdr;
+
+public:
+	DecodeShm();
+	~DecodeShm();
+
+	bool create(const char *name, u32 nout, u32 type, double binRate);
+	bool attach(const char *name);
+	void close();
+	bool isOpen()
+	{
+		return m_hdr != NULL;
+	}
+	size_t numOutputs()
+	{
+		return m_hdr ? m_hdr->nout : 0;
+	}
+	u64 head()
+	{
+		return m_hdr ? m_hdr->head.load(std::memory_order_acquire) : 0;
+	}
+	// add to the daemon's times to get ours (both from gettime())
+	double timeOffset();
+
+	// the decoder
+	void publish(bool valid, u64 binFrame, double time, double ticks,
+	             const float *y);
+	// the newest target, if it changed since seen (updated)
+	bool target(u32 &seen, DecodeTarget &t);
+
+	// the task
+	bool latest(DecodeFrame &f);
+	bool wait(u64 seen, int timeout_ms);
+	void setTarget(const float *y, bool train, double time);
+};
+
+#endif
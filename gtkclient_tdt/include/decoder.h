@@ -0,0 +1,158 @@
+#ifndef __DECODER_H__
+#define __DECODER_H__
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <armadillo>
+#include "waitqueue.h"
+#include "decode_shm.h"
+#include "util.h"
+
+using namespace arma;
+using namespace std;
+
+class MatStor;
+
+enum DECODE_TYPE {
+	DECODE_NONE = 0,
+	DECODE_WIENER,
+	DECODE_KALMAN
+};
+
+// decoder = { ... } in po8e.rc
+struct DecoderSpec {
+	int		type;
+	int		nout;	// kinematic dimensions, up to DEC_MAXOUT
+	int		lags;	// wiener: lags per unit, of the binned frame's
+	int		units;	// decode at most this many, the busiest
+	double	ridge;	// on the diagonal at each refit
+	int		refit;	// training frames between refits; 0 never
+	DecoderSpec()
+	{
+		type = DECODE_NONE;
+		nout = 2;
+		lags = 5;
+		units = 128;
+		ridge = 1.0;
+		refit = 50;
+	}
+};
+
+const char *decodeName(int type);
+
+// Decodes kinematics from the binned rates, in process, once per binned
+// frame: a linear Wiener filter on the last few lags of each unit, or a
+// steady-state Kalman filter on lag 0 (the gain is iterated to its fixed
+// point at fit time, so a step is two small matrix-vector products).
+//
+// step() runs on the binned rate thread and only reads a Model that is
+// complete; it never waits on training, and never allocates or frees.
+// While the task supplies targets, step() also fills (features, target)
+// samples from a preallocated set and queues them, and train(), on a
+// thread of its own, accumulates them into normal equations (X'X and X'Y,
+// as algs/ get_weights() builds them with multATA / multATB), hands the
+// samples back, and solves by Cholesky every refit frames. The new model
+// is handed to step() whole, with its scratch sized, and the one it
+// replaces goes back to train() to be freed.
+//
+// Units are picked when training starts: the busiest ones (by a running
+// mean of lag 0), so the normal equations stay units x lags square
+// whatever the channel count.
+class Decoder
+{
+protected:
+	DecoderSpec		m_spec;
+	size_t			m_nunits;	// of the binned frame
+	size_t			m_nlags;
+	vec				m_rate;		// running mean lag 0 bin, per unit
+
+	struct Model {
+		uvec	units;		// into the frame
+		fmat	W;			// wiener: nout x (1 + units x lags)
+		fmat	M1;			// kalman: x = M1 x + M2 (z - zbar)
+		fmat	M2;
+		fvec	zbar;
+		fvec	xbar;
+		u64		samples;	// it was fit on
+		fvec	f;			// step()'s features, and kalman's f - zbar,
+		fvec	dz;			// sized by prepare()
+	};
+	unique_ptr<Model>	m_model;	// step()'s
+	unique_ptr<Model>	m_next;		// from train(), under m_mtx
+	unique_ptr<Model>	m_retired;	// to train(), likewise; empty when m_next isn't
+	mutex				m_mtx;
+	fvec			m_x;		// kalman state, less xbar
+	fvec			m_y;
+
+	// training. step() picks the units and queues samples; train() owns
+	// the sums. a sample that starts carries the units, and starts them over.
+	struct Sample {
+		bool	start;
+		uvec	units;
+		fvec	f;
+		fvec	y;
+		u64		frame;
+	};
+	vector<Sample>		m_pool;		// all the samples there are
+	WaitQueue<Sample *>	m_queue;	// step() to train()
+	WaitQueue<Sample *>	m_free;		// and back
+	uvec			m_trainUnits;	// step()'s
+	vector<u32>		m_order;	// pickUnits()'s
+	atomic<bool>	m_reset;	// pick the units again at the next target
+	atomic<u64>		m_dropped;	// samples train() was too far behind for
+	atomic<u64>		m_samples;	// trained on
+	atomic<u64>		m_fits;
+	uvec			m_tUnits;	// train()'s
+	mat				m_F;		// a batch of samples, a column each
+	mat				m_Y;
+	vector<u64>		m_frames;
+	size_t			m_nb;
+	mat				m_XtX;		// wiener
+	mat				m_XtY;
+	vec				m_Sx, m_Sz, m_S1, m_S2;	// kalman
+	mat				m_Sxx, m_Szx, m_Szz, m_S11, m_S21, m_S22;
+	double			m_n, m_nt;
+	u64				m_lastFrame, m_sinceFit;
+	vec				m_lastY;
+
+public:
+	Decoder(const DecoderSpec &spec, size_t nunits, size_t nlags,
+	        MatStor *ms);
+	~Decoder();
+
+	int type()
+	{
+		return m_spec.type;
+	}
+	size_t numOutputs()
+	{
+		return m_spec.nout;
+	}
+	// one binned frame (nunits x nlags, unit major, 1/128ths of a spike)
+	// into y (nout). false, and y zero, until there are weights. with a
+	// target to train on, queues the pair.
+	bool step(const u16 *bins, u64 frame, const DecodeTarget *target,
+	          float *y);
+	// the training thread: waits up to timeout seconds for step() to queue
+	// something, folds in what is there, and refits when due. true if it
+	// did anything.
+	bool train(double timeout);
+	void resetTraining();
+	void save(MatStor *ms);
+	string info();
+
+protected:
+	size_t numFeatures(size_t nunits);
+	void features(const uvec &units, const u16 *bins, fvec &f);
+	void prepare(Model *m);
+	void pickUnits();
+	void startTraining(const uvec &units);
+	void accumulate();
+	Model *fitWiener();
+	Model *fitKalman();
+	void load(MatStor *ms);
+};
+
+#endif
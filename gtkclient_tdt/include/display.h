@@ -0,0 +1,29 @@
+#ifndef __DISPLAY_H__
+#define __DISPLAY_H__
+
+#include <stddef.h>
+#include "util.h"
+
+// where the pipeline sends what gets drawn. the gui draws it into its vbos
+// (gtkclient); the daemon publishes it to shared memory (DisplayShm) for a
+// viewer to pick up. timeseries() and event() come from the worker, spike()
+// from every sorting thread at once.
+class DisplaySink
+{
+public:
+	virtual ~DisplaySink() {}
+
+	// ns samples of trace h (the channel in g_channel[h]), gain applied,
+	// 1 = 10 mV
+	virtual void timeseries(int h, float *x, size_t ns) = 0;
+
+	// a spike that passed the isi check. unit 0 is unsorted; wf is NWFSAMP
+	// samples, 1 = 10 mV
+	virtual void spike(int ch, int unit, u32 tk, long double time,
+	                   float *wf) = 0;
+
+	// a stim pulse on stim channel chan
+	virtual void event(int chan, long double time) = 0;
+};
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef __DISPLAY_SHM_H__
+#define __DISPLAY_SHM_H__
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "gtkclient.h"
+#include "display.h"
+#include "util.h"
+
+using namespace std;
+
+#define DSHM_NAME	"/gtkclient_display"	// under /dev/shm
+#define DSHM_MAGIC	0x6b746764				// 'dgtk'
+
+enum {
+	DSHM_VERSION = 2,
+	DSHM_TS_LEN = NSAMP,	// samples per trace lane; what the gui draws
+	DSHM_SPIKES = 8192,		// spike ring
+	DSHM_EVENTS = 4096,		// stim ring
+	DSHM_INFO = 2048,		// the daemon's status text
+};
+
+struct DisplaySpike {
+	i32		ch;
+	i32		unit;
+	u32		tk;
+	u32		pad;
+	double	time;			// the daemon's clock; see DisplayShm::timeOffset()
+	float	wf[NWFSAMP];
+};
+
+struct DisplayEvent {
+	i32		chan;
+	i32		pad;
+	double	time;
+};
+
+// one channel's sort settings, as SortChannel has them
+struct DisplayCtl {
+	float		threshold;
+	float		centering;
+	float		gain;
+	i32			enabled;
+	float		aperture[NSORT];
+	float		tmpl[NSORT][NWFSAMP];
+};
+
+// the daemon fills these in at start; after that the controlling viewer
+// writes. a writer claims seq from even to odd, so two never overlap.
+struct DisplayCtlSlot {
+	atomic<u32>	seq;
+	DisplayCtl	c;
+};
+
+class SortChannel;
+void ctlFromChannel(SortChannel *c, DisplayCtl &d);
+void ctlToChannel(const DisplayCtl &d, SortChannel *c);
+
+// the start of the segment; the control block, trace lanes, spike ring and
+// stim ring follow, in that order, then the spike ring's slot sequences.
+struct DisplayShmHeader {
+	u32			magic;
+	u32			version;
+	u32			nc;				// neural channels (DisplayCtl's)
+	u32			decim;			// trace samples per published sample
+	double		sr;				// of the published traces
+	double		startTime;		// the daemon's g_startTime
+	i32			pid;			// the daemon's
+	atomic<i32>	viewer;			// pid of the controlling viewer; 0 for none
+	atomic<i32>	channel[NFBUF];	// lane h carries this channel; the viewer sets it
+	atomic<u64>	tsHead[NFBUF];	// samples written per lane, ever
+	atomic<u64>	spkHead;
+	atomic<u64>	evHead;
+	atomic<u32>	infoSeq;		// odd while info is being written
+	char		info[DSHM_INFO];
+};
+
+// Decimated display streams in shared memory, so the pipeline can run in a
+// process (gtkclientd) with no gl, and a viewer (gtkclient --attach) can come
+// and go without touching it.
+//
+// The daemon writes the streams. Each ring has a head counting everything
+// ever written; a reader keeps its own cursors, and when it falls more than
+// a ring behind it skips to the oldest entry still there and counts an
+// overrun. An entry is only trusted if the head has not lapped it by the
+// time it has been copied out. The sorting threads share the spike ring:
+// each reserves its entry by bumping the head, and the entry's sequence
+// (2i+1 while entry i is written, 2i+2 after) tells a reader when it is
+// whole. The traces are peak-picked by decim (the sample of largest
+// magnitude in each group), so spikes survive.
+//
+// Any number of viewers can watch. The first to control() picks the
+// channels on the trace lanes and edits the sort settings; the daemon polls
+// for both, and the other viewers follow along. When it goes, the next to
+// ask takes over.
+class DisplayShm : public DisplaySink
+{
+protected:
+	string				m_name;
+	int					m_fd;
+	u8					*m_addr;
+	size_t				m_len;
+	bool				m_owner;	// created it: unlinks it on close()
+
+	DisplayShmHeader	*m_hdr;
+	DisplayCtlSlot		*m_ctl;
+	float				*m_ts;		// NFBUF x DSHM_TS_LEN
+	DisplaySpike		*m_spk;
+	DisplayEvent		*m_ev;
+	atomic<u64>			*m_spkSeq;	// per spike slot; see above
+	bool				m_control;	// we hold the lanes and settings
+
+	// writer
+	float				m_peak[NFBUF];	// largest |x| so far in this group
+	u32					m_count[NFBUF];	// samples so far in this group
+	u64					m_tsW[NFBUF];	// lane samples written
+	vector<u32>			m_ctlSeen;	// seq of the settings last applied
+
+	// reader
+	u64					m_tsCur[NFBUF];
+	u64					m_spkCur;
+	u64					m_evCur;
+	u64					m_overruns;
+
+public:
+	DisplayShm();
+	~DisplayShm();
+
+	// the daemon: a fresh segment for nc channels, traces at sr / decim
+	bool create(const char *name, size_t nc, double sr, u32 decim);
+	// the viewer: an existing one. starts at the current heads.
+	bool attach(const char *name);
+	void close();
+	bool isOpen()
+	{
+		return m_addr != NULL;
+	}
+
+	size_t numChannels();
+	double samplingRate();	// of the traces, after decimation
+	// add to the daemon's times to get the viewer's (both from gettime())
+	double timeOffset();
+	// is the daemon still there?
+	bool alive();
+
+	// DisplaySink, for the daemon
+	void timeseries(int h, float *x, size_t ns);
+	void spike(int ch, int unit, u32 tk, long double time, float *wf);
+	void event(int chan, long double time);
+	void setInfo(const string &s);
+
+	// the viewer: take the lanes and settings, if no live viewer has them.
+	// true if we have them (again).
+	bool control();
+	bool controlling()
+	{
+		return m_owner || m_control;
+	}
+
+	// the settings: the daemon writes them first, then only reads. ignored
+	// from a viewer not controlling.
+	void putCtl(int ch, const DisplayCtl &c);
+	bool getCtl(int ch, DisplayCtl &c);
+	// true once per change the viewer makes to channel ch
+	bool ctlChanged(int ch, DisplayCtl &c);
+
+	// lanes; subscribe() is ignored from a viewer not controlling
+	void subscribe(int h, int ch);
+	int subscribed(int h);
+
+	// the viewer. each returns what is new since the last call, up to max
+	size_t readTimeseries(int h, float *x, size_t max);
+	size_t readSpikes(DisplaySpike *s, size_t max);
+	size_t readEvents(DisplayEvent *e, size_t max);
+	string info();
+	u64 overruns()
+	{
+		return m_overruns;
+	}
+
+protected:
+	bool map(size_t len, bool create);
+	void layout();
+	static size_t size(size_t nc);
+};
+
+#endif
@@ -19,6 +19,14 @@ public:
 	Filter();
 	virtual ~Filter();
 	virtual void Proc(float *in, float *out, u32 kpoints);
+	const vector<double> &num() const
+	{
+		return B;
+	}
+	const vector<double> &den() const
+	{
+		return A;
+	}
 
 protected:
 };
@@ -0,0 +1,90 @@
+#ifndef __FILTERBANK_H__
+#define __FILTERBANK_H__
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include "util.h"
+#include "filter.h"
+#include "butter.h"
+
+using namespace std;
+
+// A cascade of DF2T sections run over every channel at once.
+//
+// Coefficients and delays are stored structure-of-arrays: for each section,
+// b[j] / a[j] / d[j] is a row of nchan doubles. proc() walks one sample of
+// all channels at a time, so the inner loop is a plain stride-1 loop over
+// channels that the compiler vectorizes (-O3 -march=native).
+// Math is in double, same as Filter::Proc, so results match it to float
+// rounding (Proc rounds its input and output through float).
+//
+// Coefficients can be changed from any thread while proc() runs. The
+// setters edit a staged copy; commit() hands it to proc(), which picks it
+// up between blocks with one atomic exchange. The filter thread never
+// takes a lock or frees memory: it leaves a commit pending until the bank
+// it last retired has been freed by commit(). Delays carry over when the
+// layout (number and order of sections) is unchanged.
+class FilterBank
+{
+protected:
+	struct Section {
+		int				order;
+		vector<double>	b;	// (order+1) rows of nchan
+		vector<double>	a;	// (order+1) rows of nchan; row 0 := 1
+		vector<double>	d;	// order rows of nchan
+	};
+	typedef vector<Section> Bank;
+
+	size_t				m_nchan;
+	Bank				*m_live;	// only touched by proc()
+	atomic<Bank *>		m_next;		// committed, not yet picked up
+	atomic<Bank *>		m_dead;		// retired by proc(), freed by commit()
+	atomic<bool>		m_picking;	// proc() is between taking and retiring
+	Bank				m_edit;		// staged by the setters
+	mutex				m_mtx;		// serializes the setters
+	atomic<u64>			m_swaps;
+
+public:
+	FilterBank(size_t nchan);
+	~FilterBank();
+
+	// replace the cascade with one section per Filter, same on all channels.
+	void setFilter(const Filter &f);
+	// replace the cascade with designed sections, same on all channels.
+	void setSOS(const vector<Biquad> &sos);
+	// append a pass-through section of given order; returns its index.
+	size_t addSection(int order);
+	// set one channel's coefficients of a section (b, a are order+1 long).
+	void setSection(size_t sec, size_t ch, const double *b, const double *a);
+	// headstage-style biquad {b0, b1, a1, a2}: b2 = b0 and the feedback
+	// terms are added, y = b0*x + b1*x1 + b0*x2 + a1*y1 + a2*y2.
+	// stage must be an order-2 section.
+	void setBiquad(size_t ch, size_t stage, const float *biquad);
+	// publish the staged coefficients. setFilter() and setSOS() commit
+	// on their own; addSection() and friends need an explicit commit.
+	void commit();
+
+	// filter in place. x is nchan x ns, column-major (armadillo mat),
+	// i.e. x[k*nchan + ch]. the float version still does its math in
+	// double; only the samples are float.
+	void proc(double *x, size_t ns);
+	void proc(float *x, size_t ns);
+
+	size_t channels()
+	{
+		return m_nchan;
+	}
+	u64 swaps()
+	{
+		return m_swaps;
+	}
+
+protected:
+	size_t newSection(Bank &bank, int order);
+	void set(Bank &bank, size_t sec, size_t ch, const double *b, const double *a);
+	void pickup();
+	template <class T> void procT(T *x, size_t ns);
+};
+
+#endif
@@ -40,6 +40,7 @@ enum MODES { // ui tabs
 
 typedef struct PO8Data {
 	i64 tick;	// this is the tick for the first sample
+	u64 t_read;	// latNow() when it came off the card
 	size_t numChannels;
 	size_t numSamples;
 	i16 *data;
@@ -1,4 +1,6 @@
+#include <condition_variable>
 #include "h5writer.h"
+#include "h5chunkpool.h"
 #include "readerwriterqueue.h"
 
 #ifndef __H5AnalogWriter_H__
@@ -7,18 +9,40 @@
 using namespace std;
 using namespace moodycamel;
 
+// get one with H5AnalogWriter::get(), hand it back with add().
 typedef struct AD {
 	size_t 	nc;		// num channels
 	size_t 	ns;		// num samples
 	i64 	*tk;	// the tick for the first sample
 	double 	*ts;	// the ts for the first sample
 	i16 	*data;	// the actual data samples
+	size_t	maxns;	// room in tk and ts
+	size_t	maxdata;	// room in data
 } AD;
 
 enum {
 	H5A_BUF_SIZE = 65536,
+	H5A_SLAB = 4096,		// samples per write; the chunk length in time
+	H5A_CHUNK_CH = 32,		// channels per chunk
+	H5A_GROW = 64,			// slabs to extend the datasets by at a time
+	H5A_POOL_SLABS = 2,		// packets preallocated: this many slabs' worth
 };
 
+// Packets are copied into a slab of nc x H5A_SLAB samples, and a slab goes
+// to disk in one write per dataset once it is full. Slabs line up with the
+// chunks (H5A_CHUNK_CH x H5A_SLAB), so every chunk is written exactly once
+// and whole. The extent grows H5A_GROW slabs at a time (chunks are only
+// allocated when written) and is trimmed to what was written at close().
+//
+// With direct chunk writes on (the default, if hdf5 has H5Dwrite_chunk),
+// the samples' pipeline (delta, shuffle, deflate / lz4 / zstd) runs on an
+// H5ChunkPool and the finished chunks go to hdf5 in order, skipping its
+// chunk cache and filter machinery. Without, hdf5 filters them inline.
+//
+// The writer thread sleeps in wait() until add() has queued a slab's worth.
+// Packets come from a pool: the writer hands each back over a second SPSC
+// queue once it is copied into the slab, so steady state never hits the
+// heap.
 class H5AnalogWriter : public H5Writer
 {
 protected:
@@ -26,25 +50,64 @@ protected:
 	hid_t 			m_h5Dtk;
 	hid_t 			m_h5Dts;
 	ReaderWriterQueue<AD *> *m_q; 	// the queue for data packets
+	ReaderWriterQueue<AD *> *m_free;	// and back, for get()
+	atomic<size_t>	m_allocs;		// packets allocated past the pool
 	size_t			m_nc;			// num channels
-	size_t  		m_ns;			// number of samples allocated to dataset
+	size_t  		m_ns;			// number of samples written
+	size_t			m_alloc;		// current extent of the datasets
+
+	vector<i16>		m_slab;			// nc x H5A_SLAB, as in the file
+	vector<i64>		m_slabTk;
+	vector<double>	m_slabTs;
+	size_t			m_fill;			// samples in the slab
+
+	bool			m_direct;		// write whole chunks ourselves
+	bool			m_useDirect;	// ... and this file's filters allow it
+	size_t			m_threads;		// encoder threads for the pool
+	H5ChunkPool		*m_pool;		// encodes the sample chunks
+	H5ChunkPool::CommitFn m_commit;	// -> commitChunk()
+	size_t			m_cc;			// channels per chunk
+
+	atomic<size_t>	m_pending;		// samples queued and not yet taken
+	mutex			m_wake;			// for the wakeup only
+	condition_variable m_cv;
+
+	// stats, for the label
+	size_t			m_slabs;
+	double			m_writeTime;	// total time in flushSlab() (s)
+	double			m_writeMax;		// longest one (s)
+	size_t			m_skipped;		// packets with the wrong channel count
 
 public:
 	H5AnalogWriter();
 	~H5AnalogWriter();
 
-	// start the writer. fn is filename
+	// start the writer. fn is filename; ns is the samples per packet
+	// add() will see, to size the pool (0 preallocates none)
 	using H5Writer::open;
-	bool open(const char *fn, size_t nc);
+	bool open(const char *fn, size_t nc, size_t ns = 0);
 
 	bool setMetaData(double sr, float *scale, char *name, int slen);
 
 	//flush and close log file
 	bool close();
 
-	// log an analog protobuf
+	// direct chunk writes; call before open()
+	void setDirect(bool direct);
+
+	// threads compressing chunks (0 = on the writer); call before open()
+	void setThreads(size_t n);
+
+	// a packet with room for nc x ns samples, from the pool. call from
+	// the producer, as add(); null unless writing
+	AD *get(size_t nc, size_t ns);
+
+	// log an analog packet; it goes back to the pool once written
 	bool add(AD *a);
 
+	// block until a slab's worth is queued, or timeout (s) passes
+	void wait(double timeout);
+
 	// write the buffer to disk
 	bool write();
 
@@ -53,12 +116,25 @@ public:
 
 	size_t bytes();
 
+	// packets allocated since open() because the pool ran dry, or was
+	// too small for the packet asked for
+	size_t allocs();
+
+	// adds queue depth and write latency to the label
+	string status();
+
 	const char *name()
 	{
-		return "H5 Analog Writer v1.2";
+		return "H5 Analog Writer v1.4";
 	};
 
 protected:
+	hid_t mkDataset(const char *dname, hid_t type, size_t nc, size_t cc);
+	void flushSlab();
+	bool writeChunks();
+	bool commitChunk(const hsize_t *offset, const void *buf, size_t size);
+	AD *newAD(size_t nc, size_t ns);
+	void freeAD(AD *o);
 };
 
 #endif
@@ -0,0 +1,82 @@
+#ifndef __H5CHUNKPOOL_H__
+#define	__H5CHUNKPOOL_H__
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "hdf5.h"
+#include "h5filters.h"
+
+using namespace std;
+
+// Encodes chunks on a set of threads and hands them back in submit order.
+//
+// One writer thread calls submit() and flush(); it alone commits, so chunks
+// land in the file in order. Up to depth chunks are in flight: submit()
+// commits whatever has finished at the head, and blocks on the head only
+// when the ring is full. With no threads the chunk is encoded and committed
+// inline.
+class H5ChunkPool
+{
+public:
+	// write one encoded chunk at offset; false on error
+	typedef function<bool(const hsize_t *offset, const void *buf, size_t size)> CommitFn;
+
+protected:
+	struct Job {
+		vector<unsigned char>	raw;
+		H5ChunkCodec			codec;
+		hsize_t					offset[2];
+		const unsigned char		*out;	// into codec's scratch; NULL on error
+		size_t					size;
+		bool					done;	// under m_mtx
+	};
+	vector<Job *>		m_jobs;		// ring
+	size_t				m_head;		// next to commit
+	size_t				m_next;		// next to encode
+	size_t				m_tail;		// next to fill
+	vector<thread>		m_threads;
+	mutex				m_mtx;
+	condition_variable	m_work;		// for the encoders
+	condition_variable	m_done;		// for the writer
+	bool				m_die;
+	size_t				m_errors;	// chunks that failed to encode or commit
+
+	// stats, under m_mtx
+	double				m_raw;		// bytes in
+	double				m_packed;	// bytes out
+	double				m_busy;		// encoder time, summed over threads (s)
+
+public:
+	H5ChunkPool(size_t nthreads, size_t depth);
+	~H5ChunkPool();
+
+	// read the filters off dset; call while nothing is in flight.
+	// false if we can't run its pipeline ourselves.
+	bool setPipeline(hid_t dset);
+
+	// copy len bytes in, zero-padded to padlen, to be encoded and written
+	// at offset. false if a chunk failed since the last call.
+	bool submit(const hsize_t *offset, const void *raw, size_t len,
+	            size_t padlen, CommitFn fn);
+
+	// wait for and commit everything in flight
+	bool flush(CommitFn fn);
+
+	size_t numThreads();
+	size_t inFlight();
+	size_t errors();
+
+	// since the pool was made
+	double ratio();		// raw / packed
+	double rate();		// MB/s per encoder thread
+
+protected:
+	void run();
+	void encode(Job *j);
+	bool commitDone(CommitFn &fn, bool wait);
+};
+
+#endif
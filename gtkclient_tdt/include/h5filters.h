@@ -0,0 +1,65 @@
+#ifndef __H5FILTERS_H__
+#define	__H5FILTERS_H__
+
+#include <vector>
+#include "hdf5.h"
+
+using namespace std;
+
+// Codecs for the chunked datasets. LZ4 and zstd use the registered ids of
+// the standard hdf5 plugins (hdf5plugin, h5py, matlab with HDF5_PLUGIN_PATH)
+// and produce the same bytes, so any reader with the plugins can open the
+// files. They are only compiled in with make LZ4=true / ZSTD=true.
+enum {
+	H5C_NONE = 0,
+	H5C_DEFLATE,
+	H5C_LZ4,
+	H5C_ZSTD,
+	H5C_NUM
+};
+
+#define H5Z_FILTER_LZ4		32004
+#define H5Z_FILTER_ZSTD		32015
+// int16 delta + zigzag along time, so the shuffled high bytes are mostly
+// zero and the codec packs them away. not a registered id (32768+ is for
+// private use): readers need h5filtersRegister(), or the data back as is.
+#define H5Z_FILTER_DELTA16	32768
+
+const char *h5codecName(int codec);
+
+// compiled in, and usable for writing
+bool h5codecAvail(int codec);
+
+// register the filters we implement with hdf5 (once; safe to call again).
+// plugins that are already available are left alone.
+void h5filtersRegister();
+
+// set codec on a dataset creation property list
+bool h5codecSet(hid_t prop, int codec, int level);
+
+// Runs one chunk through a dataset's filter pipeline, the way hdf5 would on
+// write, for H5Dwrite_chunk. The scratch is kept between chunks.
+class H5ChunkCodec
+{
+protected:
+	vector<H5Z_filter_t>	m_filters;	// in pipeline order
+	int						m_level;	// deflate / zstd level
+	size_t					m_rowlen;	// elements per row, for delta
+	vector<unsigned char>	m_a;		// ping
+	vector<unsigned char>	m_b;		// pong
+
+public:
+	H5ChunkCodec();
+
+	// read the pipeline off a dataset. false if it has a filter we can't run
+	bool setPipeline(hid_t dset);
+
+	// len bytes of int16 in; returns the encoded chunk (valid until the
+	// next call) and its size, or NULL.
+	const unsigned char *encode(const void *in, size_t len, size_t *size);
+
+	// codec at the end of the pipeline, for the label
+	int codec();
+};
+
+#endif
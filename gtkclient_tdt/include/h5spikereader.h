@@ -0,0 +1,91 @@
+#ifndef __H5SPIKEREADER_H__
+#define	__H5SPIKEREADER_H__
+
+#include <vector>
+#include <map>
+#include <utility>
+#include "hdf5.h"
+#include "util.h"
+
+using namespace std;
+
+enum {
+	H5R_CACHE = 32*1024*1024,	// chunk cache per table column, bytes
+	H5R_BLOCK = 65536,			// rows per read when scanning the table
+};
+
+// one unit's spikes. wf has nwf samples per spike, spike after spike.
+struct SpikeUnit {
+	vector<i64>		tk;
+	vector<double>	ts;
+	vector<float>	wf;
+};
+
+// reads spike files written by H5SpikeWriter, either layout.
+//
+// for the table layout the index is read once at open(); read() then
+// selects just that unit's runs of rows, so the cost follows the size of
+// the unit, not of the file. channels are 1-indexed, unit 0 is unsorted.
+class H5SpikeReader
+{
+protected:
+	hid_t			m_h5file;
+	bool			m_table;		// table layout, else groups
+	size_t			m_nc;			// num channels
+	size_t			m_nu;			// num units (not including unsorted)
+	size_t			m_nwf;			// samples per waveform
+	double			m_sr;			// sampling rate, 0 if not set
+	map<pair<int, int>, vector<pair<hsize_t, hsize_t> > > m_runs; // (first, count)
+	hid_t			m_Dtk, m_Dts, m_Dch, m_Dun, m_Dwf;	// table columns
+	size_t			m_rows;			// rows in the table
+
+public:
+	H5SpikeReader();
+	~H5SpikeReader();
+
+	bool open(const char *fn);
+	void close();
+
+	bool isTable()
+	{
+		return m_table;
+	}
+	size_t channels()
+	{
+		return m_nc;
+	}
+	size_t units()
+	{
+		return m_nu;
+	}
+	size_t nwf()
+	{
+		return m_nwf;
+	}
+	double samplingRate()
+	{
+		return m_sr;
+	}
+
+	// number of spikes of (ch,un)
+	size_t count(int ch, int un);
+
+	// all spikes of (ch,un), in time order. wf gets nwf() samples per
+	// spike, spike after spike (zeros where none were saved).
+	bool read(int ch, int un, vector<i64> &tk, vector<double> &ts,
+	          vector<float> &wf);
+
+	// every unit, indexed (ch-1)*(units()+1)+un. a table is read front to
+	// back once, which beats read() on each unit when you want them all.
+	bool readAll(vector<SpikeUnit> &all);
+
+protected:
+	bool attr(const char *name, i64 &v);
+	hid_t column(const char *name);
+	bool readTable(int ch, int un, vector<i64> &tk, vector<double> &ts,
+	               vector<float> &wf);
+	bool readGroups(int ch, int un, vector<i64> &tk, vector<double> &ts,
+	                vector<float> &wf);
+};
+
+#endif
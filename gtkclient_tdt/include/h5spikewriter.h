@@ -2,6 +2,7 @@
 #include <map>
 #include "h5writer.h"
 #include "readerwriterqueue.h"
+#include "waitqueue.h"
 
 #ifndef __H5SpikeWriter_H__
 #define	__H5SpikeWriter_H__
@@ -9,17 +10,44 @@
 using namespace std;
 using namespace moodycamel;
 
+// get one with H5SpikeWriter::get(), hand it back with add().
+// wf always has room for the writer's nwf samples.
 typedef struct SPIKE {
 	i16		ch;		// channel (1-indexed), only 32767 channels okay? :)
 	i16		un;		// unit (0=unsorted, 1=a, 2=b, 3=c, etc)
 	i64		tk; 	// tdt tick of the spike, aligned to the start of the wf
 	double 	ts; 	// the timesamp of spike, aligned to the start of the wf
-	size_t	nwf;	// number of waveform samples
+	size_t	nwf;	// number of waveform samples (0 or the writer's nwf)
 	float	*wf;	// the waveform
 } SPIKE;
 
 enum {
-	H5S_BUF_SIZE = 65536,
+	H5S_BUF_SIZE = 65536,	// queue slots, over all lanes
+	H5S_POOL_SIZE = 8192,	// preallocated SPIKEs, over all lanes
+	H5S_UNIT_BUF = 128,		// spikes buffered per (ch,un) before a flush
+	H5S_CHUNK = 512,		// chunk length of the tick/timestamp datasets
+	H5S_WF_CHUNK = 128,		// waveforms per chunk
+	H5S_TABLE_BUF = 4096,	// spikes buffered before a table flush
+	H5S_TABLE_CHUNK = 1024,	// rows per chunk of the table columns
+	H5S_TABLE_WF_CHUNK = 64,	// rows per chunk of the table waveforms
+	H5S_INDEX_CHUNK = 1024,	// rows per chunk of the index
+	H5S_WAKE = 1024,		// spikes queued before the writer is woken
+};
+
+// on-disk layout of the spikes.
+//
+// groups: /Spikes/ChanN/UnitM/{Ticks,Timestamps,Waveforms}, one set of
+// datasets per (ch,un).
+//
+// table: every spike is a row of /Spikes/{Ticks,Timestamps,Channel,Unit}
+// and /Spikes/Waveforms (rows x nwf). rows are appended in blocks; within
+// a block they are grouped by (ch,un), so each unit's spikes in a block
+// are one contiguous run. /Spikes/Index (runs x 4: ch, un, first row,
+// count) lists those runs in order, which is all a reader needs to pull
+// one unit without touching the rest. see H5SpikeReader.
+enum H5S_LAYOUT {
+	H5S_LAYOUT_GROUPS = 0,
+	H5S_LAYOUT_TABLE
 };
 
 class H5SpikeWriter : public H5Writer
@@ -33,7 +61,50 @@ protected:
 	map<pair<i16, i16>, hid_t> m_h5Dts;	// holds a ts dataset for each (ch,un)
 	map<pair<i16, i16>, hid_t> m_h5Dwf;	// holds a wf dataset for each (ch,un)
 	map<pair<i16, i16>, size_t> m_ns;	// num samples written for each (ch,un)
-	ReaderWriterQueue<SPIKE *> *m_q; 	// the queue for data packets
+	vector<ReaderWriterQueue<SPIKE *> *> m_q; 	// one queue per producer lane
+	vector<ReaderWriterQueue<SPIKE *> *> m_free; // recycled spikes, per lane
+	size_t			m_nlanes;		// number of producer lanes
+	atomic<size_t>	m_queued;		// over all lanes, for wait()
+	Wakeup			m_wake;
+
+	// spikes waiting to be written, one columnar buffer per (ch,un),
+	// indexed (ch-1)*(nu+1)+un. flushed when full or old.
+	struct UnitBuf {
+		vector<i64>		tk;
+		vector<double>	ts;
+		vector<float>	wf;		// nwf rows of H5S_UNIT_BUF, as in the file
+		size_t			n;		// spikes buffered
+		bool			haswf;	// any of them came with a waveform
+		double			t0;		// when the first one was buffered
+	};
+	vector<UnitBuf>	m_buf;
+	double			m_maxAge;		// seconds a spike may sit in m_buf
+
+	int				m_layout;		// H5S_LAYOUT
+	// table layout: columns, and spikes waiting for them
+	hid_t			m_h5Ttk, m_h5Tts, m_h5Tch, m_h5Tun, m_h5Twf, m_h5Tix;
+	struct TableBuf {
+		vector<i64>		tk;
+		vector<double>	ts;
+		vector<i16>		ch;
+		vector<i16>		un;
+		vector<float>	wf;		// nwf per spike, as in the file
+		size_t			n;
+		double			t0;
+	};
+	TableBuf		m_tab;
+	TableBuf		m_sorted;		// m_tab grouped by (ch,un)
+	vector<size_t>	m_first;		// counting sort scratch, per (ch,un)
+	vector<i64>		m_runs;			// index rows of a flush
+	size_t			m_rows;			// rows in the table
+	size_t			m_nruns;		// rows in the index
+
+	// stats, for sizing
+	atomic<size_t>	m_allocs;		// SPIKEs allocated past the pool
+	size_t			m_maxDepth;		// deepest the queues got
+	size_t			m_flushes;		// dataset appends
+	double			m_flushTime;	// total time in them (s)
+	double			m_flushMax;		// longest one (s)
 
 public:
 	H5SpikeWriter();
@@ -48,8 +119,20 @@ public:
 
 	bool setMetaData(double sr, char *name, int slen);
 
-	// log an analog protobuf
-	bool add(SPIKE *s);
+	// number of producer threads (lanes). call before open().
+	void setLanes(size_t n);
+
+	// H5S_LAYOUT of the next file. call before open().
+	void setLayout(int layout);
+
+	// a spike to fill in, from lane's pool. nullptr if not enabled.
+	SPIKE *get(size_t lane = 0);
+
+	// queue a spike. each lane must only be fed by one thread at a time
+	bool add(SPIKE *s, size_t lane = 0);
+
+	// the writer thread: until H5S_WAKE spikes are queued, or timeout (s)
+	void wait(double timeout);
 
 	// write the buffer to disk
 	bool write();
@@ -59,12 +142,29 @@ public:
 
 	size_t bytes();
 
+	// SPIKEs allocated since open() because a lane's pool ran dry
+	size_t allocs();
+
+	// adds queue depth and flush latency to the label
+	string status();
+
 	const char *name()
 	{
-		return "H5 Spike Writer v1.2";
+		return "H5 Spike Writer v1.4";
 	};
 
 protected:
+	bool openGroups(size_t nc, size_t nu, size_t nwf);
+	bool openTable(size_t nwf);
+	hid_t mkColumn(const char *name, hid_t type, size_t cols, size_t chunk);
+	void append(hid_t dset, hid_t type, size_t n0, size_t n, size_t cols,
+	            const void *buf);
+	void pushTable(const SPIKE *s, double now);
+	void flush(size_t i);
+	void flushTable();
+	void setAttr(const char *name, i64 v);
+	SPIKE *newSpike();
+	void freeSpikes(ReaderWriterQueue<SPIKE *> *q);
 };
 
 #endif
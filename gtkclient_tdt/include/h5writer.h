@@ -1,10 +1,10 @@
 /* H5Writer.h - inspired by protobuflogger.h, by zheng */
-#include <gtk/gtk.h>
 #include <string>
 #include <vector>
 #include <atomic>
 #include <mutex>
 #include "hdf5.h"
+#include "h5filters.h"
 
 #ifndef __H5WRITER_H__
 #define	__H5WRITER_H__
@@ -23,10 +23,12 @@ protected:
 	vector<hid_t>	m_h5dataspaces;	// [ containers for the datapsaces
 	vector<hid_t> 	m_h5props;		// [ and the chunk properties
 	mutex 			m_mtx;			// so we dont disable while writing
-	GtkWidget 		*m_w;			// for drawing to the gui
 	bool			m_deflate;		// should we compress?
 	int 			m_deflate_level; // 0 [uncompressed]- 9 [max compressed]
 	bool 			m_shuffle;		// makes compression more efficient
+	int				m_codec;		// H5C_*, for compressDataset()
+	int				m_codec_level;	// deflate 0-9, zstd 1-22, lz4 ignores
+	bool			m_delta;		// delta pre-filter on int16 samples
 
 public:
 	H5Writer();
@@ -55,16 +57,26 @@ public:
 	// returns the name of the file we are writing to
 	virtual string filename();
 
-	virtual void registerWidget(GtkWidget *w);
-
-	virtual void draw();
+	// one line for the gui (or a log); empty when not writing
+	virtual string status();
 
 	virtual void setUUID(char *uuid_str);
 
+	// compression of the datasets; call before open()
+	void setDeflate(bool deflate, int level);
+
+	// codec for writers that use compressDataset(); call before open().
+	// falls back to deflate if the codec is not compiled in.
+	void setCodec(int codec, int level);
+	void setDelta(bool delta);
+	int codec();
+
 	virtual const char *name() = 0;
 protected:
 	void shuffleDataset(hid_t prop);
 	void deflateDataset(hid_t prop);
+	// the whole pipeline: delta (if samples), shuffle, codec
+	void compressDataset(hid_t prop, bool samples, size_t rowlen);
 };
 
 #endif
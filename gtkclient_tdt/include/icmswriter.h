@@ -1,7 +1,9 @@
 #include <iostream>
 #include <fstream>
 #include <atomic>
+#include <vector>
 #include "readerwriterqueue.h"
+#include "waitqueue.h"
 #include "datawriter.h"
 #include "icms.pb.h"
 
@@ -15,13 +17,21 @@ using namespace moodycamel;
 
 enum {
 	ICMS_BUF_SIZE 	= 65536,
+	ICMS_POOL_SIZE	= 256,	// preallocated messages
 	ICMS_MAGIC 		= 0xdeadbabe
 };
 
+// Messages come from a pool: the writer clears each one it has written
+// and hands it back, and a cleared message keeps its artifacts' storage,
+// so once each has been filled the steady state never hits the heap.
 class ICMSWriter : public DataWriter
 {
 protected:
 	ReaderWriterQueue<ICMS *> *m_q; // the protobuf(fer)
+	ReaderWriterQueue<ICMS *> *m_free;	// written and cleared, for get()
+	atomic<size_t> m_allocs;	// messages allocated past the pool
+	vector<char> m_buf;			// one serialized record; only grows
+	Wakeup m_wake;
 
 public:
 	ICMSWriter();
@@ -32,15 +42,25 @@ public:
 	//flush and close log file
 	bool close();
 
-	// log an icms protobuf
+	// an empty message to fill in, from the pool. call from the producer,
+	// as add(); null unless writing
+	ICMS *get();
+
+	// log an icms protobuf; it goes back to the pool once written
 	bool add(ICMS *a);
 
+	// the writer thread: until something is added, or timeout (s)
+	void wait(double timeout);
+
 	// write the buffer to disk
 	bool write();
 
 	// returns the number of objects in the queue
 	size_t capacity();
 
+	// messages allocated since open() because the pool ran dry
+	size_t allocs();
+
 	const char *name()
 	{
 		return "ICMS Writer v3";
@@ -0,0 +1,109 @@
+#ifndef __LATENCY_H__
+#define	__LATENCY_H__
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <time.h>
+#include "util.h"
+
+using namespace std;
+
+// log-linear buckets: values under LAT_SUB ns are exact, above that each
+// power of two is split into LAT_SUB linear buckets (~3% wide). tops out
+// at 2^LAT_MAXEXP ns, about 18 minutes.
+#define LAT_SUBBITS	5
+#define LAT_SUB		(1 << LAT_SUBBITS)
+#define LAT_MAXEXP	40
+#define LAT_BUCKETS	((LAT_MAXEXP - LAT_SUBBITS + 2) * LAT_SUB)
+
+// the stages we time. names in latencyName().
+enum {
+	LAT_READ,			// po8e readBlock()
+	LAT_QUEUE,			// block from read to the worker
+	LAT_ARTIFACT,		// artifact chain and stim artifacts
+	LAT_FILTER,			// filter banks
+	LAT_SORT,			// dispatch to shard sorted
+	LAT_SPIKE_ENQ,		// one spike into the writer queue
+	LAT_WRITE_SPIKES,	// writer passes that wrote something
+	LAT_WRITE_ICMS,
+	LAT_WRITE_PRE,		// analog, prefilter
+	LAT_WRITE_POST,		// analog, postfilter
+	LAT_TICK_TO_SPIKE,	// spike's sample tick to its delivery
+	LAT_BINNED,			// one binned rate frame, all units
+	LAT_DECODE,			// decoder step and its shm frame
+	LAT_NUM
+};
+
+const char *latencyName(int stage);
+
+// ns on a cheap monotonic clock; only differences mean anything
+static inline u64 latNow()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (u64)t.tv_sec*1000000000ull + t.tv_nsec;
+}
+
+// counts at one moment; subtract two for an interval
+struct LatencySnap {
+	vector<u64>	n;		// per bucket
+	u64			count;
+
+	LatencySnap();
+	LatencySnap operator-(const LatencySnap &o) const;
+	// seconds; the bucket's upper edge, so never flattering
+	double percentile(double p) const;
+	double max() const;
+};
+
+// HDR-style latency histogram. add() is a relaxed atomic increment, so
+// any number of threads may record at once; snapshot() may be torn by a
+// count or two, never by more.
+class LatencyHist
+{
+protected:
+	atomic<u64>	m_n[LAT_BUCKETS];
+
+public:
+	LatencyHist();
+	void add(u64 ns);
+	void since(u64 t0)
+	{
+		add(latNow() - t0);
+	}
+	void addSeconds(double s)
+	{
+		add(s > 0 ? (u64)(s*1e9) : 0);
+	}
+	void snapshot(LatencySnap &s);
+
+	static size_t bucket(u64 ns);
+	static u64 upper(size_t b);	// largest ns in bucket b
+};
+
+// Turns the histograms into a table of p50/p99/p99.9/max, over the last
+// interval and since start. update() is called periodically from one
+// thread; it also rewrites the dump file, if set, atomically.
+class LatencyMonitor
+{
+protected:
+	LatencyHist			*m_h;
+	size_t				m_n;
+	vector<LatencySnap>	m_last;
+	u64					m_lastTime;
+	mutex				m_mtx;		// m_table, m_file
+	string				m_table;
+	string				m_file;
+
+public:
+	LatencyMonitor(LatencyHist *h, size_t n);
+	void setFile(const char *fn);	// "" for none
+	void update();
+	string table();
+	// since start
+	void snapshot(vector<LatencySnap> &s);
+};
+
+#endif
@@ -3,32 +3,100 @@
 
 #include <atomic>
 #include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
 #include <armadillo>
+#include "util.h"
 
 using namespace arma;
+using namespace std;
 
 class MatStor;
 
+enum {
+	NLMS_BLOCK = 32,	// samples per update in block mode (the gui's)
+};
+
+// Predicts each channel from all the others, and learns the weights with
+// normalized LMS.
+//
+// Channel i only ever touches column i of W, so train() splits the channels
+// into contiguous ranges, one per thread, that run the whole batch without
+// talking to each other. The per-sample input norms are computed once per
+// batch; channel i's norm leaves out its own sample.
+//
+// With a block size, the weights are held for block samples at a time and
+// the update becomes two GEMMs per range (block NLMS): E = X - W'X and
+// W += mu X (E ./ N)'. Same fixed point, far fewer passes over W.
+//
+// The online side works in float: each train() publishes a float copy of
+// W', and subtract() takes the prediction out of the caller's block in
+// place with that.
 class ArtifactNLMS2
 {
 protected:
 	size_t n;		// order of the filter
 	double mu;		// learning rate. a small number try 1e-5
 
-	mat W;			// weights (n by n)
+	mat W;			// weights (n by n); column i predicts channel i
+
+	atomic<size_t>	m_block;	// 0: update every sample; else block NLMS
+
+	struct Lane {
+		size_t	a, b;	// channels [a, b)
+		mat		E;		// errors, (b-a) x block
+		mat		G;		// normalized errors
+	};
+	vector<Lane>	m_lanes;
+	vector<thread>	m_threads;
+	mutex			m_mtx;
+	condition_variable m_go;
+	condition_variable m_done;
+	u64				m_gen;		// bumped per train() (under m_mtx)
+	size_t			m_running;	// lanes still training
+	bool			m_die;
+
+	// the batch being trained, for the lanes
+	const mat		*m_X;
+	vec				m_nrm;		// ||x(k)||^2
+	size_t			m_trainBlock;
+	double			m_trainMu;
+
+	// what subtract() applies, W' in float
+	mutex			m_pmtx;
+	fmat			m_P;
+	u64				m_version;	// bumped per publish (under m_pmtx)
 
 public:
 
-	ArtifactNLMS2(int _n, MatStor *ms);
+	// nthreads 0 trains on the caller
+	ArtifactNLMS2(int _n, MatStor *ms, size_t nthreads = 0);
 	~ArtifactNLMS2();
 
 	void setMu(float _mu);
 	float getMu();
-	void train(mat X);
-	mat filter(mat X);
+	void setBlock(size_t block);
+	size_t getBlock();
+	size_t numThreads();
+	// X is n x t; trains on all of it, in order
+	void train(const mat &X);
+	mat filter(const mat &X);
+	// x -= W'x in place. x is n x ns, column-major; y is the caller's
+	// scratch, same size.
+	void subtract(float *x, float *y, size_t ns);
+	// the float W' subtract() uses, and how many times it has changed
+	void predictor(fmat &P);
+	u64 version();
 	void clearWeights();
 	void save(MatStor *ms);
+
+protected:
+	void run(size_t id);
+	void trainLane(Lane &l);
+	void trainSamples(Lane &l);
+	void trainBlocks(Lane &l);
+	void publish();
 };
 
 #endif
-
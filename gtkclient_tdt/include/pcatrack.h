@@ -0,0 +1,145 @@
+#ifndef __PCATRACK_H__
+#define __PCATRACK_H__
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "util.h"
+#include "waitqueue.h"
+
+using namespace std;
+
+enum {
+	PCA_K = 2,		// components, as drawn
+	PCA_MAXD = 96,	// waveform samples, at most (NWFSAMP at 48k)
+};
+
+// a channel's principal components as published: pc[k] is the k'th
+// eigenvector over the sqrt of its eigenvalue, scl[k] that sqrt, as
+// SortChannel keeps them.
+struct PcaBasis {
+	u32		version;	// bumped per publish; 0 for none
+	u32		n;			// waveforms the fit saw; 0 for a seed
+	float	scl[PCA_K];
+	float	pc[PCA_K][PCA_MAXD] __attribute__((aligned(32)));
+};
+
+// wf . pc[0], wf . pc[1] over d samples: eight lanes of partial sums, so
+// the compiler makes it a vector loop without reassociating anything.
+static inline void pcaProject(const PcaBasis &b, const float *wf, int d,
+                              float *out)
+{
+	float a0[8] = {0}, a1[8] = {0};
+	int j = 0;
+	for (; j+8 <= d; j+=8) {
+		for (int l=0; l<8; l++) {
+			a0[l] += b.pc[0][j+l] * wf[j+l];
+			a1[l] += b.pc[1][j+l] * wf[j+l];
+		}
+	}
+	float s0 = 0.f, s1 = 0.f;
+	for (int l=0; l<8; l++) {
+		s0 += a0[l];
+		s1 += a1[l];
+	}
+	for (; j<d; j++) {
+		s0 += b.pc[0][j] * wf[j];
+		s1 += b.pc[1][j] * wf[j];
+	}
+	out[0] = s0;
+	out[1] = s1;
+}
+
+// Streaming PCA of one channel's spike waveforms. The PcaEngine thread
+// folds each new waveform from the channel's ring (VboPca::m_wf, rows < m_w
+// complete) into an exponentially weighted mean and covariance, and every
+// so often refits the top two eigenvectors by subspace iteration, warm
+// started from the last fit. A fit is published -- seqlocked, versioned --
+// when it has moved off the published basis, or when asked for.
+class PcaTracker
+{
+protected:
+	int					m_ch;
+	int					m_d;
+	const float			*m_ring;	// rows x d
+	int					m_rows;
+	const std::atomic<int>	*m_w;	// rows written (until a vbo reset)
+	int					m_seen;
+
+	// the engine's
+	u64					m_n;		// waveforms folded in since a reset
+	vector<double>		m_mean;
+	vector<double>		m_cov;		// d x d, upper triangle kept
+	vector<double>		m_v;		// PCA_K x d, orthonormal
+	double				m_lambda[PCA_K];
+	bool				m_fitted;	// m_v is from the data
+	u64					m_solvedN;
+	double				m_solvedAt;
+
+	std::atomic<u32>	m_seq;		// odd while m_pub is written
+	PcaBasis			m_pub;
+	std::atomic<u32>	m_version;	// m_pub's, once it is out
+	std::atomic<bool>	m_resetReq;
+	std::atomic<bool>	m_publishReq;
+	Wakeup				*m_kick;	// the engine's, for requests
+
+	void publish(u32 n);
+	void iterate(int iters);
+	bool moved();
+
+public:
+	PcaTracker(int ch, int d, const float *ring, int rows,
+	           const std::atomic<int> *w);
+
+	// any thread
+	// the published basis, if newer than b's; false if b is current
+	bool latest(PcaBasis &b) const;
+	u32 version() const
+	{
+		return m_version.load(std::memory_order_acquire);
+	}
+	// the waveforms stored so far no longer count (threshold, gain)
+	void reset();
+	// publish the next fit, whatever it is
+	void request();
+
+	// before the engine starts: the basis to begin with, PCA_K x d, as
+	// SortChannel's m_pca and m_pcaScl
+	void seed(const float *pc, const float *scl);
+	void setKick(Wakeup *w)
+	{
+		m_kick = w;
+	}
+
+	// the engine's: fold in new waveforms, how many
+	int pull();
+	// refit if due; true if it published
+	bool solve(double now);
+};
+
+// the thread that runs every channel's tracker, in one pass per period
+class PcaEngine
+{
+protected:
+	vector<PcaTracker *>	m_tracks;
+	std::thread				m_thread;
+	std::atomic<bool>		m_die;
+	Wakeup					m_wake;
+	double					m_period;	// seconds between passes
+	std::atomic<u64>		m_passes;
+	std::atomic<u64>		m_published;
+	std::atomic<double>		m_passTime;	// seconds, smoothed
+
+	void run();
+
+public:
+	PcaEngine(double period = 0.05);
+	~PcaEngine();
+	// before start()
+	void add(PcaTracker *t);
+	void start();
+	void stop();
+	string getInfo();
+};
+
+#endif
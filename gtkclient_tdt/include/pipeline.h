@@ -0,0 +1,199 @@
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <string.h>
+#include <stdlib.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <armadillo>
+
+#include "readerwriterqueue.h"
+#include "waitqueue.h"
+#include "gtkclient.h"
+#include "util.h"
+#include "po8e.pb.h"
+#include "butter.h"
+#include "latency.h"
+#include "timesync.h"
+#include "h5spikewriter.h"
+#include "h5analogwriter.h"
+#include "icmswriter.h"
+
+using namespace std;
+using namespace arma;
+using namespace moodycamel;
+
+// The signal chain, from the po8e cards (or a replay) to the sorters, the
+// writers and the binned rates: everything gtkclient did that needs no
+// display. gtkclient runs it in process and draws what comes out of
+// g_display; gtkclientd runs it with no gl at all and publishes to shared
+// memory instead.
+//
+// The settings are globals, as they always were, so the gui's widgets can
+// point straight at them. The flags are int (gboolean) for mk_checkbox().
+
+class MatStor;
+class po8eConf;
+class FiringRate;
+class FilterBank;
+class SortChannel;
+class ArtifactTemplate;
+class ArtifactEngine;
+class ArtifactFilter;
+class ArtifactNLMS2;
+class ArtifactChain;
+class ReplaySource;
+class PO8DataPool;
+class SortPool;
+class DisplaySink;
+class Decoder;
+
+enum SAVE {
+	SAVE_SINGLE = 0,
+	SAVE_ENABLED,
+	SAVE_ALL
+};
+
+enum {
+	NLMS_POOL = 256,	// nlms training blocks preallocated, ~2 batches
+};
+
+enum ALIGN {
+	ALIGN_CROSSING = 0,
+	ALIGN_MIN,
+	ALIGN_MAX,
+	ALIGN_ABS,
+	ALIGN_SLOPE,
+	ALIGN_NEO
+};
+
+extern bool g_die;
+extern double g_sr;	// from po8e.rc
+extern double g_binRate;	// binned rate frames per second, 0 for none
+extern Decoder *g_decoder;	// null with no decoder
+extern TimeSync g_ts;	// keeps track of ticks (TDT time)
+
+// the sources
+extern std::mutex g_po8e_mutex;
+typedef WaitQueue<PO8Data *> PO8Queue;	// po8e (or replay) to the worker
+extern vector <pair<PO8Queue *, po8e::card *>> g_dataqueues;
+extern vector <PO8DataPool *> g_datapools; // parallel to g_dataqueues
+extern size_t g_po8e_read_size;
+extern std::atomic<bool> g_replayDone;
+extern long double g_po8eAvgInterval;
+
+// the channels; the gui's Channels are these same objects
+extern vector <SortChannel *> g_sc;
+extern vector <FiringRate *> g_fr;
+extern vector <ArtifactTemplate *> g_templates;
+extern vector<int> g_channel;	// on the traces (and jack), NFBUF of them
+extern DisplaySink *g_display;	// null draws nothing
+
+extern SortPool *g_sortpool;
+extern LatencyHist g_latency[LAT_NUM];	// see latency.h for the stages
+extern LatencyMonitor g_latmon;
+extern std::atomic<u64> g_workerAllocs; // worker scratch and nlms block allocations
+
+// writers
+extern H5SpikeWriter g_spikewriter;
+extern H5AnalogWriter g_analogwriter_postfilter;
+extern H5AnalogWriter g_analogwriter_prefilter;
+extern ICMSWriter g_icmswriter;
+extern int g_saveUnsorted;
+extern int g_saveSpikeWF;
+extern int g_spikeLayout;	// or one table, see h5spikewriter.h
+extern int g_analogCodec;	// see h5filters.h
+extern int g_analogDelta;
+extern int g_saveICMSWF;
+extern int g_whichAnalogSave;	// SAVE
+
+// filters
+extern int g_lopassNeurons;
+extern int g_hipassNeurons;
+extern FilterBank *g_bandpass;
+extern FilterBank *g_lopass;
+extern FilterBank *g_hipass;
+extern ButterSpec g_bandpassSpec;
+extern ButterSpec g_lopassSpec;
+extern ButterSpec g_hipassSpec;
+
+// sorting
+extern int g_whichSpikePreEmphasis;	// see spikebuffer.h
+extern int g_whichAlignment;	// ALIGN
+extern int g_whichSortMetric;	// MSE or SAA template match
+extern float g_minISI;	// ms
+extern float g_autoThreshold;	// standard deviations
+extern float g_neoThreshold;
+
+// artifacts
+extern WaitQueue<mat *> g_filterbuf; // for nlms filtering
+extern WaitQueue<mat *> g_filterfree; // and back, for reuse
+extern int g_artifactFilterRun;
+extern ArtifactFilter *g_artifactFilter;
+extern int g_trainArtifactNLMS;
+extern int g_filterArtifactNLMS;
+extern ArtifactNLMS2 *g_nlms;
+extern ArtifactChain *g_artifactChain;	// both of the above, fused
+extern ArtifactEngine *g_artifactEngine;
+extern int g_enableArtifactSubtr;
+extern int g_trainArtifactTempl;
+extern int g_numArtifactSamps;	// number of artifacts to use to build template
+extern int g_enableArtifactBlanking;
+extern int g_artifactBlankingSamps;
+extern int g_artifactBlankingPreSamps;
+extern int g_enableStimClockBlanking;
+
+typedef function<SortChannel *(int ch, MatStor *ms)> ChannelFactory;
+typedef function<ArtifactTemplate *(int stim, size_t nc, MatStor *ms)> ArtifactFactory;
+
+// (re)design a neural filter; safe while the worker is filtering
+bool designFilter(FilterBank *fb, ButterSpec &spec);
+
+// read size, sampling rate and filter specs from po8e.rc
+void pipelineConfig(po8eConf &pc);
+
+// the channels, filters, artifact engines, sorters and writers, with their
+// settings from ms. the factories make the per channel and per stim channel
+// objects, so the gui can make ones that draw.
+void pipelineInit(po8eConf &pc, MatStor &ms, ChannelFactory mkChannel,
+                  ArtifactFactory mkArtifact);
+void pipelineSave(MatStor &ms);
+
+// the next prefixNN.ext not taken in basedir
+string mk_legal_filename(string basedir, string prefix, string ext);
+// start recording to fn, with the channel names and scales (and
+// g_whichAnalogSave's channels, for the broadband)
+bool pipelineOpenSpikes(const char *fn);
+bool pipelineOpenAnalog(H5AnalogWriter *w, const char *fn);
+
+// the sources: one queue and pool per enabled card, and the threads that
+// fill them. false if there is nothing to read.
+bool pipelineOpenCards(po8eConf &pc, vector<thread> &threads);
+// a broadband file (or synthetic data for synthSecs, 0 for no end) in place
+// of the cards, at speed x real time, 0 for as fast as it goes
+bool pipelineOpenReplay(po8eConf &pc, ReplaySource *r, const char *fn,
+                        double synthSecs, double speed, bool loop,
+                        vector<thread> &threads);
+
+// the worker, the writers, nlms, the binned rates and the latency table
+void pipelineStart(vector<thread> &threads);
+
+// after a replay has ended, until the queues are empty; then stops
+void pipelineDrain();
+
+// set g_die first
+void pipelineJoin(vector<thread> &threads);
+void pipelineFree();
+
+// replay throughput and the latency table, at the end of a replay
+void pipelineReport(ReplaySource *r);
+
+// for the gui's info label (or the daemon's)
+string pipelineInfo();
+
+#endif
@@ -4,9 +4,13 @@
 #include <vector>
 #include "po8e.pb.h"
 #include "lconf.h"
+#include "butter.h"
 
 using namespace std;
 
+struct DecoderSpec;
+struct RtPolicy;
+
 class po8eConf : public luaConf
 {
 public:
@@ -21,6 +25,17 @@ public:
 	size_t numIgnoredChannels();
 	vector <po8e::card *> cards;
 	size_t readSize();
+	size_t sortThreads();
+	size_t compressThreads();
+	size_t nlmsThreads();
+	string latencyLog();
+	double sampleRate(double def);
+	double binRate(double def);
+	bool filterSpec(const char *name, ButterSpec &spec);
+	bool decoderSpec(DecoderSpec &spec);
+	bool threadPolicy(const char *role, RtPolicy &p);
+	bool lockMemory(bool def);
+	double queueSpin(const char *name, double def);
 protected:
 private:
 	po8e::card *loadCard(size_t i);
@@ -0,0 +1,53 @@
+#ifndef __PO8E_POOL_H__
+#define	__PO8E_POOL_H__
+
+#include <vector>
+#include <atomic>
+#include "readerwriterqueue.h"
+#include "gtkclient.h"
+
+using namespace std;
+using namespace moodycamel;
+
+enum {
+	PO8E_POOL_SIZE = 512,	// blocks per card; matches the data queue depth
+};
+
+// A fixed-size pool of PO8Data blocks for one po8e card.
+// The po8e thread takes a block with get(), reads straight into it,
+// and hands it to the worker through the data queue. The worker gives
+// it back with put() when done. Free blocks travel back over a second
+// SPSC queue (worker -> po8e thread), so steady state never hits the heap.
+class PO8DataPool
+{
+protected:
+	size_t m_nchan;			// channels per block
+	size_t m_nsamp;			// max samples per block
+	vector<PO8Data *> m_all;	// every block we own (for cleanup)
+	ReaderWriterQueue<PO8Data *> *m_free;	// blocks ready for reuse
+	std::atomic<u64> m_allocs;	// heap allocations after construction
+
+public:
+	PO8DataPool(size_t nblocks, size_t nchan, size_t nsamp);
+	~PO8DataPool();
+
+	// call from the producer (po8e) thread. never returns null
+	PO8Data *get();
+
+	// call from the consumer (worker) thread
+	void put(PO8Data *o);
+
+	size_t channels();
+	size_t samples();
+
+	// number of blocks waiting to be reused
+	size_t available();
+
+	// number of blocks that had to be allocated because the pool ran dry
+	u64 allocs();
+
+protected:
+	PO8Data *alloc();
+};
+
+#endif
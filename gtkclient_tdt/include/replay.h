@@ -0,0 +1,123 @@
+#ifndef __REPLAY_H__
+#define	__REPLAY_H__
+
+#include <vector>
+#include <random>
+#include "hdf5.h"
+#include "util.h"
+
+using namespace std;
+
+enum {
+	REPLAY_READ = 4096,		// samples per file read; one chunk in time (H5A_SLAB)
+	REPLAY_SPIKE_LEN = 32,	// samples per synthetic spike
+};
+
+// Plays broadband data back in place of a po8e card, with the same
+// samplesReady() / readBlock() calls po8e_fun() makes on the card.
+//
+// The data come either from a file written by H5AnalogWriter
+// (/Analog/Samples, nc x ns int16, and /Analog/Ticks), read a chunk at a
+// time, or from a synthetic source: gaussian noise plus a fixed spike shape
+// at random times on every channel, the same for a given seed.
+//
+// samplesReady() follows the wall clock scaled by the speed, so 1 is real
+// time and 10 is ten times faster; speed 0 makes everything ready at once
+// and the caller paces on its queues. With loop set the file starts over at
+// the end, with the ticks carried on so the stream has no glitch.
+class ReplaySource
+{
+protected:
+	hid_t			m_h5file;
+	hid_t			m_Dsamples;
+	hid_t			m_Dtk;
+	size_t			m_nc;		// channels
+	size_t			m_ns;		// samples in the file (or to synthesize)
+	double			m_sr;		// sampling rate, 0 if the file has none
+	double			m_speed;	// x real time; 0 as fast as it is taken
+	bool			m_loop;
+
+	// one read's worth, nc x m_bufLen, as in the file
+	vector<i16>		m_buf;
+	vector<i64>		m_bufTk;
+	size_t			m_bufPos;	// file sample of m_buf[0]
+	size_t			m_bufLen;
+
+	size_t			m_pos;		// next file sample
+	size_t			m_read;		// samples handed out, over all loops
+	i64				m_tkOffset;	// added to the file's ticks, per loop
+	i64				m_tkSpan;	// ticks the file covers
+	long double		m_t0;		// wall clock of the first samplesReady()
+
+	// synthetic
+	bool			m_synth;
+	mt19937			m_rng;
+	double			m_noise;	// noise sd, in counts
+	double			m_spike;	// spike amplitude, in counts
+	double			m_rate;		// spikes per second per channel
+	vector<size_t>	m_next;		// per channel: sample of the next spike
+
+public:
+	ReplaySource();
+	~ReplaySource();
+
+	// a broadband file from H5AnalogWriter
+	bool open(const char *fn);
+
+	// nc channels of noise and spikes; seconds 0 runs until stopped
+	void synth(size_t nc, double sr, double seconds, u32 seed = 1);
+
+	void close();
+
+	void setSpeed(double speed);
+	void setLoop(bool loop);
+	double speed()
+	{
+		return m_speed;
+	}
+
+	size_t numChannels()
+	{
+		return m_nc;
+	}
+	double samplingRate()
+	{
+		return m_sr;
+	}
+	// for files written without one
+	void setSamplingRate(double sr)
+	{
+		m_sr = sr;
+	}
+	// 0 when endless
+	size_t numSamples()
+	{
+		return m_ns;
+	}
+	size_t samplesRead()
+	{
+		return m_read;
+	}
+
+	// samples the clock allows now; stopped is set once there is nothing
+	// left to play
+	size_t samplesReady(bool *stopped = NULL);
+
+	// n samples into data (nc x n, channel-major, as readBlock() on a card)
+	// and their ticks. returns how many there were; the rest of data is
+	// left alone.
+	size_t readBlock(i16 *data, size_t n, i64 *tick);
+
+	// wall time since the first samplesReady() (s)
+	double elapsed();
+	// samples left to play, clock or no; SIZE_MAX when endless or looping
+	size_t remaining();
+
+protected:
+	bool endless();
+	bool fill();
+	bool fillFile();
+	void fillSynth();
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef __RTSCHED_H__
+#define __RTSCHED_H__
+
+#include <string>
+#include "util.h"
+
+using namespace std;
+
+// what a thread does, for its scheduling. threads = { <name> = {...} } in
+// po8e.rc, by the names in rtRoleName().
+enum RT_ROLE {
+	RT_ACQUIRE = 0,	// po8e reads, or the replay
+	RT_WORKER,		// filters, artifacts, dispatch
+	RT_SORT,		// the SortPool
+	RT_BINNED,		// binned rate frames and the decoder step
+	RT_NLMS,		// nlms training, and its pool
+	RT_WRITER,		// h5 writers and their compressors
+	RT_SERVICE,		// fifo shim, latency, decoder training, pca
+	RT_GUI,			// gtk's main loop, and whatever gtk and gl start
+	RT_NUM
+};
+
+const char *rtRoleName(int role);
+
+struct RtPolicy {
+	string	cpus;	// "2-3,6", as taskset -c; empty for any
+	int		fifo;	// SCHED_FIFO priority 1-99; 0 for SCHED_OTHER
+	int		nice;	// under SCHED_OTHER
+	int		numa;	// memory node to prefer, and its cpus if none; -1 any
+	RtPolicy()
+	{
+		fifo = 0;
+		nice = 0;
+		numa = -1;
+	}
+};
+
+// before any thread starts; unset roles keep the defaults above
+void rtSetPolicy(int role, const RtPolicy &p);
+
+// mlockall() now and for the future, and keep malloc from handing memory
+// back, so the pools stay resident. false (with a warning) if not allowed.
+// MCL_FUTURE faults every later mapping in as it is made, so the pools
+// need no prefaulting of their own; thread stacks, which grow on use,
+// are prefaulted in rtEnter(). without it, pools fault in on first use
+// (PO8DataPool touches its blocks as it makes them).
+bool rtLockMemory();
+
+// each thread, first thing, on itself: its role's cpus, policy and memory
+// node, and a name for top -H (15 characters; null leaves it, as the main
+// thread must, or it renames the process).
+void rtEnter(int role, const char *name);
+
+// per role cpu use and involuntary context switches, measured over a
+// second or more; calls in between get the last figures
+string rtInfo();
+
+#endif
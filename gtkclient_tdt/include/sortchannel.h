@@ -0,0 +1,201 @@
+#ifndef __SORTCHANNEL_H__
+#define __SORTCHANNEL_H__
+
+#include <armadillo>
+#include <string>
+#include <math.h>
+#include "gtkclient.h"
+#include "matStor.h"
+#include "util.h"
+#include "spikebuffer.h"
+
+using namespace arma;
+using namespace std;
+
+// what the pipeline needs of a channel: its sort settings, running stats and
+// spike buffer. no gl here, so the headless daemon can sort with it;
+// Channel (channel.h) adds the drawing.
+class SortChannel
+{
+protected:
+	float 	m_threshold; 	// 1 = + 10mV.
+	float	m_centering; 	// left/right centering. used to look for threshold crossing.
+	float 	m_gain;
+	float 	m_aperture[NSORT]; 		// aka MSE per sample.
+public:
+	float	m_pca[2][NWFSAMP]; 	// range 1 mean 0
+	float 	m_pcaScl[2]; 		// sqrt of the eigenvalues.
+	float	m_template[NSORT][NWFSAMP]; // range 1 mean 0.
+	int		m_ch; 			//channel number, obvi.
+	running_stat<double>	m_wfstats; // mean of the continuous waveform.
+	i64 	m_isi[NSORT][100]; 	//counts of the isi, in units of ms.
+	i64		m_lastSpike[NSORT]; //zero when a spike occurs. in samples.
+	bool	m_enabled;
+	SpikeBuffer m_spkbuf;
+	// TODO wrap spikebuffer methods into channel so that we can make the
+	// spikebuffer private
+	string 	m_chanName;
+	float 	m_scaleFactor; // from po8e scaling to uV
+
+	SortChannel(int ch, MatStor *ms)
+	{
+		m_ch = ch;
+		m_wfstats.reset();
+		m_enabled = true;
+		m_threshold = 0.6f;
+		m_centering = NWFSAMP/2.f;
+		m_gain = 1.f;
+		m_scaleFactor = 1.f;
+
+		for (int j=0; j<NWFSAMP; j++) {
+			// only need first two pc's
+			m_pca[0][j] = 1.f/8.f;
+			m_pca[1][j] = 1.f/8.f;
+		}
+		m_pcaScl[0] = 1.f;
+		m_pcaScl[1] = 1.f;
+
+		for (int k=0; k<NSORT; k++) {
+			for (int j=0; j<NWFSAMP; j++) {
+				m_template[k][j] = 0.5*sinf(j/6.f) / 1e2; // sinusoids scaled to ~100 uV
+			}
+			m_aperture[k] = 0.f;
+		}
+
+		//read from matlab if it's there..
+		if (ms) {
+			ms->getValue3(ch, 0, "pca", &(m_pca[0][0]), NWFSAMP);
+			ms->getValue3(ch, 1, "pca", &(m_pca[1][0]), NWFSAMP);
+			ms->getValue3(ch, 0, "pcaScl", m_pcaScl, 2);
+			for (int j=0; j<NSORT; j++) {
+				ms->getValue3(ch, j, "template", &(m_template[j][0]), NWFSAMP);
+				m_aperture[j] = ms->getValue2(ch, j, "aperture", 0.f); // old default: 0.003f
+			}
+
+			m_threshold = ms->getValue(ch, "threshold", 0.6f);
+			m_centering = ms->getValue(ch, "centering", NWFSAMP/2.f);
+			m_gain = ms->getValue(ch, "gain", 1.f);
+			m_enabled = (bool)ms->getValue(ch, "enabled", 1.f);
+		}
+
+		clearISI();
+	}
+	virtual ~SortChannel()
+	{
+	}
+	virtual void save(MatStor *ms)
+	{
+		for (int j=0; j<NSORT; j++) {
+			if (j < 2)
+				ms->setValue3(m_ch, j, "pca", &(m_pca[j][0]), NWFSAMP);
+			ms->setValue3(m_ch, j, "template", &(m_template[j][0]), NWFSAMP);
+			ms->setValue2(m_ch, j, "aperture", m_aperture[j]);
+		}
+		ms->setValue3(m_ch, 0, "pcaScl", m_pcaScl, 2);
+		ms->setValue(m_ch, "threshold", m_threshold);
+		ms->setValue(m_ch, "centering", m_centering);
+		ms->setValue(m_ch, "gain", m_gain);
+		ms->setValue(m_ch, "enabled", m_enabled);
+	}
+	float getThreshold()
+	{
+		return m_threshold;
+	}
+	virtual void setThreshold(float thresh)
+	{
+		m_threshold = thresh;
+	}
+	void autoThreshold(double s)
+	{
+		m_threshold = m_wfstats.mean() + m_wfstats.stddev() * s;
+	}
+	int getCentering()
+	{
+		return (int)m_centering;
+	}
+	virtual void setCentering(float c)
+	{
+		m_centering = c;
+	}
+	virtual void setGain(float gain)
+	{
+		m_gain = gain;
+	}
+	float getGain()
+	{
+		return m_gain;
+	}
+	void setEnabled(bool enabled)
+	{
+		m_enabled = enabled;
+	}
+	bool getEnabled()
+	{
+		return m_enabled;
+	}
+	void toggleEnabled()
+	{
+		m_enabled = !m_enabled;
+	}
+	// n is 0-indexed
+	virtual void setApertureLocal(int n, float aperture)
+	{
+		if (n >= 0 && n < NSORT)
+			m_aperture[n] = aperture;
+	}
+	void setTemplate(int n, float *wf)
+	{
+		if (n >= 0 && n < NSORT) {
+			for (int i=0; i<NWFSAMP; i++)
+				m_template[n][i] = wf[i];
+		}
+	}
+	void clearISI()
+	{
+		for (int u=0; u<NSORT; u++) {
+			m_lastSpike[u] = 0;
+			for (size_t i=0; i < sizeof(m_isi[0])/sizeof(m_isi[0][0]); i++) {
+				m_isi[u][i] = 0;
+			}
+		}
+	}
+	void updateISI(int unit, int sample)
+	{
+		//this used for calculating ISI.
+		unit -= 1; //comes in 0 = unsorted.
+		if (unit >=0 && unit < NSORT) {
+			int dsamp = sample - m_lastSpike[unit];
+			int b = floor(dsamp/SRATE_KHZ - 0.5);
+			int nisi = (int)(sizeof(m_isi[0])/sizeof(m_isi[0][0]));
+			//printf("%d isi %d u %d\n", m_ch, b, unit);
+			if (b > 0 && b < nisi)
+				m_isi[unit][b]++;
+			m_lastSpike[unit] = sample;
+		}
+	}
+	float getAperture(int unit)
+	{
+		if (unit >=0 && unit < NSORT) {
+			return m_aperture[unit];
+		} else return 0.f;
+	}
+	float getApertureUv(int unit)
+	{
+		//returns the aperture in uv. (uv^2 is less intuitive)
+		//input samples are 1 = 10mV.
+		//so waveform misalignment of 0.1 (1mV) -> 0.01; should be represented as
+		//1000uv^2, hence have to multiply by 1e8.
+		//sqrt(m_aperture * 1e8)
+		if (unit >=0 && unit < NSORT) {
+			return sqrt(m_aperture[unit] * 1e8);
+		} else return 0.f;
+	}
+	void setApertureUv(int unit, float aper)
+	{
+		if (unit >=0 && unit < NSORT) {
+			setApertureLocal( unit, aper*aper / 1e8);
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef __SORTPOOL_H__
+#define	__SORTPOOL_H__
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "util.h"
+#include "latency.h"
+
+using namespace std;
+
+// Runs spike sorting off the acquisition thread.
+//
+// Channels are split into shards (more shards than threads). A shard is the
+// unit of ownership: its channels' SpikeBuffers, templates and output lane are
+// only ever touched by the one thread currently holding the shard. Each thread
+// has a set of home shards; when those are done it steals pending shards from
+// the other threads. Since a channel always lives in the same shard and a shard
+// is drained sequentially, spikes on a channel come out in tick order.
+class SortPool
+{
+public:
+	// fn(ch, lane) sorts whatever is waiting in channel ch's spike buffer.
+	// lane is the shard index; use it to pick a single-producer output queue.
+	typedef function<void(int, int)> SortFn;
+
+protected:
+	struct Shard {
+		vector<int> 	chans;		// channels owned by this shard
+		atomic<bool>	pending;	// new samples since the last run
+		atomic<bool>	busy;		// a thread is running this shard
+		atomic<u64>		runs;		// how many times it ran
+		atomic<u64>		stolen;		// of which on a non-home thread
+	};
+	SortFn				m_fn;
+	vector<Shard *>		m_shards;
+	vector<thread>		m_threads;
+	size_t				m_nthreads;
+	mutex				m_mtx;		// for the wakeup only
+	condition_variable	m_cv;
+	u64					m_gen;		// bumped by every dispatch (under m_mtx)
+	atomic<bool>		m_die;
+	LatencyHist			*m_lat;
+	atomic<u64>			m_dispatched;	// latNow() of the last dispatch
+
+public:
+	SortPool(size_t nchan, size_t nthreads, size_t nshards, SortFn fn);
+	~SortPool();
+
+	// call from the worker after new samples are in the spike buffers.
+	// if there are no threads, sorts inline on the caller.
+	void dispatch();
+
+	// record, per shard run, the time since the dispatch it answers
+	void setLatency(LatencyHist *h);
+
+	size_t numShards();
+	size_t numThreads();
+
+	// fraction of shard runs done by a thief (for the info label)
+	double stolenFraction();
+
+protected:
+	void run(size_t id);
+	bool tryRun(size_t s, size_t id);
+};
+
+#endif
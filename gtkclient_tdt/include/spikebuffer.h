@@ -5,12 +5,19 @@
 #include <atomic>
 #include "util.h"
 
-#define SPIKE_BUF_SIZE (4096) // BYTES, MUST BE POWER OF 2
+#define SPIKE_BUF_SIZE (4096) // SAMPLES, MUST BE POWER OF 2
 #define SPIKE_MASK (SPIKE_BUF_SIZE-1)
+#define SPIKE_SLACK (1024) // resync when the writer gets this close to lapping
 
 using namespace std;
 using namespace arma;
 
+enum EMPHASIS { // spike pre-emphasis (detection signal)
+	EMPHASIS_NONE = 0,
+	EMPHASIS_ABS,
+	EMPHASIS_NEO
+};
+
 class NEO
 {
 protected:
@@ -25,15 +32,26 @@ public:
 	float mean();
 };
 
+// Single-producer (worker) single-consumer (sorter) ring of samples.
+//
+// The writer never waits: if the reader falls more than a ring behind,
+// the reader notices, skips ahead and counts the overrun. Every sample is
+// stored twice, at i and i+SPIKE_BUF_SIZE, so any window of up to a ring
+// is contiguous in memory; the threshold scan and the waveform copies run
+// over plain arrays without index masking.
 class SpikeBuffer
 {
 protected:
-	float m_wf[SPIKE_BUF_SIZE];	 	// the spike buffer
-	u32 m_tk[SPIKE_BUF_SIZE];		// the tick buffer
-	float m_neo[SPIKE_BUF_SIZE];	// the neo buffer
+	float m_wf[2*SPIKE_BUF_SIZE];	// the spike buffer (mirrored)
+	u32 m_tk[2*SPIKE_BUF_SIZE];		// the tick buffer (mirrored)
+	float m_neo[2*SPIKE_BUF_SIZE];	// the neo buffer (mirrored)
+	u8 m_cross[SPIKE_BUF_SIZE];		// scan scratch, reader only
 	std::atomic<long> m_w;       	// atomic write pointer
 	std::atomic<long> m_r;       	// atomic read pointer
-	NEO neof;
+	NEO neof;						// only touched by the writer
+	std::atomic<float> m_neoMean;	// neof.mean(), for the reader
+	std::atomic<u64> m_overruns;	// times the writer lapped the reader
+	std::atomic<u64> m_lost;		// samples skipped because of that
 
 public:
 	SpikeBuffer();
@@ -42,17 +60,29 @@ public:
 
 	bool addSample(u32 _tk, float _wf);
 
-	bool getSpike(u32 *tk, float *wf, float *neo, int n, float threshold, int alignment, int pre_emphasis);
-
-	// returns buffer capcity as a fraction. 1 means filled. 0 means empty.
+	// find up to max threshold crossings in what has been written so far.
+	// spike i is copied to tk/wf/neo[i*n .. i*n+n), starting alignment
+	// samples before its crossing. returns the number of spikes; call
+	// again if it returns max.
+	template <int E>
+	int getSpikes(u32 *tk, float *wf, float *neo, int n, float threshold,
+	              int alignment, int max);
+	// same, emphasis picked at runtime (EMPHASIS)
+	int getSpikes(u32 *tk, float *wf, float *neo, int n, float threshold,
+	              int alignment, int max, int pre_emphasis);
+
+	// returns the fill level as a fraction. 1 means filled. 0 means empty.
 	float capacity();
 
 	// returns the number of bytes written
 	long bytes();
 
+	u64 overruns();
+	u64 lost();
+
 	const char *name()
 	{
-		return "spike buffer v2";
+		return "spike buffer v3";
 	};
 
 	long rp();
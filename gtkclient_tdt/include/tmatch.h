@@ -0,0 +1,36 @@
+#ifndef __TMATCH_H__
+#define	__TMATCH_H__
+
+#include <stddef.h>
+
+// Template matching kernel for the spike sorter.
+//
+// Scores one waveform against every template of a channel in a single pass.
+// Templates are float32 and laid out contiguously, one row of nwf samples per
+// template (Channel::m_template already is). The wf is read once per chunk and
+// compared to all templates, so the kernel is bound by the template rows.
+// Nothing is allocated.
+//
+// The vector path is picked at compile time from -march (AVX-512F, AVX2+FMA,
+// or plain scalar), which is how the rest of the client is built.
+
+#define TMATCH_MAXT 8	// max templates per call
+
+enum TMATCH_METRIC {
+	TMATCH_L2 = 0,		// mean squared error per sample
+	TMATCH_L1			// mean absolute error per sample (SAA)
+};
+
+// score[u] = mean_j d(wf[j], templ[u*nwf + j]) for u in [0, nt).
+// returns the index of the best (smallest) score.
+int tmatch(const float *wf, const float *templ, int nt, int nwf,
+           int metric, float *score);
+
+// plain C loop, same results as tmatch() to float tolerance.
+int tmatch_scalar(const float *wf, const float *templ, int nt, int nwf,
+                  int metric, float *score);
+
+// which path tmatch() was built with: "avx512", "avx2" or "scalar"
+const char *tmatch_isa();
+
+#endif
@@ -0,0 +1,53 @@
+function [A, frame, t] = binned_shm(n)
+% [A, frame, t] = binned_shm(n)
+% the newest binned rate frame from gtkclient's shared-memory ring
+% (include/binned_shm.h), with no fifo handshake. A is nlags x nunits
+% uint16, as /tmp/binned.mmap has it; frame its number; t its time on
+% gtkclient's clock. returns frame = -1 while nothing is published.
+% the bins are rounded once per bin, not per spike as the fifo's were, so
+% they can differ from the fifo's for the same time by up to one 1/128th
+% per spike in a bin's cross-fades; decoders fit on fifo bins may want
+% refitting. lag 0 is what had been sorted when the frame went out; asking
+% the fifo for the same time later can count a few more spikes there.
+% n, if given, is the frame you last took: waits (polling) for a newer one.
+persistent m nunits nlags nframes stride
+if isempty(m)
+	f = '/dev/shm/gtkclient_binned';
+	h = memmapfile(f, 'Format', 'uint32', 'Repeat', 6);
+	if h.Data(1) ~= hex2dec('6e696267')
+		error('%s is not a binned rate segment', f);
+	end
+	nunits = double(h.Data(3));
+	nlags = double(h.Data(4));
+	nframes = double(h.Data(5));
+	stride = double(h.Data(6));
+	m = memmapfile(f, 'Format', 'uint8');
+end
+if nargin < 1
+	n = -1;
+end
+while true
+	head = double(typecast(m.Data(57:64), 'uint64'));
+	if head > 0 && head-1 > n
+		break;
+	end
+	pause(0.001);
+end
+for tries = 1:8
+	head = double(typecast(m.Data(57:64), 'uint64'));
+	o = 128 + mod(head-1, nframes)*stride;	% frames start 64-aligned
+	seq = typecast(m.Data(o+(1:4)), 'uint32');
+	if mod(seq, 2)
+		continue;
+	end
+	frame = double(typecast(m.Data(o+(9:16)), 'uint64'));
+	t = typecast(m.Data(o+(17:24)), 'double');
+	A = typecast(m.Data(o+32+(1:2*nunits*nlags)), 'uint16');
+	if typecast(m.Data(o+(1:4)), 'uint32') == seq && frame == head-1
+		A = reshape(A, nlags, nunits);
+		return;
+	end
+end
+A = [];
+frame = -1;
+t = 0;
@@ -0,0 +1,89 @@
+// compress artifact filter weights to a relative error budget.
+// reads a dense n x n W (as ArtifactFilter::loadWeights() does), truncates
+// it to low rank or drops its smallest weights, whichever is cheaper per
+// sample (or the one asked for), and writes the result back as a dense W.
+// gtkclient finds the structure when it loads the file and runs the cheap
+// form. the error is ||W - W'||_F / ||W||_F.
+// usage: artfilt_compress in.h5 out.h5 [tol=0.01] [auto|rank|sparse]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <armadillo>
+#include "gettime.h"
+#include "artifact_filter.h"
+
+using namespace arma;
+
+// time subtract() on po8e-sized blocks, us per block
+static double timeit(ArtifactFilter &f, size_t n)
+{
+	size_t ns = 16;
+	size_t reps = 2000;
+	fmat X(n, ns, fill::randn);
+	fmat Y(n, ns);
+	long double t0 = gettime();
+	for (size_t r=0; r<reps; r++) {
+		f.subtract(X.memptr(), Y.memptr(), ns);
+	}
+	return (double)(gettime() - t0) / reps * 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		printf("usage: %s in.h5 out.h5 [tol=0.01] [auto|rank|sparse]\n", argv[0]);
+		return 1;
+	}
+	double tol = argc > 3 ? atof(argv[3]) : 0.01;
+	const char *how = argc > 4 ? argv[4] : "auto";
+
+	mat W;
+	if (!W.load(argv[1], hdf5_binary_trans) || W.n_rows != W.n_cols) {
+		printf("%s: not a square weight matrix\n", argv[1]);
+		return 1;
+	}
+	size_t n = W.n_rows;
+	double nn = (double)n*n;
+	double wn = norm(W, "fro");
+
+	mat U, V, S;
+	size_t r = ArtifactFilter::lowRank(W, tol, U, V);
+	size_t nz = ArtifactFilter::sparsify(W, tol, S);
+	double cl = 2.0*n*r;
+	double cs = AF_SPARSE_COST*nz;
+	mat L = r > 0 ? mat(U * V.t()) : mat(n, n, fill::zeros);
+	printf("%zu x %zu weights, tol %g\n", n, n, tol);
+	printf("rank %4zu:   %5.1f%% of dense, error %.2e\n",
+	       r, 100*cl/nn, wn > 0 ? norm(W - L, "fro")/wn : 0.0);
+	printf("sparse %zu: %5.1f%% of dense, error %.2e\n",
+	       nz, 100*cs/nn, wn > 0 ? norm(W - S, "fro")/wn : 0.0);
+
+	bool rank;
+	if (strcmp(how, "rank") == 0) {
+		rank = true;
+	} else if (strcmp(how, "sparse") == 0) {
+		rank = false;
+	} else if (strcmp(how, "auto") == 0) {
+		rank = cl <= cs;
+	} else {
+		printf("unknown form %s\n", how);
+		return 1;
+	}
+	mat &out = rank ? L : S;
+	if (!out.save(argv[2], hdf5_binary_trans)) {
+		printf("%s: could not write\n", argv[2]);
+		return 1;
+	}
+
+	// what gtkclient will make of both files
+	ArtifactFilter fd(n);
+	ArtifactFilter fc(n);
+	fd.loadWeights(argv[1]);
+	fc.loadWeights(argv[2]);
+	printf("%s: %s, %.1f us per 16-sample block\n",
+	       argv[1], fd.form().c_str(), timeit(fd, n));
+	printf("%s: %s, %.1f us per 16-sample block\n",
+	       argv[2], fc.form().c_str(), timeit(fc, n));
+	return 0;
+}
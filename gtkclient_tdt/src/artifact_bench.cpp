@@ -0,0 +1,238 @@
+// benchmark: ArtifactEngine against the old per-sample artifact loop in
+// worker() (every sample, every stim channel, every pointer, with the
+// template strided by ARTBUF per channel).
+// first checks that both give the same output and templates on stim trains
+// that don't overlap, then times subtraction + training + blanking on a
+// dense train where several events per stim channel are in flight.
+// usage: artifact_bench [nchan] [stim period, samples]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include "gettime.h"
+#include "artifact_engine.h"
+
+#define NS 16	// samples per po8e read
+#define NSTIM 2
+#define PRE 4
+#define BLANK 12
+
+// the old state and loop, minus the icms writer, with three fixes so the
+// outputs can be compared:
+// - the worker subtracted at m_rindex, which only the blanking loop moved,
+//   so a whole block got the template sample meant for its first sample.
+//   this subtracts at the write index.
+// - on an event's last sample it subtracted the template already updated
+//   with that event. this subtracts before the update.
+// - the blanking loop counted an onset from the top of its block. this
+//   starts at the onset.
+struct OldArt {
+	vector<float>	wav;	// channel-major
+	vector<float>	now;
+	i64				windex[NARTPTR];
+	i64				rindex[NARTPTR];
+	size_t			start[NARTPTR];	// onset within this block
+	i64				nsamples;
+};
+
+static void old_process(vector<OldArt> &art, float *x, size_t nnc, size_t ns,
+                        const u8 *stim, size_t nsc, i64 maxsamps)
+{
+	for (size_t k=0; k<ns; k++) {
+		for (size_t i=0; i<nsc; i++) {
+			auto a = &art[i];
+			if (k == 0) {
+				for (int z=0; z<NARTPTR; z++)
+					a->start[z] = 0;
+			}
+			if (stim[i*ns+k]) {
+				for (int y=0; y<NARTPTR; y++) {
+					if (a->windex[y] == -1) {
+						a->windex[y] = 0;
+						a->rindex[y] = 0;
+						a->start[y] = k;
+						break;
+					}
+				}
+			}
+			for (int z=0; z<NARTPTR; z++) {
+				i64 idx = a->windex[z];
+				if (idx == -1)
+					continue;
+				for (size_t ch=0; ch<nnc; ch++) {
+					a->now[ch*ARTBUF+idx] = x[k*nnc+ch];
+				}
+				for (size_t ch=0; ch<nnc; ch++) {
+					x[k*nnc+ch] -= a->wav[ch*ARTBUF+idx];
+				}
+				a->windex[z]++;
+				if (a->windex[z] >= ARTBUF) {
+					a->windex[z] = -1;
+					if (a->nsamples < maxsamps) {
+						a->nsamples++;
+						float alpha = 1.f/a->nsamples;
+						for (size_t ch=0; ch<nnc; ch++) {
+							for (int j=0; j<ARTBUF; j++) {
+								float cur = a->wav[ch*ARTBUF+j];
+								float now = a->now[ch*ARTBUF+j];
+								a->wav[ch*ARTBUF+j] = cur + alpha*(now-cur);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+static void old_blank(vector<OldArt> &art, float *x, size_t nnc, size_t ns)
+{
+	for (size_t k=0; k<ns; k++) {
+		for (auto &a : art) {
+			for (int z=0; z<NARTPTR; z++) {
+				i64 ridx = a.rindex[z];
+				if (ridx == -1)
+					break;
+				if (k < a.start[z])
+					continue;
+				if (ridx >= PRE && ridx < PRE+BLANK) {
+					for (size_t ch=0; ch<nnc; ch++) {
+						x[k*nnc+ch] = 0.f;
+					}
+				}
+				a.rindex[z]++;
+				if (a.rindex[z] >= ARTBUF)
+					a.rindex[z] = -1;
+			}
+		}
+	}
+}
+
+struct Setup {
+	size_t			nc;
+	vector<float>	data;	// nc x nblocks*NS
+	vector<u8>		stim;	// per block, NSTIM x NS
+	size_t			nblocks;
+};
+
+static Setup mksetup(size_t nc, size_t nblocks, size_t period)
+{
+	Setup s;
+	s.nc = nc;
+	s.nblocks = nblocks;
+	s.data.resize(nc*nblocks*NS);
+	for (size_t t=0; t<nblocks*NS; t++) {
+		for (size_t ch=0; ch<nc; ch++) {
+			float art = (t % period) < ARTBUF ?
+			            expf(-(float)(t % period)/20.f) * (1.f + ch % 7) : 0.f;
+			s.data[t*nc+ch] = art + 0.1f * ((float)rand()/RAND_MAX - 0.5f);
+		}
+	}
+	// no onsets near the end, so every event finishes
+	s.stim.assign(nblocks*NSTIM*NS, 0);
+	for (size_t b=0; b+ARTBUF/NS+1<nblocks; b++) {
+		for (size_t i=0; i<NSTIM; i++) {
+			for (size_t k=0; k<NS; k++) {
+				size_t t = b*NS + k + i*period/NSTIM;
+				s.stim[b*NSTIM*NS + i*NS + k] = (t % period) == 0;
+			}
+		}
+	}
+	return s;
+}
+
+// both pipelines over the whole setup; returns seconds for each
+static void run(Setup &s, bool check, double &told, double &tnew)
+{
+	size_t nc = s.nc;
+	vector<OldArt> old(NSTIM);
+	vector<ArtifactTemplate *> tmpl;
+	for (size_t i=0; i<NSTIM; i++) {
+		old[i].wav.resize(nc*ARTBUF);
+		old[i].now.assign(nc*ARTBUF, 0.f);
+		for (int z=0; z<NARTPTR; z++) {
+			old[i].windex[z] = -1;
+			old[i].rindex[z] = -1;
+		}
+		tmpl.push_back(new ArtifactTemplate(i, nc, NULL));
+		for (size_t ch=0; ch<nc; ch++) {
+			for (int j=0; j<ARTBUF; j++) {
+				float w = 0.5f*expf(-j/20.f)*(1.f + ch % 5);
+				old[i].wav[ch*ARTBUF+j] = w;
+				tmpl[i]->m_wav[j*nc+ch] = w;
+			}
+		}
+		old[i].nsamples = 3;
+		tmpl[i]->m_nsamples = 3;
+	}
+	ArtifactEngine eng(tmpl, nc);
+
+	vector<float> xo(s.data);
+	vector<float> xn(s.data);
+	vector<i64> tk(NS);
+
+	long double t0 = gettime();
+	for (size_t b=0; b<s.nblocks; b++) {
+		float *x = &xo[b*NS*nc];
+		old_process(old, x, nc, NS, &s.stim[b*NSTIM*NS], NSTIM, 1000000);
+		old_blank(old, x, nc, NS);
+	}
+	told = (double)(gettime() - t0);
+
+	t0 = gettime();
+	for (size_t b=0; b<s.nblocks; b++) {
+		float *x = &xn[b*NS*nc];
+		for (size_t k=0; k<NS; k++)
+			tk[k] = b*NS + k;
+		eng.process(x, NS, &s.stim[b*NSTIM*NS], NSTIM, tk.data(),
+		            true, true, 1000000, nullptr);
+		eng.blank(x, true, PRE, BLANK);
+	}
+	tnew = (double)(gettime() - t0);
+
+	if (check) {
+		double dx = 0, dw = 0;
+		for (size_t i=0; i<xo.size(); i++)
+			dx = fmax(dx, fabs(xo[i] - xn[i]));
+		for (size_t i=0; i<NSTIM; i++) {
+			for (size_t ch=0; ch<nc; ch++) {
+				for (int j=0; j<ARTBUF; j++) {
+					dw = fmax(dw, fabs(old[i].wav[ch*ARTBUF+j] - tmpl[i]->m_wav[j*nc+ch]));
+				}
+			}
+			if (old[i].nsamples != tmpl[i]->m_nsamples)
+				dw = INFINITY;
+		}
+		printf("non-overlapping events: max diff output %.1e, template %.1e -> %s\n",
+		       dx, dw, dx == 0 && dw == 0 ? "ok" : "MISMATCH");
+	}
+	for (auto t : tmpl)
+		delete t;
+}
+
+int main(int argc, char **argv)
+{
+	size_t nc = 96;
+	size_t period = 40;
+	if (argc > 1)
+		nc = atoi(argv[1]);
+	if (argc > 2)
+		period = atoi(argv[2]);
+
+	double told, tnew;
+	Setup s = mksetup(nc, 200, 2*ARTBUF + 10);
+	run(s, true, told, tnew);
+
+	s = mksetup(nc, 4000, period);
+	run(s, false, told, tnew);
+	double sec = (double)s.nblocks*NS/SRATE_HZ;
+	printf("%zu ch, %d stim chans, a pulse every %zu samples, %d in flight:\n",
+	       nc, NSTIM, period, (int)(NSTIM*((ARTBUF+period-1)/period)));
+	printf("old loop %7.2f us/block (%5.1f%% of real time)\n",
+	       told/s.nblocks*1e6, 100*told/sec);
+	printf("engine   %7.2f us/block (%5.1f%% of real time), %.1fx\n",
+	       tnew/s.nblocks*1e6, 100*tnew/sec, told/tnew);
+	return 0;
+}
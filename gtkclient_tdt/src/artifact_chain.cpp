@@ -0,0 +1,69 @@
+
+#include "artifact_chain.h"
+#include "artifact_filter.h"
+#include "nlms2.h"
+
+ArtifactChain::ArtifactChain(ArtifactNLMS2 *nlms, ArtifactFilter *af)
+{
+	m_nlms = nlms;
+	m_af = af;
+	m_nv = 0;
+	m_av = 0;
+	m_valid = false;
+	m_both = false;
+}
+
+void ArtifactChain::update(bool now)
+{
+	lock_guard<mutex> ulock(m_umtx);
+	// versions first: a publish after this just means another update
+	u64 nv = m_nlms->version();
+	u64 av = m_af->version();
+	if (m_valid && av == m_av && nv - m_nv < (now ? 1 : CHAIN_LAG/2))
+		return;
+	if (!m_both.load(memory_order_relaxed)) {
+		// no use fusing; only keep proc() off the old one if they come on
+		lock_guard<mutex> lock(m_mtx);
+		m_valid = false;
+		return;
+	}
+	fmat Pn, Pa;
+	m_nlms->predictor(Pn);
+	m_af->predictor(Pa);
+	fmat P = Pn + Pa - Pa * Pn;
+	lock_guard<mutex> lock(m_mtx);
+	m_P.swap(P);
+	m_nv = nv;
+	m_av = av;
+	m_valid = true;
+}
+
+void ArtifactChain::proc(float *x, float *y, size_t ns, bool nlms, bool filter)
+{
+	bool both = nlms && filter;
+	if (m_both.load(memory_order_relaxed) != both)
+		m_both.store(both, memory_order_relaxed);
+	if (both) {
+		u64 nv = m_nlms->version();
+		u64 av = m_af->version();
+		bool fused = false;
+		{
+			lock_guard<mutex> lock(m_mtx);
+			if (m_valid && av == m_av && nv - m_nv <= CHAIN_LAG) {
+				fmat X(x, m_P.n_rows, ns, false, true);
+				fmat Y(y, m_P.n_rows, ns, false, true);
+				Y = m_P * X;
+				X -= Y;
+				fused = true;
+			}
+		}
+		if (!fused) {
+			m_nlms->subtract(x, y, ns);
+			m_af->subtract(x, y, ns);
+		}
+	} else if (nlms) {
+		m_nlms->subtract(x, y, ns);
+	} else if (filter) {
+		m_af->subtract(x, y, ns);
+	}
+}
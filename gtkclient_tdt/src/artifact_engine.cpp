@@ -0,0 +1,150 @@
+#include <string.h>
+#include "matStor.h"
+#include "artifact_engine.h"
+
+ArtifactTemplate::ArtifactTemplate(int stimchan, size_t nchan, MatStor *ms)
+{
+	m_stimchan = stimchan;
+	m_nchan = nchan;
+	m_wav.assign(ARTBUF*nchan, 0.f);
+	m_nsamples = 0;
+
+	if (ms) {
+		// stored per channel
+		float w[ARTBUF];
+		for (size_t ch=0; ch<m_nchan; ch++) {
+			for (int j=0; j<ARTBUF; j++)
+				w[j] = 0.f;
+			ms->getValue3(m_stimchan, ch, "artifact", w, ARTBUF);
+			for (int j=0; j<ARTBUF; j++)
+				m_wav[j*m_nchan+ch] = w[j];
+		}
+		m_nsamples = (int)ms->getValue(m_stimchan, "artifact_nsamples", m_nsamples);
+	}
+}
+
+ArtifactTemplate::~ArtifactTemplate()
+{
+}
+
+void ArtifactTemplate::clearArtifacts()
+{
+	for (auto &w : m_wav)
+		w = 0.f;
+	m_nsamples = 0;
+}
+
+void ArtifactTemplate::save(MatStor *ms)
+{
+	if (ms) {
+		float w[ARTBUF];
+		for (size_t ch=0; ch<m_nchan; ch++) {
+			for (int j=0; j<ARTBUF; j++)
+				w[j] = m_wav[j*m_nchan+ch];
+			ms->setValue3(m_stimchan, ch, "artifact", w, ARTBUF);
+		}
+		ms->setValue(m_stimchan, "artifact_nsamples", m_nsamples);
+	}
+}
+
+ArtifactEngine::ArtifactEngine(const vector<ArtifactTemplate *> &tmpl, size_t nchan)
+{
+	m_tmpl = tmpl;
+	m_nchan = nchan;
+	m_ev.resize(tmpl.size()*NARTPTR);
+	for (auto &e : m_ev) {
+		e.active = false;
+		e.now.assign(ARTBUF*nchan, 0.f);
+	}
+}
+
+// capture, subtract (s = 1) and average, one element at a time
+static void span(float *__restrict x, float *__restrict w,
+                 float *__restrict cap, size_t len, float s, float alpha)
+{
+	for (size_t i=0; i<len; i++) {
+		float v = x[i];
+		float t = w[i];
+		cap[i] = v;
+		x[i] = v - s*t;
+		w[i] = t + alpha*(v - t);
+	}
+}
+
+void ArtifactEngine::process(float *x, size_t ns, const u8 *stim, size_t nsc,
+                             const i64 *tk, bool subtract, bool train,
+                             i64 maxsamps, DoneFn done)
+{
+	size_t nc = m_nchan;
+	if (nsc > m_tmpl.size())
+		nsc = m_tmpl.size();
+
+	// events in flight pick up at the top of the block
+	for (auto &e : m_ev) {
+		e.k0 = 0;
+	}
+
+	// new events
+	for (size_t i=0; i<nsc; i++) {
+		for (size_t k=0; k<ns; k++) {
+			if (!stim[i*ns+k])
+				continue;
+			ArtifactEvent *e = NULL;
+			for (size_t z=0; z<NARTPTR; z++) {
+				if (!m_ev[i*NARTPTR+z].active) {
+					e = &m_ev[i*NARTPTR+z];
+					break;
+				}
+			}
+			if (!e) {
+				warn("STIM ARTIFACTS OVERLAP");
+				continue;
+			}
+			auto t = m_tmpl[i];
+			e->active = true;
+			e->stim = i;
+			e->tick = tk[k];
+			e->pos = 0;
+			e->k0 = k;
+			e->alpha = 0.f;
+			if (train && t->m_nsamples < maxsamps) {
+				t->m_nsamples++;
+				e->alpha = 1.f/t->m_nsamples; // iterative update of average
+			}
+		}
+	}
+
+	float s = subtract ? 1.f : 0.f;
+	for (auto &e : m_ev) {
+		if (!e.active)
+			continue;
+		size_t len = ARTBUF - e.pos;
+		if (len > ns - e.k0)
+			len = ns - e.k0;
+		e.k1 = e.k0 + len;
+		span(&x[e.k0*nc], &m_tmpl[e.stim]->m_wav[e.pos*nc],
+		     &e.now[e.pos*nc], len*nc, s, e.alpha);
+		if (e.pos + len >= ARTBUF && done)
+			done(e);
+	}
+}
+
+void ArtifactEngine::blank(float *x, bool enable, int pre, int len)
+{
+	size_t nc = m_nchan;
+	for (auto &e : m_ev) {
+		if (!e.active)
+			continue;
+		i64 j0 = e.pos;
+		i64 j1 = e.pos + (e.k1 - e.k0);
+		i64 b0 = j0 > pre ? j0 : pre;
+		i64 b1 = j1 < pre+len ? j1 : pre+len;
+		if (enable && b0 < b1) {
+			size_t k = e.k0 + (b0 - j0);
+			memset(&x[k*nc], 0, (b1-b0)*nc*sizeof(float));
+		}
+		e.pos = j1;
+		if (e.pos >= ARTBUF)
+			e.active = false;
+	}
+}
@@ -1,3 +1,4 @@
+
 #include "artifact_filter.h"
 
 ArtifactFilter::ArtifactFilter(int _n)
@@ -9,6 +10,9 @@ ArtifactFilter::ArtifactFilter(int _n)
 	W.fill(1.0/(double)n);	// init weights
 	W.diag().zeros();		// set diag to zero
 
+	m_form = AF_DENSE;
+	m_version = 0;
+	publish();
 }
 
 ArtifactFilter::~ArtifactFilter()
@@ -23,16 +27,156 @@ mat ArtifactFilter::filter(mat X)
 	return W * X;
 }
 
+// x -= Xhat, no temporaries beyond V'x
+void ArtifactFilter::subtract(float *x, float *y, size_t ns)
+{
+	fmat X(x, n, ns, false, true);
+	fmat Y(y, n, ns, false, true);
+	{
+		lock_guard<mutex> lock(m_pmtx);
+		switch (m_form) {
+		case AF_LOWRANK:
+			m_T = m_Vt * X;
+			Y = m_U * m_T;
+			break;
+		case AF_SPARSE:
+			Y = m_S * X;
+			break;
+		default:
+			Y = m_P * X;
+		}
+	}
+	X -= Y;
+}
+
+void ArtifactFilter::predictor(fmat &P)
+{
+	lock_guard<mutex> lock(m_pmtx);
+	P = m_P;
+}
+
+u64 ArtifactFilter::version()
+{
+	lock_guard<mutex> lock(m_pmtx);
+	return m_version;
+}
+
+string ArtifactFilter::form()
+{
+	lock_guard<mutex> lock(m_pmtx);
+	double nn = (double)n*n;
+	char buf[64];
+	switch (m_form) {
+	case AF_LOWRANK:
+		snprintf(buf, sizeof(buf), "rank %zu (%.0f%% of dense)",
+		         (size_t)m_U.n_cols, 100.0*2*n*m_U.n_cols/nn);
+		break;
+	case AF_SPARSE:
+		snprintf(buf, sizeof(buf), "sparse, %zu weights (%.0f%% of dense)",
+		         (size_t)m_S.n_nonzero, 100.0*AF_SPARSE_COST*m_S.n_nonzero/nn);
+		break;
+	default:
+		snprintf(buf, sizeof(buf), "dense");
+	}
+	return string(buf);
+}
+
+size_t ArtifactFilter::lowRank(const mat &W, double tol, mat &U, mat &V)
+{
+	mat Us, Vs;
+	vec s;
+	if (!svd_econ(Us, s, Vs, W)) {
+		U.reset();
+		V.reset();
+		return W.n_rows;
+	}
+	// error of rank r is the energy in s(r..)
+	vec e = cumsum(square(flipud(s)));	// e(i): energy of the last i+1
+	double total = e.is_empty() ? 0 : e(e.n_elem-1);
+	size_t r = s.n_elem;
+	while (r > 0 && e(s.n_elem-r) <= tol*tol*total)
+		r--;
+	if (r == 0) {
+		U.zeros(W.n_rows, 0);
+		V.zeros(W.n_cols, 0);
+		return 0;
+	}
+	U = Us.cols(0, r-1) * diagmat(s.subvec(0, r-1));
+	V = Vs.cols(0, r-1);
+	return r;
+}
+
+size_t ArtifactFilter::sparsify(const mat &W, double tol, mat &S)
+{
+	S = W;
+	uvec idx = sort_index(abs(vectorise(W)));	// smallest first
+	double budget = tol*tol*accu(square(W));
+	double dropped = 0;
+	size_t nz = accu(W != 0);
+	for (size_t i=0; i<idx.n_elem; i++) {
+		double w = S(idx(i));
+		if (w == 0)
+			continue;
+		if (dropped + w*w > budget)
+			break;
+		dropped += w*w;
+		S(idx(i)) = 0;
+		nz--;
+	}
+	return nz;
+}
+
+// find the cheapest exact form of W, then swap it in
+void ArtifactFilter::publish()
+{
+	double nn = (double)n*n;
+	mat U, V, S;
+	size_t r = lowRank(W, AF_EXACT_TOL, U, V);
+	size_t nz = sparsify(W, AF_EXACT_TOL, S);
+	double cl = U.is_empty() && r > 0 ? nn : 2.0*n*r;
+	double cs = AF_SPARSE_COST*nz;
+
+	int form = AF_DENSE;
+	if (cl < nn && cl <= cs)
+		form = AF_LOWRANK;
+	else if (cs < nn)
+		form = AF_SPARSE;
+
+	fmat P = conv_to<fmat>::from(W);
+	fmat Uf, Vt;
+	sp_fmat Sf;
+	if (form == AF_LOWRANK) {
+		Uf = conv_to<fmat>::from(U);
+		Vt = conv_to<fmat>::from(V.t());
+	}
+	if (form == AF_SPARSE)
+		Sf = sp_fmat(conv_to<fmat>::from(S));
+
+	lock_guard<mutex> lock(m_pmtx);
+	m_form = form;
+	m_P.swap(P);
+	m_U.swap(Uf);
+	m_Vt.swap(Vt);
+	m_S = Sf;
+	m_version++;
+}
+
 // load weights from a file
 void ArtifactFilter::loadWeights(const char *fn)
 {
 	// automatically detect format type
-	W.load(fn, hdf5_binary_trans);
+	mat Wn;
+	if (!Wn.load(fn, hdf5_binary_trans) || Wn.n_rows != n || Wn.n_cols != n) {
+		warn("%s: expected %zu x %zu artifact filter weights", fn, n, n);
+		return;
+	}
+	W = Wn;
+	publish();
 }
 
 void ArtifactFilter::clearWeights()
 {
 	W.fill(1.0/(double)n);	// init weights
 	W.diag().zeros();		// set diag to zero
+	publish();
 }
-
@@ -0,0 +1,172 @@
+// benchmark: the binned rate ring (binned_shm.h) against the fifo handshake
+// it replaces. a publisher fills frames of synthetic FiringRate bins at a
+// fixed rate; a consumer sleeps in wait() and takes each one with latest().
+// reported: publish-to-wakeup latency and the cost of a latest() read, then
+// the old request / get_bins / usleep(100) / "go" round trip over pipes.
+// usage: binned_bench [units] [frames/s] [seconds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <poll.h>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include "gettime.h"
+#include "firingrate.h"
+#include "latency.h"
+#include "binned_shm.h"
+
+#define NLAGS 20
+#define NAME "/gtkclient_binned_bench"
+
+static void fill(vector<FiringRate *> &fr, double end, u16 *bin)
+{
+	for (size_t i=0; i<fr.size(); i++)
+		fr[i]->get_bins(end, &bin[i*NLAGS]);
+}
+
+static void report(const char *label, LatencyHist &h)
+{
+	LatencySnap s;
+	h.snapshot(s);
+	printf("  %-22s p50 %7.1fus  p99 %7.1fus  p99.9 %7.1fus  max %7.1fus (%lu)\n",
+	       label, s.percentile(0.5)*1e6, s.percentile(0.99)*1e6,
+	       s.percentile(0.999)*1e6, s.max()*1e6, s.count);
+}
+
+int main(int argc, char **argv)
+{
+	int nunits = 96*4;
+	double rate = 200.0;
+	double secs = 3.0;
+	if (argc > 1)
+		nunits = atoi(argv[1]);
+	if (argc > 2)
+		rate = atof(argv[2]);
+	if (argc > 3)
+		secs = atof(argv[3]);
+	if (nunits < 1)
+		nunits = 1;
+	if (rate <= 0)
+		rate = 200.0;
+
+	g_startTime = gettime();
+	vector<FiringRate *> fr;
+	for (int i=0; i<nunits; i++) {
+		auto f = new FiringRate();
+		f->set_bin_params(NLAGS, 1.0);
+		fr.push_back(f);
+	}
+	// ~20 spikes/s per unit, fed as the sorters would
+	atomic<bool> stopSpikes(false);
+	thread spikes([&]() {
+		srand(1);
+		while (!stopSpikes) {
+			double t = (double)gettime();
+			for (int i=0; i<nunits; i++) {
+				if (rand() % 50 == 0)
+					fr[i]->add(t);
+			}
+			usleep(1000);
+		}
+	});
+
+	BinnedShm pub, sub;
+	if (!pub.create(NAME, nunits, NLAGS, rate, 1.0) || !sub.attach(NAME)) {
+		fprintf(stderr, "cannot make %s\n", NAME);
+		return 1;
+	}
+	printf("binned ring: %d units x %d lags, %.0f frames/s, %.1f s\n",
+	       nunits, NLAGS, rate, secs);
+
+	LatencyHist frameCost, wake, readCost;
+	atomic<bool> done(false);
+	thread publisher([&]() {
+		long double next = gettime();
+		while (!done) {
+			next += 1.0 / rate;
+			long double d = next - gettime();
+			if (d > 0)
+				usleep((useconds_t)(d*1e6));
+			u64 t0 = latNow();
+			double end = (double)gettime();
+			fill(fr, end, pub.begin(end));
+			pub.publish();
+			frameCost.since(t0);
+		}
+		pub.publish();	// so the consumer sees the end
+	});
+
+	vector<u16> bins(nunits*NLAGS);
+	u64 seen = 0, got = 0, skipped = 0;
+	long double stop = gettime() + secs;
+	while (gettime() < stop) {
+		if (!sub.wait(seen, 1000))
+			continue;
+		u64 t0 = latNow();
+		u64 n;
+		double t;
+		if (!sub.latest(bins.data(), &n, &t))
+			continue;
+		readCost.since(t0);
+		wake.addSeconds((double)gettime() - t);
+		if (got > 0 && n > seen)
+			skipped += n - seen;
+		seen = n + 1;
+		got++;
+	}
+	done = true;
+	publisher.join();
+	report("frame (get_bins all)", frameCost);
+	report("frame start to wakeup", wake);
+	report("latest() read", readCost);
+	printf("  %lu frames taken, %lu skipped\n", got, skipped);
+
+	// the old way: a request down one pipe, bins into shared memory, 100us
+	// to let them settle, then "go" up the other
+	int req[2], go[2];
+	if (pipe(req) || pipe(go)) {
+		perror("pipe");
+		return 1;
+	}
+	vector<u16> mm(nunits*NLAGS);
+	atomic<bool> stopFifo(false);
+	thread server([&]() {
+		pollfd p = { req[0], POLLIN, 0 };
+		while (!stopFifo) {
+			if (poll(&p, 1, 100) <= 0)
+				continue;
+			double reqTime;
+			if (read(req[0], &reqTime, 8) != 8)
+				continue;
+			fill(fr, (double)gettime(), mm.data());
+			usleep(100);
+			if (write(go[1], "go\n", 3) != 3)
+				break;
+		}
+	});
+	LatencyHist rt;
+	int nreq = (int)(secs * rate);
+	for (int i=0; i<nreq; i++) {
+		u64 t0 = latNow();
+		double now = -1.0;
+		char buf[4];
+		if (write(req[1], &now, 8) != 8 || read(go[0], buf, 3) != 3)
+			break;
+		rt.since(t0);
+		usleep((useconds_t)(1e6 / rate));
+	}
+	stopFifo = true;
+	server.join();
+	report("fifo round trip", rt);
+
+	stopSpikes = true;
+	spikes.join();
+	sub.close();
+	pub.close();
+	for (auto &f : fr)
+		delete f;
+	return 0;
+}
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "gettime.h"
+#include "binned_shm.h"
+
+// not private: the waiters are in other processes
+static long futex(atomic<u32> *w, int op, u32 val, const timespec *ts)
+{
+	return syscall(SYS_futex, (u32 *)w, op, val, ts, NULL, 0);
+}
+
+static size_t align64(size_t n)
+{
+	return (n + 63) & ~(size_t)63;
+}
+
+size_t BinnedShm::stride(size_t nunits, size_t nlags)
+{
+	return align64(sizeof(BinnedFrame) + nunits*nlags*sizeof(u16));
+}
+
+BinnedShm::BinnedShm()
+{
+	m_fd = -1;
+	m_addr = NULL;
+	m_len = 0;
+	m_owner = false;
+	m_hdr = NULL;
+	m_frames = NULL;
+}
+
+BinnedShm::~BinnedShm()
+{
+	close();
+}
+
+bool BinnedShm::create(const char *name, size_t nunits, size_t nlags,
+                       double binRate, double duration)
+{
+	close();
+	m_name = name;
+	m_owner = true;
+	size_t len = align64(sizeof(BinnedShmHeader)) +
+	             BSHM_FRAMES * stride(nunits, nlags);
+	shm_unlink(name);	// a stale one from a crash
+	m_fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR,
+	                S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+	if (m_fd < 0 || ftruncate(m_fd, len) < 0) {
+		warn("BinnedShm: cannot create %s: %s", name, strerror(errno));
+		close();
+		return false;
+	}
+	void *a = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if (a == MAP_FAILED) {
+		warn("BinnedShm: cannot map %s: %s", name, strerror(errno));
+		close();
+		return false;
+	}
+	m_addr = (u8 *)a;
+	m_len = len;
+	m_hdr = (BinnedShmHeader *)m_addr;
+	m_frames = m_addr + align64(sizeof(BinnedShmHeader));
+	m_hdr->version = BSHM_VERSION;
+	m_hdr->nunits = nunits;
+	m_hdr->nlags = nlags;
+	m_hdr->nframes = BSHM_FRAMES;
+	m_hdr->stride = stride(nunits, nlags);
+	m_hdr->binRate = binRate;
+	m_hdr->duration = duration;
+	m_hdr->startTime = (double)g_startTime;
+	m_hdr->pid = getpid();
+	atomic_thread_fence(memory_order_release);
+	m_hdr->magic = BSHM_MAGIC;
+	return true;
+}
+
+bool BinnedShm::attach(const char *name)
+{
+	close();
+	m_name = name;
+	m_owner = false;
+	m_fd = shm_open(name, O_RDWR, 0);
+	struct stat sb;
+	if (m_fd < 0 || fstat(m_fd, &sb) < 0 ||
+	    (size_t)sb.st_size < sizeof(BinnedShmHeader)) {
+		warn("BinnedShm: cannot open %s: %s", name, strerror(errno));
+		close();
+		return false;
+	}
+	void *a = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	               m_fd, 0);
+	if (a == MAP_FAILED) {
+		warn("BinnedShm: cannot map %s: %s", name, strerror(errno));
+		close();
+		return false;
+	}
+	m_addr = (u8 *)a;
+	m_len = sb.st_size;
+	BinnedShmHeader *h = (BinnedShmHeader *)m_addr;
+	if (h->magic != BSHM_MAGIC || h->version != BSHM_VERSION) {
+		warn("BinnedShm: %s is not a version %d rate segment", name,
+		     BSHM_VERSION);
+		close();
+		return false;
+	}
+	atomic_thread_fence(memory_order_acquire);
+	if (m_len < align64(sizeof(BinnedShmHeader)) +
+	    (size_t)h->nframes * h->stride) {
+		warn("BinnedShm: %s is truncated", name);
+		close();
+		return false;
+	}
+	m_hdr = h;
+	m_frames = m_addr + align64(sizeof(BinnedShmHeader));
+	return true;
+}
+
+void BinnedShm::close()
+{
+	if (m_addr)
+		munmap(m_addr, m_len);
+	if (m_fd >= 0)
+		::close(m_fd);
+	if (m_owner && !m_name.empty())
+		shm_unlink(m_name.c_str());
+	m_fd = -1;
+	m_addr = NULL;
+	m_len = 0;
+	m_owner = false;
+	m_hdr = NULL;
+	m_frames = NULL;
+}
+
+u16 *BinnedShm::begin(double time)
+{
+	if (!m_hdr)
+		return NULL;
+	u64 n = m_hdr->head.load(memory_order_relaxed);
+	BinnedFrame *f = slot(n);
+	u32 q = f->seq.load(memory_order_relaxed);
+	f->seq.store(q | 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	f->frame = n;
+	f->time = time;
+	return (u16 *)(f + 1);
+}
+
+void BinnedShm::publish()
+{
+	if (!m_hdr)
+		return;
+	u64 n = m_hdr->head.load(memory_order_relaxed);
+	BinnedFrame *f = slot(n);
+	f->published = (double)gettime();
+	f->seq.store((f->seq.load(memory_order_relaxed) | 1) + 1,
+	             memory_order_release);
+	m_hdr->head.store(n+1, memory_order_release);
+	// pairs with the waiters++ in wait(): either they see the new word, or
+	// we see them
+	m_hdr->wake.fetch_add(1);
+	if (m_hdr->waiters.load() > 0)
+		futex(&m_hdr->wake, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+bool BinnedShm::latest(u16 *bins, u64 *frame, double *time)
+{
+	if (!m_hdr)
+		return false;
+	size_t nb = (size_t)m_hdr->nunits * m_hdr->nlags;
+	for (int i=0; i<8; i++) {
+		u64 h = m_hdr->head.load(memory_order_acquire);
+		if (h == 0)
+			return false;
+		BinnedFrame *f = slot(h-1);
+		u32 q = f->seq.load(memory_order_acquire);
+		if (q & 1)
+			continue;
+		u64 n = f->frame;
+		double t = f->time;
+		if (bins)
+			memcpy(bins, f + 1, nb*sizeof(u16));
+		atomic_thread_fence(memory_order_acquire);
+		if (f->seq.load(memory_order_relaxed) != q || n != h-1)
+			continue;
+		if (frame)
+			*frame = n;
+		if (time)
+			*time = t;
+		return true;
+	}
+	return false;
+}
+
+bool BinnedShm::wait(u64 seen, int timeout_ms)
+{
+	if (!m_hdr)
+		return false;
+	long double end = gettime() + timeout_ms / 1e3;
+	while (m_hdr->head.load(memory_order_acquire) <= seen) {
+		u32 w = m_hdr->wake.load();
+		if (m_hdr->head.load(memory_order_acquire) > seen)
+			break;
+		timespec ts, *tp = NULL;
+		if (timeout_ms >= 0) {
+			long double left = end - gettime();
+			if (left <= 0)
+				return false;
+			ts.tv_sec = (time_t)left;
+			ts.tv_nsec = (long)((left - ts.tv_sec) * 1e9);
+			tp = &ts;
+		}
+		m_hdr->waiters.fetch_add(1);
+		futex(&m_hdr->wake, FUTEX_WAIT, w, tp);
+		m_hdr->waiters.fetch_sub(1);
+	}
+	return true;
+}
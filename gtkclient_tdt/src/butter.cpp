@@ -0,0 +1,156 @@
+#include <math.h>
+#include <complex>
+#include <algorithm>
+#include "util.h"
+#include "butter.h"
+
+typedef complex<double> cplx;
+
+static cplx bilinear(cplx s, double fs2)
+{
+	return (fs2 + s) / (fs2 - s);
+}
+
+// magnitude of one section at z
+static double sec_mag(const Biquad &q, cplx z)
+{
+	cplx zi = 1.0 / z;
+	cplx num = q.b[0] + zi*(q.b[1] + zi*q.b[2]);
+	cplx den = q.a[0] + zi*(q.a[1] + zi*q.a[2]);
+	return abs(num / den);
+}
+
+const char *butter_name(int type)
+{
+	switch (type) {
+	case BUTTER_LOW:
+		return "lowpass";
+	case BUTTER_HIGH:
+		return "highpass";
+	case BUTTER_BAND:
+		return "bandpass";
+	}
+	return "unknown";
+}
+
+bool butter_sos(const ButterSpec &spec, double sr, vector<Biquad> &sos)
+{
+	sos.clear();
+	double nyq = sr / 2.0;
+	int n = spec.order;
+	if (n < 1 || sr <= 0.0 || spec.f1 <= 0.0 || spec.f1 >= nyq)
+		return false;
+	if (spec.type == BUTTER_BAND &&
+	    (n % 2 || spec.f2 <= spec.f1 || spec.f2 >= nyq))
+		return false;
+	if (spec.type != BUTTER_LOW && spec.type != BUTTER_HIGH &&
+	    spec.type != BUTTER_BAND)
+		return false;
+
+	double fs2 = 2.0 * sr;
+	int m = spec.type == BUTTER_BAND ? n/2 : n; // prototype order
+
+	// analog prototype poles, left half plane, unit cutoff.
+	// only the upper half (and the real pole, if m is odd) are kept;
+	// the rest are their conjugates.
+	vector<cplx> proto;
+	for (int k=0; k<(m+1)/2; k++) {
+		double th = M_PI * (2.0*k + m + 1) / (2.0*m);
+		proto.push_back(polar(1.0, th));
+	}
+
+	// poles in s for each section, and the section's zeros in z
+	vector<cplx> p1, p2;	// p2 = conj(p1) for a complex pair
+	vector<double> z1, z2;
+	double w1 = fs2 * tan(M_PI * spec.f1 / sr); // prewarped
+	double w2 = spec.type == BUTTER_BAND ? fs2 * tan(M_PI * spec.f2 / sr) : 0.0;
+	cplx zref;
+
+	for (auto &p : proto) {
+		bool real = fabs(p.imag()) < 1e-12;
+		switch (spec.type) {
+		case BUTTER_LOW:
+			p1.push_back(p * w1);
+			p2.push_back(real ? cplx(NAN, 0) : conj(p * w1));
+			z1.push_back(-1.0);
+			z2.push_back(real ? NAN : -1.0);
+			break;
+		case BUTTER_HIGH:
+			p1.push_back(w1 / p);
+			p2.push_back(real ? cplx(NAN, 0) : conj(w1 / p));
+			z1.push_back(1.0);
+			z2.push_back(real ? NAN : 1.0);
+			break;
+		case BUTTER_BAND: {
+			// s^2 - p*bw*s + w0^2 = 0 for each prototype pole p
+			double bw = w2 - w1;
+			double w0sq = w1 * w2;
+			cplx pb = p * bw;
+			cplx r = sqrt(pb*pb - 4.0*w0sq);
+			cplx a = (pb + r) / 2.0;
+			cplx b = (pb - r) / 2.0;
+			if (real) {
+				// a and b are a conjugate pair, or both real: one section
+				p1.push_back(a);
+				p2.push_back(b);
+				z1.push_back(1.0);
+				z2.push_back(-1.0);
+			} else {
+				// a, b and their conjugates: two sections
+				p1.push_back(a);
+				p2.push_back(conj(a));
+				p1.push_back(b);
+				p2.push_back(conj(b));
+				z1.push_back(1.0);
+				z2.push_back(-1.0);
+				z1.push_back(1.0);
+				z2.push_back(-1.0);
+			}
+			break;
+		}
+		}
+	}
+
+	switch (spec.type) {
+	case BUTTER_LOW:
+		zref = 1.0;
+		break;
+	case BUTTER_HIGH:
+		zref = -1.0;
+		break;
+	default: {
+		double w0 = sqrt(w1 * w2);
+		zref = polar(1.0, 2.0 * atan(w0 / fs2));
+	}
+	}
+
+	for (size_t i=0; i<p1.size(); i++) {
+		Biquad q;
+		cplx a = bilinear(p1[i], fs2);
+		if (std::isnan(p2[i].real())) {
+			// first order: (1 - z1 z^-1) / (1 - a z^-1)
+			q.b[0] = 1.0;
+			q.b[1] = -z1[i];
+			q.b[2] = 0.0;
+			q.a[0] = 1.0;
+			q.a[1] = -a.real();
+			q.a[2] = 0.0;
+		} else {
+			cplx b = bilinear(p2[i], fs2);
+			q.b[0] = 1.0;
+			q.b[1] = -(z1[i] + z2[i]);
+			q.b[2] = z1[i] * z2[i];
+			q.a[0] = 1.0;
+			q.a[1] = -(a + b).real();
+			q.a[2] = (a * b).real();
+		}
+		// each section gets unity gain at the reference frequency
+		double g = sec_mag(q, zref);
+		if (!(g > 0.0) || !isfinite(g))
+			return false;
+		for (int j=0; j<3; j++)
+			q.b[j] /= g;
+		sos.push_back(q);
+	}
+	return true;
+}
@@ -0,0 +1,188 @@
+// harness for ClockSync: replays (local time, remote ticks) observations,
+// as `timesync trace.txt` records them, or makes some up with a known
+// clock, and reports how well the estimate tracks it. the synthetic clock
+// drifts in skew, its observations arrive late by a random amount, some
+// very late, and partway through it jumps; the previous estimator (an
+// offset and slope nudged by gain controllers) runs alongside.
+// usage: clocksync_bench [trace.txt | hours]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "clocksync.h"
+
+using namespace std;
+
+static const double SLOPE = 24414.0625;
+
+struct Obs {
+	double x;		// local seconds, when seen
+	double y;		// remote ticks
+	double truth;	// local seconds the ticks really happened; < 0 unknown
+};
+
+// what TimeSync did before: hand tuned gains on the offset and slope
+class GainEstimator
+{
+	struct Gain {
+		double avg, absavg, gain, incr, decr;
+		Gain(double g) : avg(0), absavg(1), gain(g), incr(g/1809.47),
+			decr(g/1914.12) {}
+		void update(double u)
+		{
+			avg = 0.95*avg + 0.05*u;
+			absavg = 0.95*absavg + 0.05*fabs(u);
+			if (absavg > 0.0) {
+				gain += fabs(avg)/absavg > 0.45 ? incr : -decr;
+				gain = fabs(gain);
+			}
+		}
+	};
+	Gain m_sg, m_og;
+	double m_slope, m_offset, m_timeOffset;
+	int m_frame;
+public:
+	GainEstimator(double slope) : m_sg(2e-5), m_og(1e-4), m_slope(slope),
+		m_offset(0), m_timeOffset(0), m_frame(0) {}
+	void add(double time, double ticks)
+	{
+		double u = ticks - ((time-m_timeOffset)*m_slope + m_offset);
+		if (m_frame < 100) {
+			m_offset += u*0.9;
+		} else {
+			m_offset += u*m_og.gain;
+			m_og.update(u);
+		}
+		if (m_frame > 2000) {
+			m_slope += u*m_sg.gain;
+			m_sg.update(u);
+		}
+		if (time - m_timeOffset > 10) {
+			m_offset += m_slope*(time - m_timeOffset);
+			m_timeOffset = time;
+		}
+		m_frame++;
+	}
+	double local(double ticks) const
+	{
+		return (ticks - m_offset)/m_slope + m_timeOffset;
+	}
+};
+
+// a block every 1/rate s; skew wanders by a few ppm over ~20 minutes;
+// delays are exponential with 1% of them 2-20 ms; at half time the
+// remote clock jumps by a second
+static vector<Obs> synth(double hours, double rate)
+{
+	mt19937 rng(1);
+	exponential_distribution<double> delay(1.0/150e-6);
+	uniform_real_distribution<double> u(0.0, 1.0);
+	vector<Obs> v;
+	size_t n = (size_t)(hours*3600*rate);
+	v.reserve(n);
+	double ticks = 1e6;
+	double jumpAt = hours*1800;
+	bool jumped = false;
+	for (size_t i=0; i<n; i++) {
+		double t = 10.0 + i/rate;
+		double ppm = 30.0 + 4.0*sin(2*M_PI*t/1200.0);
+		ticks += SLOPE*(1.0 + ppm*1e-6)/rate;
+		if (!jumped && t > jumpAt) {
+			ticks += SLOPE;
+			jumped = true;
+		}
+		double d = delay(rng);
+		if (u(rng) < 0.01)
+			d += 2e-3 + 18e-3*u(rng);
+		// the integer tick happened a fraction of a tick before t
+		double tps = SLOPE*(1.0 + ppm*1e-6);
+		Obs o = {t + d, floor(ticks), t - (ticks - floor(ticks))/tps};
+		v.push_back(o);
+	}
+	return v;
+}
+
+static vector<Obs> load(const char *fn)
+{
+	vector<Obs> v;
+	FILE *f = fopen(fn, "r");
+	if (!f) {
+		perror(fn);
+		exit(1);
+	}
+	double x, y;
+	while (fscanf(f, "%lf %lf", &x, &y) == 2) {
+		Obs o = {x, y, -1.0};
+		v.push_back(o);
+	}
+	fclose(f);
+	return v;
+}
+
+static void report(const char *name, vector<double> &e)
+{
+	if (e.empty())
+		return;
+	sort(e.begin(), e.end());
+	size_t n = e.size();
+	printf("  %-22s p50 %8.1f us  p99 %8.1f us  p99.9 %8.1f us  "
+	       "max %9.1f us\n", name, 1e6*e[n/2], 1e6*e[n*99/100],
+	       1e6*e[n*999/1000], 1e6*e[n-1]);
+}
+
+int main(int argc, char **argv)
+{
+	vector<Obs> obs;
+	if (argc > 1 && atof(argv[1]) <= 0.0) {
+		obs = load(argv[1]);
+		printf("%zu observations from %s\n", obs.size(), argv[1]);
+	} else {
+		double hours = argc > 1 ? atof(argv[1]) : 2.0;
+		obs = synth(hours, 100.0);
+		printf("%zu synthetic observations over %.1f hours\n",
+		       obs.size(), hours);
+	}
+	if (obs.size() < 2)
+		return 1;
+	bool truth = obs[0].truth >= 0.0;
+
+	ClockSync cs(SLOPE);
+	GainEstimator ge(SLOPE);
+	vector<double> ecs, ege, late, sd;
+	ecs.reserve(obs.size());
+	ege.reserve(obs.size());
+	double start = obs[0].x;
+	size_t skip = 0;	// the first 30 s: both are still acquiring
+	for (auto &o : obs) {
+		cs.add(o.x, o.y);
+		ge.add(o.x, o.y);
+		if (o.x - start < 30.0) {
+			skip++;
+			continue;
+		}
+		if (truth) {
+			ecs.push_back(fabs(cs.local(o.y) - o.truth));
+			ege.push_back(fabs(ge.local(o.y) - o.truth));
+		} else {
+			// without the truth: how late each came, against the fit
+			late.push_back(o.x - cs.local(o.y));
+		}
+		sd.push_back(cs.error(o.x)/cs.slope());
+	}
+	if (truth) {
+		printf("timestamp error (|estimated - true| time of each tick):\n");
+		report("ClockSync", ecs);
+		report("gain controllers", ege);
+	} else {
+		printf("arrival after the fitted time of each tick:\n");
+		report("ClockSync", late);
+	}
+	report("reported error (1 sd)", sd);
+	printf("slope %.4f ticks/s; %lu points kept, %lu outliers, "
+	       "%lu restarts\n", cs.slope(), (unsigned long)cs.m_accepted,
+	       (unsigned long)cs.m_rejected, (unsigned long)cs.m_restarts);
+	return 0;
+}
@@ -1,4 +1,3 @@
-#include <gtk/gtk.h>
 #include <iostream>
 #include <fstream>
 #include "datawriter.h"
@@ -8,7 +7,6 @@ DataWriter::DataWriter()
 	m_enabled = false;
 	m_num_written = 0;
 	m_fn.assign("");
-	m_w = NULL;
 }
 
 DataWriter::~DataWriter()
@@ -80,19 +78,14 @@ string DataWriter::filename()
 	return m_fn;
 }
 
-void DataWriter::registerWidget(GtkWidget *w)
+string DataWriter::status()
 {
-	m_w = w;
-}
-
-void DataWriter::draw()
-{
-	if (isEnabled()) {
-		size_t n = filename().find_last_of("/");
-		char str[256];
-		snprintf(str, 256, "%s: %.2f MB",
-		         filename().substr(n+1).c_str(),
-		         (double)bytes()/1e6);
-		gtk_label_set_text(GTK_LABEL(m_w), str);
-	}
+	if (!isEnabled())
+		return string();
+	size_t n = filename().find_last_of("/");
+	char str[256];
+	snprintf(str, 256, "%s: %.2f MB",
+	         filename().substr(n+1).c_str(),
+	         (double)bytes()/1e6);
+	return string(str);
 }
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "gettime.h"
+#include "decode_shm.h"
+
+// not private: the waiters are in other processes
+static long futex(atomic<u32> *w, int op, u32 val, const timespec *ts)
+{
+	return syscall(SYS_futex, (u32 *)w, op, val, ts, NULL, 0);
+}
+
+DecodeShm::DecodeShm()
+{
+	m_fd = -1;
+	m_owner = false;
+	m_hdr = NULL;
+}
+
+DecodeShm::~DecodeShm()
+{
+	close();
+}
+
+bool DecodeShm::create(const char *name, u32 nout, u32 type, double binRate)
+{
+	close();
+	m_name = name;
+	m_owner = true;
+	shm_unlink(name);	// a stale one from a crash
+	m_fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR,
+	                S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+	if (m_fd < 0 || ftruncate(m_fd, sizeof(DecodeShmHeader)) < 0) {
+		warn("DecodeShm: cannot create %s: %s", name, strerror(errno));
+		close();
+		return false;
+	}
+	void *a = mmap(NULL, sizeof(DecodeShmHeader), PROT_READ | PROT_WRITE,
+	               MAP_SHARED, m_fd, 0);
+	if (a == MAP_FAILED) {
+		warn("DecodeShm: cannot map %s: %s", name, strerror(errno));
+		close();
+		return false;
+	}
+	m_hdr = (DecodeShmHeader *)a;	// zeroed by ftruncate
+	m_hdr->version = DECSHM_VERSION;
+	m_hdr->nout = nout < (u32)DEC_MAXOUT ? nout : (u32)DEC_MAXOUT;
+	m_hdr->type = type;
+	m_hdr->binRate = binRate;
+	m_hdr->startTime = (double)g_startTime;
+	m_hdr->pid = getpid();
+	atomic_thread_fence(memory_order_release);
+	m_hdr->magic = DECSHM_MAGIC;
+	return true;
+}
+
+bool DecodeShm::attach(const char *name)
+{
+	close();
+	m_name = name;
+	m_owner = false;
+	m_fd = shm_open(name, O_RDWR, 0);
+	struct stat sb;
+	if (m_fd < 0 || fstat(m_fd, &sb) < 0 ||
+	    (size_t)sb.st_size < sizeof(DecodeShmHeader)) {
+		warn("DecodeShm: cannot open %s: %s", name, strerror(errno));
+		close();
+		return false;
+	}
+	void *a = mmap(NULL, sizeof(DecodeShmHeader), PROT_READ | PROT_WRITE,
+	               MAP_SHARED, m_fd, 0);
+	if (a == MAP_FAILED) {
+		warn("DecodeShm: cannot map %s: %s", name, strerror(errno));
+		close();
+		return false;
+	}
+	DecodeShmHeader *h = (DecodeShmHeader *)a;
+	if (h->magic != DECSHM_MAGIC || h->version != DECSHM_VERSION) {
+		warn("DecodeShm: %s is not a version %d decoder segment", name,
+		     DECSHM_VERSION);
+		munmap(a, sizeof(DecodeShmHeader));
+		close();
+		return false;
+	}
+	atomic_thread_fence(memory_order_acquire);
+	m_hdr = h;
+	return true;
+}
+
+void DecodeShm::close()
+{
+	if (m_hdr)
+		munmap(m_hdr, sizeof(DecodeShmHeader));
+	if (m_fd >= 0)
+		::close(m_fd);
+	if (m_owner && !m_name.empty())
+		shm_unlink(m_name.c_str());
+	m_fd = -1;
+	m_owner = false;
+	m_hdr = NULL;
+}
+
+double DecodeShm::timeOffset()
+{
+	return m_hdr ? m_hdr->startTime - (double)g_startTime : 0.0;
+}
+
+void DecodeShm::publish(bool valid, u64 binFrame, double time, double ticks,
+                        const float *y)
+{
+	if (!m_hdr)
+		return;
+	u64 n = m_hdr->head.load(memory_order_relaxed);
+	DecodeFrame *f = &m_hdr->frames[n % DECSHM_FRAMES];
+	u32 q = f->seq.load(memory_order_relaxed) | 1;
+	f->seq.store(q, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	f->valid = valid;
+	f->frame = n;
+	f->binFrame = binFrame;
+	f->time = time;
+	f->ticks = ticks;
+	memcpy(f->y, y, m_hdr->nout*sizeof(float));
+	f->published = (double)gettime();
+	f->seq.store(q + 1, memory_order_release);
+	m_hdr->head.store(n+1, memory_order_release);
+	m_hdr->wake.fetch_add(1);
+	if (m_hdr->waiters.load() > 0)
+		futex(&m_hdr->wake, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+bool DecodeShm::target(u32 &seen, DecodeTarget &t)
+{
+	if (!m_hdr)
+		return false;
+	DecodeTarget *s = &m_hdr->target;
+	for (int i=0; i<8; i++) {
+		u32 q = s->seq.load(memory_order_acquire);
+		if (q == seen)
+			return false;
+		if (q & 1)
+			continue;
+		t.train = s->train;
+		t.time = s->time;
+		memcpy(t.y, s->y, sizeof(t.y));
+		atomic_thread_fence(memory_order_acquire);
+		if (s->seq.load(memory_order_relaxed) != q)
+			continue;
+		seen = q;
+		return true;
+	}
+	return false;
+}
+
+bool DecodeShm::latest(DecodeFrame &f)
+{
+	if (!m_hdr)
+		return false;
+	for (int i=0; i<8; i++) {
+		u64 h = m_hdr->head.load(memory_order_acquire);
+		if (h == 0)
+			return false;
+		DecodeFrame *s = &m_hdr->frames[(h-1) % DECSHM_FRAMES];
+		u32 q = s->seq.load(memory_order_acquire);
+		if (q & 1)
+			continue;
+		f.valid = s->valid;
+		f.frame = s->frame;
+		f.binFrame = s->binFrame;
+		f.time = s->time;
+		f.ticks = s->ticks;
+		f.published = s->published;
+		memcpy(f.y, s->y, sizeof(f.y));
+		atomic_thread_fence(memory_order_acquire);
+		if (s->seq.load(memory_order_relaxed) != q || f.frame != h-1)
+			continue;
+		return true;
+	}
+	return false;
+}
+
+bool DecodeShm::wait(u64 seen, int timeout_ms)
+{
+	if (!m_hdr)
+		return false;
+	long double end = gettime() + timeout_ms / 1e3;
+	while (m_hdr->head.load(memory_order_acquire) <= seen) {
+		u32 w = m_hdr->wake.load();
+		if (m_hdr->head.load(memory_order_acquire) > seen)
+			break;
+		timespec ts, *tp = NULL;
+		if (timeout_ms >= 0) {
+			long double left = end - gettime();
+			if (left <= 0)
+				return false;
+			ts.tv_sec = (time_t)left;
+			ts.tv_nsec = (long)((left - ts.tv_sec) * 1e9);
+			tp = &ts;
+		}
+		m_hdr->waiters.fetch_add(1);
+		futex(&m_hdr->wake, FUTEX_WAIT, w, tp);
+		m_hdr->waiters.fetch_sub(1);
+	}
+	return true;
+}
+
+// one writer: the task
+void DecodeShm::setTarget(const float *y, bool train, double time)
+{
+	if (!m_hdr)
+		return;
+	DecodeTarget *s = &m_hdr->target;
+	u32 q = s->seq.load(memory_order_relaxed) | 1;
+	s->seq.store(q, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	s->train = train;
+	s->time = time - timeOffset();
+	memset(s->y, 0, sizeof(s->y));
+	memcpy(s->y, y, m_hdr->nout*sizeof(float));
+	s->seq.store(q + 1, memory_order_release);
+}
@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include "matStor.h"
+#include "decoder.h"
+
+#define DEC_BATCH	64	// samples per X'X update
+#define DEC_SAMPLES	(4*DEC_BATCH)	// preallocated; as many as train() takes at once
+
+const char *decodeName(int type)
+{
+	switch (type) {
+	case DECODE_WIENER:
+		return "wiener";
+	case DECODE_KALMAN:
+		return "kalman";
+	}
+	return "none";
+}
+
+Decoder::Decoder(const DecoderSpec &spec, size_t nunits, size_t nlags,
+                 MatStor *ms) : m_queue(DEC_SAMPLES), m_free(DEC_SAMPLES)
+{
+	m_spec = spec;
+	m_spec.nout = max(1, min(m_spec.nout, (int)DEC_MAXOUT));
+	m_spec.lags = max(1, min(m_spec.lags, (int)nlags));
+	m_spec.units = max(1, min(m_spec.units, (int)nunits));
+	m_nunits = nunits;
+	m_nlags = nlags;
+	m_rate.zeros(nunits);
+	m_x.zeros(m_spec.nout);
+	m_y.zeros(m_spec.nout);
+	// everything step() writes, at its size, so it never allocates
+	m_trainUnits.zeros(m_spec.units);
+	m_order.resize(nunits);
+	if (m_spec.refit > 0) {
+		m_pool.resize(DEC_SAMPLES);
+		for (auto &s : m_pool) {
+			s.units.zeros(m_spec.units);
+			s.f.zeros(numFeatures(m_spec.units));
+			s.y.zeros(m_spec.nout);
+			m_free.enqueue(&s);
+		}
+	}
+	m_reset = true;
+	m_dropped = 0;
+	m_samples = 0;
+	m_fits = 0;
+	m_nb = 0;
+	m_n = m_nt = 0.0;
+	m_lastFrame = 0;
+	m_sinceFit = 0;
+	load(ms);
+}
+
+Decoder::~Decoder()
+{
+}
+
+size_t Decoder::numFeatures(size_t nunits)
+{
+	if (m_spec.type == DECODE_KALMAN)
+		return nunits;
+	return 1 + nunits*m_spec.lags;	// and a bias
+}
+
+// kalman: lag 0 of each unit. wiener: 1, then each unit's lags in turn.
+// in spikes. f is already the size for units.
+void Decoder::features(const uvec &units, const u16 *bins, fvec &f)
+{
+	float *p = f.memptr();
+	if (m_spec.type == DECODE_KALMAN) {
+		for (size_t i=0; i<units.n_elem; i++)
+			p[i] = bins[units[i]*m_nlags] / 128.f;
+		return;
+	}
+	*p++ = 1.f;
+	for (size_t i=0; i<units.n_elem; i++) {
+		const u16 *b = &bins[units[i]*m_nlags];
+		for (int l=0; l<m_spec.lags; l++)
+			*p++ = b[l] / 128.f;
+	}
+}
+
+// the busiest, in frame order; in place, as step() calls it
+void Decoder::pickUnits()
+{
+	size_t k = m_spec.units;
+	for (size_t u=0; u<m_nunits; u++)
+		m_order[u] = u;
+	std::partial_sort(m_order.begin(), m_order.begin() + k, m_order.end(),
+	[this](u32 a, u32 b) {
+		return m_rate[a] > m_rate[b];
+	});
+	std::sort(m_order.begin(), m_order.begin() + k);
+	for (size_t i=0; i<k; i++)
+		m_trainUnits[i] = m_order[i];
+}
+
+// step()'s scratch, so it runs the model without allocating
+void Decoder::prepare(Model *m)
+{
+	m->f.zeros(numFeatures(m->units.n_elem));
+	if (m_spec.type == DECODE_KALMAN)
+		m->dz.zeros(m->f.n_elem);
+}
+
+bool Decoder::step(const u16 *bins, u64 frame, const DecodeTarget *target,
+                   float *y)
+{
+	// ~10 s at 50 Hz, for picking the units
+	for (size_t u=0; u<m_nunits; u++)
+		m_rate[u] += 0.002 * (bins[u*m_nlags] - m_rate[u]);
+
+	{
+		unique_lock<mutex> lock(m_mtx, try_to_lock);
+		if (lock.owns_lock() && m_next) {
+			// train() frees the old one
+			m_retired = std::move(m_model);
+			m_model = std::move(m_next);
+			m_x.zeros();
+		}
+	}
+	bool ok = m_model != nullptr;
+	if (ok) {
+		Model &m = *m_model;
+		features(m.units, bins, m.f);
+		// f - zbar into the scratch; the products are nout long, at most
+		// 16, which armadillo keeps off the heap
+		if (m_spec.type == DECODE_KALMAN) {
+			const float *f = m.f.memptr();
+			const float *z = m.zbar.memptr();
+			float *d = m.dz.memptr();
+			for (size_t i=0; i<m.dz.n_elem; i++)
+				d[i] = f[i] - z[i];
+			m_x = m.M1 * m_x + m.M2 * m.dz;
+			m_y = m_x + m.xbar;
+		} else {
+			m_y = m.W * m.f;
+		}
+	} else {
+		m_y.zeros();
+	}
+	memcpy(y, m_y.memptr(), m_spec.nout*sizeof(float));
+
+	if (target && target->train && m_spec.refit > 0) {
+		Sample *s;
+		if (!m_free.try_dequeue(s)) {
+			m_dropped++;	// train() is behind, and has them all
+		} else {
+			s->start = m_reset.exchange(false);
+			if (s->start) {
+				pickUnits();
+				s->units = m_trainUnits;	// the same size: a copy
+			}
+			features(m_trainUnits, bins, s->f);
+			memcpy(s->y.memptr(), target->y, m_spec.nout*sizeof(float));
+			s->frame = frame;
+			m_queue.enqueue(s);	// never full: there are only DEC_SAMPLES
+		}
+	}
+	return ok;
+}
+
+void Decoder::resetTraining()
+{
+	m_reset = true;
+}
+
+void Decoder::startTraining(const uvec &units)
+{
+	m_tUnits = units;
+	size_t nf = numFeatures(units.n_elem);
+	size_t p = m_spec.nout;
+	m_F.set_size(nf, DEC_BATCH);
+	m_Y.set_size(p, DEC_BATCH);
+	m_frames.resize(DEC_BATCH);
+	m_nb = 0;
+	m_n = m_nt = 0.0;
+	m_sinceFit = 0;
+	if (m_spec.type == DECODE_KALMAN) {
+		m_Sx.zeros(p);
+		m_Sz.zeros(nf);
+		m_S1.zeros(p);
+		m_S2.zeros(p);
+		m_Sxx.zeros(p, p);
+		m_Szx.zeros(nf, p);
+		m_Szz.zeros(nf, nf);
+		m_S11.zeros(p, p);
+		m_S21.zeros(p, p);
+		m_S22.zeros(p, p);
+	} else {
+		m_XtX.zeros(nf, nf);
+		m_XtY.zeros(nf, p);
+	}
+	m_samples = 0;
+}
+
+// the batch into the sums: X'X += F F' is one syrk, as multATA was
+void Decoder::accumulate()
+{
+	if (m_nb == 0)
+		return;
+	const mat F(m_F.memptr(), m_F.n_rows, m_nb, false, true);
+	const mat Y(m_Y.memptr(), m_Y.n_rows, m_nb, false, true);
+	if (m_spec.type == DECODE_KALMAN) {
+		m_Sx += sum(Y, 1);
+		m_Sz += sum(F, 1);
+		m_Sxx += Y * Y.t();
+		m_Szx += F * Y.t();
+		m_Szz += F * F.t();
+		for (size_t i=0; i<m_nb; i++) {
+			// transitions only between consecutive frames
+			if (m_n + i > 0 && m_frames[i] == m_lastFrame + 1) {
+				vec y = Y.col(i);
+				m_S1 += m_lastY;
+				m_S2 += y;
+				m_S11 += m_lastY * m_lastY.t();
+				m_S21 += y * m_lastY.t();
+				m_S22 += y * y.t();
+				m_nt += 1.0;
+			}
+			m_lastY = Y.col(i);
+			m_lastFrame = m_frames[i];
+		}
+	} else {
+		m_XtX += F * F.t();
+		m_XtY += F * Y.t();
+	}
+	m_n += m_nb;
+	m_sinceFit += m_nb;
+	m_samples += m_nb;
+	m_nb = 0;
+}
+
+bool Decoder::train(double timeout)
+{
+	{
+		lock_guard<mutex> lock(m_mtx);
+		m_retired.reset();	// the model step() last replaced
+	}
+	Sample *s;
+	int n = 0;
+	bool got = m_queue.wait_dequeue(s, timeout);
+	while (got) {
+		if (s->start) {
+			accumulate();
+			startTraining(s->units);
+		}
+		if (!m_tUnits.is_empty()) {
+			m_F.col(m_nb) = conv_to<vec>::from(s->f);
+			m_Y.col(m_nb) = conv_to<vec>::from(s->y);
+			m_frames[m_nb] = s->frame;
+			if (++m_nb == DEC_BATCH)
+				accumulate();
+		}
+		m_free.enqueue(s);	// back to step()
+		n++;
+		got = n < 4*DEC_BATCH && m_queue.try_dequeue(s);
+	}
+	if (n > 0 && m_queue.size_approx() == 0)
+		accumulate();	// caught up: don't sit on a partial batch
+	if (m_spec.refit > 0 && m_sinceFit >= (u64)m_spec.refit &&
+	    m_n >= 2*m_spec.nout) {
+		m_sinceFit = 0;
+		Model *m = m_spec.type == DECODE_KALMAN ? fitKalman() : fitWiener();
+		if (m) {
+			prepare(m);
+			lock_guard<mutex> lock(m_mtx);
+			m_retired.reset();
+			m_next.reset(m);
+			m_fits++;
+		}
+	}
+	return n > 0;
+}
+
+// (X'X + ridge) W = X'Y by Cholesky, as get_weights() did with dposv.
+// the bias is not shrunk.
+Decoder::Model *Decoder::fitWiener()
+{
+	mat A = m_XtX;
+	A.diag() += m_spec.ridge;
+	A(0,0) -= m_spec.ridge;
+	mat R;
+	if (!chol(R, A)) {
+		warn("decoder: X'X is not positive definite; more ridge?");
+		return nullptr;
+	}
+	mat W = solve(trimatu(R), solve(trimatl(R.t()), m_XtY));
+	Model *m = new Model;
+	m->units = m_tUnits;
+	m->W = conv_to<fmat>::from(W.t());
+	m->samples = (u64)m_n;
+	return m;
+}
+
+// the usual linear-gaussian fit (Wu et al.): x_t = A x_t-1 + w, z = H x + q,
+// about the means. the gain is iterated to its steady state, with Q's
+// inverse applied through H so only p x p matrices are inverted in the
+// loop.
+Decoder::Model *Decoder::fitKalman()
+{
+	if (m_nt < 2 || m_n < 2)
+		return nullptr;
+	size_t p = m_spec.nout;
+	mat I = eye<mat>(p, p);
+	vec xbar = m_Sx / m_n;
+	vec zbar = m_Sz / m_n;
+	mat Cxx = m_Sxx / m_n - xbar * xbar.t();
+	mat Czx = m_Szx / m_n - zbar * xbar.t();
+	mat Czz = m_Szz / m_n - zbar * zbar.t();
+	vec m1 = m_S1 / m_nt;
+	vec m2 = m_S2 / m_nt;
+	mat C11 = m_S11 / m_nt - m1 * m1.t();
+	mat C21 = m_S21 / m_nt - m2 * m1.t();
+	mat C22 = m_S22 / m_nt - m2 * m2.t();
+	double e = 1e-6 * trace(Cxx) / p + 1e-12;
+
+	mat A = solve(symmatu(C11) + e*I, C21.t()).t();
+	mat W = symmatu(C22 - A * C21.t());
+	W.diag() += e;
+	mat H = solve(symmatu(Cxx) + e*I, Czx.t()).t();
+	mat Q = symmatu(Czz - H * Czx.t());
+	Q.diag() += 1e-2 * m_spec.ridge + 1e-9;
+	mat Qi;
+	if (!inv_sympd(Qi, Q)) {
+		warn("decoder: observation covariance is singular; more ridge?");
+		return nullptr;
+	}
+	mat HtQi = H.t() * Qi;
+	mat HtQiH = symmatu(HtQi * H);
+	mat P = W;
+	mat K, Kold;
+	for (int it=0; it<1000; it++) {
+		mat Pm = symmatu(A * P * A.t() + W);
+		mat Pmi;
+		if (!inv_sympd(Pmi, Pm) || !inv_sympd(P, symmatu(Pmi + HtQiH))) {
+			warn("decoder: kalman gain did not converge");
+			return nullptr;
+		}
+		Kold = K;
+		K = P * HtQi;
+		if (it > 0 && norm(K - Kold, "fro") <= 1e-9 * norm(K, "fro"))
+			break;
+	}
+	Model *m = new Model;
+	m->units = m_tUnits;
+	m->M1 = conv_to<fmat>::from((I - K * H) * A);
+	m->M2 = conv_to<fmat>::from(K);
+	m->zbar = conv_to<fvec>::from(zbar);
+	m->xbar = conv_to<fvec>::from(xbar);
+	m->samples = (u64)m_n;
+	return m;
+}
+
+void Decoder::save(MatStor *ms)
+{
+	if (!ms || !m_model)
+		return;
+	Model &m = *m_model;
+	ms->setDouble(0, "decode_type", m_spec.type);
+	ms->setDouble(0, "decode_nout", m_spec.nout);
+	ms->setDouble(0, "decode_lags", m_spec.lags);
+	ms->setDouble(0, "decode_samples", (double)m.samples);
+	vector<int> u(m.units.begin(), m.units.end());
+	ms->setInt("decode_units", u);
+	ms->setDouble(0, "decode_nunits", u.size());
+	if (m_spec.type == DECODE_KALMAN) {
+		for (size_t i=0; i<m.M1.n_rows; i++) {
+			for (size_t j=0; j<m.M1.n_cols; j++)
+				ms->setDouble2(i, j, "decode_m1", m.M1(i,j));
+			for (size_t j=0; j<m.M2.n_cols; j++)
+				ms->setDouble2(i, j, "decode_m2", m.M2(i,j));
+			ms->setDouble(i, "decode_xbar", m.xbar(i));
+		}
+		for (size_t j=0; j<m.zbar.n_elem; j++)
+			ms->setDouble(j, "decode_zbar", m.zbar(j));
+	} else {
+		for (size_t i=0; i<m.W.n_rows; i++) {
+			for (size_t j=0; j<m.W.n_cols; j++)
+				ms->setDouble2(i, j, "decode_w", m.W(i,j));
+		}
+	}
+}
+
+// the last session's weights, if they fit this one
+void Decoder::load(MatStor *ms)
+{
+	if (!ms || m_spec.type == DECODE_NONE)
+		return;
+	if ((int)ms->getDouble(0, "decode_type", DECODE_NONE) != m_spec.type ||
+	    (int)ms->getDouble(0, "decode_nout", 0) != m_spec.nout ||
+	    (int)ms->getDouble(0, "decode_lags", 0) != m_spec.lags)
+		return;
+	size_t n = (size_t)ms->getDouble(0, "decode_nunits", 0);
+	if (n == 0)
+		return;
+	uvec units(n);
+	for (size_t i=0; i<n; i++) {
+		int u = ms->getInt(i, "decode_units", -1);
+		if (u < 0 || u >= (int)m_nunits)
+			return;
+		units[i] = u;
+	}
+	size_t p = m_spec.nout;
+	size_t nf = numFeatures(n);
+	Model *m = new Model;
+	m->units = units;
+	m->samples = (u64)ms->getDouble(0, "decode_samples", 0);
+	if (m_spec.type == DECODE_KALMAN) {
+		m->M1.set_size(p, p);
+		m->M2.set_size(p, nf);
+		m->xbar.set_size(p);
+		m->zbar.set_size(nf);
+		for (size_t i=0; i<p; i++) {
+			for (size_t j=0; j<p; j++)
+				m->M1(i,j) = ms->getDouble2(i, j, "decode_m1", 0.0);
+			for (size_t j=0; j<nf; j++)
+				m->M2(i,j) = ms->getDouble2(i, j, "decode_m2", 0.0);
+			m->xbar(i) = ms->getDouble(i, "decode_xbar", 0.0);
+		}
+		for (size_t j=0; j<nf; j++)
+			m->zbar(j) = ms->getDouble(j, "decode_zbar", 0.0);
+	} else {
+		m->W.set_size(p, nf);
+		for (size_t i=0; i<p; i++) {
+			for (size_t j=0; j<nf; j++)
+				m->W(i,j) = ms->getDouble2(i, j, "decode_w", 0.0);
+		}
+	}
+	prepare(m);
+	m_model.reset(m);
+	printf("decoder:\t\t%s weights for %zu units from the last session\n",
+	       decodeName(m_spec.type), n);
+}
+
+string Decoder::info()
+{
+	char str[256];
+	snprintf(str, 256, "decoder: %s, %zu outputs, %s; %lu trained, "
+	         "%lu fits, %lu dropped\n", decodeName(m_spec.type),
+	         (size_t)m_spec.nout, m_model ? "running" : "no weights",
+	         (u64)m_samples, (u64)m_fits, (u64)m_dropped);
+	return string(str);
+}
@@ -0,0 +1,517 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "gettime.h"
+#include "sortchannel.h"
+#include "display_shm.h"
+
+void ctlFromChannel(SortChannel *c, DisplayCtl &d)
+{
+	memset(&d, 0, sizeof(d));
+	d.threshold = c->getThreshold();
+	d.centering = c->getCentering();
+	d.gain = c->getGain();
+	d.enabled = c->getEnabled();
+	for (int u=0; u<NSORT; u++) {
+		d.aperture[u] = c->getAperture(u);
+		memcpy(d.tmpl[u], c->m_template[u], NWFSAMP*sizeof(float));
+	}
+}
+
+// through the setters, so a Channel redraws what changed
+void ctlToChannel(const DisplayCtl &d, SortChannel *c)
+{
+	c->setThreshold(d.threshold);
+	c->setCentering(d.centering);
+	if (c->getGain() != d.gain)
+		c->setGain(d.gain);
+	c->setEnabled(d.enabled);
+	for (int u=0; u<NSORT; u++) {
+		c->setTemplate(u, const_cast<float *>(d.tmpl[u]));
+		if (c->getAperture(u) != d.aperture[u])
+			c->setApertureLocal(u, d.aperture[u]);
+	}
+}
+
+// sections start on cache lines
+static size_t align64(size_t n)
+{
+	return (n + 63) & ~(size_t)63;
+}
+
+size_t DisplayShm::size(size_t nc)
+{
+	size_t n = align64(sizeof(DisplayShmHeader));
+	n += align64(nc * sizeof(DisplayCtlSlot));
+	n += align64(NFBUF * DSHM_TS_LEN * sizeof(float));
+	n += align64(DSHM_SPIKES * sizeof(DisplaySpike));
+	n += align64(DSHM_EVENTS * sizeof(DisplayEvent));
+	n += DSHM_SPIKES * sizeof(atomic<u64>);
+	return n;
+}
+
+DisplayShm::DisplayShm()
+{
+	m_fd = -1;
+	m_addr = NULL;
+	m_len = 0;
+	m_owner = false;
+	m_hdr = NULL;
+	m_ctl = NULL;
+	m_ts = NULL;
+	m_spk = NULL;
+	m_ev = NULL;
+	m_spkSeq = NULL;
+	m_control = false;
+	for (int h=0; h<NFBUF; h++) {
+		m_peak[h] = 0.f;
+		m_count[h] = 0;
+		m_tsW[h] = 0;
+		m_tsCur[h] = 0;
+	}
+	m_spkCur = 0;
+	m_evCur = 0;
+	m_overruns = 0;
+}
+
+DisplayShm::~DisplayShm()
+{
+	close();
+}
+
+bool DisplayShm::map(size_t len, bool create)
+{
+	if (create) {
+		shm_unlink(m_name.c_str());	// a stale one from a crash
+		m_fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR,
+		                S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+	} else {
+		m_fd = shm_open(m_name.c_str(), O_RDWR, 0);
+	}
+	if (m_fd < 0) {
+		warn("DisplayShm: cannot open %s: %s", m_name.c_str(), strerror(errno));
+		return false;
+	}
+	if (create) {
+		if (ftruncate(m_fd, len) < 0) {	// zero filled
+			warn("DisplayShm: cannot size %s: %s", m_name.c_str(),
+			     strerror(errno));
+			return false;
+		}
+	} else {
+		struct stat sb;
+		if (fstat(m_fd, &sb) < 0 || (size_t)sb.st_size < len) {
+			warn("DisplayShm: %s is too small", m_name.c_str());
+			return false;
+		}
+		len = sb.st_size;
+	}
+	void *a = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if (a == MAP_FAILED) {
+		warn("DisplayShm: cannot map %s: %s", m_name.c_str(), strerror(errno));
+		return false;
+	}
+	m_addr = (u8 *)a;
+	m_len = len;
+	return true;
+}
+
+void DisplayShm::layout()
+{
+	size_t nc = m_hdr->nc;
+	u8 *p = m_addr + align64(sizeof(DisplayShmHeader));
+	m_ctl = (DisplayCtlSlot *)p;
+	p += align64(nc * sizeof(DisplayCtlSlot));
+	m_ts = (float *)p;
+	p += align64(NFBUF * DSHM_TS_LEN * sizeof(float));
+	m_spk = (DisplaySpike *)p;
+	p += align64(DSHM_SPIKES * sizeof(DisplaySpike));
+	m_ev = (DisplayEvent *)p;
+	p += align64(DSHM_EVENTS * sizeof(DisplayEvent));
+	m_spkSeq = (atomic<u64> *)p;
+	m_ctlSeen.assign(nc, 0);
+}
+
+bool DisplayShm::create(const char *name, size_t nc, double sr, u32 decim)
+{
+	close();
+	m_name = name;
+	m_owner = true;
+	if (!map(size(nc), true)) {
+		close();
+		return false;
+	}
+	m_hdr = (DisplayShmHeader *)m_addr;
+	m_hdr->version = DSHM_VERSION;
+	m_hdr->nc = nc;
+	m_hdr->decim = decim > 0 ? decim : 1;
+	m_hdr->sr = sr / m_hdr->decim;
+	m_hdr->startTime = (double)g_startTime;
+	m_hdr->pid = getpid();
+	layout();
+	// the viewer checks the magic before it reads anything else
+	atomic_thread_fence(memory_order_release);
+	m_hdr->magic = DSHM_MAGIC;
+	return true;
+}
+
+bool DisplayShm::attach(const char *name)
+{
+	close();
+	m_name = name;
+	m_owner = false;
+	if (!map(sizeof(DisplayShmHeader), false)) {
+		close();
+		return false;
+	}
+	m_hdr = (DisplayShmHeader *)m_addr;
+	if (m_hdr->magic != DSHM_MAGIC || m_hdr->version != DSHM_VERSION) {
+		warn("DisplayShm: %s is not a version %d display segment",
+		     name, DSHM_VERSION);
+		close();
+		return false;
+	}
+	atomic_thread_fence(memory_order_acquire);
+	if (m_len < size(m_hdr->nc)) {
+		warn("DisplayShm: %s is truncated", name);
+		close();
+		return false;
+	}
+	layout();
+	for (int h=0; h<NFBUF; h++)
+		m_tsCur[h] = m_hdr->tsHead[h].load(memory_order_acquire);
+	m_spkCur = m_hdr->spkHead.load(memory_order_acquire);
+	m_evCur = m_hdr->evHead.load(memory_order_acquire);
+	m_overruns = 0;
+	return true;
+}
+
+void DisplayShm::close()
+{
+	if (m_control) {
+		i32 me = getpid();
+		m_hdr->viewer.compare_exchange_strong(me, 0);
+	}
+	if (m_addr)
+		munmap(m_addr, m_len);
+	if (m_fd >= 0)
+		::close(m_fd);
+	if (m_owner && !m_name.empty())
+		shm_unlink(m_name.c_str());
+	m_fd = -1;
+	m_addr = NULL;
+	m_len = 0;
+	m_owner = false;
+	m_hdr = NULL;
+	m_ctl = NULL;
+	m_ts = NULL;
+	m_spk = NULL;
+	m_ev = NULL;
+	m_spkSeq = NULL;
+	m_control = false;
+}
+
+size_t DisplayShm::numChannels()
+{
+	return m_hdr ? m_hdr->nc : 0;
+}
+
+double DisplayShm::samplingRate()
+{
+	return m_hdr ? m_hdr->sr : 0.0;
+}
+
+double DisplayShm::timeOffset()
+{
+	return m_hdr ? m_hdr->startTime - (double)g_startTime : 0.0;
+}
+
+bool DisplayShm::control()
+{
+	if (!m_hdr || m_owner)
+		return false;
+	i32 me = getpid();
+	i32 v = m_hdr->viewer.load();
+	while (v != me) {
+		// free, or its viewer died without close()
+		if (v != 0 && (kill(v, 0) == 0 || errno == EPERM))
+			break;
+		if (m_hdr->viewer.compare_exchange_weak(v, me))
+			v = me;
+	}
+	if (v == me && !m_control) {
+		// start from the settings as they are, not as we last wrote them
+		for (size_t i=0; i<m_hdr->nc; i++)
+			m_ctlSeen[i] = m_ctl[i].seq.load(memory_order_relaxed);
+	}
+	m_control = v == me;
+	return m_control;
+}
+
+bool DisplayShm::alive()
+{
+	if (!m_hdr)
+		return false;
+	return kill(m_hdr->pid, 0) == 0 || errno == EPERM;
+}
+
+void DisplayShm::timeseries(int h, float *x, size_t ns)
+{
+	if (!m_hdr || h < 0 || h >= NFBUF)
+		return;
+	u32 d = m_hdr->decim;
+	float *lane = &m_ts[h*DSHM_TS_LEN];
+	u64 w = m_tsW[h];
+	for (size_t k=0; k<ns; k++) {
+		if (m_count[h] == 0 || fabsf(x[k]) > fabsf(m_peak[h]))
+			m_peak[h] = x[k];
+		if (++m_count[h] >= d) {
+			lane[w % DSHM_TS_LEN] = m_peak[h];
+			w++;
+			m_count[h] = 0;
+		}
+	}
+	m_tsW[h] = w;
+	m_hdr->tsHead[h].store(w, memory_order_release);
+}
+
+void DisplayShm::spike(int ch, int unit, u32 tk, long double time, float *wf)
+{
+	if (!m_hdr)
+		return;
+	u64 w = m_hdr->spkHead.fetch_add(1, memory_order_relaxed);
+	atomic<u64> &seq = m_spkSeq[w % DSHM_SPIKES];
+	// the slot's last entry may still be being written, by a sorter a ring
+	// behind; wait it out. if a newer entry has the slot, ours is lost.
+	u64 q = seq.load(memory_order_relaxed);
+	for (;;) {
+		if (q >= 2*w+1)
+			return;
+		if (q & 1) {
+			sched_yield();
+			q = seq.load(memory_order_relaxed);
+		} else if (seq.compare_exchange_weak(q, 2*w+1,
+		                                     memory_order_relaxed)) {
+			break;
+		}
+	}
+	atomic_thread_fence(memory_order_release);
+	DisplaySpike &s = m_spk[w % DSHM_SPIKES];
+	s.ch = ch;
+	s.unit = unit;
+	s.tk = tk;
+	s.time = (double)time;
+	memcpy(s.wf, wf, NWFSAMP*sizeof(float));
+	seq.store(2*w+2, memory_order_release);
+}
+
+void DisplayShm::event(int chan, long double time)
+{
+	if (!m_hdr)
+		return;
+	u64 w = m_hdr->evHead.load(memory_order_relaxed);
+	DisplayEvent &e = m_ev[w % DSHM_EVENTS];
+	e.chan = chan;
+	e.time = (double)time;
+	m_hdr->evHead.store(w+1, memory_order_release);
+}
+
+void DisplayShm::setInfo(const string &s)
+{
+	if (!m_hdr)
+		return;
+	u32 q = m_hdr->infoSeq.load(memory_order_relaxed);
+	m_hdr->infoSeq.store(q+1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	size_t n = s.size() < DSHM_INFO-1 ? s.size() : DSHM_INFO-1;
+	memcpy(m_hdr->info, s.c_str(), n);
+	m_hdr->info[n] = 0;
+	m_hdr->infoSeq.store(q+2, memory_order_release);
+}
+
+string DisplayShm::info()
+{
+	if (!m_hdr)
+		return string();
+	char buf[DSHM_INFO];
+	for (int i=0; i<4; i++) {
+		u32 q = m_hdr->infoSeq.load(memory_order_acquire);
+		if (q & 1)
+			continue;
+		memcpy(buf, m_hdr->info, DSHM_INFO);
+		atomic_thread_fence(memory_order_acquire);
+		if (m_hdr->infoSeq.load(memory_order_relaxed) == q) {
+			buf[DSHM_INFO-1] = 0;
+			return string(buf);
+		}
+	}
+	return string();
+}
+
+void DisplayShm::putCtl(int ch, const DisplayCtl &c)
+{
+	if (!m_hdr || ch < 0 || (size_t)ch >= m_hdr->nc || !controlling())
+		return;
+	DisplayCtlSlot &s = m_ctl[ch];
+	// claim it even to odd: a viewer may attach while the daemon still
+	// fills these in, or take over from one that is mid-write
+	u32 q = s.seq.load(memory_order_relaxed);
+	for (;;) {
+		if (q & 1) {
+			sched_yield();
+			q = s.seq.load(memory_order_relaxed);
+		} else if (s.seq.compare_exchange_weak(q, q+1,
+		                                       memory_order_relaxed)) {
+			break;
+		}
+	}
+	atomic_thread_fence(memory_order_release);
+	memcpy(&s.c, &c, sizeof(DisplayCtl));
+	s.seq.store(q+2, memory_order_release);
+	m_ctlSeen[ch] = q+2;	// not news to us
+}
+
+// seqlock read; false if it was being written
+static bool readCtl(DisplayCtlSlot &s, DisplayCtl &c, u32 *seq)
+{
+	u32 q = s.seq.load(memory_order_acquire);
+	if (q & 1)
+		return false;
+	memcpy(&c, &s.c, sizeof(DisplayCtl));
+	atomic_thread_fence(memory_order_acquire);
+	if (s.seq.load(memory_order_relaxed) != q)
+		return false;
+	*seq = q;
+	return true;
+}
+
+bool DisplayShm::getCtl(int ch, DisplayCtl &c)
+{
+	if (!m_hdr || ch < 0 || (size_t)ch >= m_hdr->nc)
+		return false;
+	u32 q;
+	for (int i=0; i<4; i++) {
+		if (readCtl(m_ctl[ch], c, &q)) {
+			m_ctlSeen[ch] = q;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool DisplayShm::ctlChanged(int ch, DisplayCtl &c)
+{
+	if (!m_hdr || ch < 0 || (size_t)ch >= m_hdr->nc)
+		return false;
+	if (m_ctl[ch].seq.load(memory_order_relaxed) == m_ctlSeen[ch])
+		return false;
+	u32 q;
+	if (!readCtl(m_ctl[ch], c, &q))
+		return false;	// next time
+	m_ctlSeen[ch] = q;
+	return true;
+}
+
+void DisplayShm::subscribe(int h, int ch)
+{
+	if (m_hdr && h >= 0 && h < NFBUF && controlling())
+		m_hdr->channel[h].store(ch, memory_order_relaxed);
+}
+
+int DisplayShm::subscribed(int h)
+{
+	if (m_hdr && h >= 0 && h < NFBUF)
+		return m_hdr->channel[h].load(memory_order_relaxed);
+	return 0;
+}
+
+// copy entries [cur, head) of a ring of n out, up to max. the writer may
+// have been rewriting the oldest while we copied; those are dropped.
+template <typename T>
+static size_t drain(const T *ring, size_t n, atomic<u64> &head, u64 &cur,
+                    T *out, size_t max, u64 &overruns)
+{
+	u64 hd = head.load(memory_order_acquire);
+	if (hd < cur)
+		cur = hd;	// a new daemon on the same segment name
+	if (hd - cur > n) {
+		overruns++;
+		cur = hd - n;
+	}
+	u64 first = cur;
+	size_t k = 0;
+	while (cur < hd && k < max) {
+		out[k++] = ring[cur % n];
+		cur++;
+	}
+	atomic_thread_fence(memory_order_acquire);
+	u64 now = head.load(memory_order_relaxed);
+	if (now >= n && first + n <= now) {
+		// entry i was safe if the writer had not reached i + n
+		size_t bad = now - n + 1 - first;
+		if (bad > k)
+			bad = k;
+		memmove(out, out + bad, (k - bad)*sizeof(T));
+		k -= bad;
+		overruns++;
+	}
+	return k;
+}
+
+size_t DisplayShm::readTimeseries(int h, float *x, size_t max)
+{
+	if (!m_hdr || h < 0 || h >= NFBUF)
+		return 0;
+	return drain(&m_ts[h*DSHM_TS_LEN], DSHM_TS_LEN, m_hdr->tsHead[h],
+	             m_tsCur[h], x, max, m_overruns);
+}
+
+// the head counts entries reserved, not finished: stop at the first one
+// still being written, and take each only if its sequence held still
+size_t DisplayShm::readSpikes(DisplaySpike *s, size_t max)
+{
+	if (!m_hdr)
+		return 0;
+	u64 hd = m_hdr->spkHead.load(memory_order_acquire);
+	if (hd < m_spkCur)
+		m_spkCur = hd;	// a new daemon on the same segment name
+	if (hd - m_spkCur > DSHM_SPIKES) {
+		m_overruns++;
+		m_spkCur = hd - DSHM_SPIKES;
+	}
+	size_t k = 0;
+	while (m_spkCur < hd && k < max) {
+		u64 i = m_spkCur;
+		atomic<u64> &seq = m_spkSeq[i % DSHM_SPIKES];
+		u64 q = seq.load(memory_order_acquire);
+		if (q < 2*i+2)
+			break;		// not yet; next call
+		if (q == 2*i+2) {
+			memcpy(&s[k], &m_spk[i % DSHM_SPIKES], sizeof(DisplaySpike));
+			atomic_thread_fence(memory_order_acquire);
+			if (seq.load(memory_order_relaxed) == q)
+				k++;
+			else
+				m_overruns++;
+		} else {
+			m_overruns++;	// lapped before we got to it
+		}
+		m_spkCur++;
+	}
+	return k;
+}
+
+size_t DisplayShm::readEvents(DisplayEvent *e, size_t max)
+{
+	if (!m_hdr)
+		return 0;
+	return drain(m_ev, DSHM_EVENTS, m_hdr->evHead, m_evCur, e, max,
+	             m_overruns);
+}
@@ -0,0 +1,143 @@
+// microbenchmark: FilterBank vs. per-sample Filter::Proc, as the worker ran it,
+// and a check of butter_sos() against the compiled-in matlab coefficients.
+// usage: filter_bench [nblocks]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include "gettime.h"
+#include "filter.h"
+#include "filterbank.h"
+#include "butter.h"
+
+using namespace std;
+
+#define NS 64	// samples per block, about what a po8e read gives
+
+template <class F>
+static void bench(const char *label, size_t nc, int nblocks)
+{
+	vector<F> old(nc);
+	FilterBank fb(nc);
+	fb.setFilter(F());
+
+	vector<double> x(nc*NS);
+	vector<double> y(nc*NS);
+	srand(1);
+
+	// agreement check, run on the same input through both
+	double maxerr = 0.0;
+	double maxval = 0.0;
+	for (int i=0; i<200; i++) {
+		for (size_t j=0; j<nc*NS; j++) {
+			x[j] = ((double)rand()/RAND_MAX - 0.5) * 1e3;
+			y[j] = x[j];
+		}
+		for (size_t k=0; k<NS; k++) {
+			for (size_t ch=0; ch<nc; ch++) {
+				float samp = (float)x[k*nc+ch];
+				old[ch].Proc(&samp, &samp, 1);
+				x[k*nc+ch] = samp;
+			}
+		}
+		fb.proc(&y[0], NS);
+		for (size_t j=0; j<nc*NS; j++) {
+			maxerr = fmax(maxerr, fabs(x[j] - y[j]));
+			maxval = fmax(maxval, fabs(x[j]));
+		}
+	}
+
+	long double t = gettime();
+	for (int i=0; i<nblocks; i++) {
+		for (size_t k=0; k<NS; k++) {
+			for (size_t ch=0; ch<nc; ch++) {
+				float samp = (float)x[k*nc+ch];
+				old[ch].Proc(&samp, &samp, 1);
+				x[k*nc+ch] = samp;
+			}
+		}
+	}
+	double t_old = (double)(gettime() - t);
+
+	t = gettime();
+	for (int i=0; i<nblocks; i++) {
+		fb.proc(&y[0], NS);
+	}
+	double t_new = (double)(gettime() - t);
+
+	double n = (double)nblocks * NS * nc;
+	printf("%-22s %3zu ch: Proc %6.2f ns/samp, bank %5.2f ns/samp (%.1fx), "
+	       "max err %.1e of %.1e\n", label, nc, 1e9*t_old/n, 1e9*t_new/n,
+	       t_old/t_new, maxerr, maxval);
+}
+
+// run white noise through the matlab coefficients and the designed sections
+template <class F>
+static void check(const char *label, int type, int order, double sr,
+                  double f1, double f2)
+{
+	size_t nc = 4;
+	FilterBank ref(nc);
+	FilterBank des(nc);
+	ref.setFilter(F());
+	ButterSpec spec = {type, order, f1, f2};
+	vector<Biquad> sos;
+	if (!butter_sos(spec, sr, sos)) {
+		printf("%-22s design failed\n", label);
+		return;
+	}
+	des.setSOS(sos);
+
+	vector<double> x(nc*NS);
+	vector<double> y(nc*NS);
+	double maxerr = 0.0;
+	double maxval = 0.0;
+	srand(2);
+	for (int i=0; i<500; i++) {
+		for (size_t j=0; j<nc*NS; j++) {
+			x[j] = ((double)rand()/RAND_MAX - 0.5) * 1e3;
+			y[j] = x[j];
+		}
+		ref.proc(&x[0], NS);
+		des.proc(&y[0], NS);
+		for (size_t j=0; j<nc*NS; j++) {
+			maxerr = fmax(maxerr, fabs(x[j] - y[j]));
+			maxval = fmax(maxval, fabs(x[j]));
+		}
+	}
+	printf("%-22s designed (%zu sections) vs matlab: max err %.1e of %.1e\n",
+	       label, sos.size(), maxerr, maxval);
+}
+
+int main(int argc, char **argv)
+{
+	int nblocks = 2000;
+	if (argc > 1)
+		nblocks = atoi(argv[1]);
+	if (nblocks < 1)
+		nblocks = 1;
+	check<FilterButterBand_24k_500_3000>("band 24k 500-3000", BUTTER_BAND, 4,
+	                                    24414.0625, 500, 3000);
+	check<FilterButterBand_24k_300_5000>("band 24k 300-5000", BUTTER_BAND, 4,
+	                                    24414.0625, 300, 5000);
+	check<FilterButterBand_48k_500_3000>("band 48k 500-3000", BUTTER_BAND, 4,
+	                                    48828.125, 500, 3000);
+	check<FilterButterLow_24k_3000>("low 24k 3000", BUTTER_LOW, 2,
+	                                24414.0625, 3000, 0);
+	check<FilterButterLow_48k_5000>("low 48k 5000", BUTTER_LOW, 2,
+	                                48828.125, 5000, 0);
+	check<FilterButterHigh_24k_500>("high 24k 500", BUTTER_HIGH, 2,
+	                                24414.0625, 500, 0);
+	check<FilterButterHigh_48k_500>("high 48k 500", BUTTER_HIGH, 2,
+	                                48828.125, 500, 0);
+
+	size_t nchans[] = {96, 192, 384};
+	for (auto nc : nchans) {
+		bench<FilterButterBand_24k_500_3000>("band 24k 500-3000", nc, nblocks);
+		bench<FilterButterLow_24k_3000>("low 24k 3000", nc, nblocks);
+		bench<FilterButterHigh_24k_500>("high 24k 500", nc, nblocks);
+		bench<FilterButterBand_48k_500_3000>("band 48k 500-3000", nc, nblocks);
+	}
+	return 0;
+}
@@ -0,0 +1,237 @@
+#include <math.h>
+#include <sched.h>
+#include "filterbank.h"
+
+FilterBank::FilterBank(size_t nchan)
+{
+	m_nchan = nchan;
+	m_live = new Bank; // empty: pass-through
+	m_next = nullptr;
+	m_dead = nullptr;
+	m_picking = false;
+	m_swaps = 0;
+}
+
+FilterBank::~FilterBank()
+{
+	delete m_live;
+	delete m_next.exchange(nullptr);
+	delete m_dead.exchange(nullptr);
+}
+
+void FilterBank::setFilter(const Filter &f)
+{
+	auto &B = f.num();
+	auto &A = f.den();
+	if (B.size() < 2 || B.size() != A.size()) {
+		warn("FilterBank: bad filter (%zu, %zu coefs)", B.size(), A.size());
+		return;
+	}
+	{
+		lock_guard<mutex> lock(m_mtx);
+		m_edit.clear();
+		size_t s = newSection(m_edit, (int)B.size()-1);
+		for (size_t ch=0; ch<m_nchan; ch++) {
+			set(m_edit, s, ch, &B[0], &A[0]);
+		}
+	}
+	commit();
+}
+
+void FilterBank::setSOS(const vector<Biquad> &sos)
+{
+	{
+		lock_guard<mutex> lock(m_mtx);
+		m_edit.clear();
+		for (auto &q : sos) {
+			size_t s = newSection(m_edit, 2);
+			for (size_t ch=0; ch<m_nchan; ch++) {
+				set(m_edit, s, ch, q.b, q.a);
+			}
+		}
+	}
+	commit();
+}
+
+size_t FilterBank::addSection(int order)
+{
+	lock_guard<mutex> lock(m_mtx);
+	return newSection(m_edit, order);
+}
+
+void FilterBank::setSection(size_t sec, size_t ch, const double *b, const double *a)
+{
+	lock_guard<mutex> lock(m_mtx);
+	set(m_edit, sec, ch, b, a);
+}
+
+void FilterBank::setBiquad(size_t ch, size_t stage, const float *biquad)
+{
+	lock_guard<mutex> lock(m_mtx);
+	if (stage >= m_edit.size() || m_edit[stage].order != 2) {
+		warn("FilterBank: stage %zu is not a biquad", stage);
+		return;
+	}
+	double b[3] = {biquad[0], biquad[1], biquad[0]};
+	double a[3] = {1.0, -biquad[2], -biquad[3]};
+	set(m_edit, stage, ch, b, a);
+}
+
+void FilterBank::commit()
+{
+	auto o = new Bank;
+	{
+		lock_guard<mutex> lock(m_mtx);
+		*o = m_edit;
+	}
+	// free what proc() retired last time, and any commit it never saw
+	delete m_dead.exchange(nullptr);
+	delete m_next.exchange(o);
+	// proc() may have taken the previous commit just before ours went up,
+	// and retire its old bank after we looked; it would then wait on us to
+	// free that before taking ours. it is a few instructions from done.
+	while (m_picking)
+		sched_yield();
+	delete m_dead.exchange(nullptr);
+}
+
+size_t FilterBank::newSection(Bank &bank, int order)
+{
+	Section o;
+	o.order = order;
+	o.b.assign((order+1)*m_nchan, 0.0);
+	o.a.assign((order+1)*m_nchan, 0.0);
+	o.d.assign(order*m_nchan, 0.0);
+	for (size_t ch=0; ch<m_nchan; ch++) {
+		o.b[ch] = 1.0;
+		o.a[ch] = 1.0;
+	}
+	bank.push_back(o);
+	return bank.size()-1;
+}
+
+void FilterBank::set(Bank &bank, size_t sec, size_t ch, const double *b, const double *a)
+{
+	if (sec >= bank.size() || ch >= m_nchan)
+		return;
+	auto &o = bank[sec];
+	// normalize so a[0] = 1, like Filter assumes
+	double a0 = a[0] != 0.0 ? a[0] : 1.0;
+	for (int j=0; j<=o.order; j++) {
+		o.b[j*m_nchan+ch] = b[j] / a0;
+		o.a[j*m_nchan+ch] = a[j] / a0;
+	}
+}
+
+// called by proc(), between blocks
+void FilterBank::pickup()
+{
+	if (!m_next.load(memory_order_relaxed))
+		return;
+	m_picking = true;
+	// the last bank we retired is still there: take this one next block,
+	// rather than free it here
+	Bank *o = m_dead.load() ? nullptr : m_next.exchange(nullptr);
+	if (!o) {
+		m_picking = false;
+		return;
+	}
+	bool same = o->size() == m_live->size();
+	for (size_t s=0; same && s<o->size(); s++) {
+		same = (*o)[s].order == (*m_live)[s].order;
+	}
+	if (same) {
+		// no transient when only the coefficients moved
+		for (size_t s=0; s<o->size(); s++) {
+			(*o)[s].d = (*m_live)[s].d; // same size: no allocation
+		}
+	}
+	m_dead = m_live;	// empty, above; commit() frees it
+	m_picking = false;
+	m_live = o;
+	m_swaps++;
+}
+
+// one DF2T section of order N over a single sample of every channel
+template <int N, class T>
+static inline void df2t(T *__restrict x, const double *__restrict b,
+                        const double *__restrict a, double *__restrict d,
+                        size_t nc)
+{
+	for (size_t ch=0; ch<nc; ch++) {
+		double in = x[ch];
+		double y = d[ch] + b[ch]*in;
+		for (int j=0; j<N-1; j++) {
+			d[j*nc+ch] = d[(j+1)*nc+ch] + b[(j+1)*nc+ch]*in - a[(j+1)*nc+ch]*y;
+		}
+		d[(N-1)*nc+ch] = b[N*nc+ch]*in - a[N*nc+ch]*y;
+		x[ch] = (T)y;
+	}
+}
+
+template <class T>
+static void df2t_n(int n, T *x, const double *b, const double *a,
+                   double *d, size_t nc)
+{
+	for (size_t ch=0; ch<nc; ch++) {
+		double in = x[ch];
+		double y = d[ch] + b[ch]*in;
+		int j;
+		for (j=0; j<n-1; j++) {
+			d[j*nc+ch] = d[(j+1)*nc+ch] + b[(j+1)*nc+ch]*in - a[(j+1)*nc+ch]*y;
+		}
+		d[j*nc+ch] = b[(j+1)*nc+ch]*in - a[(j+1)*nc+ch]*y;
+		x[ch] = (T)y;
+	}
+}
+
+void FilterBank::proc(double *x, size_t ns)
+{
+	procT(x, ns);
+}
+
+void FilterBank::proc(float *x, size_t ns)
+{
+	procT(x, ns);
+}
+
+template <class T>
+void FilterBank::procT(T *x, size_t ns)
+{
+	pickup();
+	size_t nc = m_nchan;
+	for (auto &o : *m_live) {
+		const double *b = &o.b[0];
+		const double *a = &o.a[0];
+		double *d = &o.d[0];
+		for (size_t k=0; k<ns; k++) {
+			T *xk = &x[k*nc];
+			switch (o.order) {
+			case 1:
+				df2t<1>(xk, b, a, d, nc);
+				break;
+			case 2:
+				df2t<2>(xk, b, a, d, nc);
+				break;
+			case 4:
+				df2t<4>(xk, b, a, d, nc);
+				break;
+			default:
+				df2t_n(o.order, xk, b, a, d, nc);
+			}
+		}
+		// Filter::Proc checks every delay update; once a block is enough
+		// to keep a nan or inf from sticking around.
+		for (size_t ch=0; ch<nc; ch++) {
+			bool bad = false;
+			for (int j=0; j<o.order; j++) {
+				bad |= !isfinite(d[j*nc+ch]);
+			}
+			if (bad) {
+				for (int j=0; j<o.order; j++) {
+					d[j*nc+ch] = 0.0;
+				}
+			}
+		}
+	}
+}
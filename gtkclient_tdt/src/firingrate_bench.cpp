@@ -0,0 +1,173 @@
+// benchmark: the incremental lagged bins in firingrate.h against the old
+// get_bins(), which walked each unit's spike ring back from the newest spike
+// on every request. checks that get_bins_scan() is the old code exactly
+// and the incremental bins agree with it to the old per-spike rounding,
+// then times a decode-rate stream of requests over all units, forward in
+// time as binned_fun makes them: old scan, FiringRate::get_bins() per
+// unit, and the FiringRateMatrix pass.
+// usage: firingrate_bench [units] [requests/s] [spikes/s per unit]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include "gettime.h"
+#include "firingrate.h"
+
+using namespace std;
+
+#define NLAGS 20
+#define DURATION 1.0
+#define XFADE 0.3
+
+// the old get_bins(), on a copy of the ring
+struct OldRate {
+	double		ts[FR_LEN];
+	unsigned	w;
+
+	OldRate()
+	{
+		w = 0;
+		for (int i=0; i<FR_LEN; i++)
+			ts[i] = -1e10;
+	}
+	void add(double t)
+	{
+		ts[w & (FR_LEN-1)] = t;
+		w++;
+	}
+	void get_bins(double time, unsigned short *out)
+	{
+		int wi = w - 1;
+		int i = 0;
+		double lw = DURATION / NLAGS;
+		double t = 0;
+		double xf = lw*XFADE;
+		time -= xf/2;
+		for (int l=0; l<NLAGS; l++) out[l] = 0;
+		while (wi > 0 && i < FR_LEN && t < xf/-2.0) {
+			wi--;
+			i++;
+			t = time - ts[wi & (FR_LEN-1)];
+		}
+		for (int l=0; l<NLAGS+1; l++) {
+			double lag = l * lw;
+			t = time - ts[wi & (FR_LEN-1)];
+			while (wi >= 0 && i < FR_LEN && t < lag + lw - xf/2) {
+				double lerp = 0.5 + (t-lag)/xf;
+				lerp = lerp > 1.0 ? 1.0 : lerp;
+				lerp = lerp < 0.0 ? 0.0 : lerp;
+				if (l>0) out[l-1] += (unsigned short)round((1-lerp) * 128.0);
+				if (l<NLAGS) out[l] += (unsigned short)round(lerp * 128.0);
+				wi--;
+				i++;
+				t = time - ts[wi & (FR_LEN-1)];
+			}
+		}
+	}
+};
+
+int main(int argc, char **argv)
+{
+	int nunits = 384*5;
+	double rate = 50.0;
+	double fire = 20.0;
+	if (argc > 1)
+		nunits = atoi(argv[1]);
+	if (argc > 2)
+		rate = atof(argv[2]);
+	if (argc > 3)
+		fire = atof(argv[3]);
+	if (nunits < 1)
+		nunits = 1;
+	if (rate <= 0)
+		rate = 50.0;
+
+	vector<OldRate> old(nunits);
+	vector<FiringRate *> fr;
+	vector<FiringRate *> frm;	// the same spikes, for the matrix pass
+	for (int u=0; u<nunits; u++) {
+		fr.push_back(new FiringRate());
+		frm.push_back(new FiringRate());
+		fr[u]->set_bin_params(NLAGS, DURATION);
+		frm[u]->set_bin_params(NLAGS, DURATION);
+	}
+	FiringRateMatrix mat;
+	vector<unsigned short> a(nunits*NLAGS), b(nunits*NLAGS), c(nunits*NLAGS);
+	vector<unsigned short> s(nunits*NLAGS);
+
+	// 10 s of poisson spikes, requested at rate; every few requests the
+	// scan also answers one for a past time, as the fifo's explicit times
+	// can be
+	srand(1);
+	int nreq = (int)(10.0*rate);
+	double dt = 1.0 / rate;
+	double p = fire * 1e-4;	// per 100us step
+	double t = 0.0;
+	int maxerr = 0;
+	int scanerr = 0;
+	long nspikes = 0;
+	long nbins = 0;
+	double t_old = 0, t_new = 0, t_mat = 0;
+	for (int r=0; r<nreq; r++) {
+		double end = (r+1)*dt;
+		for (; t < end; t += 1e-4) {
+			for (int u=0; u<nunits; u++) {
+				if ((double)rand()/RAND_MAX < p) {
+					old[u].add(t);
+					fr[u]->add(t);
+					frm[u]->add(t);
+					nspikes++;
+				}
+			}
+		}
+		double q = end;
+		if (r > rate && r % 7 == 0) {
+			double past = end - 0.3 * (double)rand()/RAND_MAX;
+			for (int u=0; u<nunits; u++) {
+				old[u].get_bins(past, &a[u*NLAGS]);
+				fr[u]->get_bins_scan(past, &s[u*NLAGS]);
+			}
+			for (int i=0; i<nunits*NLAGS; i++)
+				scanerr = max(scanerr, abs((int)a[i] - (int)s[i]));
+		}
+
+		long double t0 = gettime();
+		for (int u=0; u<nunits; u++)
+			old[u].get_bins(q, &a[u*NLAGS]);
+		long double t1 = gettime();
+		for (int u=0; u<nunits; u++)
+			fr[u]->get_bins(q, &b[u*NLAGS]);
+		long double t2 = gettime();
+		mat.get_bins(frm.data(), nunits, q, c.data());
+		long double t3 = gettime();
+		t_old += (double)(t1 - t0);
+		t_new += (double)(t2 - t1);
+		t_mat += (double)(t3 - t2);
+
+		for (int i=0; i<nunits*NLAGS; i++) {
+			maxerr = max(maxerr, abs((int)a[i] - (int)b[i]));
+			maxerr = max(maxerr, abs((int)b[i] - (int)c[i]));
+			nbins += a[i] > 0;
+		}
+	}
+
+	printf("%d units x %d lags, %.0f requests/s, %.0f spikes/s per unit "
+	       "(%ld spikes, %ld nonzero bins)\n", nunits, NLAGS, rate, fire,
+	       nspikes, nbins);
+	printf("  old scan         %8.1f us/request\n", 1e6*t_old/nreq);
+	printf("  incremental      %8.1f us/request (%.1fx)\n", 1e6*t_new/nreq,
+	       t_old/t_new);
+	printf("  matrix pass      %8.1f us/request (%.1fx)\n", 1e6*t_mat/nreq,
+	       t_old/t_mat);
+	// the old code rounded each spike's share, so a bin can differ by
+	// up to one 1/128th per spike in its cross-fades
+	printf("  max bin difference %d/128; get_bins_scan() against the old "
+	       "code %d/128\n", maxerr, scanerr);
+
+	for (auto &f : fr)
+		delete f;
+	for (auto &f : frm)
+		delete f;
+	return 0;
+}
@@ -34,7 +34,6 @@
 #include <arpa/inet.h>
 #include <matio.h>
 #include <armadillo>
-#include <uuid.h>
 
 #include <boost/multi_array.hpp>
 #include <map>
@@ -61,13 +60,17 @@
 #include "mmaphelp.h"
 #include "fifohelp.h"
 #include "channel.h"
+#include "pcatrack.h"
 #include "artifact.h"
 #include "timesync.h"
 #include "matStor.h"
 #include "jacksnd.h"
 #include "filter.h"
+#include "filterbank.h"
+#include "butter.h"
 #include "spikebuffer.h"
 #include "artifact_filter.h"
+#include "artifact_chain.h"
 #include "nlms2.h"
 #include "util.h"
 
@@ -81,6 +84,15 @@
 #include "h5writer.h"
 #include "h5spikewriter.h"
 #include "h5analogwriter.h"
+#include "po8e_pool.h"
+#include "replay.h"
+#include "sortpool.h"
+#include "latency.h"
+#include "tmatch.h"
+#include "display.h"
+#include "display_shm.h"
+#include "rtsched.h"
+#include "pipeline.h"
 
 #include "fenv.h" // for debugging nan problems
 
@@ -94,16 +106,11 @@ using namespace std;
 using namespace arma;
 using namespace moodycamel; // for lockfree queues
 
-uuid_t	g_uuid;
-
 char	g_prefstr[256];
 
 float	g_cursPos[2];
 float	g_viewportSize[2] = {640, 480}; //width, height.
 
-class Channel;
-class Artifact;
-
 domainSocketClient g_sock;
 
 vector <VboTimeseries *> g_timeseries;
@@ -111,59 +118,24 @@ vector <VboRaster *> g_spikeraster;
 vector <VboRaster *> g_eventraster;
 // can do another raster vector for other types of rasters (icms ticks, etc)
 
-ReaderWriterQueue<mat *> g_filterbuf(1024); // for nlms filtering
-
-std::mutex g_po8e_mutex;
-vector <pair<ReaderWriterQueue<PO8Data *>*, po8e::card *>> g_dataqueues;
-size_t g_po8e_read_size = 16;
+GtkWidget *g_latencyLabel = nullptr;
 
 float g_zoomSpan = 1.0;
 
 bool g_vboInit = false;
 float	g_rasterSpan = 10.f; // %seconds.
 
+// the pipeline's g_sc and g_templates, as the Channels and Artifacts made here
 vector <Channel *> g_c;
-vector <FiringRate *> g_fr;
-TimeSync 	g_ts(SRATE_HZ); //keeps track of ticks (TDT time)
+vector <Artifact *> g_artifact;
 GLuint 		g_base;            // base display list for the font set.
 
-H5SpikeWriter	g_spikewriter;
-gboolean 		g_saveUnsorted = true;
-gboolean 		g_saveSpikeWF = true;
-
-H5AnalogWriter	g_analogwriter_postfilter;
-H5AnalogWriter	g_analogwriter_prefilter;
-
-vector <Artifact *> g_artifact;
-ICMSWriter g_icmswriter;
-
-gboolean g_lopassNeurons = false;
-gboolean g_hipassNeurons = false;
-
-#if defined KHZ_24
-vector <FilterButterBand_24k_500_3000> g_bandpass;
-vector <FilterButterLow_24k_3000> g_lopass;
-vector <FilterButterHigh_24k_500> g_hipass;
-double g_sr = 24414.0625;
-#elif defined KHZ_48
-vector <FilterButterBand_48k_500_3000> g_bandpass;
-vector <FilterButterLow_48k_3000> g_lopass;
-vector <FilterButterHigh_48k_500> g_hipass;
-double g_sr = 48828.1250;
-#else
-#error Bad sampling rate!
-#endif
+// viewing a gtkclientd's display streams, in place of running the pipeline
+DisplayShm *g_attach = nullptr;
+PcaEngine g_pcaEngine;	// the channels' pca, off the gui thread
 
-int g_whichAnalogSave = 0; // (1,2,3) -> (single,active,all)
-enum SAVE {
-	SAVE_SINGLE = 0,
-	SAVE_ENABLED,
-	SAVE_ALL
-};
 GtkWidget *g_whichAnalogSaveWidget;
 
-
-bool g_die = false;
 double g_pause_time = -1.0;
 gboolean g_pause = false;
 gboolean g_autoChOffset = false;
@@ -179,59 +151,16 @@ gboolean g_showContGrid = false;
 gboolean g_showContThresh = true;
 
 bool g_rtMouseBtn = false;
-gboolean g_saveICMSWF = true;
 
 // for drawing circles around pca points
 int 	g_polyChan = 0;
 bool 	g_addPoly = false;
 
-vector<int> g_channel {0,32,64,95};
-
-long double g_lastPo8eTime = 0.0;
-long double g_po8ePollInterval = 0.0;
-long double g_po8eAvgInterval = 0.0;
-
-int g_whichSpikePreEmphasis = 0;
-enum EMPHASIS {
-	EMPHASIS_NONE = 0,
-	EMPHASIS_ABS,
-	EMPHASIS_NEO
-};
-
-int g_whichAlignment = 0;
-enum ALIGN {
-	ALIGN_CROSSING = 0,
-	ALIGN_MIN,
-	ALIGN_MAX,
-	ALIGN_ABS,
-	ALIGN_SLOPE,
-	ALIGN_NEO
-};
-
-float g_minISI = 1.3; //ms
-float g_autoThreshold = -3.5; //standard deviations. default negative, w/e.
-float g_neoThreshold = 8;
 int g_spikesCols = 16;
 
-gboolean g_artifactFilterRun = false;
-ArtifactFilter *g_artifactFilter;
-
-gboolean g_trainArtifactNLMS = false;
-gboolean g_filterArtifactNLMS = false;
-ArtifactNLMS2 *g_nlms;
-
-gboolean g_enableArtifactSubtr = false;
-gboolean g_trainArtifactTempl = false;
-int g_numArtifactSamps = 1e4; 	// number of artifacts to use to build template
 int g_stimChanDisp = 0;	// number of artifact channels
 float g_artifactDispAtten = 0.1f;
 
-gboolean g_enableArtifactBlanking = false;
-int g_artifactBlankingSamps = 48;
-int g_artifactBlankingPreSamps = 24;
-
-gboolean g_enableStimClockBlanking = false;
-
 int g_mode = MODE_RASTERS;
 int g_drawmode[2] = {GL_POINTS, GL_LINE_STRIP};
 int	g_drawmodep = 1;
@@ -240,6 +169,7 @@ int g_blendmodep = 0;
 
 //global labels..
 GtkWidget *g_infoLabel;
+GtkWidget *g_writerLabel[4];	// spikes, icms, analog pre and post
 GtkWidget *g_channelSpin[4] = {nullptr,nullptr,nullptr,nullptr};
 GtkWidget *g_gainSpin[4] = {nullptr,nullptr,nullptr,nullptr};
 GtkWidget *g_apertureSpin[4*NSORT];
@@ -250,18 +180,14 @@ int g_uiRecursion = 0; //prevents programmatic changes to the UI
 
 void saveState()
 {
+	if (g_attach) {
+		// the daemon keeps (and saves) the settings it runs with
+		printf("Attached to %s: not saving preferences\n", DSHM_NAME);
+		return;
+	}
 	printf("Saving Preferences to %s\n", g_prefstr);
 	MatStor ms(g_prefstr); 	// no need to load before saving here
-	for (auto &c : g_c)
-		c->save(&ms);
-	for (auto &a : g_artifact)
-		a->save(&ms);
-	g_nlms->save(&ms);
-	ms.setInt("channel", g_channel);
-
-	ms.setStructValue("savemode", "unsorted_spikes", 0, (float)g_saveUnsorted);
-	ms.setStructValue("savemode", "spike_waveforms", 0, (float)g_saveSpikeWF);
-	ms.setStructValue("savemode", "icms_waveforms", 0, (float)g_saveICMSWF);
+	pipelineSave(ms);
 
 	ms.setStructValue("gui","draw_mode",0,(float)g_drawmodep);
 	ms.setStructValue("gui","blend_mode",0,(float)g_blendmodep);
@@ -270,11 +196,6 @@ void saveState()
 	ms.setStructValue("raster","show_threshold",0,(float)g_showContThresh);
 	ms.setStructValue("raster","span",0,g_rasterSpan);
 
-	ms.setStructValue("spike","pre_emphasis",0,(float)g_whichSpikePreEmphasis);
-	ms.setStructValue("spike","alignment_mode",0,(float)g_whichAlignment);
-	ms.setStructValue("spike","min_isi",0,g_minISI);
-	ms.setStructValue("spike","auto_threshold",0,g_autoThreshold);
-	ms.setStructValue("spike","neo_threshold",0,g_neoThreshold);
 	ms.setStructValue("spike","cols",0,(float)g_spikesCols);
 
 	ms.setStructValue("wf","show_unsorted",0,(float)g_showUnsorted);
@@ -286,25 +207,9 @@ void saveState()
 
 	ms.setStructValue("wf","span",0,g_zoomSpan);
 
-	ms.setStructValue("filter","lopass",0,(float)g_lopassNeurons);
-	ms.setStructValue("filter","hipass",0,(float)g_hipassNeurons);
-
-	ms.setStructValue("icms","filter_run",0,(float)g_artifactFilterRun);
-
-	ms.setStructValue("icms","lms_train",0,(float)g_trainArtifactNLMS);
-	ms.setStructValue("icms","lms_filter",0,(float)g_filterArtifactNLMS);
-
-	ms.setStructValue("icms","template_train",0,(float)g_trainArtifactTempl);
-	ms.setStructValue("icms","template_subtract",0,(float)g_enableArtifactSubtr);
-	ms.setStructValue("icms","template_numsamples",0,(float)g_numArtifactSamps);
 	ms.setStructValue("icms","template_chan_disp",0,(float)g_stimChanDisp);
 	ms.setStructValue("icms","template_chan_atten",0,g_artifactDispAtten);
 
-	ms.setStructValue("icms","blank_enable",0,(float)g_enableArtifactBlanking);
-	ms.setStructValue("icms","blank_samples",0,(float)g_artifactBlankingSamps);
-	ms.setStructValue("icms","blank_pre_samples",0,(float)g_artifactBlankingPreSamps);
-	ms.setStructValue("icms","blank_clock_enable",0,(float)g_enableStimClockBlanking);
-
 	ms.save();
 }
 void destroy(int)
@@ -652,19 +557,19 @@ expose1 (GtkWidget *da, GdkEventExpose *, gpointer )
 		u32 nplot = g_timeseries[0]->m_nplot;
 
 		//draw seconds / ms label here.
-		for (u32 i=0; i<nplot; i+=SRATE_HZ/5) {
+		for (u32 i=0; i<nplot; i+=g_sr/5) {
 			float x = 2.f*i/nplot-1.f + 2.f/g_viewportSize[0];
 			float y = 1.f - 13.f*2.f/g_viewportSize[1];
 			glRasterPos2f(x,y);
 			char buf[64];
-			snprintf(buf, 64, "%3.2f", i/SRATE_HZ);
+			snprintf(buf, 64, "%3.2f", i/g_sr);
 			glPrint(buf);
 		}
 
 		if (g_showContGrid) {
 			glColor4f(0.f, 0.8f, 0.75f, 0.35);
 			glBegin(GL_LINES);
-			for (u32 i=0; i<nplot; i+=SRATE_HZ/10) {
+			for (u32 i=0; i<nplot; i+=g_sr/10) {
 				float x = 2.f*i/nplot-1.f;
 				glVertex2f(x, 0.f);
 				glVertex2f(x, 1.f);
@@ -923,7 +828,7 @@ configure1(GtkWidget *da, GdkEventConfigure *, gpointer)
 			x->configure();
 			x->setVertexShader(g_vsThreshold);
 			x->setCGProfile(myCgVertexProfile);
-			x->setNPlot(g_zoomSpan * SRATE_HZ);
+			x->setNPlot(g_zoomSpan * g_sr);
 		}
 
 		for (auto &x : g_spikeraster) {
@@ -958,16 +863,22 @@ static gboolean rotate(gpointer user_data)
 	gdk_window_invalidate_rect(win, &allocation, FALSE);
 	gdk_window_process_updates (win, FALSE);
 
-	string s = g_ts.getInfo();
-	char str[256];
-	snprintf(str, 256, "\npo8e poll (avg): %.4Lf (ms)\n", g_po8eAvgInterval);
-	s += string(str);
+	string s = g_attach ? g_attach->info() : pipelineInfo();
+	s += g_pcaEngine.getInfo();
 	gtk_label_set_text(GTK_LABEL(g_infoLabel), s.c_str());
-
-	g_icmswriter.draw();
-	g_spikewriter.draw();
-	g_analogwriter_prefilter.draw();
-	g_analogwriter_postfilter.draw();
+	if (g_latencyLabel && !g_attach)
+		gtk_label_set_text(GTK_LABEL(g_latencyLabel), g_latmon.table().c_str());
+
+	string st[4] = {
+		g_spikewriter.status(),
+		g_icmswriter.status(),
+		g_analogwriter_prefilter.status(),
+		g_analogwriter_postfilter.status()
+	};
+	for (int i=0; i<4; i++) {
+		if (!st[i].empty())
+			gtk_label_set_text(GTK_LABEL(g_writerLabel[i]), st[i].c_str());
+	}
 
 	return TRUE;
 }
@@ -975,1039 +886,258 @@ void destroyGUI(GtkWidget *, gpointer)
 {
 	destroy(SIGINT);
 }
-void nlms_train()
-{
-	mat *X;
-	mat Y;
-	while (!g_die) {
-		int succeeded = 0;
-		int ndequeued = 0;
-		Y.reset();
-		while (ndequeued < 100 && !g_die) {
-			succeeded = g_filterbuf.try_dequeue(X);
-			if (succeeded) {
-				Y = join_rows(Y, *X);
-				delete X;
-				ndequeued++;
-				printf("q size: %zu\n", g_filterbuf.size_approx());
-			}
-		}
-
-		if (succeeded) {
-			g_nlms->train(Y);
-		} else {
-			usleep(1e3);
-		}
-	}
-}
-void sorter(int ch)
+// draws what the pipeline sends into the vbos; called from the worker and
+// the sorting threads (or from attach_fun()).
+class VboDisplay : public DisplaySink
 {
-	float 	wf_sp[2*NWFSAMP];
-	float 	neo_sp[2*NWFSAMP];
-	u32 	tk_sp[2*NWFSAMP];
-
-	float threshold;
-	if (g_whichSpikePreEmphasis == 2) {
-		threshold = g_neoThreshold;
-	} else {
-		threshold = g_c[ch]->getThreshold(); // 1 -> 10mV.
+public:
+	void timeseries(int h, float *x, size_t ns)
+	{
+		g_timeseries[h]->addData(x, ns);
+	}
+	void spike(int ch, int unit, u32, long double time, float *wf)
+	{
+		g_c[ch]->addWf(wf, unit, time, true);
+		if (unit > 0 && unit < NUNIT)
+			g_spikeraster[unit-1]->addEvent((float)time, ch);
+	}
+	void event(int chan, long double time)
+	{
+		// hardcode the zeroth element, maybe fix this XXX
+		if (g_eventraster.size() > 0)
+			g_eventraster[0]->addEvent((float)time, chan);
 	}
+};
+VboDisplay g_vboDisplay;
 
+// in place of the pipeline when attached to a gtkclientd: pull its display
+// streams into the vbos, and push our trace channels and sort settings back.
+// if another viewer has those, follow its channels and settings instead,
+// and take over when it goes.
+void attach_fun()
+{
+	DisplayShm *d = g_attach;
+	size_t nc = g_c.size();
+	double off = d->timeOffset();	// their clock to ours
+	vector<DisplayCtl> sent(nc);
+	for (size_t i=0; i<nc; i++)
+		ctlFromChannel(g_c[i], sent[i]);
+	vector<float> x(DSHM_TS_LEN);
+	vector<DisplaySpike> spk(1024);
+	vector<DisplayEvent> ev(256);
+	bool gone = false;
+	int frame = 0;
 
-	while (g_c[ch]->m_spkbuf.getSpike(tk_sp, wf_sp, neo_sp, 2*NWFSAMP, threshold, NWFSAMP, g_whichSpikePreEmphasis)) {
-		// ask for twice the width of a spike waveform so that we may align
-
-		int a = floor(NWFSAMP/2);
-		int b = floor(NWFSAMP/2)+NWFSAMP;
-
-		int centering = a;
-		float v;
-
-		switch (g_whichAlignment) {
-		case ALIGN_CROSSING:
-			//centering = (float)NWFSAMP - g_c[ch]->getCentering();
-			centering = g_c[ch]->getCentering() + a;
-			break;
-		case ALIGN_MIN:
-			v = FLT_MAX;
-			for (int i=a; i<b; i++) {
-				if (v > wf_sp[i]) {
-					v = wf_sp[i];
-					centering = i;
-				}
-			}
-			break;
-		case ALIGN_MAX:
-			v = FLT_MIN;
-			for (int i=a; i<b; i++) {
-				if (v < wf_sp[i]) {
-					v = wf_sp[i];
-					centering = i;
-				}
-			}
-
-			break;
-		case ALIGN_ABS:
-			v = FLT_MIN;
-			for (int i=a; i<b; i++) {
-				if (v < fabs(wf_sp[i])) {
-					v = fabs(wf_sp[i]);
-					centering = i;
-				}
-			}
-
-			break;
-		case ALIGN_SLOPE:
-			v = FLT_MIN;
-			for (int i=a; i<b; i++) {
-				if (v < wf_sp[i+1]-wf_sp[i]) {
-					v = wf_sp[i+1]-wf_sp[i];
-					centering = i;
-				}
-			}
-
-			break;
-		case ALIGN_NEO: {
-			v = FLT_MIN;
-			for (int i=a; i<b; i++) {
-				if (v < neo_sp[i]) {
-					v = neo_sp[i];
-					centering = i;
-				}
-			}
-		}
-		break;
-		default:
-			error("bad alignment type. exiting");
-			exit(1);
-		}
-
-		size_t idx = centering-(int)floor(NWFSAMP/2);
-
-		u32 tk = tk_sp[centering]; // alignment time
-
-		int unit = 0; // unsorted.
-		vec mse(NSORT);
-		mse.zeros();
-		for (int u=0; u<NSORT; u++) { // compare to template.
-			for (int j=0; j<NWFSAMP; j++) {
-				double r = wf_sp[idx+j] - g_c[ch]->m_template[u][j];
-				mse(u) += r*r;
+	while (!g_die) {
+		bool ctl = d->controlling();
+		for (int h=0; h<NFBUF; h++) {
+			if (ctl)
+				d->subscribe(h, g_channel[h]);
+			else
+				g_channel[h] = d->subscribed(h);
+			size_t ns = d->readTimeseries(h, x.data(), x.size());
+			if (ns > 0)
+				g_vboDisplay.timeseries(h, x.data(), ns);
+		}
+		size_t n;
+		while ((n = d->readSpikes(spk.data(), spk.size())) > 0) {
+			for (size_t i=0; i<n; i++) {
+				DisplaySpike &s = spk[i];
+				if (s.ch < 0 || s.ch >= (int)nc)
+					continue;
+				g_vboDisplay.spike(s.ch, s.unit, s.tk, s.time + off, s.wf);
+				g_c[s.ch]->updateISI(s.unit, s.tk); // does nothing for unit==0
 			}
 		}
-		mse /= NWFSAMP;
-		uword z;
-		double min_mse = mse.min(z);
-		if (min_mse < g_c[ch]->getAperture(z)) {
-			unit = z+1;
-		}
-
-		// check if this exceeds minimum ISI.
-		// wftick is indexed to the start of the waveform.
-		bool passed = true;
-		if (unit > 0) { // sorted
-			passed = (tk - g_c[ch]->m_lastSpike[unit-1]) > g_minISI*SRATE_KHZ;
-		}
-
-		if (passed) {
-			long double the_time = g_ts.getTime(tk);
-			g_c[ch]->addWf(&wf_sp[idx], unit, the_time, true);
-			g_c[ch]->updateISI(unit, tk); // does nothing for unit==0
-			if (g_spikewriter.isEnabled() && (unit > 0 || g_saveUnsorted)) {
-				SPIKE *s;
-				s = new SPIKE;	// deleted by other thread
-				s->ch = ch+1;	// 1-indexed
-				s->un = unit;
-				s->tk = tk;
-				s->ts = the_time;
-				if (g_saveSpikeWF) {
-					s->nwf = NWFSAMP;
-					s->wf = new float[s->nwf];
-					for (size_t g=0; g<s->nwf; g++) {
-						s->wf[g] = wf_sp[idx+g] * 1e4;
+		while ((n = d->readEvents(ev.data(), ev.size())) > 0) {
+			for (size_t i=0; i<n; i++)
+				g_vboDisplay.event(ev[i].chan, ev[i].time + off);
+		}
+		// ~10 Hz: whatever the gui changed goes to the daemon
+		if (++frame % 10 == 0) {
+			if (!ctl && d->control())
+				printf("now controlling the lanes and sort settings\n");
+			for (size_t i=0; i<nc; i++) {
+				DisplayCtl c;
+				if (!ctl) {
+					if (d->ctlChanged(i, c)) {
+						ctlToChannel(c, g_c[i]);
+						sent[i] = c;
 					}
-				} else {
-					s->nwf = 0;
-					s->wf = new float[0];
+					continue;
+				}
+				ctlFromChannel(g_c[i], c);
+				if (memcmp(&c, &sent[i], sizeof(c))) {
+					d->putCtl(i, c);
+					sent[i] = c;
 				}
-				g_spikewriter.add(s); // other thread deletes memory
 			}
-			if (unit > 0 && unit < NUNIT) {
-				int uu = unit-1;
-				g_fr[ch*NSORT+uu]->add(the_time);
-				g_spikeraster[uu]->addEvent((float)the_time, ch); // for drawing
-
-				// HACK HACK HACK
-				// XXX XXX XXX XX
-				// HACK HACK HACK
-
-				//if (ch == 0 && unit == 1) { //nb zero-indexed
-				//	if (!g_sock.Send(".")) {
-				//		warn("ack!");
-				//	}
-				//
-				//	auto o = new ICMS; // deleted by other thread
-				//	o->set_ts(the_time);
-				//	o->set_tick(tk);
-				//	o->set_stim_chan(2); // 1-indexed
-				//	g_icmswriter.add(o);
-				//}
+			if (!gone && !d->alive()) {
+				warn("gtkclientd has exited; the display has stopped");
+				gone = true;
 			}
 		}
+		usleep(1e4);
 	}
 }
-void spikewrite()
+void updateChannelUI(int k)
 {
-	while (!g_die) {
-		if (g_spikewriter.write()) //if it can write, it will.
-			usleep(1e4); //poll qicker.
-		else
-			usleep(1e5);
+	//called when a channel changes -- update the UI elements accordingly.
+	g_uiRecursion++;
+	int ch = g_channel[k];
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(g_gainSpin[k]), g_c[ch]->getGain());
+	for (int i=0; i<NSORT; i++) {
+		gtk_spin_button_set_value(GTK_SPIN_BUTTON(g_apertureSpin[k*NSORT+i]), g_c[ch]->getApertureUv(i));
 	}
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(g_enabledChkBx[k]), g_c[ch]->getEnabled());
+	g_uiRecursion--;
 }
-void icmswrite()
+static void channelSpinCB(GtkWidget *spinner, gpointer p)
 {
-	while (!g_die) {
-		if (g_icmswriter.write()) //if it can write, it will.
-			usleep(1e4); // poll quicker
-		else
-			usleep(1e5);
+	int k = (int)((i64)p & 0xf);
+	int ch = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(spinner));
+	ch--; // make zero indexed
+	int nc = (int)g_c.size();
+	debug("channelSpinCB: %d", ch+1);
+	if (ch < nc && ch >= 0 && ch != g_channel[k]) {
+		g_channel[k] = ch;
+		updateChannelUI(k); //update the UI too.
+	}
+	//if we are in sort mode, and k == 0, move the other channels ahead of us.
+	//this allows more PCA points for sorting!
+	if (k == 0 && g_autoChOffset) {
+		for (size_t j=1; j<g_channel.size(); j++) {
+			g_channel[j] = (g_channel[0] + j) % nc;
+			//this does not recurse -- have to set the other stuff manually.
+			g_uiRecursion++;
+			gtk_spin_button_set_value(GTK_SPIN_BUTTON(g_channelSpin[j]), (double)g_channel[j]+1);
+			g_uiRecursion--;
+		}
+		//loop over & update the UI afterward, so we don't have a race-case.
+		for (int j=1; j<4; j++) {
+			updateChannelUI(j);
+		}
 	}
 }
-void analogwrite_prefilter()
+static void gainSpinCB(GtkWidget *spinner, gpointer p)
 {
-	while (!g_die) {
-		if (g_analogwriter_prefilter.write()) // if it can write, it will
-			usleep(1e4); // poll quicker
-		else
-			usleep(1e5);
+	int x = (int)((i64)p & 0xf);
+	if (!g_uiRecursion) {
+		float gain = gtk_spin_button_get_value(GTK_SPIN_BUTTON(spinner));
+		debug("ch %d (%d) gainSpinCB: %f", g_channel[x], x, gain);
+		g_c[g_channel[x]]->setGain(gain);
+		g_c[g_channel[x]]->resetPca();
 	}
 }
-void analogwrite()
+static void basic_checkbox_cb(GtkWidget *button, gpointer p)
 {
-	while (!g_die) {
-		if (g_analogwriter_postfilter.write()) // if it can write, it will
-			usleep(1e4); // poll quicker
-		else
-			usleep(1e5);
-	}
+	gboolean *b = (gboolean *)p;
+	*b = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(button)) ?
+	     true :
+	     false;
+}
+static void basic_spinfloat_cb(GtkWidget *spinner, gpointer p)
+{
+	float *f = (float *)p;
+	*f = (float)gtk_spin_button_get_value(GTK_SPIN_BUTTON(spinner));
+}
+static void basic_spinint_cb(GtkWidget *spinner, gpointer p)
+{
+	int *x = (int *)p;
+	*x = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(spinner));
 }
-void po8e_fun(PO8e *p, ReaderWriterQueue<PO8Data *> *q)
+static void notebookPageChangedCB(GtkWidget *,
+                                  gpointer, int page, gpointer)
+{
+	// special-case the save tab (don't change the view)
+	g_mode = (page != 4) ? page : g_mode;
+}
+static GtkWidget *mk_spinner(const char *txt, GtkWidget *container,
+                             float start, float min, float max, float step,
+                             GtkCallback cb, gpointer data)
 {
-	size_t bufmax = 10000;	// must be >= 10000
+	GtkWidget *bx = gtk_hbox_new (FALSE, 1);
 
-	printf("Waiting for the stream to start ...\n");
-	//p->waitForDataReady(1);
-	while (p->samplesReady() == 0 && !g_die) {
-		usleep(5000);
-	}
+	GtkWidget *label = gtk_label_new (txt);
+	gtk_box_pack_start (GTK_BOX (bx), label, TRUE, TRUE, 2);
+	gtk_widget_show(label);
+	GtkObject *adj = gtk_adjustment_new(start, min, max, step, step, 0.0);
+	float climb = 0.0;
+	int digits = 0;
 
-	if (p == nullptr || g_die) {
-		return; /// xxx how to recover?
+	if (step <= 1e-6) {
+		climb = 1e-7;
+		digits = 7;
+	} else if (step <= 1e-5) {
+		climb = 1e-6;
+		digits = 6;
+	} else if (step <= 1e-4) {
+		climb = 1e-5;
+		digits = 5;
+	} else if (step <= 1e-3) {
+		climb = 1e-4;
+		digits = 4;
+	} else if (step <= 1e-2) {
+		climb = 1e-3;
+		digits = 3;
+	} else if (step <= 0.1) {
+		climb = 1e-2;
+		digits = 2;
+	} else if (step <= 0.99) {
+		climb = 0.1;
+		digits = 1;
 	}
 
-	auto nchan = p->numChannels();
-	auto bps = p->dataSampleSize(); // bytes/sample
-	printf("Card %p: %d channels @ %d bytes/sample\n", (void *)p, nchan, bps);
-
-	// 10000 samples * 2 bytes/sample * nChannels
-	auto buff = new i16[bufmax*(nchan)];
-	auto tick = new i64[bufmax];
-
-	// get the initial tick value. hopefully a small number
-	p->readBlock(buff, 1, tick);
-	i64 last_tick = tick[0] - 1;
-
-	while (!g_die) {
-
-		bool stopped = false;
-		size_t numSamples = p->samplesReady(&stopped);
-		if (stopped) {
-			warn("samplesReady() indicated that we are stopped: numSamples: %zu",
-			     numSamples);
-			break; // xxx how to recover?
-		}
+	GtkWidget *spinner = gtk_spin_button_new(
+	                         GTK_ADJUSTMENT(adj), climb, digits);
+	gtk_spin_button_set_wrap (GTK_SPIN_BUTTON(spinner), FALSE);
+	gtk_box_pack_start(GTK_BOX(bx), spinner, TRUE, TRUE, 2);
+	g_signal_connect(spinner, "value-changed", G_CALLBACK(cb), data);
+	gtk_widget_show(spinner);
 
-		if (numSamples >= g_po8e_read_size) {
-			if (numSamples > bufmax) {
-				warn("samplesReady() returned too many samples (buffer wrap?): %zu",
-				     numSamples);
-				numSamples = bufmax;
-			}
+	gtk_box_pack_start (GTK_BOX (container), bx, TRUE, TRUE, 2);
+	return spinner;
+}
+static GtkWidget *mk_radio(const char *txt, int ntxt,
+                           GtkWidget *container, bool vertical,
+                           const char *frameTxt, int radio_state, GtkCallback cb)
+{
+	GtkWidget *frame, *button, *modebox;
+	GSList *group;
 
+	frame = gtk_frame_new (frameTxt);
+	gtk_box_pack_start (GTK_BOX (container), frame, FALSE, FALSE, 0);
+	modebox = vertical ? gtk_vbox_new(FALSE, 2) : gtk_hbox_new(FALSE, 2);
+	gtk_container_add (GTK_CONTAINER (frame), modebox);
+	gtk_container_set_border_width (GTK_CONTAINER (modebox), 2);
+	gtk_widget_show(modebox);
 
-			size_t numRead;
+	char buf[256];
+	strncpy(buf, txt, 256);
+	char *a = strtok(buf, ",");
 
-			{
-				// warning: these braces are intentional
-				std::lock_guard<std::mutex> lock(g_po8e_mutex);
-				numRead = p->readBlock(buff, g_po8e_read_size, tick);
-				p->flushBufferedData(numRead);
-			}
+	button = gtk_radio_button_new_with_label (nullptr, (const char *)a );
+	gtk_box_pack_start (GTK_BOX (modebox), button, TRUE, TRUE, 0);
+	gtk_widget_show (button);
+	g_signal_connect (GTK_OBJECT (button), "clicked",
+	                  G_CALLBACK(cb), GINT_TO_POINTER(0));
 
-			if (tick[0] != last_tick + 1) {
-				warn("%p: PO8e tick glitch between blocks. Expected %zu got %zu",
-				     p, last_tick+1, tick[0]);
-				g_ts.m_dropped++;
-				// xxx how to recover?
-			}
-			for (size_t i=0; i<numRead-1; i++) {
-				if (tick[i+1] != tick[i] + 1) {
-					warn("%p: PO8e tick glitch within block. Expected %zu got %zu",
-					     p, tick[i]+1, tick[i+1]);
-					g_ts.m_dropped++;
-					// xxx how to recover?
-				}
-			}
-			last_tick = tick[numRead-1];
-
-			PO8Data *o;
-			o = new PO8Data;
-			o->data = new i16[nchan*numRead];
-			memcpy(o->data, buff, nchan*numRead*sizeof(i16));
-			o->numChannels = nchan;
-			o->numSamples = numRead;
-			o->tick = tick[0];
-			q->enqueue(o);
-			// NB the other thread frees o
-			// and the memory allocated to o->data
-		} else {
-			usleep(1e3);
-		}
+	for (int i=1; i<ntxt; i++) {
+		group = gtk_radio_button_get_group (GTK_RADIO_BUTTON (button));
+		a = strtok(nullptr, ",");
+		button = gtk_radio_button_new_with_label (group, (const char *)a );
+		gtk_toggle_button_set_active(
+		    GTK_TOGGLE_BUTTON(button),
+		    i == radio_state);
+		gtk_box_pack_start (GTK_BOX (modebox), button, TRUE, TRUE, 0);
+		gtk_widget_show (button);
+		g_signal_connect (GTK_OBJECT (button), "clicked",
+		                  G_CALLBACK (cb), GINT_TO_POINTER(i));
 	}
-
-	// delete buffers since we have dynamically allocated;
-	delete[] buff;
-	delete[] tick;
-
-	printf("  stopped collecting data\n");
-	p->stopCollecting();
-	printf("  releasing card %p\n", (void *)p);
-	PO8e::releaseCard(p);
-
-	printf("\n");
-	sleep(1);
+	return modebox;
 }
-
-void worker()
-{
-
-	vector<PO8Data *> p;
-	vector<po8e::card *> c;
-
-	while (!g_die) {
-
-		auto n = g_dataqueues.size();
-
-		p.clear();
-		c.clear();
-
-		for (size_t i=0; i<n; i++) {
-			auto q = g_dataqueues[i].first;
-			c.push_back(g_dataqueues[i].second);
-			int succeeded;
-			do {
-				PO8Data *x;
-				succeeded = q->try_dequeue(x);
-				if (succeeded)
-					p.push_back(x);
-				else
-					usleep(1e3);
-			} while (!succeeded && !g_die);
-		}
-
-		if (g_die) {
-			for (auto &x : p) {
-				delete[] (x->data);
-				delete x;
-			}
-			break;
-		}
-
-		auto mismatch = false;
-		for (size_t i=0; i<n; i++) {
-			if (p[i]->numSamples != p[0]->numSamples) {
-				warn("po8e card sample mismatch");
-				mismatch = true;
-				break;
-			}
-			if (p[i]->numChannels != (size_t)c[i]->channel_size()) {
-				warn("po8e card %d: configured for %d channels (%d received in po8e packet)",
-				     c[i]->id(), c[i]->channel_size(), p[i]->numChannels);
-				mismatch = true;
-				break;
-			}
-			if (p[i]->tick != p[0]->tick) {
-				warn("p08e ticks misaligned between cards");
-				mismatch = true;
-				break;
-			}
-		}
-
-		if (mismatch) // exit the worker; no data will be processed
-			break;
-
-		long double time = gettime();
-		g_po8ePollInterval = (time - g_lastPo8eTime)*1000.0;
-		g_po8eAvgInterval = g_po8eAvgInterval * 0.99 + g_po8ePollInterval * 0.01;
-		g_lastPo8eTime = time;
-
-		// also -- only accept stort-interval responses (ignore outliers..)
-		if (g_po8ePollInterval < g_po8eAvgInterval*1.5) {
-			g_ts.update(time, p[0]->tick); //also updates the mmap file.
-		}
-
-		auto ns = p[0]->numSamples;
-
-		auto tk 	= new i64[ns];
-		auto ts 	= new double[ns];
-		tk[0] = p[0]->tick;
-		ts[0] = g_ts.getTime(tk[0]);
-		for (size_t i=1; i < ns; i++) {
-			tk[i] = tk[i-1] + 1;
-			ts[i] = g_ts.getTime(tk[i]);
-		}
-
-		size_t nnc = g_c.size(); // num neural channels
-
-		auto f = new float[nnc * ns];
-		mat X(nnc, ns);
-		auto raw = new i16[nnc * ns];
-		size_t nc_i = 0;
-		for (size_t i=0; i<c.size(); i++) {
-			for (int j=0; j<c[i]->channel_size(); j++) {
-				if (c[i]->channel(j).data_type() == po8e::channel::NEURAL) {
-					auto scale_factor = g_c[nc_i]->m_scaleFactor;
-					for (size_t k=0; k<ns; k++) {
-						f[nc_i*ns+k] = (float)p[i]->data[j*ns+k]/scale_factor;
-						X(nc_i, k) = f[nc_i*ns+k];
-						raw[nc_i*ns+k] = p[i]->data[j*ns+k];
-					}
-					nc_i++;
-				}
-			}
-		}
-
-		// stim channels (and event channels generally)
-		size_t nec = 0; // num event channels
-		size_t nsc = 0; // num stim channels
-		for (auto &card : c) {
-			for (int j=0; j<card->channel_size(); j++) {
-				if (card->channel(j).data_type() == po8e::channel::EVENT) {
-					if (card->channel(j).name().compare("stim") == 0) {
-						nsc++;
-					} else {
-						nec++;
-					}
-				}
-			}
-		}
-		auto events = new bool[nec*ns];
-		auto stim 	= new bool[nsc*ns];
-		size_t ns_i = 0;
-		size_t ne_i = 0;
-		for (size_t i=0; i<c.size(); i++) {
-			for (int j=0; j<c[i]->channel_size(); j++) {
-				if (c[i]->channel(j).data_type() == po8e::channel::EVENT) {
-					if (c[i]->channel(j).name().compare("stim") == 0) {
-						for (size_t k=0; k<ns; k++) {
-							stim[ns_i*ns+k] = (bool)p[i]->data[j*ns+k];
-						}
-						ns_i++;
-					} else {
-						for (size_t k=0; k<ns; k++) {
-							events[ne_i*ns+k] = (bool)p[i]->data[j*ns+k];
-						}
-						ne_i++;
-					}
-				}
-			}
-		}
-
-		// free the po8e data packet
-		for (auto &x : p) {
-			delete[] (x->data);
-			delete x;
-		}
-
-		// hardcode the zeroth element, maybe fix this XXX
-		for (size_t k=0; k<ns; k++) {
-			for (size_t i=0; i<nsc; i++) {
-				if (stim[i*ns+k]) {
-					g_eventraster[0]->addEvent((float)ts[k], i); // to draw
-				}
-			}
-		}
-
-		// TODO:  need to be set. Keep empty for now
-		auto blank 	= new bool[ns];
-		//stim[k]  = (u16)(p[1].data[8*ns + k]);
-		//stim[k] += (u16)(p[1].data[9*ns + k]) << 16;
-		//blank[k] = p[1].data[10*ns + k] > 0;
-
-		// write (pre-filtered) broadband signal to disk
-		if (g_analogwriter_prefilter.isEnabled()) {
-
-			AD *ad; // analog data
-			ad = new AD; // deleted by other thread
-
-			ad->ns = ns;
-
-			ad->tk = new i64[ns];
-			memcpy(ad->tk, tk, ns*sizeof(i64));
-
-			ad->ts = new double[ns];
-			memcpy(ad->ts, ts, ns*sizeof(double));
-
-			switch (g_whichAnalogSave) {
-			case SAVE_SINGLE: {
-				ad->nc = 1;
-				int ch = g_channel[0];
-				ad->data = new i16[ns];
-				memcpy(ad->data, &raw[ch*ns], ns*sizeof(i16));
-				break;
-			}
-			case SAVE_ENABLED: {
-				u32 num_enabled = 0;
-				for (auto &ch : g_c) {
-					if (ch->getEnabled()) {
-						num_enabled++;
-					}
-				}
-				ad->data = new i16[num_enabled*ns];
-				size_t c_i = 0;
-				for (size_t ch=0; ch<nnc; ch++) {
-					if (g_c[ch]->getEnabled()) {
-						for (size_t k=0; k<ns; k++) {
-							ad->data[c_i*ns+k] = raw[ch*ns+k];
-						}
-						c_i++;
-					}
-				}
-				ad->nc = num_enabled;
-				break;
-			}
-			case SAVE_ALL: {
-				ad->nc = nnc;
-				ad->data = new i16[nnc*ns];
-				memcpy(ad->data, raw, nnc*ns*sizeof(i16));
-				break;
-			}
-			default:
-				error("bad analog save mode. exiting.");
-				exit(1);
-			}
-			// ad and associanted memory freed by other other thread
-			g_analogwriter_prefilter.add(ad);
-		}
-
-		// fill artifact filtering buffers (for other thread)
-		// we do both training and filtering before filtering
-		// on the intuition that it will work better this way
-
-		if (g_trainArtifactNLMS) {
-			auto Y = new mat(X);
-			g_filterbuf.enqueue(Y); // free on the other thread
-		}
-
-		// filter online here
-		if (g_filterArtifactNLMS) {
-			X -= g_nlms->filter(X);
-		}
-
-		// filter online here
-		if (g_artifactFilterRun) {
-			X -= g_artifactFilter->filter(X);
-		}
-
-		// big loop through samples
-		// TODO: make this use X, too
-		for (size_t k=0; k<ns; k++) {
-
-			for (size_t i=0; i<nsc; i++) {
-
-				//if (stim[i*ns+k]) {
-				//	printf("icms pulse\n");
-				//}
-
-				auto a = g_artifact[i];
-
-				if (stim[i*ns+k]) {
-					int z = 0;
-					for (int y=0; y<NARTPTR; y++) {
-						if (a->m_windex[y] == -1) {
-							a->m_windex[y] = 0;
-							a->m_rindex[y] = 0;
-							z++;
-							break;
-						}
-					}
-					if (z == NARTPTR) {
-						warn("STIM ARTIFACTS OVERLAP");
-					}
-				}
-
-				// update artifact-subtraction buffers
-				for (int z=0; z<NARTPTR; z++) {
-					i64 idx = a->m_windex[z]; // write pointer
-					if (idx != -1) {
-						for (int ch=0; ch<(int)nnc; ch++) {
-							a->m_now[ch*ARTBUF+idx] = f[ch*ns+k];
-						}
-						a->m_windex[z]++;
-						if (a->m_windex[z] >= ARTBUF) {
-							if (g_icmswriter.isEnabled()) {
-								auto o = new ICMS; // deleted by other thread
-								o->set_ts(g_ts.getTime(tk[k]-ARTBUF));
-								o->set_tick(tk[k]-ARTBUF);
-								o->set_stim_chan(i+1); // 1-indexed
-
-								if (g_saveICMSWF) {
-									for (int ch=0; ch<(int)nnc; ch++) {
-										ICMS_artifact *art = o->add_artifact();
-										art->set_rec_chan(ch+1); //1-indexed
-										for (int x=0; x<ARTBUF; x++) {
-											art->add_sample(a->m_now[ch*ARTBUF+x]);
-										}
-									}
-								}
-								g_icmswriter.add(o);
-							}
-							a->m_windex[z] = -1;
-
-							if ((g_trainArtifactTempl) &&
-							    (a->m_nsamples < g_numArtifactSamps)) {
-								a->m_nsamples++;
-
-								// for iterative update of average
-								float alpha = 1.f/a->m_nsamples;
-
-								for (int ch=0; ch<(int)nnc; ch++) {
-									for (int x=0; x<ARTBUF; x++) {
-										float cur = a->m_wav[ch*ARTBUF+x];
-										float now = a->m_now[ch*ARTBUF+x];
-										float nex = cur + alpha*(now-cur);
-										a->m_wav[ch*ARTBUF+x] = nex;
-									}
-								}
-							}
-						}
-					}
-
-					i64 ridx = a->m_rindex[z]; // read pointer
-
-					if (ridx == -1)
-						continue; // try next z-pointer
-
-					if (g_enableArtifactSubtr) {
-						for (int ch=0; ch<(int)nnc; ch++) {
-							f[ch*ns+k] -= a->m_wav[ch*ARTBUF+ridx];
-						}
-					}
-					// nb. updating the read pointer happens below,
-					// in the per-artifact blanking code block
-				}
-			}
-		}
-
-		for (size_t k=0; k<ns; k++) {
-
-			// post-artifact-removal filtering
-			for (size_t ch=0; ch<nnc; ch++) {
-
-				float samp = (float)X(ch, k);
-
-				if ( g_hipassNeurons &&  g_lopassNeurons)
-					g_bandpass[ch].Proc(&samp, &samp, 1);
-
-				if ( g_hipassNeurons && !g_lopassNeurons)
-					g_hipass[ch].Proc(&samp, &samp, 1);
-
-				if (!g_hipassNeurons &&  g_lopassNeurons)
-					g_lopass[ch].Proc(&samp, &samp, 1);
-
-				X(ch, k) = (double)samp;
-			}
-
-		}
-
-		// XXX TODO: MAKE THIS USE X TOO
-		for (size_t k=0; k<ns; k++) {
-
-			// blank based on artifact (must happen after filtering
-			for (auto &a : g_artifact) {
-				for (int z=0; z<NARTPTR; z++) {
-					i64 ridx = a->m_rindex[z]; // read pointer
-
-					if (ridx == -1)
-						break;
-
-					if (g_enableArtifactBlanking &&
-					    ridx >= g_artifactBlankingPreSamps &&
-					    ridx <  g_artifactBlankingPreSamps+g_artifactBlankingSamps) {
-						for (int ch=0; ch<(int)nnc; ch++) {
-							f[ch*ns+k] = 0.f;
-						}
-					}
-					a->m_rindex[z]++;
-					if (a->m_rindex[z] >= ARTBUF)
-						a->m_rindex[z] = -1;
-				}
-			}
-
-			// blank based on the stim clock (must happen last)
-			if (g_enableStimClockBlanking && blank[k]) {
-				for (int ch=0; ch<(int)nnc; ch++) {
-					// note that if we keep track of the last value from the
-					// previous loop through, we could do sample-and-hold
-					// rather than zero-out. which is better?
-					// nan-ing is also a good idea but poisons further
-					// computations
-					//f[ch*ns+k] = nanf("");
-					f[ch*ns+k] = 0.f;
-				}
-			}
-		}
-
-		// write (post-filtered) broadband signal to disk
-		if (g_analogwriter_postfilter.isEnabled()) {
-
-			AD *ad; // analog data
-			ad = new AD; // deleted by other thread
-
-			ad->ns = ns;
-
-			ad->tk = new i64[ns];
-			memcpy(ad->tk, &tk, ns*sizeof(i64));
-
-			ad->ts = new double[ns];
-			memcpy(ad->ts, &ts, ns*sizeof(double));
-
-			switch (g_whichAnalogSave) {
-			case SAVE_SINGLE: {
-				ad->nc = 1;
-				int ch = g_channel[0];
-				ad->data = new i16[ns];
-				memcpy(ad->data, &raw[ch*ns], ns*sizeof(i16));
-				break;
-			}
-			case SAVE_ENABLED: {
-				u32 num_enabled = 0;
-				for (auto &ch : g_c) {
-					if (ch->getEnabled()) {
-						num_enabled++;
-					}
-				}
-				ad->data = new i16[num_enabled*ns];
-				size_t c_i = 0;
-				for (size_t ch=0; ch<nnc; ch++) {
-					if (g_c[ch]->getEnabled()) {
-						for (size_t k=0; k<ns; k++) {
-							ad->data[c_i*ns+k] = raw[ch*ns+k];
-						}
-						c_i++;
-					}
-				}
-				ad->nc = num_enabled;
-				break;
-			}
-			case SAVE_ALL: {
-				ad->nc = nnc;
-				ad->data = new i16[nnc*ns];
-				memcpy(ad->data, raw, nnc*ns*sizeof(i16));
-				break;
-			}
-			default:
-				error("bad analog save mode. exiting.");
-				exit(1);
-			}
-			// ad and associanted memory freed by other other thread
-			g_analogwriter_postfilter.add(ad);
-		}
-
-		auto audio 	= new float[ns];
-
-		// input data is scaled from TDT so that 32767 = 10mV.
-		// send the data for one channel to jack
-		for (int h=0; h<NFBUF; h++) {
-			int ch = g_channel[h];
-			float gain = g_c[ch]->getGain();
-			for (size_t k=0; k<ns; k++) {
-				// scale into a reasonable range for audio
-				// and timeseries display
-				//float fg = f[ch*ns+k] * gain / 1e4;
-				float fg = (float)X(ch, k) * gain / 1e4;
-				g_timeseries[h]->addData(&fg, 1); // timeseries trace
-				if (h==0) {
-					audio[k] = fg;
-				}
-			}
-		}
-#ifdef JACK
-		jackAddSamples(audio, audio, ns);
-#endif
-
-		// package data for sorting / saving
-
-		for (auto &ch : g_c) {
-			//double m = ch->m_wfstats.mean();
-			for (size_t k=0; k<ns; k++) {
-				//auto x = f[ch->m_ch*ns+k] / 1e4; // scale so 1 = +10 mV
-				float x = (float)X(ch->m_ch, k) / 1e4; // scale so 1 = +10 mV
-				// 1 = +10mV; range = [-1 1] here.
-				ch->m_spkbuf.addSample(tk[k], x);
-
-				//update the channel running stats (means and stddevs, etc).
-				ch->m_wfstats(x);
-
-				//ch->m_var *= 0.999998;
-				//ch->m_var += 0.000002*(x-m)*(x-m);
-				//m *= 0.999997;
-				//m += 0.000003*x;
-			}
-			//ch->m_mean = m;
-		}
-
-		// sort -- see if samples pass threshold. if so, copy.
-		for (int ch=0; ch<(int)nnc; ch++) {
-			if (g_c[ch]->getEnabled()) { //XXX put this into channel class?
-				sorter(ch);
-			}
-		}
-
-		delete[] tk;
-		delete[] ts;
-		delete[] f;
-		delete[] raw;
-		delete[] audio;
-		delete[] events;
-		delete[] stim;
-		delete[] blank;
-	}
-}
-
-void flush_pipe(int fid)
-{
-	fcntl(fid, F_SETFL, O_NONBLOCK);
-	char *d = (char *)malloc(1024*8);
-	int r = read(fid, d, 1024*8);
-	printf("flushed %d bytes\n", r);
-	free(d);
-	int opts = fcntl(fid,F_GETFL);
-	opts ^= O_NONBLOCK;
-	fcntl(fid, F_SETFL, opts);
-}
-void mmap_fun()
-{
-	// sockets are too slow -- we need to memmap a file(s).
-	/* matlab can do this -- very well, too! e.g:
-	 * m = memmapfile('/tmp/binned.mmap', 'Format', {'uint16' [194 10] 'x'})
-	 * A = m.Data(1).x;
-	 * */
-	auto nc = g_fr.size();
-	// nb we assume that the number of lags is the same for all chans & units.
-	int nlags = g_fr[0]->get_lags();
-	size_t length = (nc+1)*nlags*sizeof(u16); // nc+1 because of counter
-	auto mmh = new mmapHelp(length, "/tmp/binned.mmap"); // xxx conf file?
-	volatile u16 *bin = (u16 *)mmh->m_addr;
-	mmh->prinfo();
-
-	auto pipe_out = new fifoHelp("/tmp/gtkclient_out.fifo"); // xxx conf file
-	pipe_out->prinfo();
-
-	auto pipe_in = new fifoHelp("/tmp/gtkclient_in.fifo"); // xxx conf file
-	pipe_in->setR(); // so we can poll
-	pipe_in->prinfo();
-
-	int frame = 0;
-	bin[nc*nlags] = 0;
-	bin[nc*nlags+1] = 0;
-	flush_pipe(pipe_out->m_fd);
-
-	while (!g_die) {
-		//printf("%d waiting for matlab...\n", frame);
-		if (pipe_in->Poll(1000)) {
-			double reqTime = 0.0;
-			int r = read(pipe_in->m_fd, &reqTime, 8); // send it the time you want to sample,
-			double end = (reqTime > 0) ? reqTime : (double)gettime(); // < 0 to bin 'now'
-			if (r >= 3) {
-				for (size_t i=0; i<nc; i++) {
-					g_fr[i]->get_bins(end, (u16 *)&(bin[i*nlags]));
-				}
-				bin[nc*nlags]++; //counter.
-				// N.B. seems we need to touch all memory to update the first page.
-				//msync(addr, length, MS_SYNC);
-				//  if made with shm_open, msync is ok -- no writes to disk.
-				usleep(100); //seems reliable with this in place.
-				write(pipe_out->m_fd, "go\n", 3);
-				//printf("sent pipe_out 'go'\n");
-			} else
-				usleep(100000); //does not seem to limit the frame rate, just the startup sync.
-			frame++;
-		}
-	}
-	delete mmh;
-	delete pipe_in;
-	delete pipe_out;
-}
-void updateChannelUI(int k)
-{
-	//called when a channel changes -- update the UI elements accordingly.
-	g_uiRecursion++;
-	int ch = g_channel[k];
-	gtk_spin_button_set_value(GTK_SPIN_BUTTON(g_gainSpin[k]), g_c[ch]->getGain());
-	for (int i=0; i<NSORT; i++) {
-		gtk_spin_button_set_value(GTK_SPIN_BUTTON(g_apertureSpin[k*NSORT+i]), g_c[ch]->getApertureUv(i));
-	}
-	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(g_enabledChkBx[k]), g_c[ch]->getEnabled());
-	g_uiRecursion--;
-}
-static void channelSpinCB(GtkWidget *spinner, gpointer p)
-{
-	int k = (int)((i64)p & 0xf);
-	int ch = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(spinner));
-	ch--; // make zero indexed
-	int nc = (int)g_c.size();
-	debug("channelSpinCB: %d", ch+1);
-	if (ch < nc && ch >= 0 && ch != g_channel[k]) {
-		g_channel[k] = ch;
-		updateChannelUI(k); //update the UI too.
-	}
-	//if we are in sort mode, and k == 0, move the other channels ahead of us.
-	//this allows more PCA points for sorting!
-	if (k == 0 && g_autoChOffset) {
-		for (size_t j=1; j<g_channel.size(); j++) {
-			g_channel[j] = (g_channel[0] + j) % nc;
-			//this does not recurse -- have to set the other stuff manually.
-			g_uiRecursion++;
-			gtk_spin_button_set_value(GTK_SPIN_BUTTON(g_channelSpin[j]), (double)g_channel[j]+1);
-			g_uiRecursion--;
-		}
-		//loop over & update the UI afterward, so we don't have a race-case.
-		for (int j=1; j<4; j++) {
-			updateChannelUI(j);
-		}
-	}
-}
-static void gainSpinCB(GtkWidget *spinner, gpointer p)
-{
-	int x = (int)((i64)p & 0xf);
-	if (!g_uiRecursion) {
-		float gain = gtk_spin_button_get_value(GTK_SPIN_BUTTON(spinner));
-		debug("ch %d (%d) gainSpinCB: %f", g_channel[x], x, gain);
-		g_c[g_channel[x]]->setGain(gain);
-		g_c[g_channel[x]]->resetPca();
-	}
-}
-static void basic_checkbox_cb(GtkWidget *button, gpointer p)
-{
-	gboolean *b = (gboolean *)p;
-	*b = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(button)) ?
-	     true :
-	     false;
-}
-static void basic_spinfloat_cb(GtkWidget *spinner, gpointer p)
-{
-	float *f = (float *)p;
-	*f = (float)gtk_spin_button_get_value(GTK_SPIN_BUTTON(spinner));
-}
-static void basic_spinint_cb(GtkWidget *spinner, gpointer p)
-{
-	int *x = (int *)p;
-	*x = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(spinner));
-}
-static void notebookPageChangedCB(GtkWidget *,
-                                  gpointer, int page, gpointer)
-{
-	// special-case the save tab (don't change the view)
-	g_mode = (page != 4) ? page : g_mode;
-}
-static GtkWidget *mk_spinner(const char *txt, GtkWidget *container,
-                             float start, float min, float max, float step,
-                             GtkCallback cb, gpointer data)
-{
-	GtkWidget *bx = gtk_hbox_new (FALSE, 1);
-
-	GtkWidget *label = gtk_label_new (txt);
-	gtk_box_pack_start (GTK_BOX (bx), label, TRUE, TRUE, 2);
-	gtk_widget_show(label);
-	GtkObject *adj = gtk_adjustment_new(start, min, max, step, step, 0.0);
-	float climb = 0.0;
-	int digits = 0;
-
-	if (step <= 1e-6) {
-		climb = 1e-7;
-		digits = 7;
-	} else if (step <= 1e-5) {
-		climb = 1e-6;
-		digits = 6;
-	} else if (step <= 1e-4) {
-		climb = 1e-5;
-		digits = 5;
-	} else if (step <= 1e-3) {
-		climb = 1e-4;
-		digits = 4;
-	} else if (step <= 1e-2) {
-		climb = 1e-3;
-		digits = 3;
-	} else if (step <= 0.1) {
-		climb = 1e-2;
-		digits = 2;
-	} else if (step <= 0.99) {
-		climb = 0.1;
-		digits = 1;
-	}
-
-	GtkWidget *spinner = gtk_spin_button_new(
-	                         GTK_ADJUSTMENT(adj), climb, digits);
-	gtk_spin_button_set_wrap (GTK_SPIN_BUTTON(spinner), FALSE);
-	gtk_box_pack_start(GTK_BOX(bx), spinner, TRUE, TRUE, 2);
-	g_signal_connect(spinner, "value-changed", G_CALLBACK(cb), data);
-	gtk_widget_show(spinner);
-
-	gtk_box_pack_start (GTK_BOX (container), bx, TRUE, TRUE, 2);
-	return spinner;
-}
-static GtkWidget *mk_radio(const char *txt, int ntxt,
-                           GtkWidget *container, bool vertical,
-                           const char *frameTxt, int radio_state, GtkCallback cb)
-{
-	GtkWidget *frame, *button, *modebox;
-	GSList *group;
-
-	frame = gtk_frame_new (frameTxt);
-	gtk_box_pack_start (GTK_BOX (container), frame, FALSE, FALSE, 0);
-	modebox = vertical ? gtk_vbox_new(FALSE, 2) : gtk_hbox_new(FALSE, 2);
-	gtk_container_add (GTK_CONTAINER (frame), modebox);
-	gtk_container_set_border_width (GTK_CONTAINER (modebox), 2);
-	gtk_widget_show(modebox);
-
-	char buf[256];
-	strncpy(buf, txt, 256);
-	char *a = strtok(buf, ",");
-
-	button = gtk_radio_button_new_with_label (nullptr, (const char *)a );
-	gtk_box_pack_start (GTK_BOX (modebox), button, TRUE, TRUE, 0);
-	gtk_widget_show (button);
-	g_signal_connect (GTK_OBJECT (button), "clicked",
-	                  G_CALLBACK(cb), GINT_TO_POINTER(0));
-
-	for (int i=1; i<ntxt; i++) {
-		group = gtk_radio_button_get_group (GTK_RADIO_BUTTON (button));
-		a = strtok(nullptr, ",");
-		button = gtk_radio_button_new_with_label (group, (const char *)a );
-		gtk_toggle_button_set_active(
-		    GTK_TOGGLE_BUTTON(button),
-		    i == radio_state);
-		gtk_box_pack_start (GTK_BOX (modebox), button, TRUE, TRUE, 0);
-		gtk_widget_show (button);
-		g_signal_connect (GTK_OBJECT (button), "clicked",
-		                  G_CALLBACK (cb), GINT_TO_POINTER(i));
-	}
-	return modebox;
-}
-static void mk_checkbox(const char *label, GtkWidget *container,
-                        gboolean *checkstate, GtkCallback cb)
+static void mk_checkbox(const char *label, GtkWidget *container,
+                        gboolean *checkstate, GtkCallback cb)
 {
 	GtkWidget *button = gtk_check_button_new_with_label(label);
 	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(button), *checkstate);
@@ -2179,24 +1309,6 @@ auto get_cwd = []()
 	char buf[512];
 	return ( getcwd(buf, sizeof(buf)) ? string(buf) : string("") );
 };
-auto mk_legal_filename = [](string basedir, string prefix, string ext)
-{
-	string f;
-	int count = 0;
-	int res = -1;
-	do {
-		stringstream s;
-		count++;
-		s.str("");
-		s << prefix << setfill('0') << setw(2) << count << ext;
-		f = s.str();
-		s.str("");
-		s << basedir << "/" << f;
-		string fn = s.str();
-		res = ::access(fn.c_str(), F_OK);
-	} while (!res);	// returns zero on success
-	return f;
-};
 static void openSaveSpikesFile(GtkWidget *, gpointer parent_window)
 {
 	string d = get_cwd();
@@ -2216,24 +1328,8 @@ static void openSaveSpikesFile(GtkWidget *, gpointer parent_window)
 	if (gtk_dialog_run (GTK_DIALOG (dialog)) == GTK_RESPONSE_ACCEPT) {
 		char *filename;
 		filename = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (dialog));
-		g_spikewriter.open(filename, g_c.size(), NSORT, NWFSAMP);
+		pipelineOpenSpikes(filename);
 		g_free (filename);
-
-		int max_str = 0;
-		for (size_t i=0; i<g_c.size(); i++) {
-			max_str = max_str > (int)g_c[i]->m_chanName.size() ?
-			          max_str : g_c[i]->m_chanName.size();
-		}
-		auto name = new char[max_str*g_c.size()];
-		for (size_t i=0; i<g_c.size(); i++) {
-			strncpy(&name[i*max_str], g_c[i]->m_chanName.c_str(),
-			        g_c[i]->m_chanName.size());
-		}
-		char uuid[37];
-		uuid_unparse(g_uuid, uuid);
-		g_spikewriter.setUUID(uuid);
-		g_spikewriter.setMetaData(g_sr, name, max_str);
-		delete[] name;
 	}
 	gtk_widget_destroy (dialog);
 }
@@ -2261,87 +1357,23 @@ static void openSaveICMSFile(GtkWidget *, gpointer parent_window)
 	}
 	gtk_widget_destroy (dialog);
 }
-static void openSaveAnalogPrefilterFile(GtkWidget *, gpointer parent_window)
+// the analog writers' channels are fixed once open
+static void lockAnalogSave()
 {
-	string d = get_cwd();
-	string f = mk_legal_filename(d, "analog_pre_", ".h5");
-
-	GtkWidget *dialog;
-	dialog = gtk_file_chooser_dialog_new ("Save Analog (pre-filter) File",
-	                                      (GtkWindow *)parent_window,
-	                                      GTK_FILE_CHOOSER_ACTION_SAVE,
-	                                      GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
-	                                      GTK_STOCK_SAVE, GTK_RESPONSE_ACCEPT,
-	                                      NULL);
-	gtk_file_chooser_set_do_overwrite_confirmation(
-	    GTK_FILE_CHOOSER (dialog), TRUE);
-	gtk_file_chooser_set_current_folder (GTK_FILE_CHOOSER (dialog),d.c_str());
-	gtk_file_chooser_set_current_name (GTK_FILE_CHOOSER (dialog),f.c_str());
-	if (gtk_dialog_run (GTK_DIALOG (dialog)) == GTK_RESPONSE_ACCEPT) {
-		char *filename;
-		filename = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (dialog));
-
-		size_t nc;
-		switch (g_whichAnalogSave) {
-		case SAVE_SINGLE: {
-			nc = 1;
-			break;
-		}
-		case SAVE_ENABLED: {
-			u32 num_enabled = 0;
-			for (size_t i=0; i< g_c.size(); i++) {
-				if (g_c[i]->getEnabled()) {
-					num_enabled++;
-				}
-			}
-			nc = num_enabled;
-			for (int i=0; i<4; i++) {
-				gtk_widget_set_sensitive(g_enabledChkBx[i], false);
-			}
-			break;
-		}
-		case SAVE_ALL: {
-			nc = g_c.size();
-			break;
-		}
-		default:
-			error("bad analog save mode. exiting.");
-			exit(1);
-		}
-
-		gtk_widget_set_sensitive(g_whichAnalogSaveWidget, false);
-
-		g_analogwriter_prefilter.open(filename, nc);
-		g_free(filename);
-
-		auto scale = new float[g_c.size()];
-		int max_str = 0;
-		for (size_t i=0; i<g_c.size(); i++) {
-			scale[i] = g_c[i]->m_scaleFactor;
-			max_str = max_str > (int)g_c[i]->m_chanName.size() ?
-			          max_str : g_c[i]->m_chanName.size();
-		}
-		auto name = new char[max_str*g_c.size()];
-		for (size_t i=0; i<g_c.size(); i++) {
-			strncpy(&name[i*max_str], g_c[i]->m_chanName.c_str(),
-			        g_c[i]->m_chanName.size());
+	if (g_whichAnalogSave == SAVE_ENABLED) {
+		for (int i=0; i<4; i++) {
+			gtk_widget_set_sensitive(g_enabledChkBx[i], false);
 		}
-		char uuid[37];
-		uuid_unparse(g_uuid, uuid);
-		g_analogwriter_prefilter.setUUID(uuid);
-		g_analogwriter_prefilter.setMetaData(g_sr, scale, name, max_str);
-		delete[] scale;
-		delete[] name;
 	}
-	gtk_widget_destroy (dialog);
+	gtk_widget_set_sensitive(g_whichAnalogSaveWidget, false);
 }
-static void openSaveAnalogFile(GtkWidget *, gpointer parent_window)
+static void openSaveAnalogPrefilterFile(GtkWidget *, gpointer parent_window)
 {
 	string d = get_cwd();
-	string f = mk_legal_filename(d, "analog_post_", ".h5");
+	string f = mk_legal_filename(d, "analog_pre_", ".h5");
 
 	GtkWidget *dialog;
-	dialog = gtk_file_chooser_dialog_new ("Save Analog File",
+	dialog = gtk_file_chooser_dialog_new ("Save Analog (pre-filter) File",
 	                                      (GtkWindow *)parent_window,
 	                                      GTK_FILE_CHOOSER_ACTION_SAVE,
 	                                      GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
@@ -2351,312 +1383,75 @@ static void openSaveAnalogFile(GtkWidget *, gpointer parent_window)
 	    GTK_FILE_CHOOSER (dialog), TRUE);
 	gtk_file_chooser_set_current_folder (GTK_FILE_CHOOSER (dialog),d.c_str());
 	gtk_file_chooser_set_current_name (GTK_FILE_CHOOSER (dialog),f.c_str());
-	if (gtk_dialog_run (GTK_DIALOG (dialog)) == GTK_RESPONSE_ACCEPT) {
-		char *filename;
-		filename = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (dialog));
-
-		size_t nc;
-		switch (g_whichAnalogSave) {
-		case SAVE_SINGLE: {
-			nc = 1;
-			break;
-		}
-		case SAVE_ENABLED: {
-			u32 num_enabled = 0;
-			for (size_t i=0; i< g_c.size(); i++) {
-				if (g_c[i]->getEnabled()) {
-					num_enabled++;
-				}
-			}
-			nc = num_enabled;
-			for (int i=0; i<4; i++) {
-				gtk_widget_set_sensitive(g_enabledChkBx[i], false);
-			}
-			break;
-		}
-		case SAVE_ALL: {
-			nc = g_c.size();
-			break;
-		}
-		default:
-			error("bad analog save mode. exiting.");
-			exit(1);
-		}
-
-		gtk_widget_set_sensitive(g_whichAnalogSaveWidget, false);
-
-		g_analogwriter_postfilter.open(filename, nc);
-		g_free(filename);
-
-		auto scale = new float[g_c.size()];
-		int max_str = 0;
-		for (size_t i=0; i<g_c.size(); i++) {
-			scale[i] = g_c[i]->m_scaleFactor;
-			max_str = max_str > (int)g_c[i]->m_chanName.size() ?
-			          max_str : g_c[i]->m_chanName.size();
-		}
-		auto name = new char[max_str*g_c.size()];
-		for (size_t i=0; i<g_c.size(); i++) {
-			strncpy(&name[i*max_str], g_c[i]->m_chanName.c_str(),
-			        g_c[i]->m_chanName.size());
-		}
-		char uuid[37];
-		uuid_unparse(g_uuid, uuid);
-		g_analogwriter_postfilter.setUUID(uuid);
-		g_analogwriter_postfilter.setMetaData(g_sr, scale, name, max_str);
-		delete[] scale;
-		delete[] name;
-	}
-	gtk_widget_destroy (dialog);
-}
-// make this an anonymous function since it's only called once
-static void getTemplateCB(GtkWidget *, gpointer _p)
-{
-	// unpack bits
-	u32 u = GPOINTER_TO_UINT(_p);
-	int i = (u >> 16) & 0xFFFF;
-	int ch = g_channel[i];
-	int un = u & 0xFFFF;
-
-	debug("ch: %d\t un: %d", ch, un);
-
-	g_c[ch]->updateTemplate(un);
-	//update the UI.
-	gtk_spin_button_set_value(GTK_SPIN_BUTTON(g_apertureSpin[i*NSORT+un]),
-	                          g_c[ch]->getApertureUv(un));
-	//remove the old poly, now that we've used it.
-	g_c[ch]->resetPoly();
-}
-
-int main(int argc, char **argv)
-{
-	using namespace gtkclient;
-
-	(void) signal(SIGINT, destroy);
-
-	pid_t mypid = getpid();
-
-	PROCTAB *pr = openproc(PROC_FILLSTAT);
-	proc_t pr_info;
-	memset(&pr_info, 0, sizeof(pr_info));
-	while (readproc(pr, &pr_info) != nullptr) {
-		if ((!strcmp(pr_info.cmd, "gtkclient")   ||
-		     !strcmp(pr_info.cmd, "timesync")) &&
-		    pr_info.tgid != mypid) {
-			error("already running with pid: %d", pr_info.tgid);
-			closeproc(pr);
-			return 1;
-		}
-	}
-	closeproc(pr);
-
-	uuid_generate(g_uuid);
-
-	string titlestr = "gtkclient (TDT) v2.00";
-
-#ifdef DEBUG
-	feenableexcept(FE_DIVBYZERO|FE_INVALID|FE_OVERFLOW);  // Enable (some) floating point exceptions
-	titlestr += " *** DEBUG ***";
-#endif
-
-	GtkWidget *window;
-	GtkWidget *da1;
-	GdkGLConfig *glconfig;
-	GtkWidget *box1, *box2, *box3, *box4;
-	GtkWidget *bx, *bx2, *v1, *label;
-	GtkWidget *paned;
-	GtkWidget *frame;
-
-	string s;
-
-	// Verify that the version of the library that we linked against is
-	// compatible with the version of the headers we compiled against.
-	GOOGLE_PROTOBUF_VERIFY_VERSION;
-
-	//FiringRate test_fr;
-	//test_fr.set_bin_params(15,1.0);
-	//test_fr.get_bins_test();
-
-	// load matlab preferences
-	if (argc > 1)
-		strncpy(g_prefstr, argv[1], 256);
-	else
-		strcpy(g_prefstr, "preferences.mat");
-	printf("using %s for settings\n", g_prefstr);
-
-	MatStor ms(g_prefstr);
-	ms.load();
-
-	auto fileExists = [](const char *f) {
-		struct stat sb;
-		int res = stat(f, &sb);
-		if (res == 0)
-			if (S_ISREG(sb.st_mode))
-				return true;
-		return false;
-	};
-
-	// load the lua-based po8e config
-	po8eConf pc;
-	bool conf_ok = false;
-	if (fileExists("po8e.rc")) {
-		conf_ok = pc.loadConf("po8e.rc");
-	} else if (fileExists("rc/po8e.rc")) {
-		conf_ok = pc.loadConf("rc/po8e.rc");
-	}
-	if (!conf_ok) {
-		error("No config file! Aborting!");
-		return 1;
-	}
-
-
-	g_po8e_read_size = pc.readSize();
-	printf("po8e read size:\t\t%zu\n", 	g_po8e_read_size);
-
-	auto nc = pc.numNeuralChannels();
-	printf("neural channels:\t%zu\n", 	nc);
-
-	printf("event channels:\t\t%zu\n", 	pc.numEventChannels());
-	printf("analog channels:\t%zu\n", 	pc.numAnalogChannels());
-	printf("ignored channels:\t%zu\n", 	pc.numIgnoredChannels());
-
-	if (nc == 0) {
-		error("No neural channels? Aborting!");
-		return 1;
-	}
-
-
-	for (size_t i=0; i<(nc*NSORT); i++) {
-		auto fr = new FiringRate();
-		fr->set_bin_params(20, 1.0); // nlags, duration (sec)
-		g_fr.push_back(fr);
-	}
-
-	size_t nc_i = 0;
-	for (auto &c : pc.cards) {
-		if (c->enabled()) {
-			for (int j=0; j<c->channel_size(); j++) {
-				if (c->channel(j).data_type() == po8e::channel::NEURAL) {
-					auto o = new Channel(nc_i, &ms);
-					o->m_chanName = c->channel(j).name();
-					float scale_factor = (float)c->channel(j).scale_factor();
-					scale_factor /= 1e6; // to get uV
-					o->m_scaleFactor = scale_factor;
-					g_c.push_back(o);
-					nc_i++;
-				}
-			}
-		}
-	}
-
-	g_artifactFilter = new ArtifactFilter(nc);
-	g_nlms = new ArtifactNLMS2(nc, &ms);
-	for (size_t i=0; i<nc; i++) {
-#if defined KHZ_24
-		g_bandpass.push_back(FilterButterBand_24k_500_3000());
-		g_lopass.push_back(FilterButterLow_24k_3000());
-		g_hipass.push_back(FilterButterHigh_24k_500());
-#elif defined KHZ_48
-		g_bandpass.push_back(FilterButterBand_48k_500_3000());
-		g_lopass.push_back(FilterButterLow_48k_3000());
-		g_hipass.push_back(FilterButterHigh_48k_500());
-#else
-#error Bad sampling rate!
-#endif
-	}
-	for (size_t i=0; i<g_channel.size(); i++) {
-		g_channel[i] = ms.getInt(i, "channel", i*16);
-		if (g_channel[i] < 0) g_channel[i] = 0;
-		if (g_channel[i] >= (int)nc) g_channel[i] = (int)nc-1;
-	}
-	for (int i=0; i<STIMCHAN; i++)
-		g_artifact.push_back(new Artifact(i, &ms));
-
-	for (int i=0; i<NFBUF; i++) {
-		g_timeseries.push_back(new VboTimeseries(NSAMP));
-	}
-
-	for (int i=0; i<NSORT; i++) {
-		VboRaster *o = new VboRaster(nc, NSBUF);
-		switch (i) {
-		case 0:
-			o->setColor(0.122, 0.471, 0.706, 0.3);	// blue
-			break;
-		case 1:
-			o->setColor(0.890, 0.102, 0.110, 0.3);	// red
-			break;
-		case 2:
-			o->setColor(0.200, 0.628, 0.173, 0.3);	// green
-			break;
-		case 3:
-			o->setColor(1.000, 0.489, 0.000, 0.3); // orange
-			break;
-		}
-		g_spikeraster.push_back(o);
-	}
-
-	// non-spike events
-	if (pc.numEventChannels() > 0) {
-		VboRaster *o = new VboRaster(pc.numEventChannels(), 2*NSBUF);
-		o->setColor(1.0, 1.0, 50.f/255.f, 0.75); // purple
-		g_eventraster.push_back(o);
-	}
-
-	g_saveUnsorted 	= (bool)ms.getStructValue("savemode", "unsorted_spikes", 0, (float)g_saveUnsorted);
-	g_saveSpikeWF  	= (bool)ms.getStructValue("savemode", "spike_waveforms", 0, (float)g_saveSpikeWF);
-	g_saveICMSWF	= (bool)ms.getStructValue("savemode", "icms_waveforms", 0, (float)g_saveICMSWF);
-
-	g_drawmodep = (int) ms.getStructValue("gui", "draw_mode", 0, (float)g_drawmodep);
-	g_blendmodep = (int) ms.getStructValue("gui", "blend_mode", 0, (float)g_blendmodep);
-
-	g_showContGrid = (bool) ms.getStructValue("raster", "show_grid", 0, (float)g_showContGrid);
-	g_showContThresh = (bool) ms.getStructValue("raster","show_threshold", 0, (float)g_showContThresh);
-	g_rasterSpan = ms.getStructValue("raster", "span", 0, g_rasterSpan);
-
-	g_whichSpikePreEmphasis = ms.getStructValue("spike", "pre_emphasis", 0, g_whichSpikePreEmphasis);
-	g_whichAlignment = ms.getStructValue("spike", "alignment_mode", 0, g_whichAlignment);
-	g_minISI = ms.getStructValue("spike", "min_isi", 0, g_minISI);
-	g_autoThreshold = ms.getStructValue("spike", "auto_threshold", 0, g_autoThreshold);
-	g_neoThreshold = ms.getStructValue("spike", "neo_threshold", 0, g_neoThreshold);
-	g_spikesCols = (int)ms.getStructValue("spike", "cols", 0, (float)g_spikesCols);
-
-	g_showUnsorted = (bool)ms.getStructValue("wf", "show_unsorted", 0, (float)g_showUnsorted);
-	g_showTemplate = (bool)ms.getStructValue("wf", "show_template", 0, (float)g_showTemplate);
-	g_showPca = (bool)ms.getStructValue("wf", "show_pca", 0, (float)g_showPca);
-	g_showWFVgrid = (bool)ms.getStructValue("wf", "show_grid", 0, (float)g_showWFVgrid);
-	g_showISIhist = (bool)ms.getStructValue("wf", "show_isi", 0, (float)g_showISIhist);
-	g_showWFstd = (bool)ms.getStructValue("wf", "show_std", 0, (float)g_showWFstd);
-	g_zoomSpan = ms.getStructValue("wf", "span", 0, g_zoomSpan);
-
-	g_lopassNeurons = (bool)ms.getStructValue("filter", "lopass", 0, (float)g_lopassNeurons);
-	g_hipassNeurons = (bool)ms.getStructValue("filter", "hipass", 0, (float)g_hipassNeurons);
-
-	g_artifactFilterRun = (bool)ms.getStructValue("icms", "filter_run", 0, (float)g_artifactFilterRun);
+	if (gtk_dialog_run (GTK_DIALOG (dialog)) == GTK_RESPONSE_ACCEPT) {
+		char *filename;
+		filename = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (dialog));
+		lockAnalogSave();
+		pipelineOpenAnalog(&g_analogwriter_prefilter, filename);
+		g_free(filename);
+	}
+	gtk_widget_destroy (dialog);
+}
+static void openSaveAnalogFile(GtkWidget *, gpointer parent_window)
+{
+	string d = get_cwd();
+	string f = mk_legal_filename(d, "analog_post_", ".h5");
 
-	g_trainArtifactNLMS = (bool)ms.getStructValue("icms", "lms_train", 0, (float)g_trainArtifactNLMS);
-	g_filterArtifactNLMS = (bool)ms.getStructValue("icms", "lms_filter", 0, (float)g_filterArtifactNLMS);
+	GtkWidget *dialog;
+	dialog = gtk_file_chooser_dialog_new ("Save Analog File",
+	                                      (GtkWindow *)parent_window,
+	                                      GTK_FILE_CHOOSER_ACTION_SAVE,
+	                                      GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+	                                      GTK_STOCK_SAVE, GTK_RESPONSE_ACCEPT,
+	                                      NULL);
+	gtk_file_chooser_set_do_overwrite_confirmation(
+	    GTK_FILE_CHOOSER (dialog), TRUE);
+	gtk_file_chooser_set_current_folder (GTK_FILE_CHOOSER (dialog),d.c_str());
+	gtk_file_chooser_set_current_name (GTK_FILE_CHOOSER (dialog),f.c_str());
+	if (gtk_dialog_run (GTK_DIALOG (dialog)) == GTK_RESPONSE_ACCEPT) {
+		char *filename;
+		filename = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (dialog));
+		lockAnalogSave();
+		pipelineOpenAnalog(&g_analogwriter_postfilter, filename);
+		g_free(filename);
+	}
+	gtk_widget_destroy (dialog);
+}
+// make this an anonymous function since it's only called once
+static void getTemplateCB(GtkWidget *, gpointer _p)
+{
+	// unpack bits
+	u32 u = GPOINTER_TO_UINT(_p);
+	int i = (u >> 16) & 0xFFFF;
+	int ch = g_channel[i];
+	int un = u & 0xFFFF;
 
-	g_trainArtifactTempl = (bool)ms.getStructValue("icms", "template_train", 0, (float)g_trainArtifactTempl);
-	g_enableArtifactSubtr = (bool)ms.getStructValue("icms", "template_subtract", 0, (float)g_enableArtifactSubtr);
-	g_numArtifactSamps = (int)ms.getStructValue("icms", "template_numsamples", 0, (float)g_numArtifactSamps);
-	g_stimChanDisp = (int)ms.getStructValue("icms", "template_chan_disp", 0, (float)g_stimChanDisp);
-	g_artifactDispAtten = ms.getStructValue("icms", "template_chan_atten", 0, g_artifactDispAtten);
+	debug("ch: %d\t un: %d", ch, un);
 
-	g_enableArtifactBlanking = (bool)ms.getStructValue("icms", "blank_enable", 0, (float)g_enableArtifactBlanking);
-	g_artifactBlankingSamps = (int)ms.getStructValue("icms", "blank_samples", 0, (float)g_artifactBlankingSamps);
-	g_artifactBlankingPreSamps = (int)ms.getStructValue("icms", "blank_pre_samples", 0, (float)g_artifactBlankingPreSamps);
-	g_enableStimClockBlanking = (bool)ms.getStructValue("icms", "blank_clock_enable", 0, (float)g_enableStimClockBlanking);
+	g_c[ch]->updateTemplate(un);
+	//update the UI.
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(g_apertureSpin[i*NSORT+un]),
+	                          g_c[ch]->getApertureUv(un));
+	//remove the old poly, now that we've used it.
+	g_c[ch]->resetPoly();
+}
 
-	//g_dropped = 0;
+// the window and everything in it; da gets the gl drawing area
+static GtkWidget *buildGUI(int *argc, char ***argv, const string &titlestr,
+                           GtkWidget **da)
+{
+	GtkWidget *window;
+	GtkWidget *da1;
+	GdkGLConfig *glconfig;
+	GtkWidget *box1, *box2, *box3, *box4;
+	GtkWidget *bx, *bx2, *v1, *label;
+	GtkWidget *paned;
+	GtkWidget *frame;
 
-	if (g_sock.Connect("/tmp/parasrv.sock")) {
-		printf("connected to parasrv socket\n");
-	} else {
-		warn("cannot connect to socket");
-	}
+	string s;
 
-	gtk_init (&argc, &argv);
-	gtk_gl_init(&argc, &argv);
+	gtk_init (argc, argv);
+	gtk_gl_init(argc, argv);
 
 	window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
 	gtk_window_set_title (GTK_WINDOW (window), titlestr.c_str());
@@ -2678,6 +1473,16 @@ int main(int argc, char **argv)
 	gtk_box_pack_start (GTK_BOX (bx), g_infoLabel, TRUE, TRUE, 0);
 	gtk_widget_show(g_infoLabel);
 
+	// per-stage latency: the tails, for closed loop
+	GtkWidget *expander = gtk_expander_new("latency");
+	g_latencyLabel = gtk_label_new("");
+	gtk_misc_set_alignment(GTK_MISC(g_latencyLabel), 0, 0);
+	PangoFontDescription *mono = pango_font_description_from_string("monospace 7");
+	gtk_widget_modify_font(g_latencyLabel, mono);
+	pango_font_description_free(mono);
+	gtk_container_add(GTK_CONTAINER(expander), g_latencyLabel);
+	gtk_box_pack_start(GTK_BOX(bx), expander, FALSE, FALSE, 0);
+
 	gtk_box_pack_start (GTK_BOX (v1), bx, FALSE, FALSE, 0);
 
 	// render 4-channel control blocks.
@@ -2742,7 +1547,7 @@ int main(int argc, char **argv)
 		float f = (float) gtk_spin_button_get_value(GTK_SPIN_BUTTON(_spin));
 		g_zoomSpan = f;
 		for (auto &x : g_timeseries)
-			x->setNPlot(f * SRATE_HZ);
+			x->setNPlot(f * g_sr);
 	}, nullptr);
 
 	mk_spinner("Raster span", box1,
@@ -2759,6 +1564,24 @@ int main(int argc, char **argv)
 	mk_checkbox("Lowpass", box2, &g_lopassNeurons, basic_checkbox_cb);
 	mk_checkbox("Highpass", box2, &g_hipassNeurons, basic_checkbox_cb);
 
+	// corners; the filter banks pick up the new design between blocks
+	mk_spinner("LP Hz", box2, g_lopassSpec.f1, 100, 10000, 100,
+	[](GtkWidget *_spin, gpointer) {
+		float f = (float)gtk_spin_button_get_value(GTK_SPIN_BUTTON(_spin));
+		g_lopassSpec.f1 = f;
+		g_bandpassSpec.f2 = f;
+		designFilter(g_lopass, g_lopassSpec);
+		designFilter(g_bandpass, g_bandpassSpec);
+	}, nullptr);
+	mk_spinner("HP Hz", box2, g_hipassSpec.f1, 1, 5000, 50,
+	[](GtkWidget *_spin, gpointer) {
+		float f = (float)gtk_spin_button_get_value(GTK_SPIN_BUTTON(_spin));
+		g_hipassSpec.f1 = f;
+		g_bandpassSpec.f1 = f;
+		designFilter(g_hipass, g_hipassSpec);
+		designFilter(g_bandpass, g_bandpassSpec);
+	}, nullptr);
+
 	gtk_widget_show (box1);
 	label = gtk_label_new("rasters");
 	gtk_label_set_angle(GTK_LABEL(label), 90);
@@ -2835,6 +1658,13 @@ int main(int argc, char **argv)
 	}
 	           );
 
+	mk_combobox("MSE,SAA", 2, box1, false, "Template Match",
+	            g_whichSortMetric,
+	[](GtkWidget *_w, gpointer) {
+		g_whichSortMetric = gtk_combo_box_get_active(GTK_COMBO_BOX(_w));
+	}
+	           );
+
 	// for the sorting, we show all waveforms (up to a point..)
 	//these should have a minimum enforced ISI.
 	mk_spinner("min ISI, ms", box1, g_minISI,
@@ -2921,6 +1751,8 @@ int main(int argc, char **argv)
 		if (gtk_dialog_run (GTK_DIALOG (dialog)) == GTK_RESPONSE_ACCEPT) {
 			char *fn = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
 			g_artifactFilter->loadWeights(fn);
+			g_artifactChain->update();
+			printf("artifact filter: %s\n", g_artifactFilter->form().c_str());
 			g_free(fn);
 		}
 		gtk_widget_destroy(dialog);
@@ -2931,6 +1763,7 @@ int main(int argc, char **argv)
 	mk_button("clear weights", box4,
 	[](GtkWidget *, gpointer) {
 		g_artifactFilter->clearWeights();
+		g_artifactChain->update();
 	}, nullptr);
 
 	// LMS
@@ -2962,8 +1795,19 @@ int main(int argc, char **argv)
 	mk_button("clear lms weights", box4,
 	[](GtkWidget *, gpointer) {
 		g_nlms->clearWeights();
+		g_artifactChain->update(true);
 	}, nullptr);
 
+	// block NLMS holds the weights for NLMS_BLOCK samples and updates
+	// them with two GEMMs; much cheaper at high channel counts
+	mk_radio("per sample,block", 2, box2, false, "lms update",
+	         g_nlms->getBlock() > 1 ? 1 : 0,
+	[](GtkWidget *_button, gpointer _p) {
+		if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(_button))) {
+			g_nlms->setBlock(((i64)_p & 0xf) ? NLMS_BLOCK : 0);
+		}
+	});
+
 	s = "Artifact Subtraction";
 	frame = gtk_frame_new (s.c_str());
 	gtk_box_pack_start (GTK_BOX (box1), frame, FALSE, FALSE, 1);
@@ -3071,6 +1915,13 @@ int main(int argc, char **argv)
 
 	mk_checkbox("Unsorted?", bxx2, &g_saveUnsorted,	basic_checkbox_cb);
 
+	mk_radio("groups,table", 2, box1, false, "spike file layout", g_spikeLayout,
+	[](GtkWidget *_button, gpointer _p) {
+		if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(_button))) {
+			g_spikeLayout = (int)((i64)_p & 0xf);
+		}
+	});
+
 
 	s = "Save ICMS";
 	frame = gtk_frame_new(s.c_str());
@@ -3151,6 +2002,15 @@ int main(int argc, char **argv)
 		}
 	});
 
+	mk_radio("none,deflate,lz4,zstd", H5C_NUM, box1, false, "analog compression",
+	         g_analogCodec,
+	[](GtkWidget *_button, gpointer _p) {
+		if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(_button))) {
+			g_analogCodec = (int)((i64)_p & 0xf);
+		}
+	});
+	mk_checkbox("delta pre-filter", box1, &g_analogDelta, basic_checkbox_cb);
+
 	mk_button("Stop All", box1,
 	[](GtkWidget *, gpointer) {
 		// TODO: signal to the other thread, let them close it.
@@ -3207,7 +2067,7 @@ int main(int argc, char **argv)
 	gtk_box_pack_start (GTK_BOX (bx), label, FALSE, FALSE, 0);
 	gtk_widget_show(label);
 	gtk_box_pack_start (GTK_BOX (v1), bx, TRUE, TRUE, 0);
-	g_spikewriter.registerWidget(label);
+	g_writerLabel[0] = label;
 
 	bx = gtk_hbox_new (FALSE, 3);
 	label = gtk_label_new ("");
@@ -3215,7 +2075,7 @@ int main(int argc, char **argv)
 	gtk_box_pack_start (GTK_BOX (bx), label, FALSE, FALSE, 0);
 	gtk_widget_show(label);
 	gtk_box_pack_start (GTK_BOX (v1), bx, TRUE, TRUE, 0);
-	g_icmswriter.registerWidget(label);
+	g_writerLabel[1] = label;
 
 	bx = gtk_hbox_new (FALSE, 3);
 	label = gtk_label_new ("");
@@ -3223,7 +2083,7 @@ int main(int argc, char **argv)
 	gtk_box_pack_start (GTK_BOX (bx), label, FALSE, FALSE, 0);
 	gtk_widget_show(label);
 	gtk_box_pack_start (GTK_BOX (v1), bx, TRUE, TRUE, 0);
-	g_analogwriter_prefilter.registerWidget(label);
+	g_writerLabel[2] = label;
 
 	bx = gtk_hbox_new (FALSE, 3);
 	label = gtk_label_new ("");
@@ -3231,7 +2091,7 @@ int main(int argc, char **argv)
 	gtk_box_pack_start (GTK_BOX (bx), label, FALSE, FALSE, 0);
 	gtk_widget_show(label);
 	gtk_box_pack_start (GTK_BOX (v1), bx, TRUE, TRUE, 0);
-	g_analogwriter_postfilter.registerWidget(label);
+	g_writerLabel[3] = label;
 
 	gtk_paned_add1(GTK_PANED(paned), v1);
 	gtk_paned_add2(GTK_PANED(paned), da1);
@@ -3277,6 +2137,234 @@ int main(int argc, char **argv)
 	// http://forums.fedoraforum.org/archive/index.php/t-242963.html
 	gtk_widget_set_can_focus(da1, true);
 
+	*da = da1;
+	return window;
+}
+int main(int argc, char **argv)
+{
+	using namespace gtkclient;
+
+	(void) signal(SIGINT, destroy);
+
+	// gtkclient [prefs.mat] [--replay file.h5 | --synth seconds]
+	//           [--speed x] [--loop] [--attach [name]]
+	// a replay plays a broadband file (or synthetic data, 0 s for no end)
+	// through the pipeline in place of the po8e cards, at x times real
+	// time, 0 for as fast as it goes. --attach runs no pipeline at all, and
+	// draws a gtkclientd's display streams instead (see display_shm.h).
+	const char *replayfn = nullptr;
+	double synthSecs = -1.0;
+	double replaySpeed = 1.0;
+	bool replayLoop = false;
+	const char *attachName = nullptr;
+	strcpy(g_prefstr, "preferences.mat");
+	bool havePrefs = false;
+	for (int i=1; i<argc; i++) {
+		string a = argv[i];
+		if (a == "--replay" && i+1 < argc) {
+			replayfn = argv[++i];
+		} else if (a == "--synth" && i+1 < argc) {
+			synthSecs = atof(argv[++i]);
+		} else if (a == "--speed" && i+1 < argc) {
+			replaySpeed = atof(argv[++i]);
+		} else if (a == "--loop") {
+			replayLoop = true;
+		} else if (a == "--attach") {
+			attachName = DSHM_NAME;
+			if (i+1 < argc && argv[i+1][0] == '/')
+				attachName = argv[++i];
+		} else if (a[0] != '-' && !havePrefs) {
+			strncpy(g_prefstr, argv[i], 256);
+			havePrefs = true;
+		}
+	}
+	bool replaying = replayfn != nullptr || synthSecs >= 0;
+	if (attachName && replaying) {
+		error("--attach takes no --replay or --synth; give those to gtkclientd");
+		return 1;
+	}
+
+	if (!attachName) {
+		pid_t mypid = getpid();
+
+		PROCTAB *pr = openproc(PROC_FILLSTAT);
+		proc_t pr_info;
+		memset(&pr_info, 0, sizeof(pr_info));
+		while (readproc(pr, &pr_info) != nullptr) {
+			if ((!strcmp(pr_info.cmd, "gtkclient")   ||
+			     !strcmp(pr_info.cmd, "gtkclientd")  ||
+			     !strcmp(pr_info.cmd, "timesync")) &&
+			    pr_info.tgid != mypid) {
+				error("already running with pid: %d", pr_info.tgid);
+				closeproc(pr);
+				return 1;
+			}
+		}
+		closeproc(pr);
+	}
+
+	string titlestr = "gtkclient (TDT) v2.00";
+	if (attachName)
+		titlestr += " [" + string(attachName) + "]";
+
+#ifdef DEBUG
+	feenableexcept(FE_DIVBYZERO|FE_INVALID|FE_OVERFLOW);  // Enable (some) floating point exceptions
+	titlestr += " *** DEBUG ***";
+#endif
+
+	GtkWidget *window = nullptr;
+	GtkWidget *da1 = nullptr;
+
+	// Verify that the version of the library that we linked against is
+	// compatible with the version of the headers we compiled against.
+	GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+	// load matlab preferences
+	printf("using %s for settings\n", g_prefstr);
+
+	MatStor ms(g_prefstr);
+	ms.load();
+
+	auto fileExists = [](const char *f) {
+		struct stat sb;
+		int res = stat(f, &sb);
+		if (res == 0)
+			if (S_ISREG(sb.st_mode))
+				return true;
+		return false;
+	};
+
+	// load the lua-based po8e config
+	po8eConf pc;
+	bool conf_ok = false;
+	if (fileExists("po8e.rc")) {
+		conf_ok = pc.loadConf("po8e.rc");
+	} else if (fileExists("rc/po8e.rc")) {
+		conf_ok = pc.loadConf("rc/po8e.rc");
+	}
+	if (!conf_ok) {
+		error("No config file! Aborting!");
+		return 1;
+	}
+
+	pipelineConfig(pc);
+
+	auto nc = pc.numNeuralChannels();
+	printf("neural channels:\t%zu\n", 	nc);
+
+	printf("event channels:\t\t%zu\n", 	pc.numEventChannels());
+	printf("analog channels:\t%zu\n", 	pc.numAnalogChannels());
+	printf("ignored channels:\t%zu\n", 	pc.numIgnoredChannels());
+
+	if (nc == 0) {
+		error("No neural channels? Aborting!");
+		return 1;
+	}
+
+	// the pipeline's channels and templates are ours, so they can draw
+	pipelineInit(pc, ms,
+	[](int ch, MatStor *m) -> SortChannel * {
+		auto o = new Channel(ch, m);
+		g_c.push_back(o);
+		return o;
+	},
+	[](int stim, size_t n, MatStor *m) -> ArtifactTemplate * {
+		auto o = new Artifact(stim, n, m);
+		g_artifact.push_back(o);
+		return o;
+	});
+
+	for (int i=0; i<NFBUF; i++) {
+		g_timeseries.push_back(new VboTimeseries(NSAMP));
+	}
+
+	for (auto &c : g_c)
+		g_pcaEngine.add(c->m_pcaTrack);
+	g_pcaEngine.start();
+
+	for (int i=0; i<NSORT; i++) {
+		VboRaster *o = new VboRaster(nc, NSBUF);
+		switch (i) {
+		case 0:
+			o->setColor(0.122, 0.471, 0.706, 0.3);	// blue
+			break;
+		case 1:
+			o->setColor(0.890, 0.102, 0.110, 0.3);	// red
+			break;
+		case 2:
+			o->setColor(0.200, 0.628, 0.173, 0.3);	// green
+			break;
+		case 3:
+			o->setColor(1.000, 0.489, 0.000, 0.3); // orange
+			break;
+		}
+		g_spikeraster.push_back(o);
+	}
+
+	// non-spike events
+	if (pc.numEventChannels() > 0) {
+		VboRaster *o = new VboRaster(pc.numEventChannels(), 2*NSBUF);
+		o->setColor(1.0, 1.0, 50.f/255.f, 0.75); // purple
+		g_eventraster.push_back(o);
+	}
+
+	g_drawmodep = (int) ms.getStructValue("gui", "draw_mode", 0, (float)g_drawmodep);
+	g_blendmodep = (int) ms.getStructValue("gui", "blend_mode", 0, (float)g_blendmodep);
+
+	g_showContGrid = (bool) ms.getStructValue("raster", "show_grid", 0, (float)g_showContGrid);
+	g_showContThresh = (bool) ms.getStructValue("raster","show_threshold", 0, (float)g_showContThresh);
+	g_rasterSpan = ms.getStructValue("raster", "span", 0, g_rasterSpan);
+
+	g_spikesCols = (int)ms.getStructValue("spike", "cols", 0, (float)g_spikesCols);
+
+	g_showUnsorted = (bool)ms.getStructValue("wf", "show_unsorted", 0, (float)g_showUnsorted);
+	g_showTemplate = (bool)ms.getStructValue("wf", "show_template", 0, (float)g_showTemplate);
+	g_showPca = (bool)ms.getStructValue("wf", "show_pca", 0, (float)g_showPca);
+	g_showWFVgrid = (bool)ms.getStructValue("wf", "show_grid", 0, (float)g_showWFVgrid);
+	g_showISIhist = (bool)ms.getStructValue("wf", "show_isi", 0, (float)g_showISIhist);
+	g_showWFstd = (bool)ms.getStructValue("wf", "show_std", 0, (float)g_showWFstd);
+	g_zoomSpan = ms.getStructValue("wf", "span", 0, g_zoomSpan);
+
+	g_stimChanDisp = (int)ms.getStructValue("icms", "template_chan_disp", 0, (float)g_stimChanDisp);
+	g_artifactDispAtten = ms.getStructValue("icms", "template_chan_atten", 0, g_artifactDispAtten);
+
+	//g_dropped = 0;
+
+	if (attachName) {
+		g_attach = new DisplayShm();
+		if (!g_attach->attach(attachName)) {
+			error("cannot attach to %s; is gtkclientd running?", attachName);
+			return 1;
+		}
+		if (g_attach->numChannels() != nc) {
+			error("%s has %zu channels; po8e.rc has %zu",
+			      attachName, g_attach->numChannels(), nc);
+			return 1;
+		}
+		// start from the daemon's sort settings, not our preferences
+		for (size_t i=0; i<nc; i++) {
+			DisplayCtl c;
+			if (g_attach->getCtl(i, c))
+				ctlToChannel(c, g_c[i]);
+		}
+		// nothing runs here at g_sr any more; the traces come decimated
+		g_sr = g_attach->samplingRate();
+		printf("attached to %s: traces at %.1f Hz\n", attachName, g_sr);
+		if (!g_attach->control())
+			printf("another viewer has the lanes and sort settings; "
+			       "following it\n");
+	} else {
+		g_display = &g_vboDisplay;
+	}
+
+	if (g_sock.Connect("/tmp/parasrv.sock")) {
+		printf("connected to parasrv socket\n");
+	} else {
+		warn("cannot connect to socket");
+	}
+
+	window = buildGUI(&argc, &argv, titlestr, &da1);
+
 	string asciiart = "\033[1m";
 	asciiart += "\n";
 	asciiart += "           _        _ \033[31m_\033[0m\033[1m\n";
@@ -3290,7 +2378,7 @@ int main(int argc, char **argv)
 	asciiart += "\033[0m";
 	printf("%s\n\n",asciiart.c_str());
 
-	printf("sampling rate: %f kHz\n", SRATE_KHZ);
+	printf("sampling rate: %f kHz\n", g_sr/1000.0);
 
 	printf("artifact buffer: %d samples\n",ARTBUF);
 
@@ -3298,118 +2386,60 @@ int main(int argc, char **argv)
 
 	vector <thread> threads;
 
-	printf("PO8e API Version %s\n", revisionString());
-	int totalcards = PO8e::cardCount();
-	printf("Found %d PO8e card(s) in the system.\n", totalcards);
-	if (totalcards < 1) {
-		error("Quitting");
-		return 1;
-	}
-
-	if (totalcards < (int)pc.cards.size()) {
-		error("config describes more po8e cards than detected");
-		return 1;
-	}
-
-	if (totalcards > (int)pc.cards.size()) {
-		totalcards = (int)pc.cards.size();
-	}
-
-	auto configureCard = [&](PO8e* p) -> bool {
-		// return true on success
-		// return false on failure
-		if (!p->startCollecting())
-		{
-			warn("startCollecting() failed with: %d", p->getLastError());
-			p->flushBufferedData();
-			p->stopCollecting();
-			printf(" -> Releasing card %p\n", (void *)p);
-			PO8e::releaseCard(p);
-			return false;
-		}
-		printf(" -> Card %p is collecting incoming data.\n", (void *)p);
-		return true;
-	};
-
-	for (int i=0; i<totalcards; i++) {
-		if (pc.cards[i]->enabled()) {
-			int id = (int)pc.cards[i]->id();
-			PO8e *p = PO8e::connectToCard(id-1); // 0-indexed
-			if (p == nullptr) {
-				break;
-			}
-			printf("Connection established to card %d at %p\n", id, (void *)p);
-			if (configureCard(p)) {
-				ReaderWriterQueue<PO8Data *> *q = new ReaderWriterQueue<PO8Data *>(512);
-				threads.push_back(thread(po8e_fun, p, q));
-				g_dataqueues.push_back(pair<ReaderWriterQueue<PO8Data *>*, po8e::card *>(q, pc.cards[i]));
-			}
-		}
-	}
-
-	if (g_dataqueues.size() < 1) {
-		error("Connected to zero po8e cards");
-		return 1;
+	ReplaySource replay;
+	if (attachName) {
+		threads.push_back(thread(attach_fun));
+	} else {
+		bool ok = replaying ?
+		          pipelineOpenReplay(pc, &replay, replayfn, synthSecs,
+		                             replaySpeed, replayLoop, threads) :
+		          pipelineOpenCards(pc, threads);
+		if (!ok)
+			return 1;
+		pipelineStart(threads);
 	}
 
-	threads.push_back(thread(worker));
-	threads.push_back(thread(spikewrite));
-	threads.push_back(thread(icmswrite));
-	threads.push_back(thread(analogwrite_prefilter));
-	threads.push_back(thread(analogwrite));
-	threads.push_back(thread(mmap_fun));
-	threads.push_back(thread(nlms_train));
-
 	gtk_widget_show_all(window);
+	if (attachName) {
+		// recording is the daemon's
+		gtk_widget_set_sensitive(
+		    gtk_notebook_get_nth_page(GTK_NOTEBOOK(g_notebook), MODE_SAVE),
+		    false);
+	}
 
 	g_timeout_add(1000 / 30, rotate, da1);
 
-	//jack.
-#ifdef JACK
-	warn("starting jack");
-	jackInit("gtkclient", JACKPROCESS_RESAMPLE);
-	jackConnectFront();
-	jackSetResample(SRATE_HZ/SAMPFREQ);
-#endif
-
+	// last: threads started from here on (gtk's, gl's) take the gui's cpus
+	rtEnter(RT_GUI, NULL);
 	gtk_main(); // gtk itself uses three threads, it seems
 
-#ifdef JACK
-	jackClose(0);
-#endif
-
 	KillFont();
 	// Optional:  Delete all global objects allocated by libprotobuf.
 	google::protobuf::ShutdownProtobufLibrary();
 
-	for (auto &thread : threads) {
-		thread.join();
+	if (attachName) {
+		for (auto &thread : threads)
+			thread.join();
+	} else {
+		pipelineJoin(threads);
 	}
 
-	// these should automatically be closed when their destructor is called
-	// however it should be safe to manually close after their thread is
-	// joined and finished
-	g_spikewriter.close();
-	g_icmswriter.close();
-	g_analogwriter_prefilter.close();
-	g_analogwriter_postfilter.close();
-
-	for (auto &q : g_dataqueues) {
-		delete q.first;
-		// q.second is deleted when the po8e_conf object is destructed
-	}
+	if (replaying)
+		pipelineReport(&replay);
 
-	// clean out our standard vectors
-	for (auto &o : g_c)
-		delete o;
+	g_display = nullptr;
+	delete g_attach;
+
+	g_pcaEngine.stop();	// before the Channels it reads go
+
+	// the Channels and Artifacts go with the pipeline's
+	pipelineFree();
+	g_c.clear();
+	g_artifact.clear();
 	for (auto &o : g_spikeraster)
 		delete o;
 	for (auto &o : g_timeseries)
 		delete o;
-	for (auto &o : g_artifact)
-		delete o;
-	for (auto &o : g_fr)
-		delete o;
 
 	if (g_vsFadeColor)
 		delete g_vsFadeColor;
@@ -0,0 +1,259 @@
+// gtkclientd: the gtkclient pipeline with no window and no gl. it sorts,
+// records and serves the binned rates exactly as gtkclient does, and
+// publishes decimated traces, spikes and stim events to shared memory for
+// any number of `gtkclient --attach` viewers; the first of them drives the
+// trace lanes and sort settings (see display_shm.h).
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <proc/readproc.h>
+#include <thread>
+#include <vector>
+#include <string>
+
+#include "po8e_conf.h"	// protobuf before util.h's type macros
+#include "gettime.h"
+#include "gtkclient.h"
+#include "util.h"
+#include "matStor.h"
+#include "replay.h"
+#include "latency.h"
+#include "sortchannel.h"
+#include "artifact_engine.h"
+#include "display_shm.h"
+#include "pipeline.h"
+
+using namespace std;
+
+static void destroy(int)
+{
+	g_die = true;	// main saves and cleans up
+}
+
+// gtkclient and gtkclientd both want the cards; viewers don't count
+static bool alreadyRunning()
+{
+	pid_t mypid = getpid();
+	bool found = false;
+	PROCTAB *pr = openproc(PROC_FILLSTAT | PROC_FILLCOM);
+	proc_t pr_info;
+	memset(&pr_info, 0, sizeof(pr_info));
+	while (readproc(pr, &pr_info) != nullptr) {
+		if (pr_info.tgid == mypid)
+			continue;
+		bool viewer = false;
+		for (int i=1; pr_info.cmdline && pr_info.cmdline[i]; i++) {
+			if (!strcmp(pr_info.cmdline[i], "--attach"))
+				viewer = true;
+		}
+		if ((!strcmp(pr_info.cmd, "gtkclient") && !viewer) ||
+		    !strcmp(pr_info.cmd, "gtkclientd") ||
+		    !strcmp(pr_info.cmd, "timesync")) {
+			error("already running with pid: %d", pr_info.tgid);
+			found = true;
+			break;
+		}
+	}
+	closeproc(pr);
+	return found;
+}
+
+int main(int argc, char **argv)
+{
+	(void) signal(SIGINT, destroy);
+	(void) signal(SIGTERM, destroy);
+
+	// gtkclientd [prefs.mat] [--replay file.h5 | --synth seconds]
+	//            [--speed x] [--loop] [--shm name] [--decim n]
+	//            [--save dir] [--prefilter]
+	// the replay options are gtkclient's. --decim thins the published
+	// traces (peak-picked, so spikes survive); --save records spikes, icms
+	// and post-filter broadband to dir from the start, --prefilter the
+	// pre-filter broadband too.
+	const char *replayfn = nullptr;
+	double synthSecs = -1.0;
+	double replaySpeed = 1.0;
+	bool replayLoop = false;
+	const char *shmName = DSHM_NAME;
+	int decim = 4;
+	const char *saveDir = nullptr;
+	bool savePrefilter = false;
+	char prefstr[256];
+	strcpy(prefstr, "preferences.mat");
+	bool havePrefs = false;
+	for (int i=1; i<argc; i++) {
+		string a = argv[i];
+		if (a == "--replay" && i+1 < argc) {
+			replayfn = argv[++i];
+		} else if (a == "--synth" && i+1 < argc) {
+			synthSecs = atof(argv[++i]);
+		} else if (a == "--speed" && i+1 < argc) {
+			replaySpeed = atof(argv[++i]);
+		} else if (a == "--loop") {
+			replayLoop = true;
+		} else if (a == "--shm" && i+1 < argc) {
+			shmName = argv[++i];
+		} else if (a == "--decim" && i+1 < argc) {
+			decim = atoi(argv[++i]);
+		} else if (a == "--save" && i+1 < argc) {
+			saveDir = argv[++i];
+		} else if (a == "--prefilter") {
+			savePrefilter = true;
+		} else if (a[0] != '-' && !havePrefs) {
+			strncpy(prefstr, argv[i], 255);
+			prefstr[255] = 0;
+			havePrefs = true;
+		} else {
+			error("unknown option %s", argv[i]);
+			return 1;
+		}
+	}
+	bool replaying = replayfn != nullptr || synthSecs >= 0;
+	if (shmName[0] != '/') {
+		error("--shm takes a name starting with /, as shm_open() does");
+		return 1;
+	}
+	if (decim < 1)
+		decim = 1;
+
+	if (alreadyRunning())
+		return 1;
+
+	GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+	printf("using %s for settings\n", prefstr);
+	MatStor ms(prefstr);
+	ms.load();
+
+	po8eConf pc;
+	struct stat sb;
+	bool conf_ok = false;
+	if (stat("po8e.rc", &sb) == 0 && S_ISREG(sb.st_mode)) {
+		conf_ok = pc.loadConf("po8e.rc");
+	} else if (stat("rc/po8e.rc", &sb) == 0 && S_ISREG(sb.st_mode)) {
+		conf_ok = pc.loadConf("rc/po8e.rc");
+	}
+	if (!conf_ok) {
+		error("No config file! Aborting!");
+		return 1;
+	}
+
+	pipelineConfig(pc);
+
+	size_t nc = pc.numNeuralChannels();
+	printf("neural channels:\t%zu\n", 	nc);
+	printf("event channels:\t\t%zu\n", 	pc.numEventChannels());
+	printf("analog channels:\t%zu\n", 	pc.numAnalogChannels());
+	printf("ignored channels:\t%zu\n", 	pc.numIgnoredChannels());
+	if (nc == 0) {
+		error("No neural channels? Aborting!");
+		return 1;
+	}
+
+	pipelineInit(pc, ms,
+	[](int ch, MatStor *m) {
+		return new SortChannel(ch, m);
+	},
+	[](int stim, size_t n, MatStor *m) {
+		return new ArtifactTemplate(stim, n, m);
+	});
+
+	g_startTime = gettime();
+
+	// viewers see our clock through the segment, so this comes after
+	DisplayShm shm;
+	if (!shm.create(shmName, nc, g_sr, decim)) {
+		error("cannot create %s", shmName);
+		return 1;
+	}
+	for (size_t i=0; i<nc; i++) {
+		DisplayCtl c;
+		ctlFromChannel(g_sc[i], c);
+		shm.putCtl(i, c);
+	}
+	for (int h=0; h<NFBUF; h++)
+		shm.subscribe(h, g_channel[h]);
+	g_display = &shm;
+	printf("display:\t\t%s, traces at %.1f Hz\n", shmName, shm.samplingRate());
+
+	if (saveDir) {
+		string d = saveDir;
+		string f = d + "/" + mk_legal_filename(d, "spikes_", ".h5");
+		if (!pipelineOpenSpikes(f.c_str()))
+			warn("cannot record spikes to %s", f.c_str());
+		f = d + "/" + mk_legal_filename(d, "icms_", ".pbd");
+		g_icmswriter.open(f.c_str());
+		f = d + "/" + mk_legal_filename(d, "analog_post_", ".h5");
+		if (!pipelineOpenAnalog(&g_analogwriter_postfilter, f.c_str()))
+			warn("cannot record broadband to %s", f.c_str());
+		if (savePrefilter) {
+			f = d + "/" + mk_legal_filename(d, "analog_pre_", ".h5");
+			if (!pipelineOpenAnalog(&g_analogwriter_prefilter, f.c_str()))
+				warn("cannot record broadband to %s", f.c_str());
+		}
+	}
+
+	vector <thread> threads;
+	ReplaySource replay;
+	bool ok = replaying ?
+	          pipelineOpenReplay(pc, &replay, replayfn, synthSecs,
+	                             replaySpeed, replayLoop, threads) :
+	          pipelineOpenCards(pc, threads);
+	if (!ok) {
+		g_die = true;
+		pipelineJoin(threads);
+		pipelineFree();
+		return 1;
+	}
+	pipelineStart(threads);
+
+	// the viewers' side of the segment, at 10 Hz
+	int frame = 0;
+	while (!g_die && !(replaying && g_replayDone)) {
+		for (int h=0; h<NFBUF; h++) {
+			int ch = shm.subscribed(h);
+			if (ch >= 0 && ch < (int)nc)
+				g_channel[h] = ch;
+		}
+		for (size_t i=0; i<nc; i++) {
+			DisplayCtl c;
+			if (shm.ctlChanged(i, c))
+				ctlToChannel(c, g_sc[i]);
+		}
+		if (++frame % 10 == 0) {
+			string s = pipelineInfo();
+			string w[4] = {
+				g_spikewriter.status(),
+				g_icmswriter.status(),
+				g_analogwriter_prefilter.status(),
+				g_analogwriter_postfilter.status()
+			};
+			for (auto &x : w) {
+				if (!x.empty())
+					s += x + "\n";
+			}
+			shm.setInfo(s + "\n" + g_latmon.table());
+		}
+		usleep(1e5);
+	}
+	if (replaying)
+		pipelineDrain();
+
+	g_die = true;
+	pipelineJoin(threads);
+	if (replaying)
+		pipelineReport(&replay);
+
+	printf("Saving Preferences to %s\n", prefstr);
+	pipelineSave(ms);	// on top of what was loaded, so the gui's settings stay
+	ms.save();
+
+	g_display = nullptr;
+	shm.close();
+	pipelineFree();
+	google::protobuf::ShutdownProtobufLibrary();
+	return 0;
+}
@@ -0,0 +1,175 @@
+// sustained-throughput benchmark of H5AnalogWriter: a producer thread feeds
+// po8e-sized packets as fast as the writer keeps up, the writer thread runs
+// the same wait()/write() loop as gtkclient. the file should be on tmpfs,
+// so that hdf5 and the writer are measured rather than the disk.
+// the samples are read back and checked afterwards.
+// each codec runs with the chunks compressed on the writer thread, then on
+// an H5ChunkPool of [threads].
+// usage: h5analog_bench [seconds] [file] [nchan] [threads]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+#include "util.h"
+#include "gettime.h"
+#include "h5analogwriter.h"
+
+using namespace std;
+
+#define NS 16				// samples per packet (g_po8e_read_size)
+#define SR 24414.0625
+#define NSIG 24414			// samples of signal, cycled
+
+// something like broadband: a few tones and noise, per channel
+static i16 sig(const vector<i16> &s, size_t c, size_t k)
+{
+	return s[c*NSIG + k % NSIG] + (i16)(c & 0xff);
+}
+
+static void bench(const char *fn, size_t nc, double secs, int codec,
+                  bool delta, bool direct, size_t threads, const vector<i16> &s)
+{
+	char label[64];
+	snprintf(label, 64, "%s %s%s %zut", direct ? "direct" : "slab",
+	         h5codecName(codec), delta ? "+delta" : "", direct ? threads : 0);
+	H5AnalogWriter w;
+	w.setCodec(codec, codec == H5C_ZSTD ? 3 : 1);
+	w.setDelta(delta);
+	w.setDirect(direct);
+	w.setThreads(threads);
+	if (!w.open(fn, nc, NS)) {
+		printf("could not open %s\n", fn);
+		return;
+	}
+
+	bool done = false;
+	thread writer([&] {
+		while (!done) {
+			w.wait(0.1);
+			w.write();
+		}
+	});
+
+	long double t0 = gettime();
+	size_t k0 = 0;
+	size_t stalls = 0;
+	size_t maxq = 0;
+	while ((double)(gettime() - t0) < secs) {
+		size_t q = w.capacity();
+		if (q > maxq)
+			maxq = q;
+		if (q > H5A_BUF_SIZE/2) {
+			stalls++;
+			usleep(100);
+			continue;
+		}
+		AD *ad = w.get(nc, NS);
+		for (size_t k=0; k<NS; k++) {
+			ad->tk[k] = k0 + k;
+			ad->ts[k] = (k0 + k) / SR;
+		}
+		for (size_t c=0; c<nc; c++) {
+			for (size_t k=0; k<NS; k++) {
+				ad->data[c*NS+k] = sig(s, c, k0+k);
+			}
+		}
+		w.add(ad);
+		k0 += NS;
+	}
+	double tp = (double)(gettime() - t0);
+	done = true;
+	writer.join();
+	w.close(); // drains what is left
+	double t = (double)(gettime() - t0);
+
+	struct stat st;
+	stat(fn, &st);
+	double rt = k0 / t / SR;
+	printf("%-24s %3zu ch: %6.2fx real time, %6.1f MB/s raw, x%5.2f, "
+	       "max queue %zu, %zu stalls, pool +%zu, close %.0f ms\n",
+	       label, nc, rt, k0*nc*2/t/1e6, k0*nc*2.0/st.st_size, maxq, stalls,
+	       w.allocs(), (t-tp)*1e3);
+
+	// read back and check every sample and tick
+	hid_t f = H5Fopen(fn, H5F_ACC_RDONLY, H5P_DEFAULT);
+	hid_t d = H5Dopen2(f, "/Analog/Samples", H5P_DEFAULT);
+	hid_t sp = H5Dget_space(d);
+	hsize_t dims[2];
+	H5Sget_simple_extent_dims(sp, dims, NULL);
+	H5Sclose(sp);
+	size_t bad = dims[0] != nc || dims[1] != k0;
+	vector<i16> row(dims[1]);
+	for (size_t c=0; c<dims[0] && !bad; c++) {
+		hsize_t offset[2] = {c, 0};
+		hsize_t count[2] = {1, dims[1]};
+		sp = H5Dget_space(d);
+		H5Sselect_hyperslab(sp, H5S_SELECT_SET, offset, NULL, count, NULL);
+		hid_t ms = H5Screate_simple(2, count, NULL);
+		H5Dread(d, H5T_NATIVE_INT16, ms, sp, H5P_DEFAULT, &row[0]);
+		H5Sclose(ms);
+		H5Sclose(sp);
+		for (size_t k=0; k<dims[1]; k++) {
+			bad += row[k] != sig(s, c, k);
+		}
+	}
+	H5Dclose(d);
+	d = H5Dopen2(f, "/Analog/Ticks", H5P_DEFAULT);
+	vector<i64> tk(k0);
+	H5Dread(d, H5T_NATIVE_INT64, H5S_ALL, H5S_ALL, H5P_DEFAULT, &tk[0]);
+	H5Dclose(d);
+	for (size_t k=0; k<k0; k++) {
+		bad += tk[k] != (i64)k;
+	}
+	H5Fclose(f);
+	printf("%-24s read back %zu x %zu: %s\n", "", (size_t)dims[0],
+	       (size_t)dims[1], bad ? "MISMATCH" : "ok");
+	unlink(fn);
+}
+
+int main(int argc, char **argv)
+{
+	double secs = 5.0;
+	const char *fn = "/dev/shm/h5analog_bench.h5";
+	size_t nc = 384;
+	size_t threads = 4;
+	if (argc > 1)
+		secs = atof(argv[1]);
+	if (argc > 2)
+		fn = argv[2];
+	if (argc > 3)
+		nc = atoi(argv[3]);
+	if (argc > 4)
+		threads = atoi(argv[4]);
+
+	vector<i16> s(nc*NSIG);
+	srand(1);
+	for (size_t c=0; c<nc; c++) {
+		double f1 = 7 + c % 13;
+		double f2 = 60.0;
+		for (size_t k=0; k<NSIG; k++) {
+			double v = 300*sin(2*M_PI*f1*k/SR) + 100*sin(2*M_PI*f2*k/SR + c);
+			v += ((double)rand()/RAND_MAX - 0.5) * 200;
+			s[c*NSIG + k] = (i16)v;
+		}
+	}
+
+	h5filtersRegister(); // for the read back
+	bench(fn, nc, secs, H5C_NONE, false, false, 0, s);
+	bench(fn, nc, secs, H5C_NONE, false, true, 0, s);
+	for (int c=H5C_DEFLATE; c<H5C_NUM; c++) {
+		if (!h5codecAvail(c)) {
+			printf("%s: not compiled in\n", h5codecName(c));
+			continue;
+		}
+		bench(fn, nc, secs, c, false, false, 0, s);
+		bench(fn, nc, secs, c, false, true, 0, s);
+		bench(fn, nc, secs, c, false, true, threads, s);
+		bench(fn, nc, secs, c, true, true, threads, s);
+	}
+	return 0;
+}
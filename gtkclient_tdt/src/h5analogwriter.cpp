@@ -1,4 +1,7 @@
+#include <string.h>
+#include <chrono>
 #include "util.h"
+#include "gettime.h"
 #include "h5analogwriter.h"
 
 //using namespace moodycamel;
@@ -10,15 +13,81 @@ H5AnalogWriter::H5AnalogWriter()
 	m_h5Dtk = 0;
 	m_h5Dts = 0;
 	m_q = NULL;
+	m_free = NULL;
+	m_allocs = 0;
 	m_nc = 0;
 	m_ns = 0;
+	m_alloc = 0;
+	m_fill = 0;
+#if H5_VERSION_GE(1,10,3)
+	m_direct = true;
+#else
+	m_direct = false;
+#endif
+	m_useDirect = false;
+	m_threads = 2;
+	m_pool = NULL;
+	m_cc = 0;
+	m_commit = [this](const hsize_t *offset, const void *buf, size_t size) {
+		return commitChunk(offset, buf, size);
+	};
+	m_pending = 0;
+	m_slabs = 0;
+	m_writeTime = 0.0;
+	m_writeMax = 0.0;
+	m_skipped = 0;
 }
 H5AnalogWriter::~H5AnalogWriter()
 {
+	close();
 }
-bool H5AnalogWriter::open(const char *fn, size_t nc)
+void H5AnalogWriter::setDirect(bool direct)
 {
 	if (isEnabled())
+		return;
+#if H5_VERSION_GE(1,10,3)
+	m_direct = direct;
+#else
+	if (direct)
+		warn("%s: this hdf5 has no H5Dwrite_chunk", name());
+#endif
+}
+void H5AnalogWriter::setThreads(size_t n)
+{
+	if (isEnabled())
+		return;
+	m_threads = n;
+}
+// an empty dataset of nc x unlimited samples (just unlimited if nc is 0),
+// chunked cc x H5A_SLAB.
+hid_t H5AnalogWriter::mkDataset(const char *dname, hid_t type, size_t nc, size_t cc)
+{
+	int rank = nc > 0 ? 2 : 1;
+	hsize_t init_dims[2] = {nc, 0};
+	hsize_t max_dims[2] = {nc, H5S_UNLIMITED};
+	hsize_t chunk_dims[2] = {cc, H5A_SLAB};
+	if (rank == 1) {
+		init_dims[0] = 0;
+		max_dims[0] = H5S_UNLIMITED;
+		chunk_dims[0] = H5A_SLAB;
+	}
+	hid_t ds = H5Screate_simple(rank, init_dims, max_dims);
+	if (ds < 0)
+		return -1;
+	m_h5dataspaces.push_back(ds);
+	hid_t prop = H5Pcreate(H5P_DATASET_CREATE);
+	m_h5props.push_back(prop);
+	compressDataset(prop, type == H5T_STD_I16LE, H5A_SLAB);
+	H5Pset_chunk(prop, rank, chunk_dims);
+	// the extent runs ahead of the data; don't write fill for it
+	H5Pset_fill_time(prop, H5D_FILL_TIME_NEVER);
+	return H5Dcreate(m_h5file, dname, type, ds, H5P_DEFAULT, prop, H5P_DEFAULT);
+}
+bool H5AnalogWriter::open(const char *fn, size_t nc, size_t ns)
+{
+	if (isEnabled())
+		return false;
+	if (nc < 1)
 		return false;
 	if (!H5Writer::open(fn)) {
 		return false;
@@ -33,101 +102,58 @@ bool H5AnalogWriter::open(const char *fn, size_t nc)
 		return false;
 	}
 
-
-	// create analog dataspace
-	// do not allow numchans to grow
-	// but allow the number of samples to be unlimited
-	hsize_t init_dims[2] = {nc, 0};
-	hsize_t max_dims[2] = {nc, H5S_UNLIMITED};
-	hid_t ds = H5Screate_simple(2, init_dims, max_dims);
-	if (ds < 0) {
-		close();
-		return false;
-	}
-	// Create a dataset creation property list and set it to use chunking
-	// Online advice is to, "keep chunks above 10KiB or so"
-	// Realistically it should probably be something that can fit into L1 cache
-	// so: definitely under 64 KB
-	// 32*32*2 bytes ~= 2 KB
-	// 32*128*2 bytes ~= 8 KB
-	// also, perhaps compression will work better with slightly larger blocks
-	hid_t prop = H5Pcreate(H5P_DATASET_CREATE);
-	if (m_shuffle)
-		shuffleDataset(prop);
-	if (m_deflate)
-		deflateDataset(prop);
-	hsize_t chunk_dims[2] = {nc < 32 ? nc : 32, 128};
-	H5Pset_chunk(prop, 2, chunk_dims);
-	// Create the analog dataset
-	m_h5Dsamples = H5Dcreate(m_h5file, "/Analog/Samples", H5T_STD_I16LE,
-	                         ds, H5P_DEFAULT, prop, H5P_DEFAULT);
+	// the samples are nc x unlimited. a chunk is H5A_CHUNK_CH channels by
+	// one slab: 256 KB, big enough that per-chunk overhead (b-tree, filter
+	// calls, syscalls) stays small next to the data.
+	size_t cc = nc < (size_t)H5A_CHUNK_CH ? nc : (size_t)H5A_CHUNK_CH;
+	m_h5Dsamples = mkDataset("/Analog/Samples", H5T_STD_I16LE, nc, cc);
 	if (m_h5Dsamples < 0) {
 		close();
 		return false;
 	}
-	m_h5dataspaces.push_back(ds);
-	m_h5props.push_back(prop);
-
-
-	// create tick dataspace
-	// allow the number of samples to be unlimited
-	init_dims[0] 	= 0;
-	max_dims[0] 	= H5S_UNLIMITED;
-	ds = H5Screate_simple(1, init_dims, max_dims);
-	if (ds < 0) {
-		close();
-		return false;
-	}
-	//Create a dataset creation property list and set it to use chunking
-	prop = H5Pcreate(H5P_DATASET_CREATE);
-	if (m_shuffle)
-		shuffleDataset(prop);
-	if (m_deflate)
-		deflateDataset(prop);
-	chunk_dims[0] = 128;
-	H5Pset_chunk(prop, 1, chunk_dims);
-	// Create the tick dataset
-	m_h5Dtk = H5Dcreate(m_h5file, "/Analog/Ticks", H5T_STD_I64LE,
-	                    ds, H5P_DEFAULT, prop, H5P_DEFAULT);
-
+	m_h5Dtk = mkDataset("/Analog/Ticks", H5T_STD_I64LE, 0, 0);
 	if (m_h5Dtk < 0) {
 		close();
 		return false;
 	}
-	m_h5dataspaces.push_back(ds);
-	m_h5props.push_back(prop);
-
-	// create timestamp dataspace
-	// allow the number of samples to be unlimited
-	init_dims[0] 	= 0;
-	max_dims[0] 	= H5S_UNLIMITED;
-	ds = H5Screate_simple(1, init_dims, max_dims);
-	if (ds < 0) {
+	m_h5Dts = mkDataset("/Analog/Timestamps", H5T_IEEE_F64LE, 0, 0);
+	if (m_h5Dts < 0) {
 		close();
 		return false;
 	}
-	//Create a dataset creation property list and set it to use chunking
-	prop = H5Pcreate(H5P_DATASET_CREATE);
-	if (m_shuffle)
-		shuffleDataset(prop);
-	if (m_deflate)
-		deflateDataset(prop);
-	chunk_dims[0] = 128;
-	H5Pset_chunk(prop, 1, chunk_dims);
-	// Create the tick dataset
-	m_h5Dts = H5Dcreate(m_h5file, "/Analog/Timestamps", H5T_IEEE_F64LE,
-	                    ds, H5P_DEFAULT, prop, H5P_DEFAULT);
 
-	if (m_h5Dts < 0) {
-		close();
-		return false;
+	// we can only filter chunks ourselves if we know every filter.
+	// two slabs of chunks in flight lets the writer move on to the next
+	m_useDirect = m_direct;
+	if (m_useDirect) {
+		m_pool = new H5ChunkPool(m_threads, 2*((nc + cc - 1) / cc));
+		if (!m_pool->setPipeline(m_h5Dsamples)) {
+			warn("%s: unknown filter on the samples, using H5Dwrite", name());
+			m_useDirect = false;
+		}
 	}
-	m_h5dataspaces.push_back(ds);
-	m_h5props.push_back(prop);
+	m_cc = cc;
 
 	m_nc = nc;
+	m_ns = 0;
+	m_alloc = 0;
+	m_fill = 0;
+	m_slab.assign(nc*H5A_SLAB, 0);
+	m_slabTk.assign(H5A_SLAB, 0);
+	m_slabTs.assign(H5A_SLAB, 0.0);
+	m_pending = 0;
+	m_slabs = 0;
+	m_writeTime = 0.0;
+	m_writeMax = 0.0;
+	m_skipped = 0;
 
 	m_q = new ReaderWriterQueue<AD *>(H5A_BUF_SIZE);
+	m_free = new ReaderWriterQueue<AD *>(H5A_BUF_SIZE);
+	size_t npool = ns > 0 ? H5A_POOL_SLABS*H5A_SLAB/ns + 1 : 0;
+	for (size_t i=0; i<npool && i<H5A_BUF_SIZE; i++) {
+		m_free->enqueue(newAD(nc, ns));
+	}
+	m_allocs = 0;
 
 	enable();
 	return true;
@@ -135,15 +161,48 @@ bool H5AnalogWriter::open(const char *fn, size_t nc)
 
 bool H5AnalogWriter::close()
 {
+	if (isEnabled()) {
+		write(); // drain the queue
+		lock_guard<mutex> lock(m_mtx);
+		flushSlab();
+		if (m_useDirect) {
+			// before the trim, which would drop chunks past the end
+			if (!m_pool->flush(m_commit))
+				warn("%s: %zu chunks failed to write", name(), m_pool->errors());
+		}
+		// drop the preallocated tail
+		hsize_t dims[2] = {m_nc, m_ns};
+		H5Dset_extent(m_h5Dsamples, dims);
+		dims[0] = m_ns;
+		H5Dset_extent(m_h5Dtk, dims);
+		H5Dset_extent(m_h5Dts, dims);
+		if (m_skipped > 0)
+			warn("%s: skipped %zu packets with the wrong channel count",
+			     name(), m_skipped);
+	}
 	disable();
 
-	if (m_q) {
-		delete m_q;
-		m_q = NULL;
+	for (auto q : {&m_q, &m_free}) {
+		if (!*q)
+			continue;
+		AD *o;
+		while ((*q)->try_dequeue(o)) {
+			freeAD(o);
+		}
+		delete *q;
+		*q = NULL;
 	}
+	m_pending = 0;
 
 	m_ns = 0;
 	m_nc = 0;
+	m_alloc = 0;
+	m_fill = 0;
+	m_useDirect = false;
+	if (m_pool) {
+		delete m_pool;
+		m_pool = NULL;
+	}
 
 	if (m_h5Dts > 0) {
 		H5Dclose(m_h5Dts);
@@ -163,16 +222,67 @@ bool H5AnalogWriter::close()
 	return H5Writer::close();
 }
 
+AD *H5AnalogWriter::newAD(size_t nc, size_t ns)
+{
+	auto o = new AD;
+	o->nc = nc;
+	o->ns = 0;
+	o->maxns = ns;
+	o->maxdata = nc*ns;
+	o->tk = new i64[ns > 0 ? ns : 1];
+	o->ts = new double[ns > 0 ? ns : 1];
+	o->data = new i16[nc*ns > 0 ? nc*ns : 1];
+	return o;
+}
+
+void H5AnalogWriter::freeAD(AD *o)
+{
+	delete[] (o->data);
+	delete[] (o->tk);
+	delete[] (o->ts);
+	delete o;
+}
+
+AD *H5AnalogWriter::get(size_t nc, size_t ns)	// consumer side of m_free
+{
+	if (!isEnabled())
+		return nullptr;
+	AD *o;
+	if (!m_free->try_dequeue(o)) {
+		m_allocs++; // pool ran dry; it grows by this one when it comes back
+		o = newAD(nc, ns);
+	} else if (o->maxns < ns || o->maxdata < nc*ns) {
+		m_allocs++; // bigger than the pool's; it stays this big
+		freeAD(o);
+		o = newAD(nc, ns);
+	}
+	o->nc = nc;
+	o->ns = ns;
+	return o;
+}
+
 bool H5AnalogWriter::add(AD *o)	// call from a single producer thread
 {
 	if (!isEnabled()) {
-		delete[] (o->data);
-		delete[] (o->tk);
-		delete[] (o->ts);
-		delete o;
+		freeAD(o);
 		return false;
 	}
-	return m_q->enqueue(o);	// todo: what if this (memory alloc) fails
+	size_t p = m_pending.fetch_add(o->ns);
+	bool ok = m_q->enqueue(o);	// todo: what if this (memory alloc) fails
+	if (p < H5A_SLAB && p + o->ns >= H5A_SLAB) {
+		// wake the writer once per slab, not per packet
+		lock_guard<mutex> lock(m_wake);
+		m_cv.notify_one();
+	}
+	return ok;
+}
+
+void H5AnalogWriter::wait(double timeout)
+{
+	unique_lock<mutex> lock(m_wake);
+	m_cv.wait_for(lock, chrono::duration<double>(timeout), [this] {
+		return m_pending >= H5A_SLAB;
+	});
 }
 
 bool H5AnalogWriter::write()   // call from a single consumer thread
@@ -182,96 +292,167 @@ bool H5AnalogWriter::write()   // call from a single consumer thread
 
 	//Lock so that the file isnt closed out from under us
 	lock_guard<mutex> lock(m_mtx); // very important!!!
+	if (!isEnabled())
+		return false;	// closed while we waited for the lock
+
+	AD *o;
+	while (m_q->try_dequeue(o)) {
+		m_pending -= o->ns;
+
+		if (o->nc != m_nc) {
+			if (m_skipped++ == 0)
+				warn("%s: packet has %zu channels, file has %zu",
+				     name(), o->nc, m_nc);
+			m_free->enqueue(o);
+			continue;
+		}
 
-	bool dequeued;
-	do {
-		AD *o;
-		dequeued = m_q->try_dequeue(o);
-		if (dequeued) {
-
-			if (o->nc != m_nc) {
-				warn("well this is embarassing");
+		// copy into the slab; a packet may straddle two
+		size_t k = 0;
+		while (k < o->ns) {
+			size_t n = o->ns - k;
+			if (n > H5A_SLAB - m_fill)
+				n = H5A_SLAB - m_fill;
+			for (size_t c=0; c<m_nc; c++) {
+				memcpy(&m_slab[c*H5A_SLAB + m_fill], &o->data[c*o->ns + k],
+				       n*sizeof(i16));
 			}
-
-			// extend sample dataset to fit new data
-			// TODO: CHECK FOR ERROR
-			hsize_t new_dims[2] = {m_nc, m_ns + o->ns};
-			H5Dset_extent(m_h5Dsamples, new_dims);
-			// select hyperslab in extended oprtion of dataset
-			hid_t filespace = H5Dget_space(m_h5Dsamples);
-			hsize_t offset[2] = {0, m_ns};
-			hsize_t packet_dims[2] = {m_nc, o->ns};
-			H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL,
-			                    packet_dims, NULL);
-			// Define memory space for new data
-			// TODO CHECK FOR ERROR
-			hid_t memspace = H5Screate_simple(2, packet_dims, NULL);
-			// Write the dataset.
-			// TODO: CHECK FOR ERROR
-			H5Dwrite(m_h5Dsamples, H5T_NATIVE_INT16, memspace, filespace,
-			         H5P_DEFAULT, o->data);
-			H5Sclose(memspace);
-			H5Sclose(filespace);
-
-			// extend tick dataset to fit new data
-			// TODO: CHECK FOR ERROR
-			new_dims[0] = m_ns + o->ns;
-			H5Dset_extent(m_h5Dtk, new_dims);
-			// select hyperslab in extended oprtion of dataset
-			filespace = H5Dget_space(m_h5Dtk);
-			offset[0] = m_ns;
-			packet_dims[0] = o->ns;
-			H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL,
-			                    packet_dims, NULL);
-			// Define memory space for new data
-			// TODO CHECK FOR ERROR
-			memspace = H5Screate_simple(1, packet_dims, NULL);
-			// Write the dataset.
-			// TODO: CHECK FOR ERROR
-			H5Dwrite(m_h5Dtk, H5T_NATIVE_INT64, memspace, filespace,
-			         H5P_DEFAULT, o->tk);
-			H5Sclose(memspace);
-			H5Sclose(filespace);
-
-			// extend ts dataset to fit new data
-			// TODO: CHECK FOR ERROR
-			new_dims[0] = m_ns + o->ns;
-			H5Dset_extent(m_h5Dts, new_dims);
-			// select hyperslab in extended oprtion of dataset
-			filespace = H5Dget_space(m_h5Dts);
-			offset[0] = m_ns;
-			packet_dims[0] = o->ns;
-			H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL,
-			                    packet_dims, NULL);
-			// Define memory space for new data
-			// TODO CHECK FOR ERROR
-			memspace = H5Screate_simple(1, packet_dims, NULL);
-			// Write the dataset.
-			// TODO: CHECK FOR ERROR
-			H5Dwrite(m_h5Dts, H5T_NATIVE_DOUBLE, memspace, filespace,
-			         H5P_DEFAULT, o->ts);
-			H5Sclose(memspace);
-			H5Sclose(filespace);
-
-			m_ns += o->ns; // increment sample pointer
-
-			//if (m_os.fail()) { // write lost, should we requeue?
-			//	fprintf(stderr,"ERROR: %s write failed!\n", name());
-			//}
-			delete[] (o->data);
-			delete[] (o->tk);
-			delete[] (o->ts);
-			delete o; // free the memory that was pointed to
+			memcpy(&m_slabTk[m_fill], &o->tk[k], n*sizeof(i64));
+			memcpy(&m_slabTs[m_fill], &o->ts[k], n*sizeof(double));
+			m_fill += n;
+			k += n;
+			if (m_fill == H5A_SLAB)
+				flushSlab();
 		}
-	} while (dequeued);
+		m_free->enqueue(o); // back to the pool
+	}
 
 	return true;
 }
 
+// write the slab at m_ns. only the last one (from close()) may be partial,
+// so the rest start on a chunk boundary. call with m_mtx held.
+void H5AnalogWriter::flushSlab()
+{
+	size_t n = m_fill;
+	if (n == 0)
+		return;
+
+	long double t = gettime();
+
+	if (m_ns + H5A_SLAB > m_alloc) {
+		// grow in big steps; chunks are allocated as they are written
+		m_alloc += H5A_GROW*H5A_SLAB;
+		hsize_t dims[2] = {m_nc, m_alloc};
+		H5Dset_extent(m_h5Dsamples, dims); // TODO: CHECK FOR ERROR
+		dims[0] = m_alloc;
+		H5Dset_extent(m_h5Dtk, dims);
+		H5Dset_extent(m_h5Dts, dims);
+	}
+	if (n < H5A_SLAB) {
+		// no stale samples in the (stored, not visible) end of the chunks
+		for (size_t c=0; c<m_nc; c++) {
+			memset(&m_slab[c*H5A_SLAB + n], 0, (H5A_SLAB-n)*sizeof(i16));
+		}
+	}
+
+	hsize_t offset[2], packet_dims[2], mem_dims[2];
+	hid_t filespace, memspace;
+
+	// SAMPLES
+	if (m_useDirect && !writeChunks()) {
+		// this slab is queued; the one(s) that failed are lost
+		warn("%s: direct chunk write failed, using H5Dwrite", name());
+		m_pool->flush(m_commit);
+		m_useDirect = false;
+	}
+	if (!m_useDirect) {
+		filespace = H5Dget_space(m_h5Dsamples);
+		offset[0] = 0;
+		offset[1] = m_ns;
+		packet_dims[0] = m_nc;
+		packet_dims[1] = n;
+		H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL,
+		                    packet_dims, NULL);
+		// the slab is nc x H5A_SLAB; take the first n columns
+		mem_dims[0] = m_nc;
+		mem_dims[1] = H5A_SLAB;
+		memspace = H5Screate_simple(2, mem_dims, NULL);
+		offset[1] = 0;
+		H5Sselect_hyperslab(memspace, H5S_SELECT_SET, offset, NULL,
+		                    packet_dims, NULL);
+		H5Dwrite(m_h5Dsamples, H5T_NATIVE_INT16, memspace, filespace,
+		         H5P_DEFAULT, &m_slab[0]);
+		H5Sclose(memspace);
+		H5Sclose(filespace);
+	}
+
+	// TICKS and TIMESTAMPS, one chunk each
+	offset[0] = m_ns;
+	packet_dims[0] = n;
+	memspace = H5Screate_simple(1, packet_dims, NULL);
+	filespace = H5Dget_space(m_h5Dtk);
+	H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL,
+	                    packet_dims, NULL);
+	H5Dwrite(m_h5Dtk, H5T_NATIVE_INT64, memspace, filespace,
+	         H5P_DEFAULT, &m_slabTk[0]);
+	H5Sclose(filespace);
+	filespace = H5Dget_space(m_h5Dts);
+	H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL,
+	                    packet_dims, NULL);
+	H5Dwrite(m_h5Dts, H5T_NATIVE_DOUBLE, memspace, filespace,
+	         H5P_DEFAULT, &m_slabTs[0]);
+	H5Sclose(filespace);
+	H5Sclose(memspace);
+
+	m_ns += n; // increment sample pointer
+	m_fill = 0;
+
+	double dt = (double)(gettime() - t);
+	m_slabs++;
+	m_writeTime += dt;
+	if (dt > m_writeMax)
+		m_writeMax = dt;
+}
+
+// hand each chunk of the slab to the pool, which encodes them on its
+// threads; they come back to commitChunk() in order.
+bool H5AnalogWriter::writeChunks()
+{
+	bool ok = true;
+	for (size_t c0=0; c0<m_nc; c0+=m_cc) {
+		// the slab is zero past m_fill, so chunks are always whole; the
+		// last one may hang past nc and is padded with zeros
+		size_t rows = m_nc - c0 < m_cc ? m_nc - c0 : m_cc;
+		hsize_t offset[2] = {c0, m_ns};
+		ok &= m_pool->submit(offset, &m_slab[c0*H5A_SLAB],
+		                     rows*H5A_SLAB*sizeof(i16), m_cc*H5A_SLAB*sizeof(i16),
+		                     m_commit);
+	}
+	return ok;
+}
+
+// on the writer thread, with m_mtx held
+bool H5AnalogWriter::commitChunk(const hsize_t *offset, const void *buf, size_t size)
+{
+#if H5_VERSION_GE(1,10,3)
+	return H5Dwrite_chunk(m_h5Dsamples, H5P_DEFAULT, 0, offset, size, buf) >= 0;
+#else
+	(void)offset;
+	(void)buf;
+	(void)size;
+	return false;
+#endif
+}
+
 size_t H5AnalogWriter::capacity()
 {
 	return m_q ? m_q->size_approx() : 0;
 }
+size_t H5AnalogWriter::allocs()
+{
+	return m_allocs;
+}
 size_t H5AnalogWriter::bytes()
 {
 	size_t n = 0;
@@ -280,6 +461,32 @@ size_t H5AnalogWriter::bytes()
 	n += m_ns * sizeof(double);
 	return n;
 }
+string H5AnalogWriter::status()
+{
+	if (!isEnabled())
+		return string();
+	size_t n = filename().find_last_of("/");
+	char str[384];
+	double b = bytes() / 1e6;
+	// racy reads of the stats; fine for a label
+	double avg = m_slabs > 0 ? m_writeTime / m_slabs : 0.0;
+	char codec[128];
+	if (m_useDirect && m_pool) {
+		snprintf(codec, 128, "%s%s x%.2f, %.0f MB/s/thread (%zu), %zu in flight",
+		         h5codecName(m_codec), m_delta ? "+delta" : "",
+		         m_pool->ratio(), m_pool->rate(), m_pool->numThreads(),
+		         m_pool->inFlight());
+	} else {
+		snprintf(codec, 128, "%s%s in hdf5", h5codecName(m_codec),
+		         m_delta ? "+delta" : "");
+	}
+	snprintf(str, 384, "%s: %.2f %s\nqueue %zu, pool +%zu, %s write %.2f ms avg, %.2f ms max\n%s",
+	         filename().substr(n+1).c_str(),
+	         b >= 1e3 ? b/1e3 : b, b >= 1e3 ? "GB" : "MB",
+	         capacity(), (size_t)m_allocs, m_useDirect ? "direct" : "slab",
+	         avg*1e3, m_writeMax*1e3, codec);
+	return string(str);
+}
 bool H5AnalogWriter::setMetaData(double sr, float *scale, char *name, int slen)
 {
 	hid_t ds, attr, atype;
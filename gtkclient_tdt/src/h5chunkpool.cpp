@@ -0,0 +1,183 @@
+#include <string.h>
+#include "gettime.h"
+#include "h5chunkpool.h"
+#include "rtsched.h"
+
+H5ChunkPool::H5ChunkPool(size_t nthreads, size_t depth)
+{
+	if (depth < 1)
+		depth = 1;
+	for (size_t i=0; i<depth; i++) {
+		auto j = new Job;
+		j->out = NULL;
+		j->size = 0;
+		j->done = false;
+		m_jobs.push_back(j);
+	}
+	m_head = m_next = m_tail = 0;
+	m_die = false;
+	m_errors = 0;
+	m_raw = m_packed = m_busy = 0.0;
+	for (size_t i=0; i<nthreads; i++) {
+		m_threads.push_back(thread(&H5ChunkPool::run, this));
+	}
+}
+
+H5ChunkPool::~H5ChunkPool()
+{
+	{
+		lock_guard<mutex> lock(m_mtx);
+		m_die = true;
+	}
+	m_work.notify_all();
+	for (auto &t : m_threads) {
+		t.join();
+	}
+	for (auto &j : m_jobs) {
+		delete j;
+	}
+	m_jobs.clear();
+}
+
+bool H5ChunkPool::setPipeline(hid_t dset)
+{
+	bool ok = true;
+	for (auto &j : m_jobs) {
+		ok &= j->codec.setPipeline(dset);
+	}
+	lock_guard<mutex> lock(m_mtx);
+	m_errors = 0;
+	return ok;
+}
+
+void H5ChunkPool::encode(Job *j)
+{
+	long double t = gettime();
+	j->out = j->codec.encode(&j->raw[0], j->raw.size(), &j->size);
+	double dt = (double)(gettime() - t);
+	lock_guard<mutex> lock(m_mtx);
+	j->done = true;
+	m_raw += j->raw.size();
+	m_packed += j->out ? j->size : j->raw.size();
+	m_busy += dt;
+}
+
+void H5ChunkPool::run()
+{
+	rtEnter(RT_WRITER, "compress");
+	while (true) {
+		Job *j;
+		{
+			unique_lock<mutex> lock(m_mtx);
+			m_work.wait(lock, [this] { return m_next != m_tail || m_die; });
+			if (m_die)
+				return;
+			j = m_jobs[m_next % m_jobs.size()];
+			m_next++;
+		}
+		encode(j);
+		m_done.notify_one();
+	}
+}
+
+// commit finished chunks at the head, in order. with wait, block until
+// at least the head is committed. returns false if any failed.
+bool H5ChunkPool::commitDone(CommitFn &fn, bool wait)
+{
+	bool ok = true;
+	while (true) {
+		Job *j;
+		{
+			unique_lock<mutex> lock(m_mtx);
+			if (m_head == m_tail)
+				break;
+			j = m_jobs[m_head % m_jobs.size()];
+			if (wait)
+				m_done.wait(lock, [j] { return j->done; });
+			else if (!j->done)
+				break;
+		}
+		// only this thread touches the head job once it is done
+		if (!j->out || !fn(j->offset, j->out, j->size)) {
+			ok = false;
+			lock_guard<mutex> lock(m_mtx);
+			m_errors++;
+		}
+		lock_guard<mutex> lock(m_mtx);
+		j->done = false;
+		m_head++;
+		wait = false;
+	}
+	return ok;
+}
+
+bool H5ChunkPool::submit(const hsize_t *offset, const void *raw, size_t len,
+                         size_t padlen, CommitFn fn)
+{
+	bool ok = commitDone(fn, false);
+	if (m_tail - m_head == m_jobs.size())
+		ok &= commitDone(fn, true); // full: wait for the head
+
+	Job *j = m_jobs[m_tail % m_jobs.size()];
+	if (padlen < len)
+		padlen = len;
+	j->raw.resize(padlen);
+	memcpy(&j->raw[0], raw, len);
+	memset(&j->raw[len], 0, padlen - len);
+	j->offset[0] = offset[0];
+	j->offset[1] = offset[1];
+
+	if (m_threads.empty()) {
+		lock_guard<mutex> lock(m_mtx);
+		m_tail++;
+		m_next++;
+	} else {
+		{
+			lock_guard<mutex> lock(m_mtx);
+			m_tail++;
+		}
+		m_work.notify_one();
+		return ok;
+	}
+	encode(j);
+	return ok & commitDone(fn, false);
+}
+
+bool H5ChunkPool::flush(CommitFn fn)
+{
+	bool ok = true;
+	while (true) {
+		{
+			lock_guard<mutex> lock(m_mtx);
+			if (m_head == m_tail)
+				break;
+		}
+		ok &= commitDone(fn, true);
+	}
+	return ok;
+}
+
+size_t H5ChunkPool::numThreads()
+{
+	return m_threads.size();
+}
+size_t H5ChunkPool::inFlight()
+{
+	lock_guard<mutex> lock(m_mtx);
+	return m_tail - m_head;
+}
+size_t H5ChunkPool::errors()
+{
+	lock_guard<mutex> lock(m_mtx);
+	return m_errors;
+}
+double H5ChunkPool::ratio()
+{
+	lock_guard<mutex> lock(m_mtx);
+	return m_packed > 0 ? m_raw / m_packed : 1.0;
+}
+double H5ChunkPool::rate()
+{
+	lock_guard<mutex> lock(m_mtx);
+	return m_busy > 0 ? m_raw / m_busy / 1e6 : 0.0;
+}
\ No newline at end of file
@@ -0,0 +1,422 @@
+#include <string.h>
+#include <mutex>
+#include <zlib.h>
+#ifdef LZ4
+#include <lz4.h>
+#endif
+#ifdef ZSTD
+#include <zstd.h>
+#endif
+#include "util.h"
+#include "h5filters.h"
+
+const char *h5codecName(int codec)
+{
+	switch (codec) {
+	case H5C_NONE:
+		return "none";
+	case H5C_DEFLATE:
+		return "deflate";
+	case H5C_LZ4:
+		return "lz4";
+	case H5C_ZSTD:
+		return "zstd";
+	}
+	return "?";
+}
+
+bool h5codecAvail(int codec)
+{
+	switch (codec) {
+	case H5C_NONE:
+	case H5C_DEFLATE:
+		return true;
+#ifdef LZ4
+	case H5C_LZ4:
+		return true;
+#endif
+#ifdef ZSTD
+	case H5C_ZSTD:
+		return true;
+#endif
+	}
+	return false;
+}
+
+// -- the transforms, shared by the hdf5 callbacks and H5ChunkCodec --
+
+// delta along each row of rowlen, zigzagged so small steps of either sign
+// are small numbers. the first sample of a row is taken against 0.
+// in and out may be the same.
+static void delta16_enc(const u16 *in, u16 *out, size_t n, size_t rowlen)
+{
+	if (rowlen == 0)
+		rowlen = n;
+	for (size_t r=0; r<n; r+=rowlen) {
+		size_t e = r + rowlen < n ? r + rowlen : n;
+		u16 prev = 0;
+		for (size_t i=r; i<e; i++) {
+			u16 x = in[i];
+			u16 d = x - prev;
+			out[i] = (u16)(d << 1) ^ (u16)((i16)d >> 15);
+			prev = x;
+		}
+	}
+}
+static void delta16_dec(const u16 *in, u16 *out, size_t n, size_t rowlen)
+{
+	if (rowlen == 0)
+		rowlen = n;
+	for (size_t r=0; r<n; r+=rowlen) {
+		size_t e = r + rowlen < n ? r + rowlen : n;
+		u16 prev = 0;
+		for (size_t i=r; i<e; i++) {
+			u16 z = in[i];
+			u16 d = (z >> 1) ^ (u16)(-(i16)(z & 1));
+			prev += d;
+			out[i] = prev;
+		}
+	}
+}
+
+// byte j of element i goes to j*nelem + i; leftover bytes are copied as
+// they are (as H5Z shuffle does)
+static void shuffle2(const unsigned char *in, unsigned char *out, size_t len)
+{
+	size_t ne = len / 2;
+	for (size_t i=0; i<ne; i++) {
+		out[i] = in[2*i];
+		out[ne+i] = in[2*i+1];
+	}
+	memcpy(&out[2*ne], &in[2*ne], len - 2*ne);
+}
+
+#ifdef LZ4
+// the H5Z_FILTER_LZ4 plugin's layout: big-endian u64 original size, u32
+// block size, then per block a u32 compressed size and the data. a block
+// that does not shrink is stored as is, with its size equal to the block's.
+static void put_be(unsigned char *p, u64 v, int n)
+{
+	for (int i=n-1; i>=0; i--) {
+		p[i] = (unsigned char)(v & 0xff);
+		v >>= 8;
+	}
+}
+static u64 get_be(const unsigned char *p, int n)
+{
+	u64 v = 0;
+	for (int i=0; i<n; i++) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+static size_t lz4_bound(size_t len)
+{
+	return 12 + 4 + (size_t)LZ4_compressBound((int)len);
+}
+// one block (we never need more: chunks are far below the 1 GB default)
+static size_t lz4_enc(const unsigned char *in, size_t len, unsigned char *out,
+                      size_t cap)
+{
+	if (cap < lz4_bound(len))
+		return 0;
+	put_be(out, len, 8);
+	put_be(out+8, len, 4);
+	int n = LZ4_compress_default((const char *)in, (char *)out+16, (int)len,
+	                             (int)(cap-16));
+	if (n <= 0 || (size_t)n >= len) {
+		memcpy(out+16, in, len);
+		n = (int)len;
+	}
+	put_be(out+12, (u64)n, 4);
+	return 16 + (size_t)n;
+}
+static size_t lz4_dec(const unsigned char *in, size_t len, unsigned char *out,
+                      size_t cap)
+{
+	if (len < 12)
+		return 0;
+	size_t orig = get_be(in, 8);
+	size_t bs = get_be(in+8, 4);
+	if (orig > cap || bs == 0)
+		return 0;
+	size_t i = 12;
+	size_t o = 0;
+	while (o < orig) {
+		size_t b = orig - o < bs ? orig - o : bs;
+		if (i + 4 > len)
+			return 0;
+		size_t n = get_be(in+i, 4);
+		i += 4;
+		if (i + n > len)
+			return 0;
+		if (n == b) {
+			memcpy(out+o, in+i, n);
+		} else if (LZ4_decompress_safe((const char *)in+i, (char *)out+o,
+		                               (int)n, (int)b) != (int)b) {
+			return 0;
+		}
+		i += n;
+		o += b;
+	}
+	return orig;
+}
+#endif
+
+// -- hdf5 filter classes --
+
+static htri_t delta16_can_apply(hid_t, hid_t type, hid_t)
+{
+	return H5Tget_class(type) == H5T_INTEGER && H5Tget_size(type) == 2;
+}
+static size_t delta16_filter(unsigned int flags, size_t cd_nelmts,
+                             const unsigned int cd_values[], size_t nbytes,
+                             size_t *, void **buf)
+{
+	size_t rowlen = cd_nelmts > 0 ? cd_values[0] : 0;
+	u16 *p = (u16 *)*buf;
+	if (flags & H5Z_FLAG_REVERSE)
+		delta16_dec(p, p, nbytes/2, rowlen);
+	else
+		delta16_enc(p, p, nbytes/2, rowlen);
+	return nbytes;
+}
+
+#ifdef LZ4
+static size_t lz4_filter(unsigned int flags, size_t, const unsigned int[],
+                         size_t nbytes, size_t *buf_size, void **buf)
+{
+	unsigned char *in = (unsigned char *)*buf;
+	if (flags & H5Z_FLAG_REVERSE) {
+		if (nbytes < 12)
+			return 0;
+		size_t orig = get_be(in, 8);
+		void *out = H5allocate_memory(orig, false);
+		if (!out)
+			return 0;
+		if (lz4_dec(in, nbytes, (unsigned char *)out, orig) != orig) {
+			H5free_memory(out);
+			return 0;
+		}
+		H5free_memory(*buf);
+		*buf = out;
+		*buf_size = orig;
+		return orig;
+	}
+	size_t cap = lz4_bound(nbytes);
+	void *out = H5allocate_memory(cap, false);
+	if (!out)
+		return 0;
+	size_t n = lz4_enc(in, nbytes, (unsigned char *)out, cap);
+	if (n == 0) {
+		H5free_memory(out);
+		return 0;
+	}
+	H5free_memory(*buf);
+	*buf = out;
+	*buf_size = cap;
+	return n;
+}
+#endif
+
+#ifdef ZSTD
+static size_t zstd_filter(unsigned int flags, size_t cd_nelmts,
+                          const unsigned int cd_values[], size_t nbytes,
+                          size_t *buf_size, void **buf)
+{
+	if (flags & H5Z_FLAG_REVERSE) {
+		unsigned long long orig = ZSTD_getFrameContentSize(*buf, nbytes);
+		if (orig == ZSTD_CONTENTSIZE_ERROR || orig == ZSTD_CONTENTSIZE_UNKNOWN)
+			return 0;
+		void *out = H5allocate_memory(orig, false);
+		if (!out)
+			return 0;
+		size_t n = ZSTD_decompress(out, orig, *buf, nbytes);
+		if (ZSTD_isError(n)) {
+			H5free_memory(out);
+			return 0;
+		}
+		H5free_memory(*buf);
+		*buf = out;
+		*buf_size = orig;
+		return n;
+	}
+	int level = cd_nelmts > 0 ? (int)cd_values[0] : 3;
+	size_t cap = ZSTD_compressBound(nbytes);
+	void *out = H5allocate_memory(cap, false);
+	if (!out)
+		return 0;
+	size_t n = ZSTD_compress(out, cap, *buf, nbytes, level);
+	if (ZSTD_isError(n)) {
+		H5free_memory(out);
+		return 0;
+	}
+	H5free_memory(*buf);
+	*buf = out;
+	*buf_size = cap;
+	return n;
+}
+#endif
+
+void h5filtersRegister()
+{
+	static once_flag once;
+	call_once(once, [] {
+		static const H5Z_class2_t delta16 = {
+			H5Z_CLASS_T_VERS, (H5Z_filter_t)H5Z_FILTER_DELTA16, 1, 1,
+			"delta16", delta16_can_apply, NULL, delta16_filter
+		};
+		if (H5Zregister(&delta16) < 0)
+			warn("HDF5: could not register the delta16 filter");
+#ifdef LZ4
+		static const H5Z_class2_t lz4 = {
+			H5Z_CLASS_T_VERS, (H5Z_filter_t)H5Z_FILTER_LZ4, 1, 1,
+			"lz4", NULL, NULL, lz4_filter
+		};
+		if (H5Zfilter_avail(H5Z_FILTER_LZ4) <= 0 && H5Zregister(&lz4) < 0)
+			warn("HDF5: could not register the lz4 filter");
+#endif
+#ifdef ZSTD
+		static const H5Z_class2_t zstd = {
+			H5Z_CLASS_T_VERS, (H5Z_filter_t)H5Z_FILTER_ZSTD, 1, 1,
+			"zstd", NULL, NULL, zstd_filter
+		};
+		if (H5Zfilter_avail(H5Z_FILTER_ZSTD) <= 0 && H5Zregister(&zstd) < 0)
+			warn("HDF5: could not register the zstd filter");
+#endif
+	});
+}
+
+bool h5codecSet(hid_t prop, int codec, int level)
+{
+	switch (codec) {
+	case H5C_NONE:
+		return true;
+	case H5C_DEFLATE:
+		return H5Pset_deflate(prop, level < 0 ? 0 : (level > 9 ? 9 : level)) >= 0;
+	case H5C_LZ4:
+		// cd[0] is the block size; 0 is the plugin's default
+		return h5codecAvail(codec) &&
+		       H5Pset_filter(prop, H5Z_FILTER_LZ4, H5Z_FLAG_OPTIONAL, 0, NULL) >= 0;
+	case H5C_ZSTD: {
+		unsigned int cd = level < 1 ? 1 : (level > 22 ? 22 : level);
+		return h5codecAvail(codec) &&
+		       H5Pset_filter(prop, H5Z_FILTER_ZSTD, H5Z_FLAG_OPTIONAL, 1, &cd) >= 0;
+	}
+	}
+	return false;
+}
+
+H5ChunkCodec::H5ChunkCodec()
+{
+	m_level = 1;
+	m_rowlen = 0;
+}
+bool H5ChunkCodec::setPipeline(hid_t dset)
+{
+	m_filters.clear();
+	m_level = 1;
+	m_rowlen = 0;
+	bool ok = true;
+	hid_t prop = H5Dget_create_plist(dset);
+	int nf = H5Pget_nfilters(prop);
+	for (int i=0; i<nf; i++) {
+		unsigned int flags, cd[8];
+		size_t ncd = 8;
+		H5Z_filter_t f = H5Pget_filter2(prop, i, &flags, &ncd, cd, 0, NULL, NULL);
+		switch (f) {
+		case H5Z_FILTER_SHUFFLE:
+			break;
+		case H5Z_FILTER_DEFLATE:
+		case H5Z_FILTER_ZSTD:
+			if (ncd > 0)
+				m_level = cd[0];
+			break;
+		case H5Z_FILTER_DELTA16:
+			m_rowlen = ncd > 0 ? cd[0] : 0;
+			break;
+		case H5Z_FILTER_LZ4:
+			if (ncd > 0 && cd[0] != 0)
+				ok = false; // we only write single-block chunks
+			break;
+		default:
+			ok = false;
+		}
+		if (f == H5Z_FILTER_LZ4 && !h5codecAvail(H5C_LZ4))
+			ok = false;
+		if (f == H5Z_FILTER_ZSTD && !h5codecAvail(H5C_ZSTD))
+			ok = false;
+		m_filters.push_back(f);
+	}
+	H5Pclose(prop);
+	return ok;
+}
+const unsigned char *H5ChunkCodec::encode(const void *in, size_t len, size_t *size)
+{
+	// big enough for any codec's worst case
+	size_t cap = compressBound(len) + 64;
+#ifdef LZ4
+	cap = cap > lz4_bound(len) ? cap : lz4_bound(len);
+#endif
+#ifdef ZSTD
+	cap = cap > ZSTD_compressBound(len) ? cap : ZSTD_compressBound(len);
+#endif
+	if (m_a.size() < cap)
+		m_a.resize(cap);
+	if (m_b.size() < cap)
+		m_b.resize(cap);
+
+	const unsigned char *src = (const unsigned char *)in;
+	unsigned char *dst = &m_a[0];
+	size_t n = len;
+	for (auto f : m_filters) {
+		switch (f) {
+		case H5Z_FILTER_DELTA16:
+			delta16_enc((const u16 *)src, (u16 *)dst, n/2, m_rowlen);
+			memcpy(dst + (n & ~(size_t)1), src + (n & ~(size_t)1), n & 1);
+			break;
+		case H5Z_FILTER_SHUFFLE:
+			shuffle2(src, dst, n);
+			break;
+		case H5Z_FILTER_DEFLATE: {
+			uLongf zlen = cap;
+			if (compress2(dst, &zlen, src, n, m_level) != Z_OK)
+				return NULL;
+			n = zlen;
+			break;
+		}
+#ifdef LZ4
+		case H5Z_FILTER_LZ4:
+			n = lz4_enc(src, n, dst, cap);
+			if (n == 0)
+				return NULL;
+			break;
+#endif
+#ifdef ZSTD
+		case H5Z_FILTER_ZSTD:
+			n = ZSTD_compress(dst, cap, src, n, m_level);
+			if (ZSTD_isError(n))
+				return NULL;
+			break;
+#endif
+		default:
+			return NULL;
+		}
+		src = dst;
+		dst = dst == &m_a[0] ? &m_b[0] : &m_a[0];
+	}
+	*size = n;
+	return src;
+}
+int H5ChunkCodec::codec()
+{
+	for (auto f : m_filters) {
+		if (f == H5Z_FILTER_DEFLATE)
+			return H5C_DEFLATE;
+		if (f == H5Z_FILTER_LZ4)
+			return H5C_LZ4;
+		if (f == H5Z_FILTER_ZSTD)
+			return H5C_ZSTD;
+	}
+	return H5C_NONE;
+}
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include "h5spikereader.h"
+
+H5SpikeReader::H5SpikeReader()
+{
+	m_h5file = 0;
+	m_table = false;
+	m_nc = 0;
+	m_nu = 0;
+	m_nwf = 0;
+	m_sr = 0.0;
+	m_Dtk = m_Dts = m_Dch = m_Dun = m_Dwf = 0;
+	m_rows = 0;
+}
+H5SpikeReader::~H5SpikeReader()
+{
+	close();
+}
+
+bool H5SpikeReader::open(const char *fn)
+{
+	close();
+	m_h5file = H5Fopen(fn, H5F_ACC_RDONLY, H5P_DEFAULT);
+	if (m_h5file < 0) {
+		m_h5file = 0;
+		warn("H5SpikeReader: could not open %s", fn);
+		return false;
+	}
+	if (H5Lexists(m_h5file, "/Spikes", H5P_DEFAULT) <= 0) {
+		warn("H5SpikeReader: no /Spikes in %s", fn);
+		close();
+		return false;
+	}
+	m_table = H5Lexists(m_h5file, "/Spikes/Index", H5P_DEFAULT) > 0;
+
+	hid_t g = H5Gopen2(m_h5file, "/Spikes", H5P_DEFAULT);
+	if (H5Aexists(g, "Sampling Rate") > 0) {
+		hid_t a = H5Aopen(g, "Sampling Rate", H5P_DEFAULT);
+		H5Aread(a, H5T_NATIVE_DOUBLE, &m_sr);
+		H5Aclose(a);
+	}
+	H5Gclose(g);
+
+	i64 v;
+	if (attr("Channels", v))
+		m_nc = v;
+	if (attr("Units", v))
+		m_nu = v;
+	if (attr("Waveform Samples", v))
+		m_nwf = v;
+
+	if (!m_table && m_nc == 0) {
+		// written before the attributes: count the groups
+		H5G_info_t info;
+		H5Gget_info_by_name(m_h5file, "/Spikes", &info, H5P_DEFAULT);
+		m_nc = info.nlinks;
+		if (m_nc > 0) {
+			H5Gget_info_by_name(m_h5file, "/Spikes/Chan1", &info, H5P_DEFAULT);
+			m_nu = info.nlinks > 0 ? info.nlinks-1 : 0;
+			hid_t d = H5Dopen2(m_h5file, "/Spikes/Chan1/Unit0/Waveforms", H5P_DEFAULT);
+			if (d >= 0) {
+				hid_t sp = H5Dget_space(d);
+				hsize_t dims[2] = {0, 0};
+				H5Sget_simple_extent_dims(sp, dims, NULL);
+				m_nwf = dims[0];
+				H5Sclose(sp);
+				H5Dclose(d);
+			}
+		}
+	}
+
+	if (m_table) {
+		// the whole index: a few rows per flush, small next to the data
+		hid_t d = H5Dopen2(m_h5file, "/Spikes/Index", H5P_DEFAULT);
+		hid_t sp = H5Dget_space(d);
+		hsize_t dims[2] = {0, 0};
+		H5Sget_simple_extent_dims(sp, dims, NULL);
+		vector<i64> ix(dims[0]*4);
+		if (dims[0] > 0)
+			H5Dread(d, H5T_NATIVE_INT64, H5S_ALL, H5S_ALL, H5P_DEFAULT, &ix[0]);
+		H5Sclose(sp);
+		H5Dclose(d);
+		for (size_t i=0; i<dims[0]; i++) {
+			auto &r = m_runs[make_pair((int)ix[i*4], (int)ix[i*4+1])];
+			r.push_back(make_pair((hsize_t)ix[i*4+2], (hsize_t)ix[i*4+3]));
+		}
+
+		// kept open, so their chunk caches last from one read() to the next
+		m_Dtk = column("/Spikes/Ticks");
+		m_Dts = column("/Spikes/Timestamps");
+		m_Dch = column("/Spikes/Channel");
+		m_Dun = column("/Spikes/Unit");
+		if (m_nwf > 0)
+			m_Dwf = column("/Spikes/Waveforms");
+		if (m_Dtk < 0 || m_Dts < 0 || m_Dch < 0 || m_Dun < 0 || m_Dwf < 0) {
+			warn("H5SpikeReader: %s is missing table columns", fn);
+			close();
+			return false;
+		}
+		sp = H5Dget_space(m_Dtk);
+		H5Sget_simple_extent_dims(sp, dims, NULL);
+		H5Sclose(sp);
+		m_rows = dims[0];
+	}
+	return true;
+}
+
+hid_t H5SpikeReader::column(const char *name)
+{
+	hid_t dapl = H5Pcreate(H5P_DATASET_ACCESS);
+	H5Pset_chunk_cache(dapl, 12421, H5R_CACHE, 1.0); // slots: a prime, ~100x the chunks
+	hid_t d = H5Dopen2(m_h5file, name, dapl);
+	H5Pclose(dapl);
+	return d;
+}
+
+void H5SpikeReader::close()
+{
+	for (auto x : {&m_Dtk, &m_Dts, &m_Dch, &m_Dun, &m_Dwf}) {
+		if (*x > 0)
+			H5Dclose(*x);
+		*x = 0;
+	}
+	m_rows = 0;
+	if (m_h5file > 0)
+		H5Fclose(m_h5file);
+	m_h5file = 0;
+	m_table = false;
+	m_nc = 0;
+	m_nu = 0;
+	m_nwf = 0;
+	m_sr = 0.0;
+	m_runs.clear();
+}
+
+bool H5SpikeReader::attr(const char *name, i64 &v)
+{
+	hid_t g = H5Gopen2(m_h5file, "/Spikes", H5P_DEFAULT);
+	bool ok = H5Aexists(g, name) > 0;
+	if (ok) {
+		hid_t a = H5Aopen(g, name, H5P_DEFAULT);
+		ok = H5Aread(a, H5T_NATIVE_INT64, &v) >= 0;
+		H5Aclose(a);
+	}
+	H5Gclose(g);
+	return ok;
+}
+
+// rows in a dataset, 0 if it isn't there
+static hsize_t rows(hid_t file, const char *name, int dim)
+{
+	if (H5Lexists(file, name, H5P_DEFAULT) <= 0)
+		return 0;
+	hid_t d = H5Dopen2(file, name, H5P_DEFAULT);
+	hid_t sp = H5Dget_space(d);
+	hsize_t dims[2] = {0, 0};
+	H5Sget_simple_extent_dims(sp, dims, NULL);
+	H5Sclose(sp);
+	H5Dclose(d);
+	return dims[dim];
+}
+
+size_t H5SpikeReader::count(int ch, int un)
+{
+	if (ch < 1 || (size_t)ch > m_nc || un < 0 || (size_t)un > m_nu)
+		return 0;
+	if (m_table) {
+		auto it = m_runs.find(make_pair(ch, un));
+		if (it == m_runs.end())
+			return 0;
+		size_t n = 0;
+		for (auto &r : it->second)
+			n += r.second;
+		return n;
+	}
+	char buf[256];
+	snprintf(buf, 256, "/Spikes/Chan%d/Unit%d/Ticks", ch, un);
+	return rows(m_h5file, buf, 0);
+}
+
+bool H5SpikeReader::read(int ch, int un, vector<i64> &tk, vector<double> &ts,
+                         vector<float> &wf)
+{
+	size_t n = count(ch, un);
+	tk.resize(n);
+	ts.resize(n);
+	wf.assign(n*m_nwf, 0.f);
+	if (n == 0)
+		return m_h5file > 0;
+	return m_table ? readTable(ch, un, tk, ts, wf) : readGroups(ch, un, tk, ts, wf);
+}
+
+// read the rows listed in runs (in order) of a dataset, n rows in all
+static bool readRuns(hid_t d, hid_t type, size_t cols,
+                     const vector<pair<hsize_t, hsize_t> > &runs, size_t n,
+                     void *buf)
+{
+	int rank = cols > 1 ? 2 : 1;
+	hid_t filespace = H5Dget_space(d);
+	H5Sselect_none(filespace);
+	for (auto &r : runs) {
+		hsize_t offset[2] = {r.first, 0};
+		hsize_t count[2] = {r.second, cols};
+		H5Sselect_hyperslab(filespace, H5S_SELECT_OR, offset, NULL, count, NULL);
+	}
+	hsize_t mem_dims[2] = {n, cols};
+	hid_t memspace = H5Screate_simple(rank, mem_dims, NULL);
+	herr_t err = H5Dread(d, type, memspace, filespace, H5P_DEFAULT, buf);
+	H5Sclose(memspace);
+	H5Sclose(filespace);
+	return err >= 0;
+}
+
+bool H5SpikeReader::readTable(int ch, int un, vector<i64> &tk,
+                              vector<double> &ts, vector<float> &wf)
+{
+	auto &runs = m_runs[make_pair(ch, un)];
+	size_t n = tk.size();
+	bool ok = readRuns(m_Dtk, H5T_NATIVE_INT64, 1, runs, n, &tk[0]);
+	ok &= readRuns(m_Dts, H5T_NATIVE_DOUBLE, 1, runs, n, &ts[0]);
+	if (m_nwf > 0)
+		ok &= readRuns(m_Dwf, H5T_NATIVE_FLOAT, m_nwf, runs, n, &wf[0]);
+	return ok;
+}
+
+// rows [r0, r0+n) of a table column
+static bool readRows(hid_t d, hid_t type, size_t cols, size_t r0, size_t n,
+                     void *buf)
+{
+	vector<pair<hsize_t, hsize_t> > run(1, make_pair((hsize_t)r0, (hsize_t)n));
+	return readRuns(d, type, cols, run, n, buf);
+}
+
+bool H5SpikeReader::readAll(vector<SpikeUnit> &all)
+{
+	size_t nu = m_nu+1;
+	all.assign(m_nc*nu, SpikeUnit());
+	if (!m_table) {
+		bool ok = m_h5file > 0;
+		for (size_t c=1; c<=m_nc; c++) {
+			for (size_t u=0; u<nu; u++) {
+				auto &o = all[(c-1)*nu + u];
+				ok &= read(c, u, o.tk, o.ts, o.wf);
+			}
+		}
+		return ok;
+	}
+
+	// size everything first, so the scatter below never reallocates
+	for (auto &kv : m_runs) {
+		size_t n = count(kv.first.first, kv.first.second);
+		if (n == 0)
+			continue;
+		auto &o = all[(kv.first.first-1)*nu + kv.first.second];
+		o.tk.reserve(n);
+		o.ts.reserve(n);
+		o.wf.reserve(n*m_nwf);
+	}
+	vector<i64> tk(H5R_BLOCK);
+	vector<double> ts(H5R_BLOCK);
+	vector<i16> ch(H5R_BLOCK);
+	vector<i16> un(H5R_BLOCK);
+	vector<float> wf(H5R_BLOCK*m_nwf);
+	for (size_t r0=0; r0<m_rows; r0+=H5R_BLOCK) {
+		size_t n = m_rows - r0 < (size_t)H5R_BLOCK ? m_rows - r0 : (size_t)H5R_BLOCK;
+		bool ok = readRows(m_Dtk, H5T_NATIVE_INT64, 1, r0, n, &tk[0]);
+		ok &= readRows(m_Dts, H5T_NATIVE_DOUBLE, 1, r0, n, &ts[0]);
+		ok &= readRows(m_Dch, H5T_NATIVE_INT16, 1, r0, n, &ch[0]);
+		ok &= readRows(m_Dun, H5T_NATIVE_INT16, 1, r0, n, &un[0]);
+		if (m_nwf > 0)
+			ok &= readRows(m_Dwf, H5T_NATIVE_FLOAT, m_nwf, r0, n, &wf[0]);
+		if (!ok)
+			return false;
+		for (size_t i=0; i<n; i++) {
+			if (ch[i] < 1 || (size_t)ch[i] > m_nc || un[i] < 0 || (size_t)un[i] >= nu)
+				continue;
+			auto &o = all[(ch[i]-1)*nu + un[i]];
+			o.tk.push_back(tk[i]);
+			o.ts.push_back(ts[i]);
+			if (m_nwf > 0)
+				o.wf.insert(o.wf.end(), &wf[i*m_nwf], &wf[(i+1)*m_nwf]);
+		}
+	}
+	return true;
+}
+
+bool H5SpikeReader::readGroups(int ch, int un, vector<i64> &tk,
+                               vector<double> &ts, vector<float> &wf)
+{
+	char buf[256];
+	hid_t d;
+	herr_t err;
+
+	snprintf(buf, 256, "/Spikes/Chan%d/Unit%d/Ticks", ch, un);
+	d = H5Dopen2(m_h5file, buf, H5P_DEFAULT);
+	err = H5Dread(d, H5T_NATIVE_INT64, H5S_ALL, H5S_ALL, H5P_DEFAULT, &tk[0]);
+	H5Dclose(d);
+	if (err < 0)
+		return false;
+
+	snprintf(buf, 256, "/Spikes/Chan%d/Unit%d/Timestamps", ch, un);
+	d = H5Dopen2(m_h5file, buf, H5P_DEFAULT);
+	err = H5Dread(d, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, &ts[0]);
+	H5Dclose(d);
+	if (err < 0)
+		return false;
+
+	// nwf x m, where m stops at the last flush that carried waveforms
+	snprintf(buf, 256, "/Spikes/Chan%d/Unit%d/Waveforms", ch, un);
+	size_t m = rows(m_h5file, buf, 1);
+	if (m == 0 || m_nwf == 0)
+		return true;
+	if (m > tk.size())
+		m = tk.size();
+	vector<float> w(m_nwf*m);
+	d = H5Dopen2(m_h5file, buf, H5P_DEFAULT);
+	hid_t filespace = H5Dget_space(d);
+	hsize_t offset[2] = {0, 0};
+	hsize_t count[2] = {m_nwf, m};
+	H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL, count, NULL);
+	hid_t memspace = H5Screate_simple(2, count, NULL);
+	err = H5Dread(d, H5T_NATIVE_FLOAT, memspace, filespace, H5P_DEFAULT, &w[0]);
+	H5Sclose(memspace);
+	H5Sclose(filespace);
+	H5Dclose(d);
+	for (size_t i=0; i<m; i++) {
+		for (size_t j=0; j<m_nwf; j++) {
+			wf[i*m_nwf + j] = w[j*m + i];
+		}
+	}
+	return err >= 0;
+}
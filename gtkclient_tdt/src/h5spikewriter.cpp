@@ -1,4 +1,6 @@
+#include <string.h>
 #include "util.h"
+#include "gettime.h"
 #include "h5spikewriter.h"
 
 H5SpikeWriter::H5SpikeWriter()
@@ -11,12 +13,62 @@ H5SpikeWriter::H5SpikeWriter()
 	m_h5Dts.clear();
 	m_h5Dwf.clear();
 	m_ns.clear();
-	m_q = NULL;
+	m_q.clear();
+	m_free.clear();
+	m_nlanes = 1;
+	m_queued = 0;
+	m_maxAge = 1.0;
+	m_allocs = 0;
+	m_maxDepth = 0;
+	m_flushes = 0;
+	m_flushTime = 0.0;
+	m_flushMax = 0.0;
+	m_layout = H5S_LAYOUT_GROUPS;
+	m_h5Ttk = m_h5Tts = m_h5Tch = m_h5Tun = m_h5Twf = m_h5Tix = 0;
+	m_tab.n = 0;
+	m_rows = 0;
+	m_nruns = 0;
 }
 H5SpikeWriter::~H5SpikeWriter()
 {
-	delete m_q;
-	m_q = NULL;
+	for (auto &q : m_q) {
+		freeSpikes(q);
+	}
+	m_q.clear();
+	m_queued = 0;
+	for (auto &q : m_free) {
+		freeSpikes(q);
+	}
+	m_free.clear();
+}
+SPIKE *H5SpikeWriter::newSpike()
+{
+	auto s = new SPIKE;
+	s->nwf = 0;
+	s->wf = new float[m_nwf > 0 ? m_nwf : 1];
+	return s;
+}
+// deletes the spikes in q, and q
+void H5SpikeWriter::freeSpikes(ReaderWriterQueue<SPIKE *> *q)
+{
+	SPIKE *s;
+	while (q->try_dequeue(s)) {
+		delete[] (s->wf);
+		delete s;
+	}
+	delete q;
+}
+void H5SpikeWriter::setLanes(size_t n)
+{
+	if (isEnabled())
+		return;
+	m_nlanes = n > 0 ? n : 1;
+}
+void H5SpikeWriter::setLayout(int layout)
+{
+	if (isEnabled())
+		return;
+	m_layout = layout == H5S_LAYOUT_TABLE ? H5S_LAYOUT_TABLE : H5S_LAYOUT_GROUPS;
 }
 bool H5SpikeWriter::open(const char *fn, size_t nc, size_t nu, size_t nwf)
 {
@@ -35,6 +87,72 @@ bool H5SpikeWriter::open(const char *fn, size_t nc, size_t nu, size_t nwf)
 		return false;
 	}
 
+	bool ok = m_layout == H5S_LAYOUT_TABLE ?
+	          openTable(nwf) : openGroups(nc, nu, nwf);
+	if (!ok) {
+		close();
+		return false;
+	}
+
+	m_nc = nc;
+	m_nu = nu;
+	m_nwf = nwf;
+
+	// so readers needn't count groups
+	setAttr("Layout", m_layout);
+	setAttr("Channels", nc);
+	setAttr("Units", nu);
+	setAttr("Waveform Samples", nwf);
+
+	m_buf.resize(nc*(nu+1));
+	for (auto &b : m_buf) {
+		b.n = 0;
+		b.haswf = false;
+		b.t0 = 0.0;
+		// allocated on the first spike: most (ch,un) never see one
+		b.tk.clear();
+		b.ts.clear();
+		b.wf.clear();
+	}
+	if (m_layout == H5S_LAYOUT_TABLE) {
+		for (auto b : {&m_tab, &m_sorted}) {
+			b->tk.resize(H5S_TABLE_BUF);
+			b->ts.resize(H5S_TABLE_BUF);
+			b->ch.resize(H5S_TABLE_BUF);
+			b->un.resize(H5S_TABLE_BUF);
+			b->wf.resize(m_nwf*H5S_TABLE_BUF);
+			b->n = 0;
+			b->t0 = 0.0;
+		}
+		m_first.resize(nc*(nu+1)+1);
+		m_runs.reserve(4*nc*(nu+1));
+		m_rows = 0;
+		m_nruns = 0;
+	}
+
+	size_t npool = H5S_POOL_SIZE/m_nlanes + 1;
+	for (size_t i=0; i<m_nlanes; i++) {
+		m_q.push_back(new ReaderWriterQueue<SPIKE *>(H5S_BUF_SIZE/m_nlanes));
+		auto q = new ReaderWriterQueue<SPIKE *>(H5S_BUF_SIZE/m_nlanes);
+		for (size_t j=0; j<npool; j++) {
+			q->enqueue(newSpike());
+		}
+		m_free.push_back(q);
+	}
+	m_allocs = 0;
+	m_maxDepth = 0;
+	m_flushes = 0;
+	m_flushTime = 0.0;
+	m_flushMax = 0.0;
+
+	enable();
+
+	return true;
+}
+
+// one group per channel, one per unit, three datasets per unit
+bool H5SpikeWriter::openGroups(size_t nc, size_t nu, size_t nwf)
+{
 	// create a group for each channel and for each unit in each channel
 	hid_t group;
 	for (size_t i=1; i<=nc; i++) { // 1-indexed
@@ -44,7 +162,6 @@ bool H5SpikeWriter::open(const char *fn, size_t nc, size_t nu, size_t nwf)
 		group = H5Gcreate2(m_h5file, buf,
 		                   H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
 		if (group < 0) {
-			close();
 			return false;
 		}
 		m_h5groups.push_back(group);
@@ -56,7 +173,6 @@ bool H5SpikeWriter::open(const char *fn, size_t nc, size_t nu, size_t nwf)
 			group = H5Gcreate2(m_h5file, buf,
 			                   H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
 			if (group < 0) {
-				close();
 				return false;
 			}
 			m_h5groups.push_back(group);
@@ -71,7 +187,6 @@ bool H5SpikeWriter::open(const char *fn, size_t nc, size_t nu, size_t nwf)
 			max_dims[0] 	= H5S_UNLIMITED;
 			ds = H5Screate_simple(1, init_dims, max_dims);
 			if (ds < 0) {
-				close();
 				return false;
 			}
 			prop = H5Pcreate(H5P_DATASET_CREATE);
@@ -79,13 +194,12 @@ bool H5SpikeWriter::open(const char *fn, size_t nc, size_t nu, size_t nwf)
 				shuffleDataset(prop);
 			if (m_deflate)
 				deflateDataset(prop);
-			chunk_dims[0] = 128;
+			chunk_dims[0] = H5S_CHUNK;
 			H5Pset_chunk(prop, 1, chunk_dims);
 			sprintf(buf, "/Spikes/Chan%zu/Unit%zu/Ticks", i, j);
 			dset = H5Dcreate(m_h5file, buf, H5T_STD_I64LE,
 			                 ds, H5P_DEFAULT, prop, H5P_DEFAULT);
 			if (dset < 0) {
-				close();
 				return false;
 			}
 			m_h5Dtk[idx] = dset;
@@ -97,7 +211,6 @@ bool H5SpikeWriter::open(const char *fn, size_t nc, size_t nu, size_t nwf)
 			max_dims[0] 	= H5S_UNLIMITED;
 			ds = H5Screate_simple(1, init_dims, max_dims);
 			if (ds < 0) {
-				close();
 				return false;
 			}
 			prop = H5Pcreate(H5P_DATASET_CREATE);
@@ -105,13 +218,12 @@ bool H5SpikeWriter::open(const char *fn, size_t nc, size_t nu, size_t nwf)
 				shuffleDataset(prop);
 			if (m_deflate)
 				deflateDataset(prop);
-			chunk_dims[0] = 128;
+			chunk_dims[0] = H5S_CHUNK;
 			H5Pset_chunk(prop, 1, chunk_dims);
 			sprintf(buf, "/Spikes/Chan%zu/Unit%zu/Timestamps", i, j);
 			dset = H5Dcreate(m_h5file, buf, H5T_IEEE_F64LE,
 			                 ds, H5P_DEFAULT, prop, H5P_DEFAULT);
 			if (dset < 0) {
-				close();
 				return false;
 			}
 			m_h5Dts[idx] = dset;
@@ -125,7 +237,6 @@ bool H5SpikeWriter::open(const char *fn, size_t nc, size_t nu, size_t nwf)
 			max_dims[1] 	= H5S_UNLIMITED;
 			ds = H5Screate_simple(2, init_dims, max_dims);
 			if (ds < 0) {
-				close();
 				return false;
 			}
 			prop = H5Pcreate(H5P_DATASET_CREATE);
@@ -134,13 +245,12 @@ bool H5SpikeWriter::open(const char *fn, size_t nc, size_t nu, size_t nwf)
 			if (m_deflate)
 				deflateDataset(prop);
 			chunk_dims[0] = nwf;
-			chunk_dims[1] = 128;
+			chunk_dims[1] = H5S_WF_CHUNK;
 			H5Pset_chunk(prop, 2, chunk_dims);
 			sprintf(buf, "/Spikes/Chan%zu/Unit%zu/Waveforms", i, j);
 			dset = H5Dcreate(m_h5file, buf, H5T_IEEE_F32LE,
 			                 ds, H5P_DEFAULT, prop, H5P_DEFAULT);
 			if (dset < 0) {
-				close();
 				return false;
 			}
 			m_h5Dwf[idx] = dset;
@@ -151,26 +261,72 @@ bool H5SpikeWriter::open(const char *fn, size_t nc, size_t nu, size_t nwf)
 
 		}
 	}
+	return true;
+}
 
-	m_nc = nc;
-	m_nu = nu;
-	m_nwf = nwf;
-
-	m_q = new ReaderWriterQueue<SPIKE *>(H5S_BUF_SIZE);
-
-	enable();
-
+// the table: one dataset per column, rows appended by flushTable()
+bool H5SpikeWriter::openTable(size_t nwf)
+{
+	m_h5Ttk = mkColumn("/Spikes/Ticks", H5T_STD_I64LE, 1, H5S_TABLE_CHUNK);
+	m_h5Tts = mkColumn("/Spikes/Timestamps", H5T_IEEE_F64LE, 1, H5S_TABLE_CHUNK);
+	m_h5Tch = mkColumn("/Spikes/Channel", H5T_STD_I16LE, 1, H5S_TABLE_CHUNK);
+	m_h5Tun = mkColumn("/Spikes/Unit", H5T_STD_I16LE, 1, H5S_TABLE_CHUNK);
+	m_h5Tix = mkColumn("/Spikes/Index", H5T_STD_I64LE, 4, H5S_INDEX_CHUNK);
+	if (m_h5Ttk < 0 || m_h5Tts < 0 || m_h5Tch < 0 || m_h5Tun < 0 || m_h5Tix < 0)
+		return false;
+	if (nwf > 0) {
+		m_h5Twf = mkColumn("/Spikes/Waveforms", H5T_IEEE_F32LE, nwf,
+		                   H5S_TABLE_WF_CHUNK);
+		if (m_h5Twf < 0)
+			return false;
+	}
 	return true;
 }
 
+// an empty, unlimited, chunked dataset of rows x cols (just rows if cols is 1)
+hid_t H5SpikeWriter::mkColumn(const char *name, hid_t type, size_t cols, size_t chunk)
+{
+	int rank = cols > 1 ? 2 : 1;
+	hsize_t init_dims[2] = {0, cols};
+	hsize_t max_dims[2] = {H5S_UNLIMITED, cols};
+	hsize_t chunk_dims[2] = {chunk, cols};
+	hid_t ds = H5Screate_simple(rank, init_dims, max_dims);
+	if (ds < 0)
+		return -1;
+	m_h5dataspaces.push_back(ds);
+	hid_t prop = H5Pcreate(H5P_DATASET_CREATE);
+	m_h5props.push_back(prop);
+	if (m_shuffle)
+		shuffleDataset(prop);
+	if (m_deflate)
+		deflateDataset(prop);
+	H5Pset_chunk(prop, rank, chunk_dims);
+	return H5Dcreate(m_h5file, name, type, ds, H5P_DEFAULT, prop, H5P_DEFAULT);
+}
+
 bool H5SpikeWriter::close()
 {
+	if (isEnabled()) {
+		write(); // drain the queues
+		lock_guard<mutex> lock(m_mtx);
+		for (size_t i=0; i<m_buf.size(); i++) {
+			flush(i);
+		}
+		if (m_layout == H5S_LAYOUT_TABLE)
+			flushTable();
+	}
 	disable();
 
-	if (m_q) {
-		delete m_q;
-		m_q = NULL;
+	for (auto &q : m_q) {
+		freeSpikes(q);
+	}
+	m_q.clear();
+	m_queued = 0;
+	for (auto &q : m_free) {
+		freeSpikes(q);
 	}
+	m_free.clear();
+	m_buf.clear();
 
 	m_nwf = 0;
 	m_nu = 0;
@@ -206,18 +362,47 @@ bool H5SpikeWriter::close()
 
 	m_ns.clear();
 
+	for (auto x : {&m_h5Ttk, &m_h5Tts, &m_h5Tch, &m_h5Tun, &m_h5Twf, &m_h5Tix}) {
+		if (*x > 0) {
+			H5Dclose(*x);
+		}
+		*x = 0;
+	}
+
 	return H5Writer::close();
 }
 
 
-bool H5SpikeWriter::add(SPIKE *s)	// call from a single producer thread
+SPIKE *H5SpikeWriter::get(size_t lane)	// producer side of m_free[lane]
 {
-	if (!isEnabled()) {
+	if (!isEnabled() || lane >= m_free.size())
+		return nullptr;
+	SPIKE *s;
+	if (m_free[lane]->try_dequeue(s))
+		return s;
+	m_allocs++; // pool ran dry; it grows by this one when it comes back
+	return newSpike();
+}
+
+bool H5SpikeWriter::add(SPIKE *s, size_t lane)	// one producer per lane
+{
+	if (!isEnabled() || lane >= m_q.size()) {
 		delete[] (s->wf);
 		delete s;
 		return false;
 	}
-	return m_q->enqueue(s);	// todo: what if this (memory alloc) fails
+	bool ok = m_q[lane]->enqueue(s);	// todo: what if this (memory alloc) fails
+	// wake the writer once per batch, not per spike
+	if (m_queued.fetch_add(1) + 1 == H5S_WAKE)
+		m_wake.signal();
+	return ok;
+}
+
+void H5SpikeWriter::wait(double timeout)
+{
+	unsigned seen = m_wake.seq();
+	if (m_queued < H5S_WAKE)
+		m_wake.wait(seen, timeout);
 }
 
 
@@ -229,100 +414,296 @@ bool H5SpikeWriter::write()   // call from a single consumer thread
 	//Lock so that the file isnt closed out from under us
 	lock_guard<mutex> lock(m_mtx); // very important!!!
 
-	bool dequeued;
-	do {
+	size_t depth = capacity();
+	if (depth > m_maxDepth)
+		m_maxDepth = depth;
+
+	double now = (double)gettime();
+	size_t nu = m_nu+1;
+
+	// lanes are drained one after another. a (ch,un) only ever
+	// arrives on one lane, so its spikes stay in order.
+	size_t ndq = 0;
+	for (size_t lane=0; lane<m_q.size(); lane++) {
 		SPIKE *s;
-		dequeued = m_q->try_dequeue(s);
-		if (dequeued) {
+		while (m_q[lane]->try_dequeue(s)) {
+			ndq++;
 
 			if ((s->nwf != m_nwf) && s->nwf != 0) {
 				warn("well this is embarassing");
 			}
 
-			auto idx = make_pair(s->ch, s->un);
+			if (s->ch < 1 || (size_t)s->ch > m_nc ||
+			    s->un < 0 || (size_t)s->un >= nu) {
+				m_free[lane]->enqueue(s);
+				continue;
+			}
+			if (m_layout == H5S_LAYOUT_TABLE) {
+				pushTable(s, now);
+				m_free[lane]->enqueue(s);
+				continue;
+			}
+			size_t i = (s->ch-1)*nu + s->un;
+			auto &b = m_buf[i];
+			if (b.tk.empty()) {
+				b.tk.resize(H5S_UNIT_BUF);
+				b.ts.resize(H5S_UNIT_BUF);
+				b.wf.resize(m_nwf*H5S_UNIT_BUF);
+			}
+			if (b.n == 0)
+				b.t0 = now;
+			b.tk[b.n] = s->tk;
+			b.ts[b.n] = s->ts;
+			// the wf dataset is nwf x n, so a spike is a column
+			if (s->nwf == m_nwf && m_nwf > 0) {
+				for (size_t j=0; j<m_nwf; j++) {
+					b.wf[j*H5S_UNIT_BUF + b.n] = s->wf[j];
+				}
+				b.haswf = true;
+			} else {
+				for (size_t j=0; j<m_nwf; j++) {
+					b.wf[j*H5S_UNIT_BUF + b.n] = 0.f;
+				}
+			}
+			b.n++;
+
+			m_free[lane]->enqueue(s); // back to the pool
 
-			hsize_t new_dims[2], offset[2], packet_dims[2];
-			hid_t filespace, memspace;
+			if (b.n == H5S_UNIT_BUF)
+				flush(i);
+		}
+	}
 
-			// TICKS
-			// extend dataset for new data (TODO: CHECK FOR ERROR)
-			new_dims[0] = m_ns[idx] + 1;
-			H5Dset_extent(m_h5Dtk[idx], new_dims);
-			// select hyperslab in extended oprtion of dataset
-			filespace = H5Dget_space(m_h5Dtk[idx]);
-			offset[0] = m_ns[idx];
-			packet_dims[0] = 1;
-			H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL,
-			                    packet_dims, NULL);
-			// Define memory space for new data (TODO CHECK FOR ERROR)
-			memspace = H5Screate_simple(1, packet_dims, NULL);
-			// Write the dataset (TODO: CHECK FOR ERROR)
-			H5Dwrite(m_h5Dtk[idx], H5T_NATIVE_INT64, memspace, filespace,
-			         H5P_DEFAULT, &(s->tk));
-			H5Sclose(memspace);
-			H5Sclose(filespace);
+	m_queued -= ndq;
 
-			// TIMESTAMPS
-			// extend dataset for new data (TODO: CHECK FOR ERROR)
-			new_dims[0] = m_ns[idx] + 1;
-			H5Dset_extent(m_h5Dts[idx], new_dims);
-			// select hyperslab in extended oprtion of dataset
-			filespace = H5Dget_space(m_h5Dts[idx]);
-			offset[0] = m_ns[idx];
-			packet_dims[0] = 1;
-			H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL,
-			                    packet_dims, NULL);
-			// Define memory space for new data (TODO CHECK FOR ERROR)
-			memspace = H5Screate_simple(1, packet_dims, NULL);
-			// Write the dataset (TODO: CHECK FOR ERROR)
-			H5Dwrite(m_h5Dts[idx], H5T_IEEE_F64LE, memspace, filespace,
-			         H5P_DEFAULT, &(s->ts));
-			H5Sclose(memspace);
-			H5Sclose(filespace);
+	// don't let a slow unit sit in memory for long
+	for (size_t i=0; i<m_buf.size(); i++) {
+		if (m_buf[i].n > 0 && now - m_buf[i].t0 > m_maxAge)
+			flush(i);
+	}
+	if (m_tab.n > 0 && now - m_tab.t0 > m_maxAge)
+		flushTable();
 
-			// WAVEFORMS
-			// extend dataset for new data (TODO: CHECK FOR ERROR)
-			if (s->nwf != 0) {
-				new_dims[0] = m_nwf;
-				new_dims[1] = m_ns[idx] + 1;
-				H5Dset_extent(m_h5Dwf[idx], new_dims);
-				// select hyperslab in extended oprtion of dataset
-				filespace = H5Dget_space(m_h5Dwf[idx]);
-				offset[0] = 0;
-				offset[1] = m_ns[idx];
-				packet_dims[0] = m_nwf;
-				packet_dims[1] = 1;
-				H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL,
-				                    packet_dims, NULL);
-				// Define memory space for new data (TODO CHECK FOR ERROR)
-				memspace = H5Screate_simple(1, packet_dims, NULL);
-				// Write the dataset (TODO: CHECK FOR ERROR)
-				H5Dwrite(m_h5Dwf[idx], H5T_IEEE_F32LE, memspace, filespace,
-				         H5P_DEFAULT, s->wf);
-				H5Sclose(memspace);
-				H5Sclose(filespace);
-			}
+	return true;
+}
 
-			m_ns[idx] += 1; // increment sample pointer
+// buffer a (checked) spike for the table. call with m_mtx held.
+void H5SpikeWriter::pushTable(const SPIKE *s, double now)
+{
+	auto &b = m_tab;
+	if (b.n == 0)
+		b.t0 = now;
+	b.tk[b.n] = s->tk;
+	b.ts[b.n] = s->ts;
+	b.ch[b.n] = s->ch;
+	b.un[b.n] = s->un;
+	float *wf = &b.wf[b.n*m_nwf];
+	if (s->nwf == m_nwf && m_nwf > 0) {
+		memcpy(wf, s->wf, m_nwf*sizeof(float));
+	} else {
+		memset(wf, 0, m_nwf*sizeof(float)); // keeps rows aligned; deflates away
+	}
+	b.n++;
+	if (b.n == H5S_TABLE_BUF)
+		flushTable();
+}
 
-			//if (m_os.fail()) { // write lost, should we requeue?
-			//	fprintf(stderr,"ERROR: %s write failed!\n", name());
-			//}
-			delete[] (s->wf);
-			delete s; // free the memory that was pointed to
+// append rows to a dataset made by mkColumn(). buf is n x cols, packed.
+void H5SpikeWriter::append(hid_t dset, hid_t type, size_t n0, size_t n,
+                           size_t cols, const void *buf)
+{
+	int rank = cols > 1 ? 2 : 1;
+	hsize_t new_dims[2] = {n0 + n, cols};
+	hsize_t offset[2] = {n0, 0};
+	hsize_t packet_dims[2] = {n, cols};
+	H5Dset_extent(dset, new_dims); // TODO: CHECK FOR ERROR
+	hid_t filespace = H5Dget_space(dset);
+	H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL,
+	                    packet_dims, NULL);
+	hid_t memspace = H5Screate_simple(rank, packet_dims, NULL);
+	H5Dwrite(dset, type, memspace, filespace, H5P_DEFAULT, buf);
+	H5Sclose(memspace);
+	H5Sclose(filespace);
+}
+
+// append the buffered spikes to the table, grouped by (ch,un), and one
+// index row per unit present. call with m_mtx held.
+void H5SpikeWriter::flushTable()
+{
+	auto &b = m_tab;
+	auto &o = m_sorted;
+	if (b.n == 0)
+		return;
+
+	long double t = gettime();
+
+	// counting sort on (ch,un). stable, so each run stays in time order.
+	size_t nu = m_nu+1;
+	for (auto &f : m_first)
+		f = 0;
+	for (size_t i=0; i<b.n; i++)
+		m_first[(b.ch[i]-1)*nu + b.un[i] + 1]++;
+	m_runs.clear();
+	for (size_t k=0; k+1<m_first.size(); k++) {
+		size_t c = m_first[k+1];
+		m_first[k+1] += m_first[k]; // now the first row of k+1
+		if (c > 0) {
+			m_runs.push_back(k/nu + 1);
+			m_runs.push_back(k%nu);
+			m_runs.push_back(m_rows + m_first[k]);
+			m_runs.push_back(c);
 		}
-	} while (dequeued);
+	}
+	for (size_t i=0; i<b.n; i++) {
+		size_t r = m_first[(b.ch[i]-1)*nu + b.un[i]]++;
+		o.tk[r] = b.tk[i];
+		o.ts[r] = b.ts[i];
+		o.ch[r] = b.ch[i];
+		o.un[r] = b.un[i];
+		memcpy(&o.wf[r*m_nwf], &b.wf[i*m_nwf], m_nwf*sizeof(float));
+	}
 
-	return true;
+	append(m_h5Ttk, H5T_NATIVE_INT64, m_rows, b.n, 1, &o.tk[0]);
+	append(m_h5Tts, H5T_NATIVE_DOUBLE, m_rows, b.n, 1, &o.ts[0]);
+	append(m_h5Tch, H5T_NATIVE_INT16, m_rows, b.n, 1, &o.ch[0]);
+	append(m_h5Tun, H5T_NATIVE_INT16, m_rows, b.n, 1, &o.un[0]);
+	if (m_h5Twf > 0)
+		append(m_h5Twf, H5T_NATIVE_FLOAT, m_rows, b.n, m_nwf, &o.wf[0]);
+	size_t nr = m_runs.size()/4;
+	append(m_h5Tix, H5T_NATIVE_INT64, m_nruns, nr, 4, &m_runs[0]);
+
+	m_rows += b.n;
+	m_nruns += nr;
+	b.n = 0;
+
+	double dt = (double)(gettime() - t);
+	m_flushes++;
+	m_flushTime += dt;
+	if (dt > m_flushMax)
+		m_flushMax = dt;
+}
+
+// append what is buffered for (ch,un) i to its three datasets.
+// call with m_mtx held.
+void H5SpikeWriter::flush(size_t i)
+{
+	auto &b = m_buf[i];
+	if (b.n == 0)
+		return;
+
+	long double t = gettime();
+
+	size_t nu = m_nu+1;
+	auto idx = make_pair((i16)(i/nu + 1), (i16)(i%nu));
+	size_t n0 = m_ns[idx];
+
+	hsize_t new_dims[2], offset[2], packet_dims[2], mem_dims[2];
+	hid_t filespace, memspace;
+
+	// TICKS
+	// extend dataset for new data (TODO: CHECK FOR ERROR)
+	new_dims[0] = n0 + b.n;
+	H5Dset_extent(m_h5Dtk[idx], new_dims);
+	// select hyperslab in extended portion of dataset
+	filespace = H5Dget_space(m_h5Dtk[idx]);
+	offset[0] = n0;
+	packet_dims[0] = b.n;
+	H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL,
+	                    packet_dims, NULL);
+	// Define memory space for new data (TODO CHECK FOR ERROR)
+	memspace = H5Screate_simple(1, packet_dims, NULL);
+	// Write the dataset (TODO: CHECK FOR ERROR)
+	H5Dwrite(m_h5Dtk[idx], H5T_NATIVE_INT64, memspace, filespace,
+	         H5P_DEFAULT, &b.tk[0]);
+	H5Sclose(memspace);
+	H5Sclose(filespace);
+
+	// TIMESTAMPS
+	H5Dset_extent(m_h5Dts[idx], new_dims);
+	filespace = H5Dget_space(m_h5Dts[idx]);
+	H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL,
+	                    packet_dims, NULL);
+	memspace = H5Screate_simple(1, packet_dims, NULL);
+	H5Dwrite(m_h5Dts[idx], H5T_IEEE_F64LE, memspace, filespace,
+	         H5P_DEFAULT, &b.ts[0]);
+	H5Sclose(memspace);
+	H5Sclose(filespace);
+
+	// WAVEFORMS
+	// the wf column index follows the tick index, as before
+	if (b.haswf) {
+		new_dims[0] = m_nwf;
+		new_dims[1] = n0 + b.n;
+		H5Dset_extent(m_h5Dwf[idx], new_dims);
+		filespace = H5Dget_space(m_h5Dwf[idx]);
+		offset[0] = 0;
+		offset[1] = n0;
+		packet_dims[0] = m_nwf;
+		packet_dims[1] = b.n;
+		H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, NULL,
+		                    packet_dims, NULL);
+		// the buffer is nwf x H5S_UNIT_BUF; take the first n columns
+		mem_dims[0] = m_nwf;
+		mem_dims[1] = H5S_UNIT_BUF;
+		memspace = H5Screate_simple(2, mem_dims, NULL);
+		offset[1] = 0;
+		H5Sselect_hyperslab(memspace, H5S_SELECT_SET, offset, NULL,
+		                    packet_dims, NULL);
+		H5Dwrite(m_h5Dwf[idx], H5T_IEEE_F32LE, memspace, filespace,
+		         H5P_DEFAULT, &b.wf[0]);
+		H5Sclose(memspace);
+		H5Sclose(filespace);
+	}
+
+	m_ns[idx] = n0 + b.n; // increment sample pointer
+	b.n = 0;
+	b.haswf = false;
+
+	double dt = (double)(gettime() - t);
+	m_flushes++;
+	m_flushTime += dt;
+	if (dt > m_flushMax)
+		m_flushMax = dt;
 }
 
 size_t H5SpikeWriter::capacity()
 {
-	return m_q ? m_q->size_approx() : 0;
+	size_t n = 0;
+	for (auto &q : m_q) {
+		n += q->size_approx();
+	}
+	return n;
+}
+size_t H5SpikeWriter::allocs()
+{
+	return m_allocs;
+}
+string H5SpikeWriter::status()
+{
+	if (!isEnabled())
+		return string();
+	size_t n = filename().find_last_of("/");
+	char str[256];
+	double b = bytes() / 1e6;
+	// racy reads of the stats; fine for a label
+	double avg = m_flushes > 0 ? m_flushTime / m_flushes : 0.0;
+	snprintf(str, 256, "%s: %.2f %s\nqueue %zu (max %zu), pool +%zu\n"
+	         "flush %.2f ms avg, %.2f ms max",
+	         filename().substr(n+1).c_str(),
+	         b >= 1e3 ? b/1e3 : b, b >= 1e3 ? "GB" : "MB",
+	         capacity(), m_maxDepth, (size_t)m_allocs,
+	         avg*1e3, m_flushMax*1e3);
+	return string(str);
 }
 size_t H5SpikeWriter::bytes()
 {
 	size_t n = 0;
+	if (m_layout == H5S_LAYOUT_TABLE) {
+		n += m_rows * (sizeof(i64) + sizeof(double) + 2*sizeof(i16));
+		n += m_rows * m_nwf * sizeof(float);
+		n += m_nruns * 4 * sizeof(i64);
+		return n;
+	}
 	for (auto &x : m_ns) {
 		n += x.second * sizeof(i64);
 		n += x.second * sizeof(double);
@@ -358,3 +739,13 @@ bool H5SpikeWriter::setMetaData(double sr, char *name, int slen)
 
 	return true;
 }
+
+void H5SpikeWriter::setAttr(const char *name, i64 v)
+{
+	hid_t ds = H5Screate(H5S_SCALAR);
+	hid_t attr = H5Acreate(m_h5topgroup, name, H5T_STD_I64LE, ds,
+	                       H5P_DEFAULT, H5P_DEFAULT);
+	H5Awrite(attr, H5T_NATIVE_INT64, &v); // TODO: CHECK ERROR
+	H5Aclose(attr);
+	H5Sclose(ds);
+}
@@ -10,10 +10,12 @@ H5Writer::H5Writer()
 	m_h5topgroup = 0;
 	m_h5dataspaces.clear();
 	m_h5props.clear();
-	m_w = NULL;
 	m_deflate = true;
 	m_deflate_level = 1;
 	m_shuffle = true;
+	m_codec = H5C_DEFLATE;
+	m_codec_level = 1;
+	m_delta = false;
 }
 
 H5Writer::~H5Writer()
@@ -26,6 +28,7 @@ bool H5Writer::open(const char *fn)
 	if (isEnabled()) {
 		return false;
 	}
+	h5filtersRegister();
 	// Create a new file using default properties.
 	m_h5file = H5Fcreate(fn, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
 
@@ -103,30 +106,25 @@ string H5Writer::filename()
 	return m_fn;
 }
 
-void H5Writer::registerWidget(GtkWidget *w)
+string H5Writer::status()
 {
-	m_w = w;
-}
+	if (!isEnabled())
+		return string();
 
-void H5Writer::draw()
-{
-	if (isEnabled()) {
+	size_t n = filename().find_last_of("/");
+	char str[256];
 
-		size_t n = filename().find_last_of("/");
-		char str[256];
+	double b = bytes() / 1e6;
 
-		double b = bytes() / 1e6;
-
-		if (b >= 1e3) {
-			b /= 1e3;
-			snprintf(str, 256, "%s: %.2f GB",
-			         filename().substr(n+1).c_str(), b);
-		} else {
-			snprintf(str, 256, "%s: %.2f MB",
-			         filename().substr(n+1).c_str(), b);
-		}
-		gtk_label_set_text(GTK_LABEL(m_w), str);
+	if (b >= 1e3) {
+		b /= 1e3;
+		snprintf(str, 256, "%s: %.2f GB",
+		         filename().substr(n+1).c_str(), b);
+	} else {
+		snprintf(str, 256, "%s: %.2f MB",
+		         filename().substr(n+1).c_str(), b);
 	}
+	return string(str);
 }
 void H5Writer::shuffleDataset(hid_t prop)
 {
@@ -158,6 +156,55 @@ void H5Writer::deflateDataset(hid_t prop)
 		error("HDF5: gzip filter not available");
 	}
 }
+void H5Writer::setDeflate(bool deflate, int level)
+{
+	if (isEnabled())
+		return;
+	m_deflate = deflate;
+	m_deflate_level = level < 0 ? 0 : (level > 9 ? 9 : level);
+	m_codec = deflate ? H5C_DEFLATE : H5C_NONE;
+	m_codec_level = m_deflate_level;
+}
+void H5Writer::setCodec(int codec, int level)
+{
+	if (isEnabled())
+		return;
+	if (!h5codecAvail(codec)) {
+		warn("%s: %s is not compiled in, using deflate", name(),
+		     h5codecName(codec));
+		codec = H5C_DEFLATE;
+		level = m_deflate_level;
+	}
+	m_codec = codec;
+	m_codec_level = level;
+	m_deflate = codec != H5C_NONE;
+	if (codec == H5C_DEFLATE)
+		m_deflate_level = level < 0 ? 0 : (level > 9 ? 9 : level);
+}
+void H5Writer::setDelta(bool delta)
+{
+	if (isEnabled())
+		return;
+	m_delta = delta;
+}
+int H5Writer::codec()
+{
+	return m_codec;
+}
+void H5Writer::compressDataset(hid_t prop, bool samples, size_t rowlen)
+{
+	if (samples && m_delta) {
+		unsigned int cd = (unsigned int)rowlen;
+		if (H5Pset_filter(prop, H5Z_FILTER_DELTA16, H5Z_FLAG_MANDATORY, 1, &cd) < 0)
+			error("HDF5: delta16 filter not available");
+	}
+	if (m_shuffle)
+		shuffleDataset(prop);
+	if (m_codec == H5C_DEFLATE)
+		deflateDataset(prop);
+	else if (!h5codecSet(prop, m_codec, m_codec_level))
+		error("HDF5: %s filter not available", h5codecName(m_codec));
+}
 void H5Writer::setUUID(char *uuid_str)
 {
 	// all h5 files get the same uuid (until we restart the program)
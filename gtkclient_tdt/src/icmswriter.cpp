@@ -1,7 +1,7 @@
 #include <iostream>
 #include <fstream>
-#include "util.h"
 #include "icmswriter.h"
+#include "util.h"
 
 using namespace google::protobuf::io;
 using namespace moodycamel;
@@ -9,6 +9,8 @@ using namespace moodycamel;
 ICMSWriter::ICMSWriter()
 {
 	m_q = NULL;
+	m_free = NULL;
+	m_allocs = 0;
 }
 
 bool ICMSWriter::open(const char *fn)
@@ -16,24 +18,59 @@ bool ICMSWriter::open(const char *fn)
 	if (isEnabled())
 		return false;
 	m_q = new ReaderWriterQueue<ICMS *>(ICMS_BUF_SIZE);
+	m_free = new ReaderWriterQueue<ICMS *>(ICMS_BUF_SIZE);
+	for (size_t i=0; i<ICMS_POOL_SIZE; i++) {
+		m_free->enqueue(new ICMS);
+	}
+	m_allocs = 0;
 	return DataWriter::open(fn);
 }
 
 bool ICMSWriter::close()
 {
 	if (isEnabled()) {
-		delete m_q;
-		m_q = NULL;
+		bool ok = DataWriter::close();
+		for (auto q : {&m_q, &m_free}) {
+			ICMS *o;
+			while ((*q)->try_dequeue(o)) {
+				delete o;
+			}
+			delete *q;
+			*q = NULL;
+		}
+		return ok;
 	}
 	return DataWriter::close();
 }
 
-bool ICMSWriter::add(ICMS *o)	// call from a single producer thread
+ICMS *ICMSWriter::get()	// consumer side of m_free
 {
 	if (!isEnabled())
+		return nullptr;
+	ICMS *o;
+	if (m_free->try_dequeue(o))
+		return o;
+	m_allocs++; // pool ran dry; it grows by this one when it comes back
+	return new ICMS;
+}
+
+bool ICMSWriter::add(ICMS *o)	// call from a single producer thread
+{
+	if (!isEnabled()) {
+		delete o;
 		return false;
+	}
+
+	bool ok = m_q->enqueue(o);	// todo: what if this (memory alloc) fails
+	m_wake.signal();	// stim events are rare; wake for each
+	return ok;
+}
 
-	return m_q->enqueue(o);	// todo: what if this (memory alloc) fails
+void ICMSWriter::wait(double timeout)
+{
+	unsigned seen = m_wake.seq();
+	if (!isEnabled() || m_q->size_approx() == 0)
+		m_wake.wait(seen, timeout);
 }
 
 bool ICMSWriter::write()   // call from a single consumer thread
@@ -48,22 +85,26 @@ bool ICMSWriter::write()   // call from a single consumer thread
 		if (dequeued) {
 
 			u32 magic = ICMS_MAGIC;
+#if GOOGLE_PROTOBUF_VERSION >= 3004000
+			u32 sz = (u32)o->ByteSizeLong();
+#else
 			u32 sz = o->ByteSize();
-			u32 *tmp = (u32 *)malloc(sizeof(magic)+sizeof(sz)+sz);
-			u32 *u = tmp;
+#endif
+			if (m_buf.size() < sizeof(magic)+sizeof(sz)+sz)
+				m_buf.resize(sizeof(magic)+sizeof(sz)+sz);
+			u32 *u = (u32 *)m_buf.data();
 			*u++ = magic;
 			*u++ = sz;
 			o->SerializeToArray((void *)u, sz);
-			char *c = (char *)tmp;
-			m_os.write(c, sz+8);
+			o->Clear();	// keeps the artifacts' storage for the next
+			m_free->enqueue(o);
+			m_os.write(m_buf.data(), sz+8);
 			if (m_os.fail()) { // write lost, should we requeue?
 				fprintf(stderr,"ERROR: %s write failed!\n", name());
 
 				return false;
 			}
 			m_num_written += sz+8;
-			free(tmp);
-			delete o;	// free the memory that was pointed to
 		}
 	} while (dequeued);
 
@@ -76,3 +117,8 @@ size_t ICMSWriter::capacity()
 		return 0;
 	return m_q->size_approx();
 }
+
+size_t ICMSWriter::allocs()
+{
+	return m_allocs;
+}
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <unistd.h>
+#include "latency.h"
+
+const char *latencyName(int stage)
+{
+	static const char *names[LAT_NUM] = {
+		"po8e read",
+		"queue wait",
+		"artifact",
+		"filter",
+		"sort",
+		"spike enqueue",
+		"write spikes",
+		"write icms",
+		"write analog pre",
+		"write analog post",
+		"tick to spike",
+		"binned frame",
+		"decode step",
+	};
+	if (stage < 0 || stage >= LAT_NUM)
+		return "?";
+	return names[stage];
+}
+
+LatencySnap::LatencySnap()
+{
+	n.assign(LAT_BUCKETS, 0);
+	count = 0;
+}
+
+LatencySnap LatencySnap::operator-(const LatencySnap &o) const
+{
+	LatencySnap d;
+	for (size_t i=0; i<LAT_BUCKETS; i++) {
+		d.n[i] = n[i] >= o.n[i] ? n[i] - o.n[i] : 0;
+		d.count += d.n[i];
+	}
+	return d;
+}
+
+double LatencySnap::percentile(double p) const
+{
+	if (count == 0)
+		return 0;
+	u64 want = (u64)(p*count);
+	if (want >= count)
+		want = count - 1;
+	u64 seen = 0;
+	for (size_t i=0; i<LAT_BUCKETS; i++) {
+		seen += n[i];
+		if (seen > want)
+			return LatencyHist::upper(i) * 1e-9;
+	}
+	return LatencyHist::upper(LAT_BUCKETS-1) * 1e-9;
+}
+
+double LatencySnap::max() const
+{
+	for (size_t i=LAT_BUCKETS; i>0; i--) {
+		if (n[i-1])
+			return LatencyHist::upper(i-1) * 1e-9;
+	}
+	return 0;
+}
+
+LatencyHist::LatencyHist()
+{
+	for (auto &c : m_n)
+		c = 0;
+}
+
+size_t LatencyHist::bucket(u64 ns)
+{
+	if (ns < LAT_SUB)
+		return ns;
+	int e = 63 - __builtin_clzll(ns);	// >= LAT_SUBBITS
+	if (e > LAT_MAXEXP)
+		return LAT_BUCKETS - 1;
+	size_t sub = (ns >> (e - LAT_SUBBITS)) & (LAT_SUB - 1);
+	return (e - LAT_SUBBITS + 1) * LAT_SUB + sub;
+}
+
+u64 LatencyHist::upper(size_t b)
+{
+	if (b < LAT_SUB)
+		return b;
+	int e = b / LAT_SUB + LAT_SUBBITS - 1;
+	u64 sub = b % LAT_SUB;
+	return ((LAT_SUB + sub + 1) << (e - LAT_SUBBITS)) - 1;
+}
+
+void LatencyHist::add(u64 ns)
+{
+	m_n[bucket(ns)].fetch_add(1, memory_order_relaxed);
+}
+
+void LatencyHist::snapshot(LatencySnap &s)
+{
+	s.count = 0;
+	for (size_t i=0; i<LAT_BUCKETS; i++) {
+		s.n[i] = m_n[i].load(memory_order_relaxed);
+		s.count += s.n[i];
+	}
+}
+
+LatencyMonitor::LatencyMonitor(LatencyHist *h, size_t n)
+{
+	m_h = h;
+	m_n = n;
+	m_last.resize(n);
+	m_lastTime = latNow();
+}
+
+void LatencyMonitor::setFile(const char *fn)
+{
+	lock_guard<mutex> lock(m_mtx);
+	m_file = fn ? fn : "";
+}
+
+static string fmt(double s)
+{
+	char buf[32];
+	if (s < 1e-3)
+		snprintf(buf, sizeof(buf), "%6.1fus", s*1e6);
+	else if (s < 1)
+		snprintf(buf, sizeof(buf), "%6.2fms", s*1e3);
+	else
+		snprintf(buf, sizeof(buf), "%6.2fs ", s);
+	return string(buf);
+}
+
+void LatencyMonitor::update()
+{
+	u64 now = latNow();
+	double dt = (now - m_lastTime) * 1e-9;
+	m_lastTime = now;
+
+	string t;
+	char buf[256];
+	snprintf(buf, sizeof(buf), "%-18s %8s %8s %8s %8s %8s | %8s %8s\n",
+	         "stage", "/s", "p50", "p99", "p99.9", "max", "p99.9", "max");
+	t += buf;
+	snprintf(buf, sizeof(buf), "%-18s %44s | %17s\n", "",
+	         "(last interval)", "(since start)");
+	t += buf;
+	for (size_t i=0; i<m_n; i++) {
+		LatencySnap s;
+		m_h[i].snapshot(s);
+		LatencySnap d = s - m_last[i];
+		m_last[i] = s;
+		if (s.count == 0)
+			continue;
+		snprintf(buf, sizeof(buf), "%-18s %8.0f %s %s %s %s | %s %s\n",
+		         latencyName(i), dt > 0 ? d.count/dt : 0.0,
+		         fmt(d.percentile(0.5)).c_str(),
+		         fmt(d.percentile(0.99)).c_str(),
+		         fmt(d.percentile(0.999)).c_str(),
+		         fmt(d.max()).c_str(),
+		         fmt(s.percentile(0.999)).c_str(),
+		         fmt(s.max()).c_str());
+		t += buf;
+	}
+
+	string fn;
+	{
+		lock_guard<mutex> lock(m_mtx);
+		m_table = t;
+		fn = m_file;
+	}
+	if (fn.empty())
+		return;
+	// readers never see half a table
+	string tmp = fn + ".tmp";
+	FILE *f = fopen(tmp.c_str(), "w");
+	if (!f)
+		return;
+	fputs(t.c_str(), f);
+	fclose(f);
+	rename(tmp.c_str(), fn.c_str());
+}
+
+string LatencyMonitor::table()
+{
+	lock_guard<mutex> lock(m_mtx);
+	return m_table;
+}
+
+void LatencyMonitor::snapshot(vector<LatencySnap> &s)
+{
+	s.resize(m_n);
+	for (size_t i=0; i<m_n; i++) {
+		m_h[i].snapshot(s[i]);
+	}
+}
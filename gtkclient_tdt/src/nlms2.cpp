@@ -1,14 +1,17 @@
+
 #include <float.h>                      // for FLT_EPSILON
 #include <atomic>
 #include <mutex>
 #include "matStor.h"                    // for MatStor
 #include "nlms2.h"                       // for ArtifactNLMS, NLMS
+#include "rtsched.h"
 
 
-ArtifactNLMS2::ArtifactNLMS2(int _n, MatStor *ms)
+ArtifactNLMS2::ArtifactNLMS2(int _n, MatStor *ms, size_t nthreads)
 {
 	n = _n;
 	mu = 1e-5;	// reasonable default
+	m_block = 0;
 
 	W.set_size(n, n);
 
@@ -23,11 +26,45 @@ ArtifactNLMS2::ArtifactNLMS2(int _n, MatStor *ms)
 			}
 		}
 		mu = ms->getDouble(0, "nlms_mu", mu);
+		m_block = (size_t)ms->getDouble(0, "nlms_block", 0.0);
+		W.diag().zeros();	// trainSamples() relies on it
+	}
+
+	// contiguous channel ranges, as even as they come
+	size_t nl = nthreads > 0 ? nthreads : 1;
+	if (nl > n)
+		nl = n > 0 ? n : 1;
+	for (size_t i=0; i<nl; i++) {
+		Lane l;
+		l.a = n * i / nl;
+		l.b = n * (i+1) / nl;
+		m_lanes.push_back(l);
+	}
+	m_gen = 0;
+	m_running = 0;
+	m_die = false;
+	m_X = NULL;
+	m_trainBlock = 0;
+	m_trainMu = mu;
+	m_version = 0;
+	publish();
+	if (nthreads > 0) {
+		for (size_t i=0; i<m_lanes.size(); i++) {
+			m_threads.push_back(thread(&ArtifactNLMS2::run, this, i));
+		}
 	}
 }
 
 ArtifactNLMS2::~ArtifactNLMS2()
 {
+	{
+		lock_guard<mutex> lock(m_mtx);
+		m_die = true;
+	}
+	m_go.notify_all();
+	for (auto &t : m_threads) {
+		t.join();
+	}
 }
 
 void ArtifactNLMS2::setMu(float _mu)
@@ -40,54 +77,216 @@ float ArtifactNLMS2::getMu()
 	return (float)mu;
 }
 
+void ArtifactNLMS2::setBlock(size_t block)
+{
+	m_block = block;
+}
+
+size_t ArtifactNLMS2::getBlock()
+{
+	return m_block;
+}
+
+size_t ArtifactNLMS2::numThreads()
+{
+	return m_threads.size();
+}
+
+void ArtifactNLMS2::run(size_t id)
+{
+	rtEnter(RT_NLMS, "nlms");
+	u64 seen = 0;
+	while (true) {
+		{
+			unique_lock<mutex> lock(m_mtx);
+			m_go.wait(lock, [&] { return m_gen != seen || m_die; });
+			if (m_die)
+				return;
+			seen = m_gen;
+		}
+		trainLane(m_lanes[id]);
+		{
+			lock_guard<mutex> lock(m_mtx);
+			m_running--;
+		}
+		m_done.notify_one();
+	}
+}
+
 // X is the input matrix (n by t)
-void ArtifactNLMS2::train(mat X)
+void ArtifactNLMS2::train(const mat &X)
 {
 	// in the below we use (roughly) the notation of Haykin, 4th ed. pg 324
+	if (X.n_rows != n || X.n_cols == 0)
+		return;
 
-	size_t t = X.n_cols;
+	// ||x(k)||^2 over all channels; each channel takes its own sample out
+	m_nrm = sum(square(X), 0).t();
+	m_X = &X;
+	m_trainBlock = m_block;
+	m_trainMu = mu;
 
-	// copy X -> Y
-	mat Y(X);
+	if (m_threads.empty()) {
+		trainLane(m_lanes[0]);
+	} else {
+		{
+			lock_guard<mutex> lock(m_mtx);
+			m_running = m_lanes.size();
+			m_gen++;
+		}
+		m_go.notify_all();
+		unique_lock<mutex> lock(m_mtx);
+		m_done.wait(lock, [this] { return m_running == 0; });
+	}
+	publish();
+}
 
-	for (size_t i=0; i<n; i++) {
+void ArtifactNLMS2::trainLane(Lane &l)
+{
+	if (l.a >= l.b)
+		return;
+	if (m_trainBlock > 1)
+		trainBlocks(l);
+	else
+		trainSamples(l);
+}
 
-		X.row(i).zeros();
+// exact NLMS, one sample at a time. W(i,i) is held at 0, which is the same
+// as zeroing x(i) in the dot product and the update.
+void ArtifactNLMS2::trainSamples(Lane &l)
+{
+	const mat &X = *m_X;
+	size_t t = X.n_cols;
+	double m = m_trainMu;
 
-		for (size_t k=0; k<t; k++) {
+	for (size_t k=0; k<t; k++) {
+		const double *x = X.colptr(k);
+		double nk = m_nrm(k);
+		for (size_t i=l.a; i<l.b; i++) {
+			double *w = W.colptr(i);
 
 			// yhat = w(k) * x(k)
-			double yhat = dot(W.col(i), X.col(k));
+			double y0 = 0, y1 = 0, y2 = 0, y3 = 0;
+			size_t j = 0;
+			for (; j+4<=n; j+=4) {
+				y0 += w[j]*x[j];
+				y1 += w[j+1]*x[j+1];
+				y2 += w[j+2]*x[j+2];
+				y3 += w[j+3]*x[j+3];
+			}
+			for (; j<n; j++) {
+				y0 += w[j]*x[j];
+			}
+			double yhat = (y0 + y1) + (y2 + y3);
 
 			// alpha(k) = y(k) - w'(k) * x(k);
-			double alpha = Y(i, k) - yhat;
+			double alpha = x[i] - yhat;
 
-			// temp(k) = (mu * alpha(k) (k)) / ||x(k)||^2
-			double xnorm = norm(X.col(k));
-			double temp = (mu * alpha) / ((xnorm * xnorm) + FLT_EPSILON);
+			// temp(k) = (mu * alpha(k)) / ||x(k)||^2, without x(i)
+			double xnorm = nk - x[i]*x[i];
+			double temp = (m * alpha) / (xnorm + FLT_EPSILON);
 
 			// w(k+1) = w(k) + x(k) * temp(k)
-			// scalar has to come second because of operator overloading
-			W.col(i) += X.col(k) * temp;
+			for (j=0; j<n; j++) {
+				w[j] += x[j] * temp;
+			}
+			w[i] = 0.0;
 		}
+	}
+}
 
-		X.row(i) = Y.row(i);
+// block NLMS: the weights are fixed over each block of B samples, so the
+// predictions and the update are GEMMs on the lane's columns of W.
+void ArtifactNLMS2::trainBlocks(Lane &l)
+{
+	const mat &X = *m_X;
+	size_t t = X.n_cols;
+	size_t B = m_trainBlock;
+	size_t nr = l.b - l.a;
+	double m = m_trainMu;
+
+	if (l.E.n_rows != nr || l.E.n_cols != B) {
+		l.E.set_size(nr, B);
+		l.G.set_size(nr, B);
 	}
 
+	for (size_t k0=0; k0<t; k0+=B) {
+		size_t nb = t - k0 < B ? t - k0 : B;
+		// views, no copies
+		const mat Xb(const_cast<double *>(X.colptr(k0)), n, nb, false, true);
+		mat E(l.E.memptr(), nr, nb, false, true);
+		mat G(l.G.memptr(), nr, nb, false, true);
+		auto Wl = W.cols(l.a, l.b-1);
+
+		// E = Y - W'X, for our channels
+		E = Xb.rows(l.a, l.b-1) - Wl.t() * Xb;
+
+		// G(i,k) = mu E(i,k) / (||x(k)||^2 - x(i,k)^2)
+		for (size_t k=0; k<nb; k++) {
+			const double *x = Xb.colptr(k);
+			const double *e = E.colptr(k);
+			double *g = G.colptr(k);
+			double nk = m_nrm(k0+k);
+			for (size_t i=0; i<nr; i++) {
+				double xi = x[l.a+i];
+				g[i] = (m * e[i]) / (nk - xi*xi + FLT_EPSILON);
+			}
+		}
+
+		// W += X G'
+		Wl += Xb * G.t();
+		for (size_t i=l.a; i<l.b; i++) {
+			W(i, i) = 0.0;
+		}
+	}
 }
 
 // X is the input matrix (n by t)
 // returns the predicted output matrix Xhat, (n x t)
-mat ArtifactNLMS2::filter(mat X)
+mat ArtifactNLMS2::filter(const mat &X)
+{
+	// Xhat(i,:) = W(:,i)' * X, as trained
+	return W.t() * X;
+}
+
+// x -= Xhat, one float GEMM, no temporaries
+void ArtifactNLMS2::subtract(float *x, float *y, size_t ns)
+{
+	fmat X(x, n, ns, false, true);
+	fmat Y(y, n, ns, false, true);
+	{
+		lock_guard<mutex> lock(m_pmtx);
+		Y = m_P * X;
+	}
+	X -= Y;
+}
+
+void ArtifactNLMS2::predictor(fmat &P)
+{
+	lock_guard<mutex> lock(m_pmtx);
+	P = m_P;
+}
+
+u64 ArtifactNLMS2::version()
+{
+	lock_guard<mutex> lock(m_pmtx);
+	return m_version;
+}
+
+// convert outside the lock; the worker only waits for the swap
+void ArtifactNLMS2::publish()
 {
-	// Xhat = W * X;
-	return W * X;
+	fmat P = conv_to<fmat>::from(W.t());
+	lock_guard<mutex> lock(m_pmtx);
+	m_P.swap(P);
+	m_version++;
 }
 
 void ArtifactNLMS2::clearWeights()
 {
 	W.fill(1.0/(double)n);	// init weights
 	W.diag().zeros();		// set diag to zero
+	publish();
 }
 
 void ArtifactNLMS2::save(MatStor *ms)
@@ -99,5 +298,6 @@ void ArtifactNLMS2::save(MatStor *ms)
 			}
 		}
 		ms->setDouble(0, "nlms_mu", mu);
+		ms->setDouble(0, "nlms_block", (double)m_block);
 	}
 }
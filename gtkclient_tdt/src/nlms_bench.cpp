@@ -0,0 +1,207 @@
+// benchmark: ArtifactNLMS2::train() vs. the old per-channel loop.
+// the data are nc channels of independent noise plus a few shared
+// 'artifact' sources with random gains, which the filter should learn.
+// reports training speed against real time at 24 kHz, the weights'
+// agreement with the old loop, and how much of the artifact the trained
+// weights take out of fresh data. column i of W predicts channel i, so the
+// prediction is W'X; the old filter()'s W X is shown for comparison. then
+// the trainer's side of the chain: ArtifactChain::update() after each
+// batch, against fusing after every batch as it used to. last, the online side: the old
+// X -= filter(X) on a double block against the in-place float subtract().
+// usage: nlms_bench [nchan] [threads] [batches]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <armadillo>
+#include "gettime.h"
+#include "nlms2.h"
+#include "artifact_filter.h"
+#include "artifact_chain.h"
+
+using namespace arma;
+
+#define SR 24414.0625
+#define BATCH 1600	// 100 po8e reads of 16, as nlms_train() gathers them
+#define NSRC 3
+#define MU 1e-2
+
+// what ArtifactNLMS2::train() did before: by value, norms from scratch,
+// row i zeroed and restored per channel
+static void old_train(mat &W, mat X, double mu)
+{
+	size_t n = W.n_rows;
+	size_t t = X.n_cols;
+	mat Y(X);
+	for (size_t i=0; i<n; i++) {
+		X.row(i).zeros();
+		for (size_t k=0; k<t; k++) {
+			double yhat = dot(W.col(i), X.col(k));
+			double alpha = Y(i, k) - yhat;
+			double xnorm = norm(X.col(k));
+			double temp = (mu * alpha) / ((xnorm * xnorm) + FLT_EPSILON);
+			W.col(i) += X.col(k) * temp;
+		}
+		X.row(i) = Y.row(i);
+	}
+}
+
+static mat mkdata(const mat &A, size_t t)
+{
+	mat S(NSRC, t, fill::randn);
+	return A * S + 0.1 * mat(A.n_rows, t, fill::randn);
+}
+
+// fraction of the signal power left after subtracting the prediction
+static double residual(ArtifactNLMS2 &f, const mat &X)
+{
+	mat R = X - f.filter(X);
+	return accu(square(R)) / accu(square(X));
+}
+
+int main(int argc, char **argv)
+{
+	size_t nc = 96;
+	size_t threads = 4;
+	size_t nb = 20;
+	if (argc > 1)
+		nc = atoi(argv[1]);
+	if (argc > 2)
+		threads = atoi(argv[2]);
+	if (argc > 3)
+		nb = atoi(argv[3]);
+
+	arma_rng::set_seed(1);
+	mat A(nc, NSRC, fill::randn);
+	vector<mat> batches;
+	for (size_t b=0; b<nb; b++) {
+		batches.push_back(mkdata(A, BATCH));
+	}
+	mat test = mkdata(A, 8*BATCH);
+
+	// the old loop, on fewer batches if it is slow
+	mat Wold(nc, nc);
+	Wold.fill(1.0/nc);
+	Wold.diag().zeros();
+	long double t0 = gettime();
+	size_t nold = nb < 4 ? nb : 4;
+	for (size_t b=0; b<nold; b++) {
+		old_train(Wold, batches[b], MU);
+	}
+	double told = (double)(gettime() - t0) / nold;
+	printf("%3zu ch, batches of %d samples (%.1f ms of data)\n",
+	       nc, BATCH, 1e3*BATCH/SR);
+	printf("%-18s %8.2f ms/batch, %6.2fx real time\n", "old loop",
+	       told*1e3, BATCH/SR/told);
+	auto left = [&](const mat &Xh) {
+		return accu(square(test - Xh)) / accu(square(test));
+	};
+	printf("%-18s residual W'X %.3f, W X %.3f\n", "old weights",
+	       left(Wold.t() * test), left(Wold * test));
+
+	struct {
+		const char *label;
+		size_t threads;
+		size_t block;
+	} runs[] = {
+		{"sample", 0, 0},
+		{"sample, threads", threads, 0},
+		{"block 16", 0, 16},
+		{"block 16, threads", threads, 16},
+		{"block 64", 0, 64},
+		{"block 64, threads", threads, 64},
+	};
+	for (auto &r : runs) {
+		ArtifactNLMS2 f(nc, NULL, r.threads);
+		f.setMu(MU);
+		f.setBlock(r.block);
+		double before = residual(f, test);
+
+		// agreement with the old loop over the same batches
+		for (size_t b=0; b<nold; b++) {
+			f.train(batches[b]);
+		}
+		mat Xh = f.filter(batches[0]);
+		mat Xo = Wold.t() * batches[0];
+		double err = abs(Xh - Xo).max() / abs(Xo).max();
+
+		t0 = gettime();
+		for (size_t b=nold; b<nb; b++) {
+			f.train(batches[b]);
+		}
+		double t = (double)(gettime() - t0) / (nb - nold > 0 ? nb - nold : 1);
+		printf("%-18s %8.2f ms/batch, %6.2fx real time, rel diff to old %.1e, "
+		       "residual %.3f -> %.3f (%zu threads)\n",
+		       r.label, t*1e3, BATCH/SR/t, err, before, residual(f, test),
+		       f.numThreads());
+	}
+
+	// the trainer's loop: a batch, then the chain. it used to fuse
+	// Pn + Pa - Pa Pn after every batch, both stages on or not.
+	{
+		ArtifactNLMS2 g(nc, NULL, 0);
+		g.setBlock(64);
+		ArtifactFilter af(nc);
+		ArtifactChain chain(&g, &af);
+		fmat Xf = conv_to<fmat>::from(mat(test.cols(0, 15)));
+		fmat Yf(nc, 16);
+		auto loop = [&](bool both, bool old) {
+			chain.proc(Xf.memptr(), Yf.memptr(), 16, true, both);
+			double t = 0;
+			for (size_t b=0; b<nb; b++) {
+				g.train(batches[b]);
+				long double t1 = gettime();
+				if (old) {
+					fmat Pn, Pa;
+					g.predictor(Pn);
+					af.predictor(Pa);
+					fmat P = Pn + Pa - Pa * Pn;
+					Yf(0) = P(0);
+				} else {
+					chain.update();
+				}
+				t += (double)(gettime() - t1);
+			}
+			return t / nb;
+		};
+		printf("%-18s %8.1f us/batch fusing every batch, %.1f us nlms only, "
+		       "%.1f us both on\n", "chain update", loop(true, true)*1e6,
+		       loop(false, false)*1e6, loop(true, false)*1e6);
+		// fused, and stage by stage
+		chain.update(true);
+		fmat Xa(Xf), Xb(Xf);
+		chain.proc(Xa.memptr(), Yf.memptr(), 16, true, true);
+		g.subtract(Xb.memptr(), Yf.memptr(), 16);
+		af.subtract(Xb.memptr(), Yf.memptr(), 16);
+		printf("%-18s max diff fused to stage by stage %.1e\n", "",
+		       abs(Xa - Xb).max());
+	}
+
+	// online filtering of po8e-sized blocks
+	ArtifactNLMS2 f(nc, NULL, 0);
+	f.train(batches[0]);
+	size_t ns = 16;
+	size_t reps = 2000;
+	mat X = test.cols(0, ns-1);
+	fmat Xf = conv_to<fmat>::from(X);
+	fmat Yf(nc, ns);
+	t0 = gettime();
+	for (size_t r=0; r<reps; r++) {
+		mat Xr(X);
+		Xr -= f.filter(Xr);
+	}
+	double tdbl = (double)(gettime() - t0) / reps;
+	t0 = gettime();
+	for (size_t r=0; r<reps; r++) {
+		fmat Xr(Xf);
+		f.subtract(Xr.memptr(), Yf.memptr(), ns);
+	}
+	double tflt = (double)(gettime() - t0) / reps;
+	fmat Xr(Xf);
+	f.subtract(Xr.memptr(), Yf.memptr(), ns);
+	mat Xd = X - f.filter(X);
+	printf("%zu-sample block: X -= filter(X) %.1f us, subtract() %.1f us, "
+	       "max diff %.1e\n", ns, tdbl*1e6, tflt*1e6,
+	       abs(conv_to<mat>::from(Xr) - Xd).max());
+	return 0;
+}
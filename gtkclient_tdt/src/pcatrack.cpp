@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "gettime.h"
+#include "rtsched.h"
+#include "pcatrack.h"
+
+#define PCA_TAU		4096	// waveforms; the covariance forgets on this scale
+#define PCA_MINN	256		// waveforms before a fit, at least (and 4 d)
+#define PCA_EVERY	0.5		// seconds between refits
+#define PCA_NEWN	32		// new waveforms before a refit
+#define PCA_COS		0.95	// republish below this |cos| to the published
+#define PCA_SCL		1.25	// or when a scale moves by more than this ratio
+
+PcaTracker::PcaTracker(int ch, int d, const float *ring, int rows,
+                       const std::atomic<int> *w)
+{
+	m_ch = ch;
+	m_d = d < PCA_MAXD ? d : PCA_MAXD;
+	m_ring = ring;
+	m_rows = rows;
+	m_w = w;
+	m_seen = 0;
+	m_n = 0;
+	m_mean.assign(m_d, 0.0);
+	m_cov.assign(m_d*m_d, 0.0);
+	m_v.assign(PCA_K*m_d, 0.0);
+	for (int k=0; k<PCA_K; k++) {
+		m_v[k*m_d + k] = 1.0;
+		m_lambda[k] = 0.0;
+	}
+	m_fitted = false;
+	m_solvedN = 0;
+	m_solvedAt = 0.0;
+	m_seq = 0;
+	memset(&m_pub, 0, sizeof(m_pub));
+	m_version = 0;
+	m_resetReq = false;
+	m_publishReq = false;
+	m_kick = NULL;
+}
+
+bool PcaTracker::latest(PcaBasis &b) const
+{
+	u32 v = m_version.load(std::memory_order_acquire);
+	if (v == 0 || v == b.version)
+		return false;
+	for (int i=0; i<64; i++) {
+		u32 q = m_seq.load(std::memory_order_acquire);
+		if (q & 1)
+			continue;
+		memcpy(&b, &m_pub, sizeof(b));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (m_seq.load(std::memory_order_relaxed) == q)
+			return true;
+	}
+	return false;
+}
+
+void PcaTracker::reset()
+{
+	m_resetReq = true;
+}
+
+void PcaTracker::request()
+{
+	m_publishReq = true;
+	if (m_kick)
+		m_kick->signal();
+}
+
+void PcaTracker::seed(const float *pc, const float *scl)
+{
+	u32 q = m_seq.load(std::memory_order_relaxed) | 1;
+	m_seq.store(q, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	m_pub.version++;
+	m_pub.n = 0;
+	for (int k=0; k<PCA_K; k++) {
+		m_pub.scl[k] = scl[k];
+		for (int j=0; j<m_d; j++)
+			m_pub.pc[k][j] = pc[k*m_d + j];
+	}
+	m_seq.store(q + 1, std::memory_order_release);
+	m_version.store(m_pub.version, std::memory_order_release);
+}
+
+void PcaTracker::publish(u32 n)
+{
+	u32 q = m_seq.load(std::memory_order_relaxed) | 1;
+	m_seq.store(q, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	m_pub.version++;
+	m_pub.n = n;
+	for (int k=0; k<PCA_K; k++) {
+		double l = m_lambda[k] > 1e-20 ? m_lambda[k] : 1e-20;
+		double s = sqrt(l);
+		m_pub.scl[k] = (float)s;
+		for (int j=0; j<m_d; j++)
+			m_pub.pc[k][j] = (float)(m_v[k*m_d + j] / s);
+	}
+	m_seq.store(q + 1, std::memory_order_release);
+	m_version.store(m_pub.version, std::memory_order_release);
+}
+
+int PcaTracker::pull()
+{
+	if (m_resetReq.exchange(false)) {
+		m_n = 0;
+		m_solvedN = 0;
+		// the ring's rows so far are from before; skip them
+		m_seen = m_w->load(std::memory_order_acquire);
+	}
+	int w = m_w->load(std::memory_order_acquire);
+	if (w < m_seen)		// the vbo was reset under us
+		m_seen = 0;
+	// the sorter may be writing row w; keep well clear of it
+	if (w - m_seen > m_rows/2)
+		m_seen = w - m_rows/2;
+	int d = m_d;
+	int got = 0;
+	for (; m_seen < w; m_seen++, got++) {
+		const float *x = m_ring + (size_t)(m_seen % m_rows) * d;
+		m_n++;
+		// exponentially weighted, plain averages until there are TAU:
+		// mean += a dx; cov = (1-a) (cov + a dx dx')
+		double a = m_n < PCA_TAU ? 1.0 / m_n : 1.0 / PCA_TAU;
+		double dx[PCA_MAXD];
+		for (int i=0; i<d; i++) {
+			dx[i] = x[i] - m_mean[i];
+			m_mean[i] += a * dx[i];
+		}
+		double b = 1.0 - a;
+		for (int i=0; i<d; i++) {
+			double *c = &m_cov[i*d];
+			double ai = a * dx[i];
+			for (int j=i; j<d; j++)
+				c[j] = b * (c[j] + ai * dx[j]);
+		}
+	}
+	return got;
+}
+
+// orthogonal iteration on the top PCA_K eigenvectors, then a Rayleigh-Ritz
+// step on the 2x2 projection to order and unmix them
+void PcaTracker::iterate(int iters)
+{
+	int d = m_d;
+	vector<double> w(PCA_K*d);
+	for (int it=0; it<iters; it++) {
+		// w = C v, C symmetric from its upper triangle
+		for (int k=0; k<PCA_K; k++) {
+			const double *v = &m_v[k*d];
+			double *o = &w[k*d];
+			for (int i=0; i<d; i++) {
+				double s = 0.0;
+				for (int j=0; j<i; j++)
+					s += m_cov[j*d + i] * v[j];
+				for (int j=i; j<d; j++)
+					s += m_cov[i*d + j] * v[j];
+				o[i] = s;
+			}
+		}
+		// gram-schmidt back into v
+		for (int k=0; k<PCA_K; k++) {
+			double *o = &w[k*d];
+			for (int p=0; p<k; p++) {
+				const double *u = &m_v[p*d];
+				double dot = 0.0;
+				for (int i=0; i<d; i++)
+					dot += o[i] * u[i];
+				for (int i=0; i<d; i++)
+					o[i] -= dot * u[i];
+			}
+			double nn = 0.0;
+			for (int i=0; i<d; i++)
+				nn += o[i] * o[i];
+			if (nn < 1e-30) {
+				// degenerate (no variance that way): any orthogonal unit
+				for (int i=0; i<d; i++)
+					o[i] = (i == k) ? 1.0 : 0.0;
+				for (int p=0; p<k; p++) {
+					const double *u = &m_v[p*d];
+					double dot = u[k];
+					for (int i=0; i<d; i++)
+						o[i] -= dot * u[i];
+				}
+				nn = 0.0;
+				for (int i=0; i<d; i++)
+					nn += o[i] * o[i];
+			}
+			double r = 1.0 / sqrt(nn);
+			for (int i=0; i<d; i++)
+				m_v[k*d + i] = o[i] * r;
+		}
+	}
+	// h = v' C v, and its eigenvectors by one rotation
+	double cv[PCA_K][PCA_MAXD];
+	for (int k=0; k<PCA_K; k++) {
+		const double *v = &m_v[k*d];
+		for (int i=0; i<d; i++) {
+			double s = 0.0;
+			for (int j=0; j<i; j++)
+				s += m_cov[j*d + i] * v[j];
+			for (int j=i; j<d; j++)
+				s += m_cov[i*d + j] * v[j];
+			cv[k][i] = s;
+		}
+	}
+	double h00 = 0.0, h01 = 0.0, h11 = 0.0;
+	for (int i=0; i<d; i++) {
+		h00 += m_v[i] * cv[0][i];
+		h01 += m_v[i] * cv[1][i];
+		h11 += m_v[d + i] * cv[1][i];
+	}
+	double th = 0.5 * atan2(2.0 * h01, h00 - h11);
+	double c = cos(th), s = sin(th);
+	for (int i=0; i<d; i++) {
+		double v0 = m_v[i];
+		double v1 = m_v[d + i];
+		m_v[i] = c * v0 + s * v1;
+		m_v[d + i] = -s * v0 + c * v1;
+	}
+	m_lambda[0] = c*c*h00 + 2.0*s*c*h01 + s*s*h11;
+	m_lambda[1] = s*s*h00 - 2.0*s*c*h01 + c*c*h11;
+}
+
+// the fit against what is published; also turns it to the same signs, so
+// the display doesn't flip
+bool PcaTracker::moved()
+{
+	int d = m_d;
+	bool far = false;
+	for (int k=0; k<PCA_K; k++) {
+		double dot = 0.0, nn = 0.0;
+		for (int i=0; i<d; i++) {
+			double p = m_pub.pc[k][i];
+			dot += m_v[k*d + i] * p;
+			nn += p * p;
+		}
+		if (dot < 0.0) {
+			for (int i=0; i<d; i++)
+				m_v[k*d + i] = -m_v[k*d + i];
+			dot = -dot;
+		}
+		if (nn <= 0.0 || dot / sqrt(nn) < PCA_COS)
+			far = true;
+		double s = sqrt(m_lambda[k] > 0.0 ? m_lambda[k] : 0.0);
+		double r = m_pub.scl[k] > 0.f ? s / m_pub.scl[k] : 0.0;
+		if (r > PCA_SCL || r < 1.0 / PCA_SCL)
+			far = true;
+	}
+	return far;
+}
+
+bool PcaTracker::solve(double now)
+{
+	bool req = m_publishReq.load();
+	u64 minn = PCA_MINN > 4*m_d ? PCA_MINN : 4*m_d;
+	if (m_n < minn) {
+		if (req) {
+			m_publishReq = false;
+			printf("PCA ch %d: %lu waveforms, not enough\n", m_ch + 1,
+			       (unsigned long)m_n);
+		}
+		return false;
+	}
+	if (!req && (now - m_solvedAt < PCA_EVERY ||
+	             m_n - m_solvedN < PCA_NEWN))
+		return false;
+	// cold, from wherever: long enough to settle; warm, a few
+	iterate(m_fitted ? 4 : 40);
+	m_fitted = true;
+	m_solvedN = m_n;
+	m_solvedAt = now;
+	bool far = moved();
+	if (!req && !far)
+		return false;
+	m_publishReq = false;
+	publish((u32)(m_n < 0xffffffff ? m_n : 0xffffffff));
+	return true;
+}
+
+PcaEngine::PcaEngine(double period)
+{
+	m_die = false;
+	m_period = period;
+	m_passes = 0;
+	m_published = 0;
+	m_passTime = 0.0;
+}
+
+PcaEngine::~PcaEngine()
+{
+	stop();
+}
+
+void PcaEngine::add(PcaTracker *t)
+{
+	t->setKick(&m_wake);
+	m_tracks.push_back(t);
+}
+
+void PcaEngine::start()
+{
+	m_die = false;
+	m_thread = std::thread(&PcaEngine::run, this);
+}
+
+void PcaEngine::stop()
+{
+	if (!m_thread.joinable())
+		return;
+	m_die = true;
+	m_wake.signal();
+	m_thread.join();
+}
+
+void PcaEngine::run()
+{
+	rtEnter(RT_SERVICE, "pca");
+	while (!m_die) {
+		unsigned seen = m_wake.seq();
+		double t0 = (double)gettime();
+		for (auto t : m_tracks) {
+			t->pull();
+			if (t->solve(t0))
+				m_published++;
+		}
+		double t1 = (double)gettime();
+		m_passTime = 0.95 * m_passTime.load() + 0.05 * (t1 - t0);
+		m_passes++;
+		m_wake.wait(seen, m_period);
+	}
+}
+
+string PcaEngine::getInfo()
+{
+	char str[256];
+	snprintf(str, 256, "pca: %zu channels, %.2f ms per pass, %lu fits "
+	         "published\n", m_tracks.size(), 1e3 * m_passTime.load(),
+	         (unsigned long)m_published.load());
+	return string(str);
+}
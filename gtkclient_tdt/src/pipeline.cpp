@@ -0,0 +1,1711 @@
+#include <stdio.h>
+#include <float.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <armadillo>
+#include <uuid.h>
+#include <sstream>
+#include <iomanip>
+
+#include "readerwriterqueue.h"
+
+// the vendor's default timeout (INFINITE, 0xffffffff) overflows its int
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverflow"
+#include "PO8e.h"
+#pragma GCC diagnostic pop
+#include "po8e_conf.h"
+
+#include "gettime.h"
+#include "firingrate.h"
+#include "gtkclient.h"
+#include "mmaphelp.h"
+#include "fifohelp.h"
+#include "sortchannel.h"
+#include "artifact_engine.h"
+#include "timesync.h"
+#include "matStor.h"
+#include "jacksnd.h"
+#include "filter.h"
+#include "filterbank.h"
+#include "butter.h"
+#include "spikebuffer.h"
+#include "artifact_filter.h"
+#include "artifact_chain.h"
+#include "nlms2.h"
+#include "util.h"
+
+#include "icms.pb.h"
+
+#include "datawriter.h"
+#include "icmswriter.h"
+
+#include "h5writer.h"
+#include "h5spikewriter.h"
+#include "h5analogwriter.h"
+#include "po8e_pool.h"
+#include "replay.h"
+#include "sortpool.h"
+#include "latency.h"
+#include "tmatch.h"
+#include "display.h"
+#include "binned_shm.h"
+#include "decode_shm.h"
+#include "decoder.h"
+#include "rtsched.h"
+#include "pipeline.h"
+
+using namespace std;
+using namespace arma;
+using namespace moodycamel; // for lockfree queues
+
+uuid_t	g_uuid;
+
+WaitQueue<mat *> g_filterbuf(1024); // for nlms filtering
+WaitQueue<mat *> g_filterfree(1024); // and back, for reuse
+
+std::mutex g_po8e_mutex;
+vector <pair<PO8Queue *, po8e::card *>> g_dataqueues;
+static double s_dataSpin = 0.0; // s the worker spins on an empty queue
+vector <PO8DataPool *> g_datapools; // parallel to g_dataqueues
+size_t g_po8e_read_size = 16;
+std::atomic<u64> g_workerAllocs(0); // worker scratch and nlms block allocations
+SortPool *g_sortpool = nullptr;
+LatencyHist g_latency[LAT_NUM];	// see latency.h for the stages
+LatencyMonitor g_latmon(g_latency, LAT_NUM);
+std::atomic<bool> g_replayDone(false);
+
+vector <SortChannel *> g_sc;
+vector <FiringRate *> g_fr;
+vector <ArtifactTemplate *> g_templates;
+TimeSync 	g_ts(SRATE_HZ); //keeps track of ticks (TDT time)
+DisplaySink *g_display = nullptr;
+
+H5SpikeWriter	g_spikewriter;
+int 			g_saveUnsorted = true;
+int 			g_saveSpikeWF = true;
+int				g_spikeLayout = H5S_LAYOUT_GROUPS; // or one table, see h5spikewriter.h
+
+H5AnalogWriter	g_analogwriter_postfilter;
+H5AnalogWriter	g_analogwriter_prefilter;
+int				g_analogCodec = H5C_DEFLATE; // see h5filters.h
+int				g_analogDelta = false;
+
+ArtifactEngine *g_artifactEngine = nullptr;
+ICMSWriter g_icmswriter;
+
+int g_lopassNeurons = false;
+int g_hipassNeurons = false;
+
+FilterBank *g_bandpass = nullptr;
+FilterBank *g_lopass = nullptr;
+FilterBank *g_hipass = nullptr;
+// designed at startup from po8e.rc; these are the old compiled-in filters
+ButterSpec g_bandpassSpec = {BUTTER_BAND, 4, 500, 3000};
+ButterSpec g_lopassSpec = {BUTTER_LOW, 2, 3000, 0};
+ButterSpec g_hipassSpec = {BUTTER_HIGH, 2, 500, 0};
+
+double g_sr = SRATE_HZ; // from po8e.rc
+double g_binRate = 50.0; // from po8e.rc
+static DecoderSpec s_decoderSpec; // from po8e.rc
+Decoder *g_decoder = nullptr;
+
+int g_whichAnalogSave = 0; // (1,2,3) -> (single,active,all)
+
+bool g_die = false;
+int g_saveICMSWF = true;
+
+vector<int> g_channel {0,32,64,95};
+
+long double g_lastPo8eTime = 0.0;
+long double g_po8ePollInterval = 0.0;
+long double g_po8eAvgInterval = 0.0;
+
+int g_whichSpikePreEmphasis = EMPHASIS_NONE; // see spikebuffer.h
+
+int g_whichAlignment = 0;
+
+int g_whichSortMetric = TMATCH_L2; // MSE or SAA template match
+
+float g_minISI = 1.3; //ms
+float g_autoThreshold = -3.5; //standard deviations. default negative, w/e.
+float g_neoThreshold = 8;
+
+int g_artifactFilterRun = false;
+ArtifactFilter *g_artifactFilter = nullptr;
+
+int g_trainArtifactNLMS = false;
+int g_filterArtifactNLMS = false;
+ArtifactNLMS2 *g_nlms = nullptr;
+ArtifactChain *g_artifactChain = nullptr;	// both of the above, fused
+
+int g_enableArtifactSubtr = false;
+int g_trainArtifactTempl = false;
+int g_numArtifactSamps = 1e4; 	// number of artifacts to use to build template
+
+int g_enableArtifactBlanking = false;
+int g_artifactBlankingSamps = 48;
+int g_artifactBlankingPreSamps = 24;
+
+int g_enableStimClockBlanking = false;
+
+// (re)design a neural filter; safe while the worker is filtering
+bool designFilter(FilterBank *fb, ButterSpec &spec)
+{
+	vector<Biquad> sos;
+	if (!butter_sos(spec, g_sr, sos)) {
+		warn("bad %s: order %d, %.1f-%.1f Hz at %.1f Hz", butter_name(spec.type),
+		     spec.order, spec.f1, spec.f2, g_sr);
+		return false;
+	}
+	fb->setSOS(sos);
+	printf("%s:\t\torder %d, %.1f %.1f Hz, %zu sections\n",
+	       butter_name(spec.type), spec.order, spec.f1, spec.f2, sos.size());
+	return true;
+}
+
+void pipelineSave(MatStor &ms)
+{
+	for (auto &c : g_sc)
+		c->save(&ms);
+	for (auto &a : g_templates)
+		a->save(&ms);
+	g_nlms->save(&ms);
+	if (g_decoder)
+		g_decoder->save(&ms);
+	ms.setInt("channel", g_channel);
+
+	ms.setStructValue("savemode", "unsorted_spikes", 0, (float)g_saveUnsorted);
+	ms.setStructValue("savemode", "spike_waveforms", 0, (float)g_saveSpikeWF);
+	ms.setStructValue("savemode", "spike_layout", 0, (float)g_spikeLayout);
+	ms.setStructValue("savemode", "analog_codec", 0, (float)g_analogCodec);
+	ms.setStructValue("savemode", "analog_delta", 0, (float)g_analogDelta);
+	ms.setStructValue("savemode", "icms_waveforms", 0, (float)g_saveICMSWF);
+
+	ms.setStructValue("spike","pre_emphasis",0,(float)g_whichSpikePreEmphasis);
+	ms.setStructValue("spike","alignment_mode",0,(float)g_whichAlignment);
+	ms.setStructValue("spike","sort_metric",0,(float)g_whichSortMetric);
+	ms.setStructValue("spike","min_isi",0,g_minISI);
+	ms.setStructValue("spike","auto_threshold",0,g_autoThreshold);
+	ms.setStructValue("spike","neo_threshold",0,g_neoThreshold);
+
+	ms.setStructValue("filter","lopass",0,(float)g_lopassNeurons);
+	ms.setStructValue("filter","hipass",0,(float)g_hipassNeurons);
+
+	ms.setStructValue("icms","filter_run",0,(float)g_artifactFilterRun);
+
+	ms.setStructValue("icms","lms_train",0,(float)g_trainArtifactNLMS);
+	ms.setStructValue("icms","lms_filter",0,(float)g_filterArtifactNLMS);
+
+	ms.setStructValue("icms","template_train",0,(float)g_trainArtifactTempl);
+	ms.setStructValue("icms","template_subtract",0,(float)g_enableArtifactSubtr);
+	ms.setStructValue("icms","template_numsamples",0,(float)g_numArtifactSamps);
+
+	ms.setStructValue("icms","blank_enable",0,(float)g_enableArtifactBlanking);
+	ms.setStructValue("icms","blank_samples",0,(float)g_artifactBlankingSamps);
+	ms.setStructValue("icms","blank_pre_samples",0,(float)g_artifactBlankingPreSamps);
+	ms.setStructValue("icms","blank_clock_enable",0,(float)g_enableStimClockBlanking);
+}
+static void nlms_train()
+{
+	rtEnter(RT_NLMS, "nlms train");
+	// the batch is gathered into Y in place; Y only grows
+	mat *X;
+	mat Y;
+	while (!g_die) {
+		int ndequeued = 0;
+		size_t t = 0;
+		// sleep until the worker queues a block, then take what is there
+		bool got = g_filterbuf.wait_dequeue(X, 0.1);
+		while (got) {
+			if (Y.n_rows != X->n_rows || Y.n_cols < t + X->n_cols)
+				Y.resize(X->n_rows, 2*(t + X->n_cols));
+			Y.cols(t, t + X->n_cols - 1) = *X;
+			t += X->n_cols;
+			g_filterfree.enqueue(X); // back to the worker
+			ndequeued++;
+			got = ndequeued < 100 && g_filterbuf.try_dequeue(X);
+		}
+
+		if (t > 0) {
+			// a view of the first t columns, not a copy
+			const mat Yt(Y.memptr(), Y.n_rows, t, false, true);
+			g_nlms->train(Yt);
+		}
+		// whether or not we trained: the chain fuses only while both
+		// stages are on, and every CHAIN_LAG/2 batches
+		g_artifactChain->update();
+	}
+}
+// sort channel ch. called from a SortPool thread that owns ch's shard;
+// lane is that shard, and picks the spike writer queue.
+static void sorter(int ch, int lane)
+{
+	if (!g_sc[ch]->getEnabled()) //XXX put this into channel class?
+		return;
+
+	enum { SPIKE_BATCH = 16, }; // spikes fetched per scan
+	float 	wf_b[SPIKE_BATCH*2*NWFSAMP];
+	float 	neo_b[SPIKE_BATCH*2*NWFSAMP];
+	u32 	tk_b[SPIKE_BATCH*2*NWFSAMP];
+
+	float threshold;
+	if (g_whichSpikePreEmphasis == EMPHASIS_NEO) {
+		threshold = g_neoThreshold;
+	} else {
+		threshold = g_sc[ch]->getThreshold(); // 1 -> 10mV.
+	}
+
+
+	const TimeMap tmap = g_ts.snapshot();	// for all of this scan's spikes
+	int nsp;
+	do {
+		// ask for twice the width of a spike waveform so that we may align
+		nsp = g_sc[ch]->m_spkbuf.getSpikes(tk_b, wf_b, neo_b, 2*NWFSAMP,
+		                                  threshold, NWFSAMP, SPIKE_BATCH,
+		                                  g_whichSpikePreEmphasis);
+		for (int sp=0; sp<nsp; sp++) {
+			float *wf_sp = &wf_b[sp*2*NWFSAMP];
+			float *neo_sp = &neo_b[sp*2*NWFSAMP];
+			u32 *tk_sp = &tk_b[sp*2*NWFSAMP];
+
+			int a = floor(NWFSAMP/2);
+			int b = floor(NWFSAMP/2)+NWFSAMP;
+
+			int centering = a;
+			float v;
+
+			switch (g_whichAlignment) {
+			case ALIGN_CROSSING:
+				//centering = (float)NWFSAMP - g_sc[ch]->getCentering();
+				centering = g_sc[ch]->getCentering() + a;
+				break;
+			case ALIGN_MIN:
+				v = FLT_MAX;
+				for (int i=a; i<b; i++) {
+					if (v > wf_sp[i]) {
+						v = wf_sp[i];
+						centering = i;
+					}
+				}
+				break;
+			case ALIGN_MAX:
+				v = FLT_MIN;
+				for (int i=a; i<b; i++) {
+					if (v < wf_sp[i]) {
+						v = wf_sp[i];
+						centering = i;
+					}
+				}
+
+				break;
+			case ALIGN_ABS:
+				v = FLT_MIN;
+				for (int i=a; i<b; i++) {
+					if (v < fabs(wf_sp[i])) {
+						v = fabs(wf_sp[i]);
+						centering = i;
+					}
+				}
+
+				break;
+			case ALIGN_SLOPE:
+				v = FLT_MIN;
+				for (int i=a; i<b; i++) {
+					if (v < wf_sp[i+1]-wf_sp[i]) {
+						v = wf_sp[i+1]-wf_sp[i];
+						centering = i;
+					}
+				}
+
+				break;
+			case ALIGN_NEO: {
+				v = FLT_MIN;
+				for (int i=a; i<b; i++) {
+					if (v < neo_sp[i]) {
+						v = neo_sp[i];
+						centering = i;
+					}
+				}
+			}
+			break;
+			default:
+				error("bad alignment type. exiting");
+				exit(1);
+			}
+
+			size_t idx = centering-(int)floor(NWFSAMP/2);
+
+			u32 tk = tk_sp[centering]; // alignment time
+
+			int unit = 0; // unsorted.
+			float score[NSORT];
+			int z = tmatch(&wf_sp[idx], &(g_sc[ch]->m_template[0][0]),
+			               NSORT, NWFSAMP, g_whichSortMetric, score);
+			float aperture = g_sc[ch]->getAperture(z); // MSE
+			if (g_whichSortMetric == TMATCH_L1) {
+				aperture = sqrtf(aperture); // compare L1 to the rms equivalent
+			}
+			if (score[z] < aperture) {
+				unit = z+1;
+			}
+
+			// check if this exceeds minimum ISI.
+			// wftick is indexed to the start of the waveform.
+			bool passed = true;
+			if (unit > 0) { // sorted
+				passed = (tk - g_sc[ch]->m_lastSpike[unit-1]) > g_minISI*g_sr/1000.0;
+			}
+
+			if (passed) {
+				double the_time = tmap.time(tk);
+				if (g_display)
+					g_display->spike(ch, unit, tk, the_time, &wf_sp[idx]);
+				g_sc[ch]->updateISI(unit, tk); // does nothing for unit==0
+				SPIKE *s = nullptr;
+				if (unit > 0 || g_saveUnsorted)
+					s = g_spikewriter.get(lane); // null unless recording
+				if (s) {
+					s->ch = ch+1;	// 1-indexed
+					s->un = unit;
+					s->tk = tk;
+					s->ts = the_time;
+					if (g_saveSpikeWF) {
+						s->nwf = NWFSAMP;
+						for (size_t g=0; g<s->nwf; g++) {
+							s->wf[g] = wf_sp[idx+g] * 1e4;
+						}
+					} else {
+						s->nwf = 0;
+					}
+					u64 tq = latNow();
+					g_spikewriter.add(s, lane); // recycled by the writer
+					g_latency[LAT_SPIKE_ENQ].since(tq);
+				}
+				if (unit > 0 && unit < NUNIT) {
+					int uu = unit-1;
+					g_fr[ch*NSORT+uu]->add(the_time);
+
+					// HACK HACK HACK
+					// XXX XXX XXX XX
+					// HACK HACK HACK
+
+					//if (ch == 0 && unit == 1) { //nb zero-indexed
+					//	if (!g_sock.Send(".")) {
+					//		warn("ack!");
+					//	}
+					//
+					//	auto o = new ICMS; // deleted by other thread
+					//	o->set_ts(the_time);
+					//	o->set_tick(tk);
+					//	o->set_stim_chan(2); // 1-indexed
+					//	g_icmswriter.add(o);
+					//}
+				}
+				// the sample's time is from the tick, so this covers the
+				// card, the queue, filtering and sorting
+				g_latency[LAT_TICK_TO_SPIKE].addSeconds((double)(gettime() - the_time));
+			}
+		}
+	} while (nsp == SPIKE_BATCH);
+}
+static void spikewrite()
+{
+	rtEnter(RT_WRITER, "write spikes");
+	while (!g_die) {
+		// add() wakes us once a batch is queued; old spikes go out by
+		// the timeout
+		g_spikewriter.wait(0.1);
+		u64 t0 = latNow();
+		if (g_spikewriter.write()) //if it can write, it will.
+			g_latency[LAT_WRITE_SPIKES].since(t0);
+	}
+}
+static void icmswrite()
+{
+	rtEnter(RT_WRITER, "write icms");
+	while (!g_die) {
+		g_icmswriter.wait(0.1);
+		u64 t0 = latNow();
+		if (g_icmswriter.write()) //if it can write, it will.
+			g_latency[LAT_WRITE_ICMS].since(t0);
+	}
+}
+static void analogwrite_prefilter()
+{
+	rtEnter(RT_WRITER, "write pre");
+	while (!g_die) {
+		// add() wakes us once a slab is queued
+		g_analogwriter_prefilter.wait(0.1);
+		u64 t0 = latNow();
+		if (g_analogwriter_prefilter.write())
+			g_latency[LAT_WRITE_PRE].since(t0);
+	}
+}
+static void analogwrite()
+{
+	rtEnter(RT_WRITER, "write post");
+	while (!g_die) {
+		g_analogwriter_postfilter.wait(0.1);
+		u64 t0 = latNow();
+		if (g_analogwriter_postfilter.write())
+			g_latency[LAT_WRITE_POST].since(t0);
+	}
+}
+// refresh the latency table (and its file) once a second
+static void latency_fun()
+{
+	rtEnter(RT_SERVICE, "latency");
+	while (!g_die) {
+		for (int i=0; i<10 && !g_die; i++)
+			usleep(1e5);
+		g_latmon.update();
+	}
+}
+// sleep for as long as n more samples take to arrive at sr (per second);
+// a moment, with no rate
+static void sleepSamples(size_t n, double sr)
+{
+	if (sr <= 0) {
+		usleep(1e2);
+		return;
+	}
+	double s = n / sr;
+	timespec ts;
+	ts.tv_sec = (time_t)s;
+	ts.tv_nsec = (long)((s - ts.tv_sec) * 1e9);
+	clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+}
+static void po8e_fun(PO8e *p, PO8Queue *q, PO8DataPool *pool)
+{
+	rtEnter(RT_ACQUIRE, "po8e read");
+	size_t bufmax = 10000;	// must be >= 10000
+
+	printf("Waiting for the stream to start ...\n");
+	while (p->samplesReady() == 0 && !g_die) {
+		p->waitForDataReady(100);	// ms; to see g_die
+	}
+
+	if (p == nullptr || g_die) {
+		return; /// xxx how to recover?
+	}
+
+	auto nchan = p->numChannels();
+	auto bps = p->dataSampleSize(); // bytes/sample
+	printf("Card %p: %d channels @ %d bytes/sample\n", (void *)p, nchan, bps);
+
+	if ((size_t)nchan > pool->channels()) {
+		error("Card %p: %d channels but pool blocks hold %zu. aborting read",
+		      (void *)p, nchan, pool->channels());
+		g_die = true;
+		return;
+	}
+
+	// blocks come from the pool; we only need room for the ticks
+	auto tick = new i64[pool->samples()];
+
+	// get the initial tick value. hopefully a small number
+	{
+		PO8Data *o = pool->get();
+		p->readBlock(o->data, 1, tick);
+		pool->put(o); // nb we are the only thread touching the pool yet
+	}
+	i64 last_tick = tick[0] - 1;
+
+	while (!g_die) {
+
+		bool stopped = false;
+		size_t numSamples = p->samplesReady(&stopped);
+		if (stopped) {
+			warn("samplesReady() indicated that we are stopped: numSamples: %zu",
+			     numSamples);
+			break; // xxx how to recover?
+		}
+
+		if (numSamples >= g_po8e_read_size) {
+			if (numSamples > bufmax) {
+				warn("samplesReady() returned too many samples (buffer wrap?): %zu",
+				     numSamples);
+				numSamples = bufmax;
+			}
+
+
+			size_t numRead;
+			PO8Data *o = pool->get();
+
+			u64 t0 = latNow();
+			{
+				// warning: these braces are intentional
+				std::lock_guard<std::mutex> lock(g_po8e_mutex);
+				numRead = p->readBlock(o->data, g_po8e_read_size, tick);
+				p->flushBufferedData(numRead);
+			}
+			o->t_read = latNow();
+			g_latency[LAT_READ].add(o->t_read - t0);
+
+			if (tick[0] != last_tick + 1) {
+				warn("%p: PO8e tick glitch between blocks. Expected %zu got %zu",
+				     p, last_tick+1, tick[0]);
+				g_ts.m_dropped++;
+				// xxx how to recover?
+			}
+			for (size_t i=0; i<numRead-1; i++) {
+				if (tick[i+1] != tick[i] + 1) {
+					warn("%p: PO8e tick glitch within block. Expected %zu got %zu",
+					     p, tick[i]+1, tick[i+1]);
+					g_ts.m_dropped++;
+					// xxx how to recover?
+				}
+			}
+			last_tick = tick[numRead-1];
+
+			o->numChannels = nchan;
+			o->numSamples = numRead;
+			o->tick = tick[0];
+			q->enqueue(o);
+			// NB the worker returns o to the pool
+		} else if (numSamples == 0) {
+			p->waitForDataReady(100);
+		} else {
+			// the driver wakes us per transfer; sleep out the rest of the
+			// block instead, so a partial one doesn't spin
+			sleepSamples(g_po8e_read_size - numSamples, g_sr);
+		}
+	}
+
+	delete[] tick;
+
+	printf("  stopped collecting data\n");
+	p->stopCollecting();
+	printf("  releasing card %p\n", (void *)p);
+	PO8e::releaseCard(p);
+
+	printf("\n");
+	sleep(1);
+}
+// stands in for po8e_fun() on every card at once: the source's channels
+// are the neural channels, in config order; event and analog channels are
+// zero. at speed 0 it only keeps the queues half full, so nothing is lost.
+static void replay_fun(ReplaySource *r)
+{
+	rtEnter(RT_ACQUIRE, "replay");
+	size_t n = g_dataqueues.size();
+	size_t rs = g_po8e_read_size;
+	size_t nc = r->numChannels();
+	size_t nnc = g_sc.size();
+	if (nc != nnc) {
+		warn("replay has %zu channels, config has %zu neural; %s",
+		     nc, nnc, nc < nnc ? "the rest are zero" : "dropping the rest");
+	}
+
+	vector<i16> buf(nc * rs);
+	vector<i64> tick(rs);
+	vector<PO8Data *> o(n);
+	i64 last_tick = 0;
+
+	while (!g_die) {
+		bool stopped = false;
+		size_t ready = r->samplesReady(&stopped);
+		// a tail shorter than a block never becomes ready; po8e_fun() would
+		// wait on it forever, but a replay is over
+		if (stopped || r->remaining() < rs)
+			break;
+		bool room = true;
+		for (auto &q : g_dataqueues) {
+			if (q.first->size_approx() > PO8E_POOL_SIZE/2)
+				room = false;
+		}
+		if (ready < rs) {
+			sleepSamples(rs - ready, r->samplingRate() * r->speed());
+			continue;
+		}
+		if (!room) {
+			usleep(1e2);	// the worker is behind; at speed 0 it always is
+			continue;
+		}
+
+		u64 t0 = latNow();
+		size_t numRead = r->readBlock(&buf[0], rs, &tick[0]);
+		if (numRead < rs)
+			break;	// a partial block at the end; po8e_fun() would wait
+		if (r->samplesRead() > rs && tick[0] != last_tick + 1) {
+			warn("replay: tick gap between blocks. Expected %zu got %zu",
+			     last_tick+1, tick[0]);
+			g_ts.m_dropped++;
+		}
+		last_tick = tick[rs-1];
+
+		size_t nc_i = 0;
+		for (size_t i=0; i<n; i++) {
+			auto card = g_dataqueues[i].second;
+			o[i] = g_datapools[i]->get();
+			size_t cs = card->channel_size();
+			memset(o[i]->data, 0, cs * rs * sizeof(i16));
+			for (size_t j=0; j<cs; j++) {
+				if (card->channel(j).data_type() == po8e::channel::NEURAL) {
+					if (nc_i < nc)
+						memcpy(&o[i]->data[j*rs], &buf[nc_i*rs], rs*sizeof(i16));
+					nc_i++;
+				}
+			}
+		}
+		u64 t1 = latNow();
+		g_latency[LAT_READ].add(t1 - t0);
+		for (size_t i=0; i<n; i++) {
+			o[i]->numChannels = g_dataqueues[i].second->channel_size();
+			o[i]->numSamples = rs;
+			o[i]->tick = tick[0];
+			o[i]->t_read = t1;
+			g_dataqueues[i].first->enqueue(o[i]);
+		}
+	}
+	g_replayDone = true;
+}
+
+// hand back a worker scratch buffer of at least n elements.
+// buffers only ever grow, so this allocates once per session.
+template <typename T>
+static T *scratch(vector<T> &v, size_t n)
+{
+	if (n > v.capacity())
+		g_workerAllocs++;
+	v.resize(n);
+	return v.data();
+}
+// one block of raw samples, per the save mode, into a packet from w's
+// pool; the writer thread hands it back.
+static void saveAnalog(H5AnalogWriter *w, size_t ns, const i64 *tk,
+                       const double *ts, const i16 *raw)
+{
+	size_t nnc = g_sc.size();
+	size_t nc = 0;
+	switch (g_whichAnalogSave) {
+	case SAVE_SINGLE:
+		nc = 1;
+		break;
+	case SAVE_ENABLED:
+		for (auto &ch : g_sc) {
+			if (ch->getEnabled())
+				nc++;
+		}
+		break;
+	case SAVE_ALL:
+		nc = nnc;
+		break;
+	default:
+		error("bad analog save mode. exiting.");
+		exit(1);
+	}
+	AD *ad = w->get(nc, ns);
+	if (!ad)
+		return; // closed meanwhile
+	memcpy(ad->tk, tk, ns*sizeof(i64));
+	memcpy(ad->ts, ts, ns*sizeof(double));
+	switch (g_whichAnalogSave) {
+	case SAVE_SINGLE:
+		memcpy(ad->data, &raw[g_channel[0]*ns], ns*sizeof(i16));
+		break;
+	case SAVE_ENABLED: {
+		size_t c_i = 0;
+		for (size_t ch=0; ch<nnc; ch++) {
+			if (g_sc[ch]->getEnabled()) {
+				memcpy(&ad->data[c_i*ns], &raw[ch*ns], ns*sizeof(i16));
+				c_i++;
+			}
+		}
+		break;
+	}
+	case SAVE_ALL:
+		memcpy(ad->data, raw, nnc*ns*sizeof(i16));
+		break;
+	}
+	w->add(ad);
+}
+static void worker()
+{
+	rtEnter(RT_WORKER, "worker");
+	vector<PO8Data *> p;
+	vector<po8e::card *> c;
+	p.reserve(g_dataqueues.size());
+	c.reserve(g_dataqueues.size());
+
+	// scratch buffers live for the whole session
+	vector<i64> s_tk;
+	vector<double> s_ts;
+	vector<float> s_x;
+	vector<float> s_y;
+	vector<i16> s_raw;
+	vector<float> s_audio;
+	vector<float> s_trace;
+	vector<u8> s_events;
+	vector<u8> s_stim;
+	vector<u8> s_blank;
+
+	while (!g_die) {
+
+		auto n = g_dataqueues.size();
+
+		p.clear();
+		c.clear();
+
+		for (size_t i=0; i<n; i++) {
+			auto q = g_dataqueues[i].first;
+			c.push_back(g_dataqueues[i].second);
+			// the po8e thread wakes us; the timeout is only to see g_die
+			PO8Data *x;
+			while (!g_die) {
+				if (q->wait_dequeue(x, 0.1)) {
+					p.push_back(x);
+					break;
+				}
+			}
+		}
+
+		if (g_die) {
+			for (size_t i=0; i<p.size(); i++) {
+				g_datapools[i]->put(p[i]);
+			}
+			break;
+		}
+
+		// how long the blocks sat in the queues
+		u64 now = latNow();
+		for (auto &o : p) {
+			g_latency[LAT_QUEUE].add(now - o->t_read);
+		}
+
+		auto mismatch = false;
+		for (size_t i=0; i<n; i++) {
+			if (p[i]->numSamples != p[0]->numSamples) {
+				warn("po8e card sample mismatch");
+				mismatch = true;
+				break;
+			}
+			if (p[i]->numChannels != (size_t)c[i]->channel_size()) {
+				warn("po8e card %d: configured for %d channels (%d received in po8e packet)",
+				     c[i]->id(), c[i]->channel_size(), p[i]->numChannels);
+				mismatch = true;
+				break;
+			}
+			if (p[i]->tick != p[0]->tick) {
+				warn("p08e ticks misaligned between cards");
+				mismatch = true;
+				break;
+			}
+		}
+
+		if (mismatch) // exit the worker; no data will be processed
+			break;
+
+		long double time = gettime();
+		g_po8ePollInterval = (time - g_lastPo8eTime)*1000.0;
+		g_po8eAvgInterval = g_po8eAvgInterval * 0.99 + g_po8ePollInterval * 0.01;
+		g_lastPo8eTime = time;
+
+		g_ts.update(time, p[0]->tick); //also updates the mmap file.
+
+		auto ns = p[0]->numSamples;
+
+		// one map for the whole block, whatever update() does meanwhile
+		const TimeMap tmap = g_ts.snapshot();
+		auto tk 	= scratch(s_tk, ns);
+		auto ts 	= scratch(s_ts, ns);
+		for (size_t i=0; i < ns; i++)
+			tk[i] = p[0]->tick + (i64)i;
+		tmap.fill(tk[0], ns, ts);
+
+		size_t nnc = g_sc.size(); // num neural channels
+
+		// the neural data, scaled, nnc x ns column-major: each sample is
+		// contiguous across channels. everything below works on it in place.
+		auto xn = scratch(s_x, nnc * ns);
+		auto raw = scratch(s_raw, nnc * ns);
+		size_t nc_i = 0;
+		for (size_t i=0; i<c.size(); i++) {
+			for (int j=0; j<c[i]->channel_size(); j++) {
+				if (c[i]->channel(j).data_type() == po8e::channel::NEURAL) {
+					auto scale_factor = g_sc[nc_i]->m_scaleFactor;
+					for (size_t k=0; k<ns; k++) {
+						xn[k*nnc+nc_i] = (float)p[i]->data[j*ns+k]/scale_factor;
+						raw[nc_i*ns+k] = p[i]->data[j*ns+k];
+					}
+					nc_i++;
+				}
+			}
+		}
+
+		// stim channels (and event channels generally)
+		size_t nec = 0; // num event channels
+		size_t nsc = 0; // num stim channels
+		for (auto &card : c) {
+			for (int j=0; j<card->channel_size(); j++) {
+				if (card->channel(j).data_type() == po8e::channel::EVENT) {
+					if (card->channel(j).name().compare("stim") == 0) {
+						nsc++;
+					} else {
+						nec++;
+					}
+				}
+			}
+		}
+		auto events = scratch(s_events, nec*ns);
+		auto stim 	= scratch(s_stim, nsc*ns);
+		size_t ns_i = 0;
+		size_t ne_i = 0;
+		for (size_t i=0; i<c.size(); i++) {
+			for (int j=0; j<c[i]->channel_size(); j++) {
+				if (c[i]->channel(j).data_type() == po8e::channel::EVENT) {
+					if (c[i]->channel(j).name().compare("stim") == 0) {
+						for (size_t k=0; k<ns; k++) {
+							stim[ns_i*ns+k] = (bool)p[i]->data[j*ns+k];
+						}
+						ns_i++;
+					} else {
+						for (size_t k=0; k<ns; k++) {
+							events[ne_i*ns+k] = (bool)p[i]->data[j*ns+k];
+						}
+						ne_i++;
+					}
+				}
+			}
+		}
+
+		// return the po8e data packets to their pools
+		for (size_t i=0; i<n; i++) {
+			g_datapools[i]->put(p[i]);
+		}
+
+		for (size_t k=0; k<ns && g_display; k++) {
+			for (size_t i=0; i<nsc; i++) {
+				if (stim[i*ns+k]) {
+					g_display->event(i, ts[k]); // to draw
+				}
+			}
+		}
+
+		// TODO:  need to be set. Keep empty for now
+		auto blank 	= scratch(s_blank, ns);
+		//stim[k]  = (u16)(p[1].data[8*ns + k]);
+		//stim[k] += (u16)(p[1].data[9*ns + k]) << 16;
+		//blank[k] = p[1].data[10*ns + k] > 0;
+
+		// write (pre-filtered) broadband signal to disk
+		if (g_analogwriter_prefilter.isEnabled())
+			saveAnalog(&g_analogwriter_prefilter, ns, tk, ts, raw);
+
+		// fill artifact filtering buffers (for other thread)
+		// we do both training and filtering before filtering
+		// on the intuition that it will work better this way
+
+		if (g_trainArtifactNLMS) {
+			// from the pool; the training thread hands it back
+			mat *Y;
+			if (!g_filterfree.try_dequeue(Y)) {
+				g_workerAllocs++; // training is behind; the pool grows by one
+				Y = new mat(nnc, ns);
+			} else if (Y->n_rows != nnc || Y->n_cols != ns) {
+				g_workerAllocs++;
+				Y->set_size(nnc, ns);
+			}
+			double *y = Y->memptr();
+			for (size_t i=0; i<nnc*ns; i++) {
+				y[i] = xn[i];
+			}
+			g_filterbuf.enqueue(Y);
+		}
+
+		// filter online here: nlms and the loaded filter, one float GEMM
+		// in place (fused when both are on)
+		u64 t_art = latNow();
+		if (g_filterArtifactNLMS || g_artifactFilterRun) {
+			auto y = scratch(s_y, nnc * ns);
+			g_artifactChain->proc(xn, y, ns, g_filterArtifactNLMS,
+			                      g_artifactFilterRun);
+		}
+
+		// stim artifacts: capture, template subtraction and the running
+		// average, a whole event span at a time
+		g_artifactEngine->process(xn, ns, stim, nsc, tk,
+		                          g_enableArtifactSubtr, g_trainArtifactTempl,
+		                          g_numArtifactSamps,
+		[&](const ArtifactEvent &e) {
+			auto o = g_icmswriter.get(); // back to the pool once written
+			if (!o)
+				return;
+			o->set_ts(tmap.time(e.tick));
+			o->set_tick(e.tick);
+			o->set_stim_chan(e.stim+1); // 1-indexed
+
+			if (g_saveICMSWF) {
+				for (int ch=0; ch<(int)nnc; ch++) {
+					ICMS_artifact *art = o->add_artifact();
+					art->set_rec_chan(ch+1); //1-indexed
+					for (int j=0; j<ARTBUF; j++) {
+						art->add_sample(e.now[j*nnc+ch]);
+					}
+				}
+			}
+			g_icmswriter.add(o);
+		});
+		t_art = latNow() - t_art;
+
+		// post-artifact-removal filtering, all channels at once
+		u64 t_filt = latNow();
+		if ( g_hipassNeurons &&  g_lopassNeurons)
+			g_bandpass->proc(xn, ns);
+
+		if ( g_hipassNeurons && !g_lopassNeurons)
+			g_hipass->proc(xn, ns);
+
+		if (!g_hipassNeurons &&  g_lopassNeurons)
+			g_lopass->proc(xn, ns);
+		g_latency[LAT_FILTER].since(t_filt);
+
+		// blank based on artifact (must happen after filtering)
+		u64 t_blank = latNow();
+		g_artifactEngine->blank(xn, g_enableArtifactBlanking,
+		                        g_artifactBlankingPreSamps,
+		                        g_artifactBlankingSamps);
+		g_latency[LAT_ARTIFACT].add(t_art + latNow() - t_blank);
+
+		// blank based on the stim clock (must happen last)
+		if (g_enableStimClockBlanking) {
+			for (size_t k=0; k<ns; k++) {
+				if (blank[k]) {
+					// note that if we keep track of the last value from the
+					// previous loop through, we could do sample-and-hold
+					// rather than zero-out. which is better?
+					// nan-ing is also a good idea but poisons further
+					// computations
+					memset(&xn[k*nnc], 0, nnc*sizeof(float));
+				}
+			}
+		}
+
+		// write (post-filtered) broadband signal to disk
+		if (g_analogwriter_postfilter.isEnabled())
+			saveAnalog(&g_analogwriter_postfilter, ns, tk, ts, raw);
+
+		auto audio 	= scratch(s_audio, ns);
+		auto trace 	= scratch(s_trace, ns);
+
+		// input data is scaled from TDT so that 32767 = 10mV.
+		// send the data for one channel to jack
+		for (int h=0; h<NFBUF; h++) {
+			int ch = g_channel[h];
+			float gain = g_sc[ch]->getGain();
+			for (size_t k=0; k<ns; k++) {
+				// scale into a reasonable range for audio
+				// and timeseries display
+				trace[k] = xn[k*nnc+ch] * gain / 1e4;
+			}
+			if (g_display)
+				g_display->timeseries(h, trace, ns); // timeseries trace
+			if (h==0) {
+				memcpy(audio, trace, ns*sizeof(float));
+			}
+		}
+#ifdef JACK
+		jackAddSamples(audio, audio, ns);
+#endif
+
+		// package data for sorting / saving
+
+		for (auto &ch : g_sc) {
+			//double m = ch->m_wfstats.mean();
+			for (size_t k=0; k<ns; k++) {
+				float x = xn[k*nnc+ch->m_ch] / 1e4; // scale so 1 = +10 mV
+				// 1 = +10mV; range = [-1 1] here.
+				ch->m_spkbuf.addSample(tk[k], x);
+
+				//update the channel running stats (means and stddevs, etc).
+				ch->m_wfstats(x);
+
+				//ch->m_var *= 0.999998;
+				//ch->m_var += 0.000002*(x-m)*(x-m);
+				//m *= 0.999997;
+				//m += 0.000003*x;
+			}
+			//ch->m_mean = m;
+		}
+
+		// sort -- see if samples pass threshold. if so, copy.
+		// this runs on the sorting threads; we go on to the next block.
+		g_sortpool->dispatch();
+	}
+}
+
+static void flush_pipe(int fid)
+{
+	fcntl(fid, F_SETFL, O_NONBLOCK);
+	char *d = (char *)malloc(1024*8);
+	int r = read(fid, d, 1024*8);
+	printf("flushed %d bytes\n", r);
+	free(d);
+	int opts = fcntl(fid,F_GETFL);
+	opts ^= O_NONBLOCK;
+	fcntl(fid, F_SETFL, opts);
+}
+// the binned rates of every unit, at the frame rate, into the shm ring.
+// get_bins() moves each unit's lag edges as it goes, so this is the only
+// thread that calls it; the fifo shim reads the ring, or scans.
+static BinnedShm s_binned;
+static std::atomic<u64> s_binLate(0);	// frames that started a period late
+static DecodeShm s_decode;
+// decode the frame just published; its target only if the task wrote one
+// in the last two frames
+static void decode_step(const u16 *bins, double end)
+{
+	static u32 seen = 0;
+	static DecodeTarget target;
+	static float y[DEC_MAXOUT];
+	u64 t0 = latNow();
+	s_decode.target(seen, target);
+	bool fresh = fabs(end - target.time) < 2.0 / g_binRate;
+	bool valid = g_decoder->step(bins, s_binned.head()-1,
+	                             fresh ? &target : NULL, y);
+	s_decode.publish(valid, s_binned.head()-1, end, g_ts.getTicks(end), y);
+	g_latency[LAT_DECODE].since(t0);
+}
+static void binned_fun()
+{
+	rtEnter(RT_BINNED, "binned");
+	FiringRateMatrix frm;
+	long period = (long)(1e9 / g_binRate);
+	timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (!g_die) {
+		next.tv_nsec += period;
+		while (next.tv_nsec >= 1000000000L) {
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long behind = (now.tv_sec - next.tv_sec)*1000000000L +
+		              (now.tv_nsec - next.tv_nsec);
+		if (behind > period) {
+			s_binLate++;
+			next = now;	// drop the missed frames rather than burst them
+		}
+		u64 t0 = latNow();
+		double end = (double)gettime();
+		u16 *bins = s_binned.begin(end);
+		frm.get_bins(g_fr.data(), g_fr.size(), end, bins);
+		s_binned.publish();
+		g_latency[LAT_BINNED].since(t0);
+		// the slot is only written by us, at the next begin()
+		if (s_decode.isOpen())
+			decode_step(bins, end);
+	}
+}
+static void decode_train()
+{
+	rtEnter(RT_SERVICE, "decode train");
+	while (!g_die)
+		g_decoder->train(0.1);
+}
+// the old fifo handshake, for matlab code that still uses it: a request
+// (the time to bin, < 0 for now) on the in fifo, the bins in the mmap file,
+// then "go" on the out fifo. 'now' is the newest shm frame when the ring
+// is running (rounded per bin; see FiringRate::get_bins()). a given time,
+// or 'now' with no ring, is the old scan, with the old values, and leaves
+// binned_fun's edges where they are.
+static void mmap_fun()
+{
+	rtEnter(RT_SERVICE, "fifo shim");
+	// sockets are too slow -- we need to memmap a file(s).
+	/* matlab can do this -- very well, too! e.g:
+	 * m = memmapfile('/tmp/binned.mmap', 'Format', {'uint16' [194 10] 'x'})
+	 * A = m.Data(1).x;
+	 * */
+	auto nc = g_fr.size();
+	// nb we assume that the number of lags is the same for all chans & units.
+	int nlags = g_fr[0]->get_lags();
+	size_t length = (nc+1)*nlags*sizeof(u16); // nc+1 because of counter
+	auto mmh = new mmapHelp(length, "/tmp/binned.mmap"); // xxx conf file?
+	volatile u16 *bin = (u16 *)mmh->m_addr;
+	mmh->prinfo();
+
+	auto pipe_out = new fifoHelp("/tmp/gtkclient_out.fifo"); // xxx conf file
+	pipe_out->prinfo();
+
+	auto pipe_in = new fifoHelp("/tmp/gtkclient_in.fifo"); // xxx conf file
+	pipe_in->setR(); // so we can poll
+	pipe_in->prinfo();
+
+	int frame = 0;
+	bin[nc*nlags] = 0;
+	bin[nc*nlags+1] = 0;
+	flush_pipe(pipe_out->m_fd);
+
+	while (!g_die) {
+		//printf("%d waiting for matlab...\n", frame);
+		if (pipe_in->Poll(1000)) {
+			double reqTime = 0.0;
+			int r = read(pipe_in->m_fd, &reqTime, 8); // send it the time you want to sample,
+			if (r >= 3) {
+				if (reqTime > 0 || !s_binned.latest((u16 *)bin, NULL, NULL)) {
+					double end = (reqTime > 0) ? reqTime : (double)gettime(); // < 0 to bin 'now'
+					for (size_t i=0; i<nc; i++)
+						g_fr[i]->get_bins_scan(end, (u16 *)&bin[i*nlags]);
+				}
+				bin[nc*nlags]++; //counter.
+				// the file is MAP_SHARED, so the stores are in the page cache
+				// matlab maps; they only have to be ordered before the "go".
+				// (this used to be a usleep(100).)
+				std::atomic_thread_fence(std::memory_order_release);
+				write(pipe_out->m_fd, "go\n", 3);
+				//printf("sent pipe_out 'go'\n");
+			} else
+				usleep(100000); //does not seem to limit the frame rate, just the startup sync.
+			frame++;
+		}
+	}
+	delete mmh;
+	delete pipe_in;
+	delete pipe_out;
+}
+
+string mk_legal_filename(string basedir, string prefix, string ext)
+{
+	string f;
+	int count = 0;
+	int res = -1;
+	do {
+		stringstream s;
+		count++;
+		s.str("");
+		s << prefix << setfill('0') << setw(2) << count << ext;
+		f = s.str();
+		s.str("");
+		s << basedir << "/" << f;
+		string fn = s.str();
+		res = ::access(fn.c_str(), F_OK);
+	} while (!res);	// returns zero on success
+	return f;
+}
+
+// channel names packed at a fixed stride, for setMetaData()
+static char *packNames(int *max_str)
+{
+	int m = 0;
+	for (size_t i=0; i<g_sc.size(); i++) {
+		m = m > (int)g_sc[i]->m_chanName.size() ?
+		    m : g_sc[i]->m_chanName.size();
+	}
+	auto name = new char[m*g_sc.size()];
+	for (size_t i=0; i<g_sc.size(); i++) {
+		strncpy(&name[i*m], g_sc[i]->m_chanName.c_str(),
+		        g_sc[i]->m_chanName.size());
+	}
+	*max_str = m;
+	return name;
+}
+
+bool pipelineOpenSpikes(const char *fn)
+{
+	g_spikewriter.setLayout(g_spikeLayout);
+	if (!g_spikewriter.open(fn, g_sc.size(), NSORT, NWFSAMP))
+		return false;
+
+	int max_str = 0;
+	char *name = packNames(&max_str);
+	char uuid[37];
+	uuid_unparse(g_uuid, uuid);
+	g_spikewriter.setUUID(uuid);
+	g_spikewriter.setMetaData(g_sr, name, max_str);
+	delete[] name;
+	return true;
+}
+
+bool pipelineOpenAnalog(H5AnalogWriter *w, const char *fn)
+{
+	size_t nc;
+	switch (g_whichAnalogSave) {
+	case SAVE_SINGLE: {
+		nc = 1;
+		break;
+	}
+	case SAVE_ENABLED: {
+		u32 num_enabled = 0;
+		for (size_t i=0; i< g_sc.size(); i++) {
+			if (g_sc[i]->getEnabled()) {
+				num_enabled++;
+			}
+		}
+		nc = num_enabled;
+		break;
+	}
+	case SAVE_ALL: {
+		nc = g_sc.size();
+		break;
+	}
+	default:
+		error("bad analog save mode. exiting.");
+		exit(1);
+	}
+
+	w->setCodec(g_analogCodec, g_analogCodec == H5C_ZSTD ? 3 : 1);
+	w->setDelta(g_analogDelta);
+	if (!w->open(fn, nc, g_po8e_read_size))
+		return false;
+
+	auto scale = new float[g_sc.size()];
+	for (size_t i=0; i<g_sc.size(); i++) {
+		scale[i] = g_sc[i]->m_scaleFactor;
+	}
+	int max_str = 0;
+	char *name = packNames(&max_str);
+	char uuid[37];
+	uuid_unparse(g_uuid, uuid);
+	w->setUUID(uuid);
+	w->setMetaData(g_sr, scale, name, max_str);
+	delete[] scale;
+	delete[] name;
+	return true;
+}
+
+void pipelineConfig(po8eConf &pc)
+{
+	g_po8e_read_size = pc.readSize();
+	printf("po8e read size:\t\t%zu\n", 	g_po8e_read_size);
+
+	g_binRate = pc.binRate(g_binRate);
+	if (g_binRate > 0)
+		printf("binned rates:\t\t%.1f Hz to %s\n", g_binRate, BSHM_NAME);
+	if (pc.decoderSpec(s_decoderSpec)) {
+		if (g_binRate > 0)
+			printf("decoder:\t\t%s, %d outputs to %s\n",
+			       decodeName(s_decoderSpec.type), s_decoderSpec.nout,
+			       DECSHM_NAME);
+		else
+			warn("decoder: needs bin_rate > 0; not decoding");
+	}
+
+	g_sr = pc.sampleRate(SRATE_HZ);
+	g_ts.reset(g_sr);
+	printf("sampling rate:\t\t%.4f Hz\n", g_sr);
+	if (fabs(g_sr - SRATE_HZ) > 1.0) {
+		// the filters follow g_sr; window lengths are still in samples
+		warn("sample_rate %.4f differs from the build's %.4f Hz: "
+		     "waveform and artifact windows keep their length in samples",
+		     g_sr, SRATE_HZ);
+	}
+	pc.filterSpec("bandpass", g_bandpassSpec);
+	pc.filterSpec("lowpass", g_lopassSpec);
+	pc.filterSpec("highpass", g_hipassSpec);
+
+	// before anything is allocated or started, so all of it is resident
+	// and every thread picks its policy up
+	for (int r=0; r<RT_NUM; r++) {
+		RtPolicy p;
+		if (pc.threadPolicy(rtRoleName(r), p))
+			rtSetPolicy(r, p);
+	}
+	if (pc.lockMemory(false))
+		rtLockMemory();
+	s_dataSpin = pc.queueSpin("data", s_dataSpin);
+	g_filterbuf.setSpin(pc.queueSpin("nlms", 0.0));
+	if (s_dataSpin > 0)
+		printf("data queue spin:\t%.0f us\n", s_dataSpin*1e6);
+}
+
+void pipelineInit(po8eConf &pc, MatStor &ms, ChannelFactory mkChannel,
+                  ArtifactFactory mkArtifact)
+{
+	size_t nc = pc.numNeuralChannels();
+
+	uuid_generate(g_uuid);
+
+	for (size_t i=0; i<(nc*NSORT); i++) {
+		auto fr = new FiringRate();
+		fr->set_bin_params(20, 1.0); // nlags, duration (sec)
+		g_fr.push_back(fr);
+	}
+	if (s_decoderSpec.type != DECODE_NONE && g_binRate > 0 && !g_fr.empty())
+		g_decoder = new Decoder(s_decoderSpec, g_fr.size(),
+		                        g_fr[0]->get_lags(), &ms);
+
+	size_t nc_i = 0;
+	for (auto &c : pc.cards) {
+		if (c->enabled()) {
+			for (int j=0; j<c->channel_size(); j++) {
+				if (c->channel(j).data_type() == po8e::channel::NEURAL) {
+					auto o = mkChannel(nc_i, &ms);
+					o->m_chanName = c->channel(j).name();
+					float scale_factor = (float)c->channel(j).scale_factor();
+					scale_factor /= 1e6; // to get uV
+					o->m_scaleFactor = scale_factor;
+					g_sc.push_back(o);
+					nc_i++;
+				}
+			}
+		}
+	}
+
+	g_artifactFilter = new ArtifactFilter(nc);
+	size_t nnlms = pc.nlmsThreads();
+	printf("nlms training threads:\t%zu\n", nnlms);
+	g_nlms = new ArtifactNLMS2(nc, &ms, nnlms);
+	// the blocks the worker hands the trainer; they come back
+	for (int i=0; i<NLMS_POOL; i++) {
+		g_filterfree.enqueue(new mat(nc, g_po8e_read_size));
+	}
+	g_artifactChain = new ArtifactChain(g_nlms, g_artifactFilter);
+	g_bandpass = new FilterBank(nc);
+	g_lopass = new FilterBank(nc);
+	g_hipass = new FilterBank(nc);
+	designFilter(g_bandpass, g_bandpassSpec);
+	designFilter(g_lopass, g_lopassSpec);
+	designFilter(g_hipass, g_hipassSpec);
+	for (size_t i=0; i<g_channel.size(); i++) {
+		g_channel[i] = ms.getInt(i, "channel", i*16);
+		if (g_channel[i] < 0) g_channel[i] = 0;
+		if (g_channel[i] >= (int)nc) g_channel[i] = (int)nc-1;
+	}
+	for (int i=0; i<STIMCHAN; i++)
+		g_templates.push_back(mkArtifact(i, nc, &ms));
+	g_artifactEngine = new ArtifactEngine(g_templates, nc);
+
+	size_t nsort = pc.sortThreads();
+	printf("sorting threads:\t%zu\n", nsort);
+	g_sortpool = new SortPool(nc, nsort, 4*nsort, sorter);
+	g_sortpool->setLatency(&g_latency[LAT_SORT]);
+	string latlog = pc.latencyLog();
+	if (!latlog.empty())
+		printf("latency table:\t\t%s\n", latlog.c_str());
+	g_latmon.setFile(latlog.c_str());
+	g_spikewriter.setLanes(g_sortpool->numShards());
+
+	size_t ncompress = pc.compressThreads();
+	printf("compression threads:\t%zu per analog writer\n", ncompress);
+	g_analogwriter_prefilter.setThreads(ncompress);
+	g_analogwriter_postfilter.setThreads(ncompress);
+
+	g_saveUnsorted 	= (bool)ms.getStructValue("savemode", "unsorted_spikes", 0, (float)g_saveUnsorted);
+	g_saveSpikeWF  	= (bool)ms.getStructValue("savemode", "spike_waveforms", 0, (float)g_saveSpikeWF);
+	g_spikeLayout	= (int)ms.getStructValue("savemode", "spike_layout", 0, (float)g_spikeLayout);
+	g_analogCodec	= (int)ms.getStructValue("savemode", "analog_codec", 0, (float)g_analogCodec);
+	g_analogDelta	= (bool)ms.getStructValue("savemode", "analog_delta", 0, (float)g_analogDelta);
+	if (g_analogCodec < 0 || g_analogCodec >= H5C_NUM)
+		g_analogCodec = H5C_DEFLATE;
+	g_saveICMSWF	= (bool)ms.getStructValue("savemode", "icms_waveforms", 0, (float)g_saveICMSWF);
+
+	g_whichSpikePreEmphasis = ms.getStructValue("spike", "pre_emphasis", 0, g_whichSpikePreEmphasis);
+	g_whichAlignment = ms.getStructValue("spike", "alignment_mode", 0, g_whichAlignment);
+	g_whichSortMetric = ms.getStructValue("spike", "sort_metric", 0, g_whichSortMetric);
+	g_minISI = ms.getStructValue("spike", "min_isi", 0, g_minISI);
+	g_autoThreshold = ms.getStructValue("spike", "auto_threshold", 0, g_autoThreshold);
+	g_neoThreshold = ms.getStructValue("spike", "neo_threshold", 0, g_neoThreshold);
+
+	g_lopassNeurons = (bool)ms.getStructValue("filter", "lopass", 0, (float)g_lopassNeurons);
+	g_hipassNeurons = (bool)ms.getStructValue("filter", "hipass", 0, (float)g_hipassNeurons);
+
+	g_artifactFilterRun = (bool)ms.getStructValue("icms", "filter_run", 0, (float)g_artifactFilterRun);
+
+	g_trainArtifactNLMS = (bool)ms.getStructValue("icms", "lms_train", 0, (float)g_trainArtifactNLMS);
+	g_filterArtifactNLMS = (bool)ms.getStructValue("icms", "lms_filter", 0, (float)g_filterArtifactNLMS);
+
+	g_trainArtifactTempl = (bool)ms.getStructValue("icms", "template_train", 0, (float)g_trainArtifactTempl);
+	g_enableArtifactSubtr = (bool)ms.getStructValue("icms", "template_subtract", 0, (float)g_enableArtifactSubtr);
+	g_numArtifactSamps = (int)ms.getStructValue("icms", "template_numsamples", 0, (float)g_numArtifactSamps);
+
+	g_enableArtifactBlanking = (bool)ms.getStructValue("icms", "blank_enable", 0, (float)g_enableArtifactBlanking);
+	g_artifactBlankingSamps = (int)ms.getStructValue("icms", "blank_samples", 0, (float)g_artifactBlankingSamps);
+	g_artifactBlankingPreSamps = (int)ms.getStructValue("icms", "blank_pre_samples", 0, (float)g_artifactBlankingPreSamps);
+	g_enableStimClockBlanking = (bool)ms.getStructValue("icms", "blank_clock_enable", 0, (float)g_enableStimClockBlanking);
+}
+
+bool pipelineOpenCards(po8eConf &pc, vector<thread> &threads)
+{
+	printf("PO8e API Version %s\n", revisionString());
+	int totalcards = PO8e::cardCount();
+	printf("Found %d PO8e card(s) in the system.\n", totalcards);
+	if (totalcards < 1) {
+		error("Quitting");
+		return false;
+	}
+
+	if (totalcards < (int)pc.cards.size()) {
+		error("config describes more po8e cards than detected");
+		return false;
+	}
+
+	if (totalcards > (int)pc.cards.size()) {
+		totalcards = (int)pc.cards.size();
+	}
+
+	auto configureCard = [&](PO8e* p) -> bool {
+		// return true on success
+		// return false on failure
+		if (!p->startCollecting())
+		{
+			warn("startCollecting() failed with: %d", p->getLastError());
+			p->flushBufferedData();
+			p->stopCollecting();
+			printf(" -> Releasing card %p\n", (void *)p);
+			PO8e::releaseCard(p);
+			return false;
+		}
+		printf(" -> Card %p is collecting incoming data.\n", (void *)p);
+		return true;
+	};
+
+	for (int i=0; i<totalcards; i++) {
+		if (pc.cards[i]->enabled()) {
+			int id = (int)pc.cards[i]->id();
+			PO8e *p = PO8e::connectToCard(id-1); // 0-indexed
+			if (p == nullptr) {
+				break;
+			}
+			printf("Connection established to card %d at %p\n", id, (void *)p);
+			if (configureCard(p)) {
+				auto q = new PO8Queue(PO8E_POOL_SIZE, s_dataSpin);
+				auto pool = new PO8DataPool(PO8E_POOL_SIZE,
+				                            pc.cards[i]->channel_size(),
+				                            g_po8e_read_size);
+				threads.push_back(thread(po8e_fun, p, q, pool));
+				g_dataqueues.push_back(pair<PO8Queue *, po8e::card *>(q, pc.cards[i]));
+				g_datapools.push_back(pool);
+			}
+		}
+	}
+
+	if (g_dataqueues.size() < 1) {
+		error("Connected to zero po8e cards");
+		return false;
+	}
+	return true;
+}
+
+bool pipelineOpenReplay(po8eConf &pc, ReplaySource *r, const char *fn,
+                        double synthSecs, double speed, bool loop,
+                        vector<thread> &threads)
+{
+	bool ok = true;
+	if (fn)
+		ok = r->open(fn);
+	else
+		r->synth(g_sc.size(), g_sr, synthSecs);
+	if (!ok) {
+		error("cannot replay %s", fn);
+		return false;
+	}
+	if (r->samplingRate() == 0.0)
+		r->setSamplingRate(g_sr);
+	else if (fabs(r->samplingRate() - g_sr) > 1.0)
+		warn("replay was recorded at %.4f Hz; running at %.4f Hz",
+		     r->samplingRate(), g_sr);
+	r->setSpeed(speed);
+	r->setLoop(loop);
+	printf("replay:\t\t\t%s, %zu channels, ",
+	       fn ? fn : "synthetic", r->numChannels());
+	if (r->numSamples() > 0)
+		printf("%.1f s%s\n", r->numSamples() / r->samplingRate(),
+		       loop ? ", looped" : "");
+	else
+		printf("no end\n");
+	if (speed > 0)
+		printf("replay speed:\t\t%gx real time\n", speed);
+	else
+		printf("replay speed:\t\tas fast as possible\n");
+
+	for (auto &card : pc.cards) {
+		if (card->enabled()) {
+			auto q = new PO8Queue(PO8E_POOL_SIZE, s_dataSpin);
+			auto pool = new PO8DataPool(PO8E_POOL_SIZE,
+			                            card->channel_size(),
+			                            g_po8e_read_size);
+			g_dataqueues.push_back(pair<PO8Queue *, po8e::card *>(q, card));
+			g_datapools.push_back(pool);
+		}
+	}
+	if (g_dataqueues.size() < 1) {
+		error("no enabled po8e cards to stand in for");
+		return false;
+	}
+	threads.push_back(thread(replay_fun, r));
+	return true;
+}
+
+void pipelineStart(vector<thread> &threads)
+{
+	// the segment carries g_startTime, so this comes after it is set, and
+	// before the fifo shim looks at it
+	if (g_binRate > 0 && !g_fr.empty())
+		s_binned.create(BSHM_NAME, g_fr.size(), g_fr[0]->get_lags(),
+		                g_binRate, g_fr[0]->get_duration());
+	if (g_decoder && s_binned.isOpen())
+		s_decode.create(DECSHM_NAME, g_decoder->numOutputs(),
+		                g_decoder->type(), g_binRate);
+	threads.push_back(thread(worker));
+	threads.push_back(thread(spikewrite));
+	threads.push_back(thread(icmswrite));
+	threads.push_back(thread(analogwrite_prefilter));
+	threads.push_back(thread(analogwrite));
+	threads.push_back(thread(mmap_fun));
+	if (s_binned.isOpen())
+		threads.push_back(thread(binned_fun));
+	if (s_decode.isOpen())
+		threads.push_back(thread(decode_train));
+	threads.push_back(thread(nlms_train));
+	threads.push_back(thread(latency_fun));
+
+	//jack.
+#ifdef JACK
+	warn("starting jack");
+	jackInit("gtkclient", JACKPROCESS_RESAMPLE);
+	jackConnectFront();
+	jackSetResample(g_sr/SAMPFREQ);
+#endif
+}
+
+void pipelineDrain()
+{
+	// until the replay ends (or SIGINT), then until the queues drain
+	while (!g_die && !g_replayDone)
+		usleep(1e5);
+	auto queued = []() {
+		size_t n = 0;
+		for (auto &q : g_dataqueues)
+			n += q.first->size_approx();
+		return n;
+	};
+	while (!g_die && queued() > 0)
+		usleep(1e4);
+	usleep(2e5);	// for the sorters and writers
+	g_die = true;
+}
+
+void pipelineJoin(vector<thread> &threads)
+{
+#ifdef JACK
+	jackClose(0);
+#endif
+	for (auto &thread : threads) {
+		thread.join();
+	}
+	threads.clear();
+}
+
+void pipelineReport(ReplaySource *r)
+{
+	double secs = r->samplesRead() / r->samplingRate();
+	double wall = r->elapsed();
+	printf("replayed %.2f s of data in %.2f s (%.2fx real time)\n",
+	       secs, wall, wall > 0 ? secs / wall : 0.0);
+	g_latmon.update();
+	printf("%s", g_latmon.table().c_str());
+}
+
+void pipelineFree()
+{
+	// these should automatically be closed when their destructor is called
+	// however it should be safe to manually close after their thread is
+	// joined and finished
+	delete g_sortpool; // joins the sorting threads
+	g_sortpool = nullptr;
+
+	g_spikewriter.close();
+	g_icmswriter.close();
+	g_analogwriter_prefilter.close();
+	g_analogwriter_postfilter.close();
+
+	for (auto &q : g_dataqueues) {
+		delete q.first;
+		// q.second is deleted when the po8e_conf object is destructed
+	}
+	g_dataqueues.clear();
+	for (auto &pool : g_datapools) {
+		delete pool; // frees blocks still sitting in the data queues
+	}
+	g_datapools.clear();
+
+	// clean out our standard vectors
+	for (auto &o : g_sc)
+		delete o;
+	g_sc.clear();
+	delete g_artifactEngine;
+	g_artifactEngine = nullptr;
+	mat *X;
+	while (g_filterbuf.try_dequeue(X))
+		delete X;
+	while (g_filterfree.try_dequeue(X))
+		delete X;
+	for (auto &o : g_templates)
+		delete o;
+	g_templates.clear();
+	s_decode.close();
+	delete g_decoder;
+	g_decoder = nullptr;
+	s_binned.close();
+	for (auto &o : g_fr)
+		delete o;
+	g_fr.clear();
+	delete g_bandpass;
+	delete g_lopass;
+	delete g_hipass;
+	g_bandpass = g_lopass = g_hipass = nullptr;
+}
+
+string pipelineInfo()
+{
+	string s = g_ts.getInfo();
+	char str[256];
+	snprintf(str, 256, "\npo8e poll (avg): %.4Lf (ms)\n", g_po8eAvgInterval);
+	s += string(str);
+	// everything the data path had to allocate past its pools
+	u64 allocs = g_workerAllocs;
+	for (auto &pool : g_datapools) {
+		allocs += pool->allocs();
+	}
+	allocs += g_spikewriter.allocs();
+	allocs += g_icmswriter.allocs();
+	allocs += g_analogwriter_prefilter.allocs();
+	allocs += g_analogwriter_postfilter.allocs();
+	snprintf(str, 256, "data path allocs: %lu\n", allocs);
+	s += string(str);
+	u64 overruns = 0;
+	u64 lost = 0;
+	for (auto &c : g_sc) {
+		overruns += c->m_spkbuf.overruns();
+		lost += c->m_spkbuf.lost();
+	}
+	snprintf(str, 256, "spike buffer overruns: %lu (%lu samples)\n",
+	         overruns, lost);
+	s += string(str);
+	if (s_binned.isOpen()) {
+		snprintf(str, 256, "binned: %lu frames at %.1f Hz, %lu late\n",
+		         s_binned.head(), s_binned.binRate(), (u64)s_binLate);
+		s += string(str);
+	}
+	if (g_decoder)
+		s += g_decoder->info();
+	s += rtInfo();
+	if (g_sortpool) {
+		snprintf(str, 256, "sort: %zu threads, %zu shards, %.1f%% stolen\n",
+		         g_sortpool->numThreads(), g_sortpool->numShards(),
+		         100.0*g_sortpool->stolenFraction());
+		s += string(str);
+	}
+	if (g_nlms && g_trainArtifactNLMS) {
+		size_t b = g_nlms->getBlock();
+		snprintf(str, 256, "nlms: %zu threads, %s%s, backlog %zu blocks\n",
+		         g_nlms->numThreads(), b > 1 ? "block " : "per sample",
+		         b > 1 ? to_string(b).c_str() : "", g_filterbuf.size_approx());
+		s += string(str);
+	}
+	return s;
+}
@@ -1,6 +1,8 @@
 #include <boost/tokenizer.hpp>
-#include "util.h"
 #include "po8e_conf.h"
+#include "util.h"
+#include "decoder.h"
+#include "rtsched.h"
 
 using namespace std;
 using namespace boost;
@@ -74,6 +76,245 @@ size_t po8eConf::readSize()
 	lua_pop(L, 1);
 	return read_size;
 }
+// number of spike sorting threads. 0 sorts on the worker thread.
+size_t po8eConf::sortThreads()
+{
+	int n = 2; // reasonable default
+	lua_getglobal(L, "sort_threads");
+	if (lua_isnumber(L, -1)) {
+		n = (int)lua_tointeger(L, -1);
+	}
+	if (n < 0) {
+		n = 0;
+	}
+	lua_pop(L, 1);
+	return (size_t)n;
+}
+// threads compressing chunks, per analog writer. 0 compresses on the
+// writer thread.
+size_t po8eConf::compressThreads()
+{
+	int n = 2; // reasonable default
+	lua_getglobal(L, "compress_threads");
+	if (lua_isnumber(L, -1)) {
+		n = (int)lua_tointeger(L, -1);
+	}
+	if (n < 0) {
+		n = 0;
+	}
+	lua_pop(L, 1);
+	return (size_t)n;
+}
+// threads training the artifact nlms filter. 0 trains on its own thread.
+size_t po8eConf::nlmsThreads()
+{
+	int n = 2; // reasonable default
+	lua_getglobal(L, "nlms_threads");
+	if (lua_isnumber(L, -1)) {
+		n = (int)lua_tointeger(L, -1);
+	}
+	if (n < 0) {
+		n = 0;
+	}
+	lua_pop(L, 1);
+	return (size_t)n;
+}
+// where to dump the latency table every second; "" for nowhere
+string po8eConf::latencyLog()
+{
+	string fn;
+	lua_getglobal(L, "latency_log");
+	if (lua_isstring(L, -1)) {
+		fn = lua_tostring(L, -1);
+	}
+	lua_pop(L, 1);
+	return fn;
+}
+// sampling rate of the rig in Hz; def if not set
+double po8eConf::sampleRate(double def)
+{
+	double sr = def;
+	lua_getglobal(L, "sample_rate");
+	if (lua_isnumber(L, -1)) {
+		sr = (double)lua_tonumber(L, -1);
+	}
+	if (sr <= 0.0) {
+		sr = def;
+	}
+	lua_pop(L, 1);
+	return sr;
+}
+// binned rate frames per second in shared memory; 0 turns them off
+double po8eConf::binRate(double def)
+{
+	double r = def;
+	lua_getglobal(L, "bin_rate");
+	if (lua_isnumber(L, -1)) {
+		r = (double)lua_tonumber(L, -1);
+	}
+	if (r < 0.0) {
+		r = 0.0;
+	}
+	lua_pop(L, 1);
+	return r;
+}
+// filters.<name> = { order = n, low = hz, high = hz }
+// low alone is a highpass, high alone a lowpass, both a bandpass.
+// spec is left alone (and false returned) if the entry is missing.
+bool po8eConf::filterSpec(const char *name, ButterSpec &spec)
+{
+	bool ok = false;
+	lua_getglobal(L, "filters");
+	if (lua_istable(L, -1)) {
+		lua_getfield(L, -1, name);
+		if (lua_istable(L, -1)) {
+			ButterSpec s = spec;
+			double lo = 0.0;
+			double hi = 0.0;
+			lua_getfield(L, -1, "order");
+			if (lua_isnumber(L, -1))
+				s.order = (int)lua_tointeger(L, -1);
+			lua_pop(L, 1);
+			lua_getfield(L, -1, "low");
+			if (lua_isnumber(L, -1))
+				lo = (double)lua_tonumber(L, -1);
+			lua_pop(L, 1);
+			lua_getfield(L, -1, "high");
+			if (lua_isnumber(L, -1))
+				hi = (double)lua_tonumber(L, -1);
+			lua_pop(L, 1);
+			if (lo > 0.0 && hi > 0.0) {
+				s.type = BUTTER_BAND;
+				s.f1 = lo;
+				s.f2 = hi;
+				ok = true;
+			} else if (lo > 0.0) {
+				s.type = BUTTER_HIGH;
+				s.f1 = lo;
+				ok = true;
+			} else if (hi > 0.0) {
+				s.type = BUTTER_LOW;
+				s.f1 = hi;
+				ok = true;
+			}
+			if (ok)
+				spec = s;
+		}
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+	return ok;
+}
+// decoder = { type = "wiener"|"kalman"|"none", outputs = n, lags = n,
+//             units = n, ridge = x, refit = n }
+// fields left out keep spec's; false (spec alone) with no table or type none.
+bool po8eConf::decoderSpec(DecoderSpec &spec)
+{
+	DecoderSpec s = spec;
+	lua_getglobal(L, "decoder");
+	if (lua_istable(L, -1)) {
+		lua_getfield(L, -1, "type");
+		if (lua_isstring(L, -1)) {
+			string t = lua_tostring(L, -1);
+			if (t == "wiener")
+				s.type = DECODE_WIENER;
+			else if (t == "kalman")
+				s.type = DECODE_KALMAN;
+			else if (t == "none")
+				s.type = DECODE_NONE;
+			else
+				warn("decoder type %s? (wiener, kalman or none)", t.c_str());
+		}
+		lua_pop(L, 1);
+		lua_getfield(L, -1, "outputs");
+		if (lua_isnumber(L, -1))
+			s.nout = (int)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		lua_getfield(L, -1, "lags");
+		if (lua_isnumber(L, -1))
+			s.lags = (int)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		lua_getfield(L, -1, "units");
+		if (lua_isnumber(L, -1))
+			s.units = (int)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		lua_getfield(L, -1, "ridge");
+		if (lua_isnumber(L, -1))
+			s.ridge = (double)lua_tonumber(L, -1);
+		lua_pop(L, 1);
+		lua_getfield(L, -1, "refit");
+		if (lua_isnumber(L, -1))
+			s.refit = (int)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+	if (s.type == DECODE_NONE)
+		return false;
+	if (s.ridge < 0.0)
+		s.ridge = 0.0;
+	if (s.refit < 0)
+		s.refit = 0;
+	spec = s;
+	return true;
+}
+// threads.<role> = { cpus = "2-3", fifo = prio, nice = n, numa = node }
+// false, p alone, if the role has no entry.
+bool po8eConf::threadPolicy(const char *role, RtPolicy &p)
+{
+	bool ok = false;
+	lua_getglobal(L, "threads");
+	if (lua_istable(L, -1)) {
+		lua_getfield(L, -1, role);
+		if (lua_istable(L, -1)) {
+			RtPolicy s = p;
+			lua_getfield(L, -1, "cpus");
+			if (lua_isstring(L, -1))	// a number is a string to lua
+				s.cpus = lua_tostring(L, -1);
+			lua_pop(L, 1);
+			lua_getfield(L, -1, "fifo");
+			if (lua_isnumber(L, -1))
+				s.fifo = (int)lua_tointeger(L, -1);
+			lua_pop(L, 1);
+			lua_getfield(L, -1, "nice");
+			if (lua_isnumber(L, -1))
+				s.nice = (int)lua_tointeger(L, -1);
+			lua_pop(L, 1);
+			lua_getfield(L, -1, "numa");
+			if (lua_isnumber(L, -1))
+				s.numa = (int)lua_tointeger(L, -1);
+			lua_pop(L, 1);
+			p = s;
+			ok = true;
+		}
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+	return ok;
+}
+bool po8eConf::lockMemory(bool def)
+{
+	bool b = def;
+	lua_getglobal(L, "lock_memory");
+	if (lua_isboolean(L, -1)) {
+		b = lua_toboolean(L, -1);
+	}
+	lua_pop(L, 1);
+	return b;
+}
+// queue_spin.<name> = us; seconds out
+double po8eConf::queueSpin(const char *name, double def)
+{
+	double s = def;
+	lua_getglobal(L, "queue_spin");
+	if (lua_istable(L, -1)) {
+		lua_getfield(L, -1, name);
+		if (lua_isnumber(L, -1))
+			s = (double)lua_tonumber(L, -1) * 1e-6;
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+	return s > 0.0 ? s : 0.0;
+}
 // allocates memory
 po8e::card *po8eConf::loadCard(size_t idx)
 {
@@ -0,0 +1,77 @@
+#include <string.h>
+#include "util.h"
+#include "po8e_pool.h"
+
+PO8DataPool::PO8DataPool(size_t nblocks, size_t nchan, size_t nsamp)
+{
+	m_nchan = nchan;
+	m_nsamp = nsamp;
+	// twice the blocks, so overflow blocks can rejoin the pool
+	m_free = new ReaderWriterQueue<PO8Data *>(2*nblocks);
+	m_all.reserve(2*nblocks);
+	for (size_t i=0; i<nblocks; i++) {
+		m_free->enqueue(alloc());
+	}
+	m_allocs = 0;
+}
+
+PO8DataPool::~PO8DataPool()
+{
+	// only safe once both the po8e thread and the worker are joined
+	delete m_free;
+	for (auto &o : m_all) {
+		delete[] (o->data);
+		delete o;
+	}
+	m_all.clear();
+}
+
+PO8Data *PO8DataPool::alloc()
+{
+	auto o = new PO8Data;
+	o->tick = 0;
+	o->numChannels = m_nchan;
+	o->numSamples = 0;
+	o->data = new i16[m_nchan*m_nsamp];
+	// touch it now, so the first reads into it don't fault
+	memset(o->data, 0, m_nchan*m_nsamp*sizeof(i16));
+	m_all.push_back(o);
+	return o;
+}
+
+PO8Data *PO8DataPool::get()
+{
+	PO8Data *o;
+	if (m_free->try_dequeue(o))
+		return o;
+	// the worker is behind; grow rather than drop data
+	m_allocs++;
+	return alloc();
+}
+
+void PO8DataPool::put(PO8Data *o)
+{
+	// if the free queue is full the block is simply retired;
+	// it is still freed in the destructor
+	m_free->try_enqueue(o);
+}
+
+size_t PO8DataPool::channels()
+{
+	return m_nchan;
+}
+
+size_t PO8DataPool::samples()
+{
+	return m_nsamp;
+}
+
+size_t PO8DataPool::available()
+{
+	return m_free->size_approx();
+}
+
+u64 PO8DataPool::allocs()
+{
+	return m_allocs;
+}
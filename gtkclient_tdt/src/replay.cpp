@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include "gettime.h"
+#include "h5filters.h"
+#include "replay.h"
+
+ReplaySource::ReplaySource()
+{
+	m_h5file = 0;
+	m_Dsamples = 0;
+	m_Dtk = 0;
+	m_nc = 0;
+	m_ns = 0;
+	m_sr = 0.0;
+	m_speed = 1.0;
+	m_loop = false;
+	m_bufPos = 0;
+	m_bufLen = 0;
+	m_pos = 0;
+	m_read = 0;
+	m_tkOffset = 0;
+	m_tkSpan = 0;
+	m_t0 = 0;
+	m_synth = false;
+	m_noise = 0.0;
+	m_spike = 0.0;
+	m_rate = 0.0;
+}
+ReplaySource::~ReplaySource()
+{
+	close();
+}
+
+bool ReplaySource::open(const char *fn)
+{
+	close();
+	h5filtersRegister();	// delta, lz4, zstd chunks
+	m_h5file = H5Fopen(fn, H5F_ACC_RDONLY, H5P_DEFAULT);
+	if (m_h5file < 0) {
+		m_h5file = 0;
+		warn("ReplaySource: could not open %s", fn);
+		return false;
+	}
+	if (H5Lexists(m_h5file, "/Analog/Samples", H5P_DEFAULT) <= 0) {
+		warn("ReplaySource: no /Analog/Samples in %s", fn);
+		close();
+		return false;
+	}
+	m_Dsamples = H5Dopen2(m_h5file, "/Analog/Samples", H5P_DEFAULT);
+	hid_t sp = H5Dget_space(m_Dsamples);
+	hsize_t dims[2] = {0, 0};
+	int rank = H5Sget_simple_extent_dims(sp, dims, NULL);
+	H5Sclose(sp);
+	if (rank != 2 || dims[0] == 0 || dims[1] == 0) {
+		warn("ReplaySource: %s has no samples", fn);
+		close();
+		return false;
+	}
+	m_nc = dims[0];
+	m_ns = dims[1];
+
+	hid_t g = H5Gopen2(m_h5file, "/Analog", H5P_DEFAULT);
+	if (H5Aexists(g, "Sampling Rate") > 0) {
+		hid_t a = H5Aopen(g, "Sampling Rate", H5P_DEFAULT);
+		H5Aread(a, H5T_NATIVE_DOUBLE, &m_sr);
+		H5Aclose(a);
+	}
+	H5Gclose(g);
+
+	// the ticks, if they were saved: only the ends are needed up front
+	if (H5Lexists(m_h5file, "/Analog/Ticks", H5P_DEFAULT) > 0) {
+		m_Dtk = H5Dopen2(m_h5file, "/Analog/Ticks", H5P_DEFAULT);
+		i64 ends[2] = {0, 0};
+		hsize_t offset[1] = {0};
+		hsize_t count[1] = {1};
+		hsize_t mdims[1] = {1};
+		hid_t mem = H5Screate_simple(1, mdims, NULL);
+		for (int i=0; i<2; i++) {
+			offset[0] = i == 0 ? 0 : m_ns-1;
+			hid_t fs = H5Dget_space(m_Dtk);
+			H5Sselect_hyperslab(fs, H5S_SELECT_SET, offset, NULL, count, NULL);
+			if (H5Dread(m_Dtk, H5T_NATIVE_INT64, mem, fs, H5P_DEFAULT, &ends[i]) < 0) {
+				warn("ReplaySource: could not read the ticks; counting samples");
+				H5Dclose(m_Dtk);
+				m_Dtk = 0;
+				H5Sclose(fs);
+				break;
+			}
+			H5Sclose(fs);
+		}
+		H5Sclose(mem);
+		m_tkSpan = m_Dtk ? ends[1] - ends[0] + 1 : (i64)m_ns;
+	} else {
+		m_tkSpan = m_ns;
+	}
+
+	m_buf.assign(m_nc*REPLAY_READ, 0);
+	m_bufTk.assign(REPLAY_READ, 0);
+	m_bufPos = 0;
+	m_bufLen = 0;
+	return true;
+}
+
+void ReplaySource::synth(size_t nc, double sr, double seconds, u32 seed)
+{
+	close();
+	m_synth = true;
+	m_nc = nc;
+	m_sr = sr;
+	m_ns = seconds > 0 ? (size_t)(seconds * sr) : 0;
+	m_tkSpan = m_ns;
+	m_rng.seed(seed);
+	m_noise = 200.0;
+	m_spike = 1500.0;
+	m_rate = 10.0;
+	m_next.assign(nc, 0);
+	exponential_distribution<double> isi(m_rate / m_sr);
+	for (auto &n : m_next)
+		n = (size_t)isi(m_rng);
+	m_buf.assign(m_nc*REPLAY_READ, 0);
+	m_bufTk.assign(REPLAY_READ, 0);
+}
+
+void ReplaySource::close()
+{
+	if (m_Dtk)
+		H5Dclose(m_Dtk);
+	if (m_Dsamples)
+		H5Dclose(m_Dsamples);
+	if (m_h5file)
+		H5Fclose(m_h5file);
+	m_h5file = m_Dsamples = m_Dtk = 0;
+	m_synth = false;
+	m_nc = 0;
+	m_ns = 0;
+	m_sr = 0.0;
+	m_bufPos = m_bufLen = 0;
+	m_pos = m_read = 0;
+	m_tkOffset = 0;
+	m_t0 = 0;
+}
+
+void ReplaySource::setSpeed(double speed)
+{
+	m_speed = speed > 0 ? speed : 0.0;
+}
+
+void ReplaySource::setLoop(bool loop)
+{
+	m_loop = loop;
+}
+
+// synthetic data need no looping; they just carry on
+bool ReplaySource::endless()
+{
+	return m_ns == 0 || (m_synth && m_loop);
+}
+
+size_t ReplaySource::remaining()
+{
+	if (m_nc == 0)
+		return 0;
+	if (m_loop || endless())
+		return SIZE_MAX;
+	return m_ns - m_pos;
+}
+
+size_t ReplaySource::samplesReady(bool *stopped)
+{
+	size_t rem = remaining();
+	if (stopped)
+		*stopped = rem == 0;
+	if (rem == 0)
+		return 0;
+	if (m_t0 == 0)
+		m_t0 = gettime();
+	if (m_speed <= 0 || m_sr <= 0)
+		return rem;
+	double due = (double)(gettime() - m_t0) * m_sr * m_speed;
+	if (due <= (double)m_read)
+		return 0;
+	double n = due - (double)m_read;
+	return n < (double)rem ? (size_t)n : rem;
+}
+
+size_t ReplaySource::readBlock(i16 *data, size_t n, i64 *tick)
+{
+	size_t k = 0;
+	while (k < n) {
+		if (m_pos < m_bufPos || m_pos >= m_bufPos + m_bufLen) {
+			if (!endless() && m_pos >= m_ns) {
+				if (!m_loop)
+					break;
+				m_pos = 0;
+				m_tkOffset += m_tkSpan;
+			}
+			if (!fill())
+				break;
+		}
+		size_t j = m_pos - m_bufPos;
+		size_t len = m_bufLen - j;
+		if (len > n - k)
+			len = n - k;
+		for (size_t c=0; c<m_nc; c++) {
+			memcpy(&data[c*n + k], &m_buf[c*m_bufLen + j], len*sizeof(i16));
+		}
+		for (size_t i=0; i<len; i++) {
+			tick[k+i] = m_bufTk[j+i] + m_tkOffset;
+		}
+		k += len;
+		m_pos += len;
+		m_read += len;
+	}
+	return k;
+}
+
+double ReplaySource::elapsed()
+{
+	return m_t0 == 0 ? 0.0 : (double)(gettime() - m_t0);
+}
+
+bool ReplaySource::fill()
+{
+	m_bufPos = m_pos;
+	m_bufLen = REPLAY_READ;
+	if (!endless() && m_ns - m_pos < m_bufLen)
+		m_bufLen = m_ns - m_pos;
+	if (m_synth) {
+		fillSynth();
+		return true;
+	}
+	if (!fillFile()) {
+		m_bufLen = 0;
+		return false;
+	}
+	return true;
+}
+
+// whole chunks in time, all channels, in one read
+bool ReplaySource::fillFile()
+{
+	hsize_t offset[2] = {0, m_bufPos};
+	hsize_t count[2] = {m_nc, m_bufLen};
+	hid_t fs = H5Dget_space(m_Dsamples);
+	H5Sselect_hyperslab(fs, H5S_SELECT_SET, offset, NULL, count, NULL);
+	hid_t mem = H5Screate_simple(2, count, NULL);
+	herr_t err = H5Dread(m_Dsamples, H5T_NATIVE_INT16, mem, fs, H5P_DEFAULT,
+	                     &m_buf[0]);
+	H5Sclose(mem);
+	H5Sclose(fs);
+	if (err < 0) {
+		warn("ReplaySource: read of %zu samples at %zu failed",
+		     m_bufLen, m_bufPos);
+		return false;
+	}
+
+	if (m_Dtk) {
+		hsize_t toff[1] = {m_bufPos};
+		hsize_t tcount[1] = {m_bufLen};
+		fs = H5Dget_space(m_Dtk);
+		H5Sselect_hyperslab(fs, H5S_SELECT_SET, toff, NULL, tcount, NULL);
+		mem = H5Screate_simple(1, tcount, NULL);
+		err = H5Dread(m_Dtk, H5T_NATIVE_INT64, mem, fs, H5P_DEFAULT,
+		              &m_bufTk[0]);
+		H5Sclose(mem);
+		H5Sclose(fs);
+		if (err >= 0)
+			return true;
+		warn("ReplaySource: tick read failed; counting samples");
+		H5Dclose(m_Dtk);
+		m_Dtk = 0;
+	}
+	for (size_t i=0; i<m_bufLen; i++)
+		m_bufTk[i] = (i64)(m_bufPos + i);
+	return true;
+}
+
+// a negative peak and a slower positive rebound, peak -1
+static float spikeShape(size_t j)
+{
+	double a = ((double)j - 8.0) / 2.5;
+	double b = ((double)j - 16.0) / 5.0;
+	return (float)(-exp(-a*a) + 0.35*exp(-b*b));
+}
+
+void ReplaySource::fillSynth()
+{
+	static float shape[REPLAY_SPIKE_LEN];
+	static bool init = false;
+	if (!init) {
+		for (size_t j=0; j<REPLAY_SPIKE_LEN; j++)
+			shape[j] = spikeShape(j);
+		init = true;
+	}
+	normal_distribution<float> noise(0.f, (float)m_noise);
+	exponential_distribution<double> isi(m_rate / m_sr);
+	size_t end = m_bufPos + m_bufLen;
+	for (size_t c=0; c<m_nc; c++) {
+		i16 *x = &m_buf[c*m_bufLen];
+		for (size_t k=0; k<m_bufLen; k++)
+			x[k] = (i16)lrintf(noise(m_rng));
+		// spikes may start in the last buffer and run into this one
+		size_t &next = m_next[c];
+		while (next < end) {
+			for (size_t j=0; j<REPLAY_SPIKE_LEN; j++) {
+				size_t k = next + j;
+				if (k >= m_bufPos && k < end)
+					x[k - m_bufPos] += (i16)lrintf(m_spike * shape[j]);
+			}
+			if (next + REPLAY_SPIKE_LEN > end)
+				break;	// finish it next time
+			next += REPLAY_SPIKE_LEN + (size_t)isi(m_rng);
+		}
+	}
+	for (size_t i=0; i<m_bufLen; i++)
+		m_bufTk[i] = (i64)(m_bufPos + i);
+}
@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include "gettime.h"
+#include "rtsched.h"
+
+#define RT_STACK	(256*1024)	// prefaulted per thread once memory is locked
+#define RT_INFO_EVERY	1.0			// seconds; rtInfo() measures over no less
+
+const char *rtRoleName(int role)
+{
+	static const char *names[RT_NUM] = {
+		"acquire",
+		"worker",
+		"sort",
+		"binned",
+		"nlms",
+		"writer",
+		"service",
+		"gui",
+	};
+	if (role < 0 || role >= RT_NUM)
+		return "?";
+	return names[role];
+}
+
+struct RtThread {
+	int		role;
+	pid_t	tid;
+	string	name;
+	u64		ticks;		// utime + stime at the last rtInfo()
+	u64		invol;		// nonvoluntary_ctxt_switches, likewise
+};
+
+static std::mutex s_mtx;
+static RtPolicy s_policy[RT_NUM];
+static bool s_configured = false;	// leave threads alone until something is
+static bool s_locked = false;
+static bool s_warned[RT_NUM];
+static cpu_set_t s_startCpus;	// the process's, for roles with none
+static vector<RtThread> s_threads;
+static double s_lastInfo = 0.0;
+static string s_info;		// rtInfo()'s, until it is due again
+
+static void startCpus()
+{
+	static std::once_flag once;
+	std::call_once(once, [] {
+		CPU_ZERO(&s_startCpus);
+		if (sched_getaffinity(0, sizeof(s_startCpus), &s_startCpus) < 0) {
+			for (int i=0; i<CPU_SETSIZE; i++)
+				CPU_SET(i, &s_startCpus);
+		}
+	});
+}
+
+// "0-3,8,10-11"; false if it doesn't parse
+static bool parseCpus(const string &s, cpu_set_t &set)
+{
+	CPU_ZERO(&set);
+	const char *p = s.c_str();
+	bool any = false;
+	while (*p) {
+		char *e;
+		long a = strtol(p, &e, 10);
+		if (e == p || a < 0 || a >= CPU_SETSIZE)
+			return false;
+		long b = a;
+		p = e;
+		if (*p == '-') {
+			b = strtol(p+1, &e, 10);
+			if (e == p+1 || b < a || b >= CPU_SETSIZE)
+				return false;
+			p = e;
+		}
+		for (long i=a; i<=b; i++)
+			CPU_SET(i, &set);
+		any = true;
+		while (*p == ',' || *p == ' ')
+			p++;
+	}
+	return any;
+}
+
+static string nodeCpus(int node)
+{
+	char fn[128];
+	snprintf(fn, 128, "/sys/devices/system/node/node%d/cpulist", node);
+	FILE *f = fopen(fn, "r");
+	if (!f)
+		return string();
+	char buf[256] = {0};
+	if (!fgets(buf, sizeof(buf), f))
+		buf[0] = 0;
+	fclose(f);
+	buf[strcspn(buf, "\n")] = 0;
+	return string(buf);
+}
+
+void rtSetPolicy(int role, const RtPolicy &p)
+{
+	if (role < 0 || role >= RT_NUM)
+		return;
+	startCpus();
+	std::lock_guard<std::mutex> lock(s_mtx);
+	s_policy[role] = p;
+	s_configured = true;
+	char cpus[64];
+	snprintf(cpus, 64, "cpus %s", p.cpus.empty() ? "any" : p.cpus.c_str());
+	if (p.fifo > 0)
+		printf("%s threads:\t%s, fifo %d", rtRoleName(role), cpus, p.fifo);
+	else
+		printf("%s threads:\t%s, nice %d", rtRoleName(role), cpus, p.nice);
+	if (p.numa >= 0)
+		printf(", numa node %d", p.numa);
+	printf("\n");
+}
+
+bool rtLockMemory()
+{
+	// freed memory stays in the heap, locked, rather than going back to
+	// the kernel and faulting in again on the next allocation
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+		warn("mlockall: %s (raise ulimit -l, or CAP_IPC_LOCK); "
+		     "memory is not locked", strerror(errno));
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(s_mtx);
+	s_locked = true;
+	printf("memory:\t\t\tlocked\n");
+	return true;
+}
+
+// fault in n bytes now, so first use doesn't
+static void rtPrefault(void *p, size_t n)
+{
+	volatile char *c = (volatile char *)p;
+	long pg = sysconf(_SC_PAGESIZE);
+	for (size_t i=0; i<n; i+=pg)
+		c[i] = c[i];
+	if (n > 0)
+		c[n-1] = c[n-1];
+}
+
+static void prefaultStack()
+{
+	volatile char buf[RT_STACK];
+	rtPrefault((void *)buf, RT_STACK);
+}
+
+void rtEnter(int role, const char *name)
+{
+	if (role < 0 || role >= RT_NUM)
+		return;
+	startCpus();
+	pid_t tid = (pid_t)syscall(SYS_gettid);
+	if (name)
+		pthread_setname_np(pthread_self(), name);
+	RtPolicy p;
+	bool configured, locked;
+	{
+		std::lock_guard<std::mutex> lock(s_mtx);
+		RtThread t = {role, tid, name ? name : rtRoleName(role), 0, 0};
+		s_threads.push_back(t);
+		p = s_policy[role];
+		configured = s_configured;
+		locked = s_locked;
+	}
+	if (locked)
+		prefaultStack();
+	if (!configured)
+		return;
+
+	// set everything explicitly: a thread inherits its creator's cpus and
+	// policy, which may be another role's
+	vector<string> problems;
+	string cpus = p.cpus;
+	if (cpus.empty() && p.numa >= 0)
+		cpus = nodeCpus(p.numa);
+	cpu_set_t set;
+	if (cpus.empty()) {
+		set = s_startCpus;
+	} else if (!parseCpus(cpus, set)) {
+		problems.push_back("cpus \"" + cpus + "\" does not parse");
+		set = s_startCpus;
+	}
+	int r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (r != 0)
+		problems.push_back(string("affinity: ") + strerror(r));
+
+	if (p.numa >= 0) {
+		const int bits = 8*sizeof(unsigned long);
+		unsigned long mask[16] = {0};
+		if (p.numa < 16*bits) {
+			mask[p.numa / bits] |= 1ul << (p.numa % bits);
+			if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask,
+			            8*sizeof(mask)) < 0)
+				problems.push_back(string("numa: ") + strerror(errno));
+		}
+	}
+
+	sched_param sp;
+	memset(&sp, 0, sizeof(sp));
+	bool fifo = false;
+	if (p.fifo > 0) {
+		sp.sched_priority = min(p.fifo, sched_get_priority_max(SCHED_FIFO));
+		r = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+		if (r == 0)
+			fifo = true;
+		else
+			problems.push_back(string("SCHED_FIFO: ") + strerror(r) +
+			                   " (rtprio in limits.conf, or CAP_SYS_NICE)");
+	}
+	if (!fifo) {
+		sp.sched_priority = 0;
+		pthread_setschedparam(pthread_self(), SCHED_OTHER, &sp);
+		// per thread on linux, by tid
+		if (setpriority(PRIO_PROCESS, tid, p.nice) < 0 && p.nice < 0)
+			problems.push_back(string("nice: ") + strerror(errno));
+	}
+
+	if (!problems.empty()) {
+		std::lock_guard<std::mutex> lock(s_mtx);
+		if (!s_warned[role]) {
+			s_warned[role] = true;
+			string s;
+			for (auto &q : problems)
+				s += (s.empty() ? "" : "; ") + q;
+			warn("%s threads: %s", rtRoleName(role), s.c_str());
+		}
+	}
+}
+
+// utime + stime in clock ticks, and involuntary switches; false if the
+// thread has gone
+static bool threadStats(pid_t tid, u64 &ticks, u64 &invol)
+{
+	char fn[64];
+	char buf[1024];
+	snprintf(fn, 64, "/proc/self/task/%d/stat", tid);
+	FILE *f = fopen(fn, "r");
+	if (!f)
+		return false;
+	size_t n = fread(buf, 1, sizeof(buf)-1, f);
+	fclose(f);
+	buf[n] = 0;
+	// the name, in parens, may have spaces; fields count from after it
+	char *p = strrchr(buf, ')');
+	if (!p)
+		return false;
+	unsigned long ut = 0, st = 0;
+	if (sscanf(p+2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+	           &ut, &st) != 2)
+		return false;
+	ticks = ut + st;
+	invol = 0;
+	snprintf(fn, 64, "/proc/self/task/%d/status", tid);
+	f = fopen(fn, "r");
+	if (!f)
+		return false;
+	while (fgets(buf, sizeof(buf), f)) {
+		unsigned long v;
+		if (sscanf(buf, "nonvoluntary_ctxt_switches: %lu", &v) == 1)
+			invol = v;
+	}
+	fclose(f);
+	return true;
+}
+
+string rtInfo()
+{
+	std::lock_guard<std::mutex> lock(s_mtx);
+	double now = (double)gettime();
+	double dt = now - s_lastInfo;
+	bool first = s_lastInfo == 0.0;
+	// cpu time comes in clock ticks (10 ms), and the gui asks at 30 Hz:
+	// measure over a second at least, and spare it the /proc reads between
+	if (!first && dt < RT_INFO_EVERY)
+		return s_info;
+	s_lastInfo = now;
+	double hz = (double)sysconf(_SC_CLK_TCK);
+	int nthreads[RT_NUM] = {0};
+	u64 ticks[RT_NUM] = {0};
+	u64 invol[RT_NUM] = {0};
+	for (auto &t : s_threads) {
+		u64 tk, iv;
+		if (!threadStats(t.tid, tk, iv))
+			continue;
+		nthreads[t.role]++;
+		ticks[t.role] += tk - t.ticks;
+		invol[t.role] += iv - t.invol;
+		t.ticks = tk;
+		t.invol = iv;
+	}
+	string s;
+	char str[256];
+	for (int r=0; r<RT_NUM; r++) {
+		if (nthreads[r] == 0)
+			continue;
+		if (first || dt <= 0.0)
+			snprintf(str, 256, "%s: %d threads\n", rtRoleName(r),
+			         nthreads[r]);
+		else
+			snprintf(str, 256, "%s: %d threads, %.0f%% cpu, "
+			         "%lu involuntary switches\n", rtRoleName(r),
+			         nthreads[r], 100.0 * ticks[r] / hz / dt, invol[r]);
+		s += string(str);
+	}
+	s_info = s;
+	return s;
+}
@@ -0,0 +1,150 @@
+#include "sortpool.h"
+#include "rtsched.h"
+
+SortPool::SortPool(size_t nchan, size_t nthreads, size_t nshards, SortFn fn)
+{
+	m_fn = fn;
+	m_nthreads = nthreads;
+	m_gen = 0;
+	m_die = false;
+	m_lat = nullptr;
+	m_dispatched = 0;
+
+	if (nshards > nchan)
+		nshards = nchan;
+	if (nshards < 1)
+		nshards = 1;
+
+	for (size_t s=0; s<nshards; s++) {
+		auto o = new Shard;
+		o->pending = false;
+		o->busy = false;
+		o->runs = 0;
+		o->stolen = 0;
+		m_shards.push_back(o);
+	}
+	// interleave, so neighbouring (similarly busy) channels spread out
+	for (size_t ch=0; ch<nchan; ch++) {
+		m_shards[ch % nshards]->chans.push_back((int)ch);
+	}
+
+	for (size_t i=0; i<m_nthreads; i++) {
+		m_threads.push_back(thread(&SortPool::run, this, i));
+	}
+}
+
+SortPool::~SortPool()
+{
+	{
+		lock_guard<mutex> lock(m_mtx);
+		m_die = true;
+	}
+	m_cv.notify_all();
+	for (auto &t : m_threads) {
+		t.join();
+	}
+	for (auto &o : m_shards) {
+		delete o;
+	}
+	m_shards.clear();
+}
+
+void SortPool::dispatch()
+{
+	if (m_lat)
+		m_dispatched = latNow();
+	for (auto &o : m_shards) {
+		o->pending = true;
+	}
+	if (m_nthreads == 0) {
+		for (size_t s=0; s<m_shards.size(); s++) {
+			tryRun(s, 0);
+		}
+		return;
+	}
+	{
+		lock_guard<mutex> lock(m_mtx);
+		m_gen++;
+	}
+	m_cv.notify_all();
+}
+
+// returns true if we ran the shard
+bool SortPool::tryRun(size_t s, size_t id)
+{
+	auto o = m_shards[s];
+	if (!o->pending)
+		return false;
+	bool expected = false;
+	if (!o->busy.compare_exchange_strong(expected, true))
+		return false; // someone else has it
+	// clear pending before sorting: a dispatch that lands while
+	// we are running leaves it set, and the shard runs again
+	if (!o->pending.exchange(false)) {
+		o->busy = false;
+		return false;
+	}
+	for (auto &ch : o->chans) {
+		m_fn(ch, (int)s);
+	}
+	if (m_lat)
+		m_lat->since(m_dispatched);
+	o->runs++;
+	if (m_nthreads > 0 && s % m_nthreads != id)
+		o->stolen++;
+	o->busy = false; // release: the next owner sees our writes
+	return true;
+}
+
+void SortPool::run(size_t id)
+{
+	rtEnter(RT_SORT, "sort");
+	u64 seen = 0;
+	size_t n = m_shards.size();
+	while (!m_die) {
+		{
+			unique_lock<mutex> lock(m_mtx);
+			m_cv.wait(lock, [&] { return m_gen != seen || m_die; });
+			seen = m_gen;
+		}
+		bool did;
+		do {
+			did = false;
+			// home shards first
+			for (size_t s=id; s<n; s+=m_nthreads) {
+				did |= tryRun(s, id);
+			}
+			// then help whoever is behind
+			for (size_t s=0; s<n; s++) {
+				if (s % m_nthreads != id)
+					did |= tryRun(s, id);
+			}
+		} while (did && !m_die);
+	}
+}
+
+void SortPool::setLatency(LatencyHist *h)
+{
+	m_lat = h;
+}
+
+size_t SortPool::numShards()
+{
+	return m_shards.size();
+}
+
+size_t SortPool::numThreads()
+{
+	return m_nthreads;
+}
+
+double SortPool::stolenFraction()
+{
+	u64 runs = 0;
+	u64 stolen = 0;
+	for (auto &o : m_shards) {
+		runs += o->runs;
+		stolen += o->stolen;
+	}
+	return runs > 0 ? (double)stolen / (double)runs : 0.0;
+}
@@ -32,6 +32,9 @@ SpikeBuffer::SpikeBuffer()
 {
 	m_w = 0;
 	m_r = 0;
+	m_neoMean = 0.f;
+	m_overruns = 0;
+	m_lost = 0;
 }
 
 SpikeBuffer::~SpikeBuffer()
@@ -40,70 +43,156 @@ SpikeBuffer::~SpikeBuffer()
 
 bool SpikeBuffer::addSample(u32 _tk, float _wf)
 {
-	long w = m_w; // atomic;
+	long w = m_w.load(std::memory_order_relaxed); // we are the only writer
+	long i = w & SPIKE_MASK;
+	float y = neof.eval(_wf);
 
-	m_tk[w & SPIKE_MASK] = _tk;
-	m_wf[w & SPIKE_MASK] = _wf;
-	m_neo[w & SPIKE_MASK] = neof.eval(_wf);
-	w++;
+	m_tk[i] = m_tk[i+SPIKE_BUF_SIZE] = _tk;
+	m_wf[i] = m_wf[i+SPIKE_BUF_SIZE] = _wf;
+	m_neo[i] = m_neo[i+SPIKE_BUF_SIZE] = y;
+	// a plain store, not an xchg per sample: the reader only scales its
+	// threshold by it, and any recent mean will do
+	m_neoMean.store(neof.mean(), std::memory_order_relaxed);
 
-	m_w = w; // atomic
+	m_w.store(w+1, std::memory_order_release); // publishes the sample
 
 	return true;
 }
-bool SpikeBuffer::getSpike(u32 *tk, float *wf, float *neo, int n, float threshold, int alignment, int pre_emphasis)
+
+// detection signal for each pre-emphasis
+template <int E> static inline float emph(const float *wf, const float *neo, long i);
+template <> inline float emph<EMPHASIS_NONE>(const float *wf, const float *, long i)
+{
+	return wf[i];
+}
+template <> inline float emph<EMPHASIS_ABS>(const float *wf, const float *, long i)
 {
+	return fabsf(wf[i]);
+}
+template <> inline float emph<EMPHASIS_NEO>(const float *, const float *neo, long i)
+{
+	return neo[i];
+}
 
+template <int E>
+int SpikeBuffer::getSpikes(u32 *tk, float *wf, float *neo, int n, float threshold,
+                           int alignment, int max)
+{
 	if (alignment >= n) {
 		fprintf(stderr,"ERROR: (Spikebuffer) wf alignment greater than wf length!\n");
-		return false;
+		return 0;
+	}
+	if (n > SPIKE_BUF_SIZE - SPIKE_SLACK)
+		return 0;
+
+	float thr;
+	switch (E) {
+	case EMPHASIS_NEO:
+		thr = threshold * m_neoMean.load(std::memory_order_relaxed);
+		break;
+	case EMPHASIS_ABS:
+		thr = fabs(threshold);
+		break;
+	default:
+		thr = threshold;
+	}
+	// fold the sign in, so the test is the same for both directions:
+	// thr > 0: a <= thr && b > thr; thr < 0: a >= thr && b < thr.
+	float sgn = thr > 0 ? 1.f : -1.f;
+	thr *= sgn;
+
+	long w = m_w.load(std::memory_order_acquire);
+	long r = m_r.load(std::memory_order_relaxed); // we are the only reader
+
+	if (w - r > SPIKE_BUF_SIZE - SPIKE_SLACK) {
+		// the writer lapped us, or is about to: skip to recent data
+		long nr = w - SPIKE_BUF_SIZE/2;
+		m_lost += nr - r;
+		m_overruns++;
+		r = nr;
 	}
 
-	float a, b, thr;
-
-	long w = m_w;   // atomic
-
-	// as long as there is space in the buffer for a whole wf
-	while (m_r < (w-n)) {
-
-		long x = m_r  + alignment;
-
-		switch (pre_emphasis) {
-		case 2:
-			a = m_neo[(x  ) & SPIKE_MASK];
-			b = m_neo[(x+1) & SPIKE_MASK];
-			thr = threshold * neof.mean();
-			break;
-		case 1:
-			a = fabs(m_wf[(x  ) & SPIKE_MASK]);
-			b = fabs(m_wf[(x+1) & SPIKE_MASK]);
-			thr = fabs(threshold);
-			break;
-		case 0:
-		default:
-			a = m_wf[(x  ) & SPIKE_MASK];
-			b = m_wf[(x+1) & SPIKE_MASK];
-			thr = threshold;
-		}
+	// candidate crossings are (x, x+1) with x = r+alignment, for r < w-n
+	long len = w - n - r;
+	if (len <= 0)
+		return 0;
+	if (thr == 0.f) { // nothing can cross; keep up with the writer
+		m_r.store(r+len, std::memory_order_release);
+		return 0;
+	}
 
-		if ((thr > 0 && (a <= thr && b > thr))
-		    || (thr < 0 && (a >= thr && b < thr))) {
+	// contiguous view of [r, r+len+n) thanks to the mirror
+	long base = r & SPIKE_MASK;
+	const float *pwf = &m_wf[base + alignment];
+	const float *pneo = &m_neo[base + alignment];
+	u8 *cross = m_cross;
+	// branch-free, so it vectorizes; crossings are rare, so
+	// finding the set flags afterwards is cheap
+	for (long i=0; i<len; i++) {
+		float a = sgn * emph<E>(pwf, pneo, i);
+		float b = sgn * emph<E>(pwf, pneo, i+1);
+		cross[i] = (a <= thr) & (b > thr);
+	}
 
-			for (int i=0; i<n; i++) {
-				tk[i] 	= m_tk[(m_r+i) & SPIKE_MASK];
-				wf[i] 	= m_wf[(m_r+i) & SPIKE_MASK];
-				neo[i] 	= m_neo[(m_r+i) & SPIKE_MASK];
-			}
-			m_r+=n; // atomic
-			return true;
+	int nsp = 0;
+	long i = 0;
+	while (i < len && nsp < max) {
+		if (!cross[i]) {
+			i++;
+			continue;
+		}
+		long s = base + i;
+		for (int j=0; j<n; j++) {
+			tk[nsp*n+j] 	= m_tk[s+j];
+			wf[nsp*n+j] 	= m_wf[s+j];
+			neo[nsp*n+j] 	= m_neo[s+j];
 		}
-		m_r++; // atomic
+		// if the writer got to this slot again while we copied, the
+		// waveform is torn; drop it (the resync above catches up)
+		long w2 = m_w.load(std::memory_order_acquire);
+		if (w2 - (r+i) < SPIKE_BUF_SIZE) {
+			nsp++;
+		}
+		i += n; // skip the rest of this spike
 	}
-	return false;
+	// i is past the last spike returned, or at the end of the scan
+	m_r.store(r+i, std::memory_order_release);
+	return nsp;
 }
+
+template int SpikeBuffer::getSpikes<EMPHASIS_NONE>(u32 *, float *, float *, int, float, int, int);
+template int SpikeBuffer::getSpikes<EMPHASIS_ABS>(u32 *, float *, float *, int, float, int, int);
+template int SpikeBuffer::getSpikes<EMPHASIS_NEO>(u32 *, float *, float *, int, float, int, int);
+
+int SpikeBuffer::getSpikes(u32 *tk, float *wf, float *neo, int n, float threshold,
+                           int alignment, int max, int pre_emphasis)
+{
+	switch (pre_emphasis) {
+	case EMPHASIS_NEO:
+		return getSpikes<EMPHASIS_NEO>(tk, wf, neo, n, threshold, alignment, max);
+	case EMPHASIS_ABS:
+		return getSpikes<EMPHASIS_ABS>(tk, wf, neo, n, threshold, alignment, max);
+	default:
+		return getSpikes<EMPHASIS_NONE>(tk, wf, neo, n, threshold, alignment, max);
+	}
+}
+
 float SpikeBuffer::capacity()
 {
-	return (float)1.f - (m_w-m_r)/SPIKE_BUF_SIZE;
+	long d = m_w - m_r;
+	if (d > SPIKE_BUF_SIZE)
+		d = SPIKE_BUF_SIZE;
+	return (float)d / (float)SPIKE_BUF_SIZE;
+}
+
+u64 SpikeBuffer::overruns()
+{
+	return m_overruns;
+}
+
+u64 SpikeBuffer::lost()
+{
+	return m_lost;
 }
 
 long SpikeBuffer::bytes()
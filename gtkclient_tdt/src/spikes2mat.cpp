@@ -1,4 +1,6 @@
 // program to convert gtkclient's stream-saved output to matlab files.
+// takes the old wfpak stream (.bin) or an H5SpikeWriter file (.h5),
+// either layout.
 
 #include <matio.h>                      // for matvar_t, Mat_VarCreate, etc
 #include <stdbool.h>                    // for true, false, bool
@@ -6,16 +8,86 @@
 #include <stdio.h>                      // for printf, fclose, feof, etc
 #include <stdlib.h>                     // for free, malloc, EXIT_FAILURE, etc
 #include <string.h>                     // for strncpy, strlen
+#include <vector>                       // for vector
 #include "gtkclient.h"                  // for NWFSAMP
 #include "wfwriter.h"                   // for wfpak
+#include "h5spikereader.h"              // for H5SpikeReader
 
 //#define _LARGEFILE_SOURCE enabled by default.
 #define _FILE_OFFSET_BITS 64
 
+// cells of wf, time and ticks, units x channels; cell {u+1, c} is
+// Unit u of Chan c.
+static int convert_h5(const char *fn, mat_t *mat)
+{
+	H5SpikeReader r;
+	if (!r.open(fn))
+		return EXIT_FAILURE;
+	size_t nc = r.channels();
+	size_t nu = r.units() + 1; // with unsorted
+	size_t nwf = r.nwf();
+	printf("%s layout, %zu channels, %zu units, %zu wf samples, %.2f Hz\n",
+	       r.isTable() ? "table" : "groups", nc, nu, nwf, r.samplingRate());
+
+	size_t dims[2], dims2[2];
+	dims[0] = nu;
+	dims[1] = nc;
+	matvar_t **wf_cell = (matvar_t **)malloc(nu*nc*sizeof(matvar_t *));
+	matvar_t **time_cell = (matvar_t **)malloc(nu*nc*sizeof(matvar_t *));
+	matvar_t **ticks_cell = (matvar_t **)malloc(nu*nc*sizeof(matvar_t *));
+	if (wf_cell == 0 || time_cell == 0 || ticks_cell == 0) {
+		printf("not enough memory. bummer.");
+		return EXIT_FAILURE;
+	}
+	std::vector<SpikeUnit> all;
+	if (!r.readAll(all)) {
+		printf("could not read %s\n", fn);
+		return EXIT_FAILURE;
+	}
+	size_t total = 0;
+	for (size_t index=0; index<all.size(); index++) {
+		auto &o = all[index];
+		size_t m = o.tk.size();
+		total += m;
+		dims2[0] = nwf;
+		dims2[1] = m;
+		wf_cell[index] = Mat_VarCreate
+		                 (NULL, MAT_C_SINGLE, MAT_T_SINGLE, 2, dims2,
+		                  m && nwf ? &o.wf[0] : NULL, 0);
+		dims2[0] = m;
+		dims2[1] = 1;
+		time_cell[index] = Mat_VarCreate
+		                   (NULL, MAT_C_DOUBLE, MAT_T_DOUBLE, 2, dims2,
+		                    m ? &o.ts[0] : NULL, 0);
+		ticks_cell[index] = Mat_VarCreate
+		                    (NULL, MAT_C_INT64, MAT_T_INT64, 2, dims2,
+		                     m ? &o.tk[0] : NULL, 0);
+		o = SpikeUnit(); // copied by matio; free as we go
+	}
+	printf("total %zu spikes\n", total);
+
+	matvar_t *cell_matvar = Mat_VarCreate
+	                        ("wf", MAT_C_CELL, MAT_T_CELL, 2, dims, wf_cell, 0);
+	Mat_VarWrite(mat, cell_matvar, MAT_COMPRESSION_NONE);
+	Mat_VarFree(cell_matvar);
+	free(wf_cell);
+	cell_matvar = Mat_VarCreate("time", MAT_C_CELL, MAT_T_CELL, 2, dims, time_cell, 0);
+	Mat_VarWrite(mat, cell_matvar, MAT_COMPRESSION_NONE);
+	Mat_VarFree(cell_matvar);
+	free(time_cell);
+	cell_matvar = Mat_VarCreate("ticks", MAT_C_CELL, MAT_T_CELL, 2, dims, ticks_cell, 0);
+	Mat_VarWrite(mat, cell_matvar, MAT_COMPRESSION_NONE);
+	Mat_VarFree(cell_matvar);
+	free(ticks_cell);
+
+	Mat_Close(mat);
+	return EXIT_SUCCESS;
+}
+
 int main(int argn, char **argc)
 {
 	if (argn != 3 && argn != 2) {
-		printf("usage: spikes2mat infile.dat outfile.mat\n");
+		printf("usage: spikes2mat infile.{bin,h5} outfile.mat\n");
 		printf(" or just: convert infile.dat\n");
 		return EXIT_FAILURE;
 	}
@@ -26,26 +98,33 @@ int main(int argn, char **argc)
 		return EXIT_FAILURE;
 	}
 	int nn = strlen(argc[1]);
-	if (nn < 5 || nn > 511) {
-		printf(" infile not .bin?\n");
+	if (nn < 4 || nn > 507) {
+		printf(" infile not .bin or .h5?\n");
 		fclose(in);
 		return EXIT_FAILURE;
 	}
 	char s[512];
 	if (argn == 2) {
+		// swap the extension for .mat
 		strncpy(s, argc[1], 512);
-		s[nn-3] = 'm';
-		s[nn-2] = 'a';
-		s[nn-1] = 't';
+		char *dot = strrchr(s, '.');
+		if (!dot || strchr(dot, '/'))
+			dot = s + nn;
+		strcpy(dot, ".mat");
 	} else {
-		strncpy(s, argc[2], 512);
+		strncpy(s, argc[2], 511);
+		s[511] = 0;
 	}
 	mat_t *mat = Mat_CreateVer(s, NULL, MAT_FT_MAT73);
 	if (!mat) {
-		printf("could not open for writing %s\n", argc[2]);
+		printf("could not open for writing %s\n", s);
 		fclose(in);
 		return EXIT_FAILURE;
 	}
+	if (H5Fis_hdf5(argc[1]) > 0) {
+		fclose(in);
+		return convert_h5(argc[1], mat);
+	}
 
 	//this is (for now) a two-stage process:
 	//have to scan through the file,
@@ -26,6 +26,7 @@ long double g_lastPo8eTime = 0.0;
 long double g_po8ePollInterval = 0.0;
 long double g_po8eAvgInterval = 0.0;
 int64_t g_tdtOffsetDiff = 0;
+FILE *g_trace = NULL;	// (time, ticks) per update, for clocksync_bench
 
 void destroy(int)
 {
@@ -151,11 +152,11 @@ void *po8_thread(void *)
 						printf("\nTDT Offset changed rel. ticks! old: %ld new %ld\n",
 						       g_tdtOffsetDiff, diff);
 					} else {
-						// also -- only accept stort-interval responses (ignore outliers..)
-						if (g_po8ePollInterval < g_po8eAvgInterval* 0.5) {
-							g_ts.update(time, ticks); //also updates the mmap file.
-							g_ts.m_dropped = (int)totalSamples - ticks;
-						}
+						// late reads are the estimator's to reject
+						g_ts.update(time, ticks); //also updates the mmap file.
+						g_ts.m_dropped = (int)totalSamples - ticks;
+						if (g_trace)
+							fprintf(g_trace, "%.9Lf %d\n", time, ticks);
 						g_running = true;
 					}
 					g_tdtOffsetDiff = diff;
@@ -171,12 +172,22 @@ void *po8_thread(void *)
 	return 0;
 }
 
-int main()
+int main(int argc, char **argv)
 {
 	(void) signal(SIGINT,destroy);
 
 	g_startTime = gettime();
 
+	if (argc > 1) {
+		g_trace = fopen(argv[1], "w");
+		if (!g_trace) {
+			perror(argv[1]);
+			return 1;
+		}
+		setvbuf(g_trace, NULL, _IOLBF, 0);	// the po8e thread isn't joined
+		printf("recording (time, ticks) to %s\n", argv[1]);
+	}
+
 	pid_t mypid = getpid();
 
 	PROCTAB *pr = openproc(PROC_FILLSTAT);
@@ -184,6 +195,7 @@ int main()
 	memset(&pr_info, 0, sizeof(pr_info));
 	while (readproc(pr, &pr_info) != NULL) {
 		if ((!strcmp(pr_info.cmd, "gtkclient")   ||
+		     !strcmp(pr_info.cmd, "gtkclientd")  ||
 		     !strcmp(pr_info.cmd, "timesync")) &&
 		    pr_info.tgid != mypid) {
 			printf("already running with pid: %d\n", pr_info.tgid);
@@ -207,9 +219,11 @@ int main()
 	while (!g_die) {
 		if (g_running) {
 			printf("%s", g_ts.getTime().c_str());
-			printf(" | ticks %d", g_ts.getTicks());
-			printf(" | slope %0.3Lf", g_ts.m_slope);
-			printf(" | offset %0.1Lf", g_ts.m_offset);
+			printf(" | ticks %ld", (long)g_ts.getTicks());
+			TimeMap m = g_ts.snapshot();
+			printf(" | slope %0.3f", m.slope);
+			printf(" | offset %0.1f", m.offset);
+			printf(" | error (us) %0.1f", m.error * 1e6);
 			printf(" | po8e (ms) %0.2f\r", (double)g_po8ePollInterval);
 			fflush(stdout);
 		}
@@ -0,0 +1,148 @@
+#include <math.h>
+#include <float.h>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+#include "tmatch.h"
+
+static int argmin(const float *score, int nt)
+{
+	int z = 0;
+	for (int u=1; u<nt; u++) {
+		if (score[u] < score[z])
+			z = u;
+	}
+	return z;
+}
+
+int tmatch_scalar(const float *wf, const float *templ, int nt, int nwf,
+                  int metric, float *score)
+{
+	for (int u=0; u<nt; u++) {
+		const float *t = &templ[u*nwf];
+		float s = 0.f;
+		if (metric == TMATCH_L1) {
+			for (int j=0; j<nwf; j++) {
+				s += fabsf(wf[j] - t[j]);
+			}
+		} else {
+			for (int j=0; j<nwf; j++) {
+				float r = wf[j] - t[j];
+				s += r*r;
+			}
+		}
+		score[u] = s / (float)nwf;
+	}
+	return argmin(score, nt);
+}
+
+#if defined(__AVX512F__)
+
+template <int M>
+static int tmatch_v(const float *wf, const float *templ, int nt, int nwf,
+                    float *score)
+{
+	__m512 acc[TMATCH_MAXT];
+	for (int u=0; u<nt; u++)
+		acc[u] = _mm512_setzero_ps();
+
+	for (int j=0; j<nwf; j+=16) {
+		// the last chunk is masked, so any nwf works
+		__mmask16 k = (nwf-j >= 16) ? (__mmask16)0xffff :
+		              (__mmask16)((1u << (nwf-j)) - 1);
+		__m512 x = _mm512_maskz_loadu_ps(k, wf+j);
+		for (int u=0; u<nt; u++) {
+			__m512 t = _mm512_maskz_loadu_ps(k, templ+u*nwf+j);
+			__m512 r = _mm512_sub_ps(x, t);
+			if (M == TMATCH_L1)
+				acc[u] = _mm512_add_ps(acc[u], _mm512_abs_ps(r));
+			else
+				acc[u] = _mm512_fmadd_ps(r, r, acc[u]);
+		}
+	}
+	float lane[16];
+	for (int u=0; u<nt; u++) {
+		_mm512_storeu_ps(lane, acc[u]);
+		float s = 0.f;
+		for (int i=0; i<16; i++)
+			s += lane[i];
+		score[u] = s / (float)nwf;
+	}
+	return argmin(score, nt);
+}
+
+const char *tmatch_isa()
+{
+	return "avx512";
+}
+
+#elif defined(__AVX2__) && defined(__FMA__)
+
+static inline float hsum(__m256 v)
+{
+	__m128 lo = _mm256_castps256_ps128(v);
+	__m128 hi = _mm256_extractf128_ps(v, 1);
+	lo = _mm_add_ps(lo, hi);
+	lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+	lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+	return _mm_cvtss_f32(lo);
+}
+
+template <int M>
+static int tmatch_v(const float *wf, const float *templ, int nt, int nwf,
+                    float *score)
+{
+	const __m256 absmask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	__m256 acc[TMATCH_MAXT];
+	for (int u=0; u<nt; u++)
+		acc[u] = _mm256_setzero_ps();
+
+	int j = 0;
+	for (; j+8 <= nwf; j+=8) {
+		__m256 x = _mm256_loadu_ps(wf+j);
+		for (int u=0; u<nt; u++) {
+			__m256 t = _mm256_loadu_ps(templ+u*nwf+j);
+			__m256 r = _mm256_sub_ps(x, t);
+			if (M == TMATCH_L1)
+				acc[u] = _mm256_add_ps(acc[u], _mm256_and_ps(r, absmask));
+			else
+				acc[u] = _mm256_fmadd_ps(r, r, acc[u]);
+		}
+	}
+	for (int u=0; u<nt; u++) {
+		float s = hsum(acc[u]);
+		for (int i=j; i<nwf; i++) { // tail; NWFSAMP is a multiple of 8
+			float r = wf[i] - templ[u*nwf+i];
+			s += (M == TMATCH_L1) ? fabsf(r) : r*r;
+		}
+		score[u] = s / (float)nwf;
+	}
+	return argmin(score, nt);
+}
+
+const char *tmatch_isa()
+{
+	return "avx2";
+}
+
+#else
+
+const char *tmatch_isa()
+{
+	return "scalar";
+}
+
+#endif
+
+int tmatch(const float *wf, const float *templ, int nt, int nwf,
+           int metric, float *score)
+{
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+	if (nt <= TMATCH_MAXT) {
+		if (metric == TMATCH_L1)
+			return tmatch_v<TMATCH_L1>(wf, templ, nt, nwf, score);
+		return tmatch_v<TMATCH_L2>(wf, templ, nt, nwf, score);
+	}
+#endif
+	return tmatch_scalar(wf, templ, nt, nwf, metric, score);
+}
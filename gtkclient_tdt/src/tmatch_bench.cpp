@@ -0,0 +1,117 @@
+// microbenchmark: tmatch() vs. the old sorter() loop.
+// usage: tmatch_bench [nspikes]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <armadillo>
+#include "gettime.h"
+#include "tmatch.h"
+
+using namespace arma;
+
+#define NT 4	// NSORT
+
+// what sorter() did before: double math, and a vec allocated per spike
+static int old_loop(const float *wf, float tmpl[][96], int nwf, double *best)
+{
+	vec mse(NT);
+	mse.zeros();
+	for (int u=0; u<NT; u++) {
+		for (int j=0; j<nwf; j++) {
+			double r = wf[j] - tmpl[u][j];
+			mse(u) += r*r;
+		}
+	}
+	mse /= nwf;
+	uword z;
+	*best = mse.min(z);
+	return (int)z;
+}
+
+static void bench(const char *label, int nwf, int nspikes)
+{
+	float tmpl[NT][96];	// 96 is NWFSAMP at 48 kHz
+	float *wf = new float[nspikes*nwf];
+	float score[NT];
+
+	srand(1);
+	for (int u=0; u<NT; u++) {
+		for (int j=0; j<nwf; j++) {
+			tmpl[u][j] = 0.5f*sinf(j/6.f + u) / 1e2f;
+		}
+	}
+	for (int i=0; i<nspikes*nwf; i++) {
+		wf[i] = ((float)rand()/RAND_MAX - 0.5f) / 1e2f;
+	}
+
+	// the kernel wants contiguous rows of nwf
+	float *bank = new float[NT*nwf];
+	for (int u=0; u<NT; u++) {
+		for (int j=0; j<nwf; j++) {
+			bank[u*nwf+j] = tmpl[u][j];
+		}
+	}
+
+	// agreement check
+	int mismatch = 0;
+	double maxerr = 0.0;
+	for (int i=0; i<nspikes; i++) {
+		double b;
+		int a = old_loop(&wf[i*nwf], tmpl, nwf, &b);
+		int z = tmatch(&wf[i*nwf], bank, NT, nwf, TMATCH_L2, score);
+		if (a != z && fabs(score[a] - score[z]) > 1e-6*fabs(b))
+			mismatch++;
+		maxerr = fmax(maxerr, fabs(score[z] - b) / (b > 0 ? b : 1.0));
+	}
+
+	volatile int sink = 0;
+	long double t = gettime();
+	for (int i=0; i<nspikes; i++) {
+		double b;
+		sink += old_loop(&wf[i*nwf], tmpl, nwf, &b);
+	}
+	double t_old = (double)(gettime() - t);
+
+	t = gettime();
+	for (int i=0; i<nspikes; i++) {
+		sink += tmatch_scalar(&wf[i*nwf], bank, NT, nwf, TMATCH_L2, score);
+	}
+	double t_scalar = (double)(gettime() - t);
+
+	t = gettime();
+	for (int i=0; i<nspikes; i++) {
+		sink += tmatch(&wf[i*nwf], bank, NT, nwf, TMATCH_L2, score);
+	}
+	double t_l2 = (double)(gettime() - t);
+
+	t = gettime();
+	for (int i=0; i<nspikes; i++) {
+		sink += tmatch(&wf[i*nwf], bank, NT, nwf, TMATCH_L1, score);
+	}
+	double t_l1 = (double)(gettime() - t);
+
+	printf("%s (nwf=%d, %d templates, %d spikes)\n", label, nwf, NT, nspikes);
+	printf("  old loop      %8.1f ns/spike\n", 1e9*t_old/nspikes);
+	printf("  scalar        %8.1f ns/spike\n", 1e9*t_scalar/nspikes);
+	printf("  %-6s L2     %8.1f ns/spike (%.1fx)\n", tmatch_isa(),
+	       1e9*t_l2/nspikes, t_old/t_l2);
+	printf("  %-6s L1     %8.1f ns/spike (%.1fx)\n", tmatch_isa(),
+	       1e9*t_l1/nspikes, t_old/t_l1);
+	printf("  max rel err %.2e, argmin mismatches %d\n", maxerr, mismatch);
+
+	delete[] wf;
+	delete[] bank;
+}
+
+int main(int argc, char **argv)
+{
+	int nspikes = 1000000;
+	if (argc > 1)
+		nspikes = atoi(argv[1]);
+	if (nspikes < 1)
+		nspikes = 1;
+	bench("24 kHz", 48, nspikes);
+	bench("48 kHz", 96, nspikes);
+	return 0;
+}
@@ -76,10 +76,11 @@ void VboRaster::copy()
 }
 void VboRaster::addEvent(float the_time, int the_chan)
 {
-	u32 w = m_w % (m_nchan * m_nsamp); // atomic
+	// several sorting threads add events, so claim the slot atomically.
+	// copy() may pick up a claimed-but-unwritten slot; it is redrawn next frame.
+	u32 w = m_w.fetch_add(1) % (m_nchan * m_nsamp);
 	m_f[w*2+0] = the_time;
 	m_f[w*2+1] = (float)the_chan;
-	m_w++; // atomic
 }
 void VboRaster::draw()
 {
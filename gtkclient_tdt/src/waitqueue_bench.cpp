@@ -0,0 +1,117 @@
+// benchmark: handing blocks from a producer to a consumer thread, as the
+// po8e threads hand them to the worker. the old consumer polled
+// try_dequeue() with a usleep(1e3) between tries; WaitQueue sleeps on a
+// futex until the producer enqueues, optionally spinning first. reports
+// the enqueue to dequeue latency and the consumer's cpu time.
+// usage: waitqueue_bench [blocks/s] [seconds] [spin us]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include "gettime.h"
+#include "waitqueue.h"
+
+using namespace std;
+using namespace moodycamel;
+
+static double threadCpu()
+{
+	rusage ru;
+	getrusage(RUSAGE_THREAD, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec*1e-6 +
+	       ru.ru_stime.tv_sec + ru.ru_stime.tv_usec*1e-6;
+}
+
+static void report(const char *name, vector<double> &lat, double cpu,
+                   double secs)
+{
+	sort(lat.begin(), lat.end());
+	size_t n = lat.size();
+	if (n == 0)
+		return;
+	printf("  %-18s p50 %7.1f us  p99 %7.1f us  max %7.1f us  "
+	       "cpu %5.1f%%\n", name, 1e6*lat[n/2], 1e6*lat[n*99/100],
+	       1e6*lat[n-1], 100.0*cpu/secs);
+}
+
+// the producer: n blocks at rate, each carrying its enqueue time
+template <typename Q>
+static void produce(Q &q, double rate, int n)
+{
+	long double t0 = gettime();
+	for (int i=0; i<n; i++) {
+		long double due = t0 + i / rate;
+		long double now;
+		while ((now = gettime()) < due) {
+			if (due - now > 2e-4)
+				usleep(100);
+		}
+		q.enqueue(gettime());
+	}
+}
+
+int main(int argc, char **argv)
+{
+	double rate = 24414.0625 / 16;	// blocks of 16 samples
+	double secs = 3.0;
+	double spin = 0.0;
+	if (argc > 1)
+		rate = atof(argv[1]);
+	if (argc > 2)
+		secs = atof(argv[2]);
+	if (argc > 3)
+		spin = atof(argv[3]) * 1e-6;
+	if (rate <= 0)
+		rate = 1000;
+	int n = (int)(rate * secs);
+	printf("%d blocks at %.0f/s\n", n, rate);
+
+	{
+		ReaderWriterQueue<long double> q(1024);
+		vector<double> lat;
+		lat.reserve(n);
+		double cpu = 0;
+		thread c([&] {
+			double c0 = threadCpu();
+			long double t;
+			while ((int)lat.size() < n) {
+				if (q.try_dequeue(t))
+					lat.push_back((double)(gettime() - t));
+				else
+					usleep(1e3);
+			}
+			cpu = threadCpu() - c0;
+		});
+		produce(q, rate, n);
+		c.join();
+		report("usleep(1e3) poll", lat, cpu, secs);
+	}
+	vector<double> spins = {0.0};
+	if (spin > 0.0)
+		spins.push_back(spin);
+	for (double s : spins) {
+		WaitQueue<long double> q(1024, s);
+		vector<double> lat;
+		lat.reserve(n);
+		double cpu = 0;
+		thread c([&] {
+			double c0 = threadCpu();
+			long double t;
+			while ((int)lat.size() < n) {
+				if (q.wait_dequeue(t, 0.1))
+					lat.push_back((double)(gettime() - t));
+			}
+			cpu = threadCpu() - c0;
+		});
+		produce(q, rate, n);
+		c.join();
+		char name[64];
+		snprintf(name, 64, "wait, spin %.0f us", s*1e6);
+		report(name, lat, cpu, secs);
+	}
+	return 0;
+}